@@ -8,10 +8,12 @@ find_library(GLFW_LIBRARY NAMES glfw3 glfw)
 
 
 # find version
-file(STRINGS "${GLFW_INCLUDE_DIR}/glfw3.h" GLFW_VERSION_STRING
-  REGEX "^#define[ \t]+GLFW_VERSION_(MAJOR|MINOR|REVISION)")
-string(REGEX REPLACE ".*([0-9]+).*([0-9]+).*([0-9]+).*" "\\1.\\2.\\3"
-  GLFW_VERSION_STRING "${GLFW_VERSION_STRING}")
+if(GLFW_INCLUDE_DIR)
+  file(STRINGS "${GLFW_INCLUDE_DIR}/glfw3.h" GLFW_VERSION_STRING
+    REGEX "^#define[ \t]+GLFW_VERSION_(MAJOR|MINOR|REVISION)")
+  string(REGEX REPLACE ".*([0-9]+).*([0-9]+).*([0-9]+).*" "\\1.\\2.\\3"
+    GLFW_VERSION_STRING "${GLFW_VERSION_STRING}")
+endif()
 
 #message("=== GLFW_VERSION_STRING ${GLFW_VERSION_STRING}")
 
@@ -41,8 +41,10 @@ log(SDL2_LIBRARY)
 
 
 # Get version info
-file(STRINGS "${SDL2_INCLUDE_DIR}/SDL_version.h" SDL2_VERSION_STRING REGEX "^#define[ \t]+SDL_(MAJOR|MINOR|PATCHLEVEL)")
-string(REGEX REPLACE ".*([0-9]+).*([0-9]+).*([0-9]+).*" "\\1.\\2.\\3" SDL2_VERSION_STRING "${SDL2_VERSION_STRING}")
+if(SDL2_INCLUDE_DIR)
+	file(STRINGS "${SDL2_INCLUDE_DIR}/SDL_version.h" SDL2_VERSION_STRING REGEX "^#define[ \t]+SDL_(MAJOR|MINOR|PATCHLEVEL)")
+	string(REGEX REPLACE ".*([0-9]+).*([0-9]+).*([0-9]+).*" "\\1.\\2.\\3" SDL2_VERSION_STRING "${SDL2_VERSION_STRING}")
+endif()
 log(SDL2_VERSION_STRING)
 
 
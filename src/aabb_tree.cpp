@@ -0,0 +1,242 @@
+#include "aabb_tree.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "game.hpp"
+#include "maths.hpp"
+#include "maths_collisions.hpp"
+
+
+//Median split keeps the tree balanced, so this is plenty for any level
+constexpr int MAX_STACK = 64;
+
+
+BoundingBox Union(const BoundingBox &a, const BoundingBox &b)
+{
+  return {
+    {std::min(a.top_left.x, b.top_left.x), std::min(a.top_left.y, b.top_left.y)},
+    {std::max(a.bottom_right.x, b.bottom_right.x), std::max(a.bottom_right.y, b.bottom_right.y)}};
+}
+
+
+vec2 Centre(const BoundingBox &b)
+{
+  return (b.top_left + b.bottom_right) / 2.0f;
+}
+
+
+void AABBTree::Build(const std::vector<Block> &blocks)
+{
+  const int n = blocks.size();
+
+  nodes.clear();
+  nodes.reserve(std::max(0, n * 2 - 1));
+  block_leaf.assign(n, -1);
+
+  order.resize(n);
+  for (int i = 0; i < n; i++) order[i] = i;
+
+  root = (n > 0) ? BuildNode(blocks, -1, 0, n) : -1;
+
+  num_removed = 0;
+  built = true;
+}
+
+
+int AABBTree::BuildNode(const std::vector<Block> &blocks, int parent, int begin, int end)
+{
+  const int index = nodes.size();
+  nodes.emplace_back();
+  nodes[index].parent = parent;
+
+  if (end - begin == 1)
+  {
+    const int block = order[begin];
+    Node &leaf = nodes[index];
+    leaf.block = block;
+    leaf.bounds = blocks[block].bounds;
+    leaf.alive = 1;
+    block_leaf[block] = index;
+    return index;
+  }
+
+  //Split at the median centre along the longest axis
+  vec2 centre = Centre(blocks[order[begin]].bounds);
+  BoundingBox centres{centre, centre};
+  for (int i = begin + 1; i < end; i++)
+  {
+    centre = Centre(blocks[order[i]].bounds);
+    centres = Union(centres, {centre, centre});
+  }
+
+  const vec2 extent = centres.bottom_right - centres.top_left;
+  const bool split_x = extent.x >= extent.y;
+  const int mid = (begin + end) / 2;
+
+  std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+    [&](int a, int b) {
+      vec2 ca = Centre(blocks[a].bounds);
+      vec2 cb = Centre(blocks[b].bounds);
+      float va = split_x ? ca.x : ca.y;
+      float vb = split_x ? cb.x : cb.y;
+      return (va < vb) or (va == vb and a < b);
+    });
+
+  //Recursing grows the node vector, so no references held across these
+  const int left = BuildNode(blocks, index, begin, mid);
+  const int right = BuildNode(blocks, index, mid, end);
+
+  Node &node = nodes[index];
+  node.left = left;
+  node.right = right;
+  node.bounds = Union(nodes[left].bounds, nodes[right].bounds);
+  node.alive = nodes[left].alive + nodes[right].alive;
+
+  return index;
+}
+
+
+void AABBTree::Clear()
+{
+  nodes.clear();
+  block_leaf.clear();
+  root = -1;
+  num_removed = 0;
+  built = false;
+}
+
+
+int AABBTree::GetDepth() const
+{
+  if (root < 0) return 0;
+
+  int depth = 0;
+  std::vector<std::pair<int, int>> stack{{root, 1}};
+  while (not stack.empty())
+  {
+    auto top = stack.back();
+    stack.pop_back();
+    depth = std::max(depth, top.second);
+
+    const Node &node = nodes[top.first];
+    if (node.left >= 0) stack.push_back({node.left, top.second + 1});
+    if (node.right >= 0) stack.push_back({node.right, top.second + 1});
+  }
+  return depth;
+}
+
+
+void AABBTree::Refit(int node)
+{
+  for (int p = nodes[node].parent; p >= 0; p = nodes[p].parent)
+  {
+    Node &parent = nodes[p];
+    const Node &left = nodes[parent.left];
+    const Node &right = nodes[parent.right];
+
+    parent.alive = left.alive + right.alive;
+
+    if (left.alive and right.alive)
+      parent.bounds = Union(left.bounds, right.bounds);
+    else if (left.alive)
+      parent.bounds = left.bounds;
+    else if (right.alive)
+      parent.bounds = right.bounds;
+  }
+}
+
+
+void AABBTree::SwapRemoveBlock(int i)
+{
+  if (not built) return;
+
+  const int last = GetNumBlocks() - 1;
+  if (i > last)
+  {
+    Clear();
+    return;
+  }
+
+  //Unlink the leaf, shrinking its ancestors
+  const int leaf = block_leaf[i];
+  nodes[leaf].block = -1;
+  nodes[leaf].alive = 0;
+  Refit(leaf);
+  num_removed++;
+
+  if (i != last)
+  {
+    block_leaf[i] = block_leaf[last];
+    nodes[block_leaf[i]].block = i;
+  }
+  block_leaf.pop_back();
+
+  //Once most of the tree is dead weight it gets rebuilt on next use
+  if (num_removed > GetNumBlocks()) Clear();
+}
+
+
+template<typename OVERLAPS>
+void AABBTree::Collect(const OVERLAPS &overlaps, std::vector<int> &out_blocks) const
+{
+  out_blocks.clear();
+  if (root < 0) return;
+
+  int stack[MAX_STACK];
+  int top = 0;
+  stack[top++] = root;
+
+  while (top > 0)
+  {
+    const Node &node = nodes[stack[--top]];
+
+    if (node.alive == 0 or not overlaps(node.bounds)) continue;
+
+    if (node.left < 0)
+    {
+      out_blocks.push_back(node.block);
+    }
+    else
+    {
+      if (top + 2 > MAX_STACK) throw std::runtime_error("AABBTree too deep");
+      stack[top++] = node.right;
+      stack[top++] = node.left;
+    }
+  }
+
+  std::sort(out_blocks.begin(), out_blocks.end());
+}
+
+
+void AABBTree::Query(const BoundingBox &bounds, std::vector<int> &out_blocks) const
+{
+  //Inclusive test, so it never misses anything BoundingBoxCollides accepts
+  Collect([&bounds](const BoundingBox &b) {
+    return (bounds.top_left.x <= b.bottom_right.x) and
+      (bounds.bottom_right.x >= b.top_left.x) and
+      (bounds.top_left.y <= b.bottom_right.y) and
+      (bounds.bottom_right.y >= b.top_left.y);
+  },
+    out_blocks);
+}
+
+
+void AABBTree::QuerySegment(const vec2 &p1, const vec2 &p2, std::vector<int> &out_blocks) const
+{
+  Collect([&p1, &p2](const BoundingBox &b) { return SegmentCollides(b, p1, p2); },
+    out_blocks);
+}
+
+
+void AABBTree::QueryRay(const vec2 &origin, const vec2 &direction, float max_distance, std::vector<int> &out_blocks) const
+{
+  //No direction to normalize, so it doesn't go anywhere
+  if (direction.x == 0.0f and direction.y == 0.0f)
+  {
+    out_blocks.clear();
+    return;
+  }
+
+  QuerySegment(origin, origin + normalize(direction) * max_distance, out_blocks);
+}
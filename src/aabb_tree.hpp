@@ -0,0 +1,56 @@
+#pragma once
+
+#include <vector>
+
+#include "maths_types.hpp"
+
+
+//Bounding volume hierarchy over block bounds, an alternative broadphase to
+//SpatialGrid that copes better with uneven levels (dense clusters next to
+//empty space). Leaves hold one block index (into GameState::blocks) each.
+
+class AABBTree
+{
+private:
+  struct Node
+  {
+    BoundingBox bounds;
+    int parent = -1;
+    int left = -1; //both children are -1 for leaves
+    int right = -1;
+    int block = -1; //leaves only, -1 once the block is removed
+    int alive = 0; //live leaves in this subtree
+  };
+
+  std::vector<Node> nodes;
+  std::vector<int> block_leaf;
+  int root = -1;
+  bool built = false;
+  int num_removed = 0;
+
+  std::vector<int> order;
+
+  int BuildNode(const std::vector<struct Block> &blocks, int parent, int begin, int end);
+  void Refit(int node);
+
+  template<typename OVERLAPS>
+  void Collect(const OVERLAPS &overlaps, std::vector<int> &out_blocks) const;
+
+public:
+  void Build(const std::vector<struct Block> &blocks);
+  void Clear();
+
+  bool IsBuilt() const { return built; }
+  int GetNumBlocks() const { return block_leaf.size(); }
+  int GetDepth() const;
+
+  //Call before GameState::blocks removes block i, unlinks its leaf and
+  //refits the parents instead of rebuilding the whole tree, then gives the
+  //last block its index the way SlotMap::RemoveAt moves it
+  void SwapRemoveBlock(int i);
+
+  //All of these return block indexes sorted in ascending order
+  void Query(const BoundingBox &bounds, std::vector<int> &out_blocks) const;
+  void QuerySegment(const vec2 &p1, const vec2 &p2, std::vector<int> &out_blocks) const;
+  void QueryRay(const vec2 &origin, const vec2 &direction, float max_distance, std::vector<int> &out_blocks) const;
+};
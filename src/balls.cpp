@@ -0,0 +1,234 @@
+#include "balls.hpp"
+
+#include "maths.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+Ball::Ball(const vec2 &position, const vec2 &velocity, const col4 &colour)
+: position(position)
+, velocity(velocity)
+, colour(colour)
+, bounds{}
+{
+  UpdateBounds();
+}
+
+
+void Ball::UpdateBounds()
+{
+  bounds.top_left = {position.x - radius, position.y - radius};
+  bounds.bottom_right = {position.x + radius, position.y + radius};
+}
+
+
+void BallStore::clear()
+{
+  for (auto *vec : {&x, &y, &vx, &vy, &radius, &min_x, &min_y, &max_x, &max_y})
+  {
+    vec->clear();
+  }
+  colour.clear();
+  alive_mask.clear();
+  handles.clear();
+}
+
+
+void BallStore::reserve(int count)
+{
+  for (auto *vec : {&x, &y, &vx, &vy, &radius, &min_x, &min_y, &max_x, &max_y})
+  {
+    vec->reserve(count);
+  }
+  colour.reserve(count);
+  alive_mask.reserve((count + 63) / 64);
+  handles.reserve(count);
+}
+
+
+SlotHandle BallStore::Add(const Ball &ball)
+{
+  const int i = size();
+
+  x.push_back(ball.position.x);
+  y.push_back(ball.position.y);
+  vx.push_back(ball.velocity.x);
+  vy.push_back(ball.velocity.y);
+  radius.push_back(ball.radius);
+
+  min_x.push_back(ball.bounds.top_left.x);
+  min_y.push_back(ball.bounds.top_left.y);
+  max_x.push_back(ball.bounds.bottom_right.x);
+  max_y.push_back(ball.bounds.bottom_right.y);
+
+  colour.push_back(ball.colour);
+
+  if (i / 64 >= static_cast<int>(alive_mask.size())) alive_mask.push_back(0);
+  SetAlive(i, ball.alive);
+
+  return handles.Add();
+}
+
+
+Ball BallStore::Get(int i) const
+{
+  Ball ball(GetPosition(i), GetVelocity(i), colour[i]);
+  ball.radius = radius[i];
+  ball.alive = IsAlive(i);
+  ball.bounds = GetBounds(i);
+  ball.handle = GetHandle(i);
+  return ball;
+}
+
+
+void BallStore::Set(int i, const Ball &ball)
+{
+  x[i] = ball.position.x;
+  y[i] = ball.position.y;
+  vx[i] = ball.velocity.x;
+  vy[i] = ball.velocity.y;
+  radius[i] = ball.radius;
+
+  min_x[i] = ball.bounds.top_left.x;
+  min_y[i] = ball.bounds.top_left.y;
+  max_x[i] = ball.bounds.bottom_right.x;
+  max_y[i] = ball.bounds.bottom_right.y;
+
+  colour[i] = ball.colour;
+  SetAlive(i, ball.alive);
+}
+
+
+void BallStore::SetAlive(int i, bool alive)
+{
+  const uint64_t bit = uint64_t{1} << (i % 64);
+
+  if (alive)
+    alive_mask[i / 64] |= bit;
+  else
+    alive_mask[i / 64] &= ~bit;
+}
+
+
+void BallStore::UpdateBounds(int i)
+{
+  min_x[i] = x[i] - radius[i];
+  min_y[i] = y[i] - radius[i];
+  max_x[i] = x[i] + radius[i];
+  max_y[i] = y[i] + radius[i];
+}
+
+
+void BallStore::RemoveAt(int i)
+{
+  const int last = size() - 1;
+
+  handles.SwapRemove(i);
+
+  if (i != last)
+  {
+    for (auto *vec : {&x, &y, &vx, &vy, &radius, &min_x, &min_y, &max_x, &max_y})
+    {
+      (*vec)[i] = vec->back();
+    }
+    colour[i] = colour.back();
+    SetAlive(i, IsAlive(last));
+  }
+
+  for (auto *vec : {&x, &y, &vx, &vy, &radius, &min_x, &min_y, &max_x, &max_y})
+  {
+    vec->pop_back();
+  }
+  colour.pop_back();
+
+  alive_mask.resize((last + 63) / 64);
+}
+
+
+void BallStore::RemoveDead()
+{
+  const int n = size();
+
+  //The live balls keep their order, which is the order they collide in
+  handles.RemoveKeepingOrder([this](int i) { return not IsAlive(i); });
+
+  int kept = 0;
+  for (int i = 0; i < n; i++)
+  {
+    if (not IsAlive(i)) continue;
+
+    if (kept != i)
+    {
+      for (auto *vec : {&x, &y, &vx, &vy, &radius, &min_x, &min_y, &max_x, &max_y})
+      {
+        (*vec)[kept] = (*vec)[i];
+      }
+      colour[kept] = colour[i];
+    }
+    kept++;
+  }
+
+  for (auto *vec : {&x, &y, &vx, &vy, &radius, &min_x, &min_y, &max_x, &max_y})
+  {
+    vec->resize(kept);
+  }
+  colour.resize(kept);
+
+  //Everything left is alive
+  alive_mask.assign((kept + 63) / 64, ~uint64_t{0});
+  if (kept % 64) alive_mask.back() = (uint64_t{1} << (kept % 64)) - 1;
+}
+
+
+//Reference version, same operations as the Ball/vec2 code in UpdatePhysics
+void IntegrateRange(BallStore &balls, int begin, int end, float dt)
+{
+  for (int i = begin; i < end; i++)
+  {
+    balls.x[i] = balls.x[i] + balls.vx[i] * dt;
+    balls.y[i] = balls.y[i] + balls.vy[i] * dt;
+    balls.UpdateBounds(i);
+  }
+}
+
+
+void IntegrateBallsScalar(BallStore &balls, float dt)
+{
+  IntegrateRange(balls, 0, balls.size(), dt);
+}
+
+
+void IntegrateBalls(BallStore &balls, float dt)
+{
+  const int n = balls.size();
+  int i = 0;
+
+#if defined(__SSE2__)
+  float *x = balls.x.data();
+  float *y = balls.y.data();
+  const float *vx = balls.vx.data();
+  const float *vy = balls.vy.data();
+  const float *radius = balls.radius.data();
+
+  const __m128 step = _mm_set1_ps(dt);
+
+  for (; i + 4 <= n; i += 4)
+  {
+    const __m128 r = _mm_loadu_ps(radius + i);
+    const __m128 px = _mm_add_ps(_mm_loadu_ps(x + i), _mm_mul_ps(_mm_loadu_ps(vx + i), step));
+    const __m128 py = _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(_mm_loadu_ps(vy + i), step));
+
+    _mm_storeu_ps(x + i, px);
+    _mm_storeu_ps(y + i, py);
+    _mm_storeu_ps(balls.min_x.data() + i, _mm_sub_ps(px, r));
+    _mm_storeu_ps(balls.min_y.data() + i, _mm_sub_ps(py, r));
+    _mm_storeu_ps(balls.max_x.data() + i, _mm_add_ps(px, r));
+    _mm_storeu_ps(balls.max_y.data() + i, _mm_add_ps(py, r));
+  }
+#endif
+
+  //Whatever doesn't fill a whole vector
+  IntegrateRange(balls, i, n, dt);
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "maths_types.hpp"
+#include "slot_map.hpp"
+
+
+struct Ball
+{
+  float radius = 10.0f;
+  bool alive = true;
+  vec2 position;
+  vec2 velocity;
+  col4 colour;
+
+  BoundingBox bounds;
+
+  //Which ball in the BallStore this is a copy of, set by BallStore::Get
+  SlotHandle handle;
+
+  Ball(const vec2 &position, const vec2 &velocity, const col4 &colour);
+
+  void UpdateBounds();
+};
+
+
+//Structure of arrays storage for the balls in play, so the physics can step
+//many balls at once (see IntegrateBalls). Ball is still used to pass single
+//balls around, Get/Set copy one in and out. Each ball also has a handle (see
+//slot_map.hpp) that keeps finding it as others are removed.
+struct BallStore
+{
+  std::vector<float> x;
+  std::vector<float> y;
+  std::vector<float> vx;
+  std::vector<float> vy;
+  std::vector<float> radius;
+
+  std::vector<float> min_x;
+  std::vector<float> min_y;
+  std::vector<float> max_x;
+  std::vector<float> max_y;
+
+  std::vector<col4> colour;
+
+  //One bit per ball
+  std::vector<uint64_t> alive_mask;
+
+  SlotTable handles;
+
+  int size() const { return x.size(); }
+  bool empty() const { return x.empty(); }
+
+  void clear();
+  void reserve(int count);
+
+  SlotHandle Add(const Ball &ball);
+  Ball Get(int i) const;
+  void Set(int i, const Ball &ball);
+
+  vec2 GetPosition(int i) const { return {x[i], y[i]}; }
+  vec2 GetVelocity(int i) const { return {vx[i], vy[i]}; }
+  BoundingBox GetBounds(int i) const { return {{min_x[i], min_y[i]}, {max_x[i], max_y[i]}}; }
+
+  bool IsAlive(int i) const { return (alive_mask[i / 64] >> (i % 64)) & 1; }
+  void SetAlive(int i, bool alive);
+
+  SlotHandle GetHandle(int i) const { return handles.GetHandle(i); }
+
+  //The ball's index, or -1 once it has been removed
+  int Find(const SlotHandle &handle) const { return handles.Find(handle); }
+
+  void UpdateBounds(int i);
+
+  //Moves the last ball into i's place
+  void RemoveAt(int i);
+
+  //Drops dead balls, the rest stay in the same order
+  void RemoveDead();
+};
+
+
+//Moves every ball by velocity * dt and recomputes its bounds, using SSE2
+//where available. Gives the same results as the scalar step in UpdatePhysics.
+void IntegrateBalls(BallStore &balls, float dt);
+void IntegrateBallsScalar(BallStore &balls, float dt);
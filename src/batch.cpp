@@ -0,0 +1,59 @@
+#include "batch.hpp"
+
+#include <chrono>
+#include <stdexcept>
+
+
+BatchRunner::BatchRunner(const Game &game, int num_threads)
+: game(game)
+, pool(num_threads)
+{
+  //Every game already has a thread to itself, and a pool can only run one
+  //loop at a time
+  if (game.GetThreadPool()) throw std::runtime_error("BatchRunner needs a Game without a thread pool");
+}
+
+
+void RunBatchGame(const Game &game, BatchGame &batch_game, int num_ticks, float dt)
+{
+  GameState &state = batch_game.state;
+
+  for (int tick = 0; tick < num_ticks and state.running; tick++)
+  {
+    if (tick < static_cast<int>(batch_game.intents.size()))
+    {
+      game.ProcessIntents(state, batch_game.intents[tick]);
+    }
+
+    game.ProcessStateGraph(state, dt);
+    game.SimulateInPlace(state, dt);
+
+    state.sound_events.clear();
+    batch_game.ticks++;
+  }
+}
+
+
+BatchResult BatchRunner::Run(std::vector<BatchGame> &games, int num_ticks, float dt)
+{
+  long long ticks_before = 0;
+  for (const BatchGame &batch_game : games) ticks_before += batch_game.ticks;
+
+  auto start = std::chrono::steady_clock::now();
+
+  pool.ParallelFor(games.size(), [&](int i) { RunBatchGame(game, games[i], num_ticks, dt); });
+
+  auto end = std::chrono::steady_clock::now();
+
+  BatchResult result;
+  result.num_games = games.size();
+  result.num_threads = pool.GetNumThreads();
+  result.seconds = std::chrono::duration<double>(end - start).count();
+
+  for (const BatchGame &batch_game : games) result.total_ticks += batch_game.ticks;
+  result.total_ticks -= ticks_before;
+
+  if (result.seconds > 0.0) result.ticks_per_second = result.total_ticks / result.seconds;
+
+  return result;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <vector>
+
+#include "game.hpp"
+#include "input.hpp"
+#include "thread_pool.hpp"
+
+
+//One game in a batch. intents[t] is fed to ProcessIntents before tick t,
+//ticks past the end of the list get no input.
+struct BatchGame
+{
+  GameState state;
+  std::vector<std::vector<Intent>> intents;
+
+  long long ticks = 0;
+};
+
+
+struct BatchResult
+{
+  int num_games = 0;
+  int num_threads = 0;
+
+  long long total_ticks = 0;
+  double seconds = 0.0;
+  double ticks_per_second = 0.0;
+};
+
+
+//Runs lots of games side by side, for soak testing and tuning. Each game is
+//stepped on one thread from start to finish, so a game comes out the same
+//whatever the thread count. Nothing is drawn or played, queued up sound
+//events are thrown away after each tick.
+
+class BatchRunner
+{
+private:
+  const Game &game;
+  ThreadPool pool;
+
+public:
+  //0 threads means one per hardware thread
+  explicit BatchRunner(const Game &game, int num_threads = 0);
+
+  int GetNumThreads() const { return pool.GetNumThreads(); }
+
+  //Steps every game up to num_ticks times at dt, games that stop running
+  //finish early
+  BatchResult Run(std::vector<BatchGame> &games, int num_ticks, float dt);
+};
+
+
+//Runs one game the way BatchRunner does, on the calling thread
+void RunBatchGame(const Game &game, BatchGame &batch_game, int num_ticks, float dt);
@@ -0,0 +1,1393 @@
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+using std::cout;
+using std::endl;
+
+#include "batch.hpp"
+#include "game.hpp"
+#include "level.hpp"
+#include "maths.hpp"
+#include "replay.hpp"
+#include "snapshot.hpp"
+#include "text.hpp"
+
+
+using Clock = std::chrono::steady_clock;
+
+
+double SecondsSince(Clock::time_point start)
+{
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+
+//Square-ish field holding roughly num_blocks blocks, balls scattered over it
+GameState MakeBenchGame(const Game &game, int num_blocks, int num_balls)
+{
+  const BlockType types[] = {BlockType::square, BlockType::triangle_left,
+    BlockType::triangle_right, BlockType::rectangle,
+    BlockType::rect_triangle_left, BlockType::rect_triangle_right};
+
+  const int columns = std::max(1, static_cast<int>(sqrtf(num_blocks)));
+  const int rows = (num_blocks + columns - 1) / columns;
+  const int width = 100 + columns * 110;
+  const int height = 200 + rows * 60;
+
+  GameState state = game.NewGame(width, height, 1234);
+  state.blocks.clear();
+
+  for (int i = 0; i < num_blocks; i++)
+  {
+    vec2 position{50.0f + 110.0f * (i % columns), 50.0f + 60.0f * (i / columns)};
+    state.blocks.Add(game.NewBlock(state, position, types[i % 6]));
+  }
+
+  for (int i = 0; i < num_balls; i++)
+  {
+    vec2 pos{RandomFloat(state.rng, 50.0f, width - 50.0f), RandomFloat(state.rng, 50.0f, height - 50.0f)};
+    state.balls.Add(Ball(pos, angle_to_vec2(RandomFloat(state.rng, 0.0f, TWO_PI), 300.0f), RandomRGB(state.rng)));
+  }
+
+  state.player.sticky_ball = false;
+  state.state = State::mid_game;
+
+  return state;
+}
+
+
+//A huge mostly empty field with the blocks packed into a few tight clusters
+GameState MakeClusteredBenchGame(const Game &game, int num_blocks, int num_balls)
+{
+  const int width = 20000;
+  const int height = 20000;
+  const int num_clusters = 4;
+
+  GameState state = game.NewGame(width, height, 1234);
+  state.blocks.clear();
+
+  const int per_cluster = (num_blocks + num_clusters - 1) / num_clusters;
+  const int columns = std::max(1, static_cast<int>(sqrtf(per_cluster)));
+
+  for (int c = 0; c < num_clusters; c++)
+  {
+    vec2 corner{RandomFloat(state.rng, 0.0f, width - columns * 55.0f), RandomFloat(state.rng, 0.0f, height - columns * 55.0f)};
+
+    for (int i = 0; i < per_cluster and static_cast<int>(state.blocks.size()) < num_blocks; i++)
+    {
+      vec2 position = corner + vec2{55.0f * (i % columns), 55.0f * (i / columns)};
+      state.blocks.Add(game.NewBlock(state, position, BlockType::square));
+    }
+  }
+
+  for (int i = 0; i < num_balls; i++)
+  {
+    //Half the balls inside clusters, the rest out in the open
+    const Block &near = state.blocks[RandomInt(state.rng, 0, state.blocks.size())];
+    vec2 pos = (i % 2) ? near.position : vec2{RandomFloat(state.rng, 0.0f, width), RandomFloat(state.rng, 0.0f, height)};
+    state.balls.Add(Ball(pos, angle_to_vec2(RandomFloat(state.rng, 0.0f, TWO_PI), 300.0f), RandomRGB(state.rng)));
+  }
+
+  state.player.sticky_ball = false;
+  state.state = State::mid_game;
+
+  return state;
+}
+
+
+//Seconds per CalculateBallCollision call, averaged over every ball
+double TimeBallCollisions(const Game &game, GameState &state)
+{
+  game.PrepareBroadphase(state);
+
+  std::vector<BlockHandle> hit_blocks;
+  vec2 normal{};
+  int calls = 0;
+
+  auto start = Clock::now();
+  do
+  {
+    for (int i = 0; i < state.balls.size(); i++)
+    {
+      game.CalculateBallCollision(state, i, normal, hit_blocks);
+      calls++;
+    }
+  } while (SecondsSince(start) < 0.2);
+
+  return SecondsSince(start) / calls;
+}
+
+
+//Number of blocks hit by all the balls, to check the broadphases agree
+int CountBlockHits(const Game &game, GameState &state)
+{
+  game.PrepareBroadphase(state);
+
+  std::vector<BlockHandle> hit_blocks;
+  vec2 normal{};
+  int hits = 0;
+
+  for (int i = 0; i < state.balls.size(); i++)
+  {
+    game.CalculateBallCollision(state, i, normal, hit_blocks);
+    hits += hit_blocks.size();
+  }
+
+  return hits;
+}
+
+
+void BenchBroadphase(const std::string &layout)
+{
+  cout << "\n==== Ball vs block broadphase, " << layout << " level (ns per CalculateBallCollision)\n"
+       << endl;
+
+  cout << std::setw(8) << "blocks"
+       << std::setw(14) << "brute_force"
+       << std::setw(14) << "grid"
+       << std::setw(14) << "aabb_tree"
+       << std::setw(12) << "grid_x"
+       << std::setw(12) << "tree_x" << endl;
+
+  for (int num_blocks : {100, 1000, 4000, 16000, 64000})
+  {
+    Game game;
+
+    GameState state = (layout == "clustered")
+      ? MakeClusteredBenchGame(game, num_blocks, 256)
+      : MakeBenchGame(game, num_blocks, 256);
+
+    game.SetBroadphase(Broadphase::brute_force);
+    double brute = TimeBallCollisions(game, state);
+    int brute_hits = CountBlockHits(game, state);
+
+    game.SetBroadphase(Broadphase::grid);
+    double grid = TimeBallCollisions(game, state);
+    int grid_hits = CountBlockHits(game, state);
+
+    game.SetBroadphase(Broadphase::aabb_tree);
+    double tree = TimeBallCollisions(game, state);
+    int tree_hits = CountBlockHits(game, state);
+
+    if (brute_hits != grid_hits or brute_hits != tree_hits)
+      throw std::runtime_error("Broadphase results differ");
+
+    cout << std::setw(8) << num_blocks
+         << std::setw(14) << brute * 1e9
+         << std::setw(14) << grid * 1e9
+         << std::setw(14) << tree * 1e9
+         << std::setw(11) << brute / grid << "x"
+         << std::setw(11) << brute / tree << "x" << endl;
+  }
+}
+
+
+void BenchBallIntegration()
+{
+  cout << "\n==== Ball integration step (ns per ball)\n"
+       << endl;
+
+  cout << std::setw(8) << "balls"
+       << std::setw(14) << "Ball structs"
+       << std::setw(14) << "scalar SoA"
+       << std::setw(16) << "IntegrateBalls"
+       << std::setw(10) << "speedup" << endl;
+
+  const float dt = 1.0f / 60.0f;
+
+  for (int num_balls : {1000, 10000, 100000})
+  {
+    Random rng(1234);
+
+    std::vector<Ball> structs;
+    BallStore store;
+    for (int i = 0; i < num_balls; i++)
+    {
+      Ball ball({RandomFloat(rng, 0.0f, 640.0f), RandomFloat(rng, 0.0f, 480.0f)},
+        angle_to_vec2(RandomFloat(rng, 0.0f, TWO_PI), 300.0f), RandomRGB(rng));
+      structs.push_back(ball);
+      store.Add(ball);
+    }
+
+    //What the per Ball path in UpdatePhysics does, copy in, step, copy out
+    auto per_ball_step = [dt](const Ball &old_ball) {
+      Ball out = old_ball;
+      out.position = old_ball.position + (old_ball.velocity * dt);
+      out.UpdateBounds();
+      return out;
+    };
+
+    int steps = 0;
+    auto start = Clock::now();
+    do
+    {
+      for (Ball &b : structs) b = per_ball_step(b);
+      steps++;
+    } while (SecondsSince(start) < 0.2);
+    double per_struct = SecondsSince(start) / (double(steps) * num_balls);
+
+    steps = 0;
+    start = Clock::now();
+    do
+    {
+      IntegrateBallsScalar(store, dt);
+      steps++;
+    } while (SecondsSince(start) < 0.2);
+    double per_scalar = SecondsSince(start) / (double(steps) * num_balls);
+
+    steps = 0;
+    start = Clock::now();
+    do
+    {
+      IntegrateBalls(store, dt);
+      steps++;
+    } while (SecondsSince(start) < 0.2);
+    double per_simd = SecondsSince(start) / (double(steps) * num_balls);
+
+    cout << std::setw(8) << num_balls
+         << std::setw(14) << per_struct * 1e9
+         << std::setw(14) << per_scalar * 1e9
+         << std::setw(16) << per_simd * 1e9
+         << std::setw(9) << per_struct / per_simd << "x" << endl;
+  }
+}
+
+
+void BenchRandom()
+{
+  cout << "\n==== Random numbers (ns per call)\n"
+       << endl;
+
+  cout << std::setw(16) << "rand() float"
+       << std::setw(16) << "RandomFloat"
+       << std::setw(16) << "Particle" << endl;
+
+  const int count = 1000000;
+  volatile float sink = 0.0f;
+
+  srand(1234);
+  auto start = Clock::now();
+  for (int i = 0; i < count; i++)
+  {
+    sink += static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
+  }
+  double per_rand = SecondsSince(start) / count;
+
+  Random rng(1234);
+  start = Clock::now();
+  for (int i = 0; i < count; i++)
+  {
+    sink += RandomFloat(rng);
+  }
+  double per_random = SecondsSince(start) / count;
+
+  //What a destroyed block pays per particle
+  start = Clock::now();
+  for (int i = 0; i < count; i++)
+  {
+    Particle p(rng, {0.0f, 0.0f}, {0.0f, 0.0f}, 4.0f, {1.0f, 1.0f, 1.0f, 1.0f}, 1.0f);
+    sink += p.size;
+  }
+  double per_particle = SecondsSince(start) / count;
+
+  cout << std::setw(16) << per_rand * 1e9
+       << std::setw(16) << per_random * 1e9
+       << std::setw(16) << per_particle * 1e9 << endl;
+}
+
+
+void BenchParallelCollisions()
+{
+  cout << "\n==== Discrete collisions on a thread pool (ms per tick, 20k blocks)\n"
+       << endl;
+
+  cout << std::setw(8) << "balls"
+       << std::setw(10) << "threads"
+       << std::setw(12) << "ms/tick"
+       << std::setw(10) << "speedup" << endl;
+
+  const int max_threads = std::max(1u, std::thread::hardware_concurrency());
+
+  for (int num_balls : {500, 5000})
+  {
+    Game serial_game;
+    const GameState start = MakeBenchGame(serial_game, 20000, num_balls);
+    double serial_time = 0.0;
+
+    for (int threads = 0; threads <= max_threads; threads = std::max(1, threads * 2))
+    {
+      //0 is the plain one ball at a time loop
+      ThreadPool pool(std::max(1, threads));
+      Game game;
+      if (threads > 0) game.SetThreadPool(&pool);
+
+      //Every tick starts from the same full field so they all do the same
+      //work, only the Simulate call is timed
+      const int ticks = 20;
+      double total = 0.0;
+      GameState state;
+      for (int i = 0; i < ticks; i++)
+      {
+        state = start;
+        auto start_time = Clock::now();
+        game.SimulateInPlace(state, 1.0f / 60.0f);
+        total += SecondsSince(start_time);
+      }
+      double per_tick = total / ticks;
+
+      if (threads == 0) serial_time = per_tick;
+
+      cout << std::setw(8) << num_balls
+           << std::setw(10) << (threads ? std::to_string(threads) : "serial")
+           << std::setw(12) << per_tick * 1e3
+           << std::setw(9) << serial_time / per_tick << "x" << endl;
+    }
+  }
+}
+
+
+//A multiball storm, 10k collisions in one tick, through the sound and
+//particle stages. The ring's capacity is what bounds the cost.
+void BenchCollisionStorm()
+{
+  cout << "\n==== Collision stages, 10k collisions a tick (ms per tick)\n"
+       << endl;
+
+  cout << std::setw(10) << "capacity"
+       << std::setw(10) << "threads"
+       << std::setw(10) << "kept"
+       << std::setw(12) << "ms/tick" << endl;
+
+  Game game;
+  GameState start = MakeBenchGame(game, 100, 0);
+  const int num_collisions = 10000;
+
+  for (int capacity : {16384, 1024})
+  {
+    for (int threads : {0, 2})
+    {
+      ThreadPool pool(std::max(1, threads));
+      Game stage_game;
+      if (threads > 0) stage_game.SetThreadPool(&pool);
+
+      GameState state = start;
+      state.collisions.SetCapacity(capacity);
+      state.particles.reserve(num_collisions * 20);
+
+      const int ticks = 20;
+      double total = 0.0;
+      for (int tick = 0; tick < ticks; tick++)
+      {
+        state.particles.clear();
+        state.sound_events.clear();
+
+        for (int i = 0; i < num_collisions; i++)
+        {
+          state.collisions.Push({{RandomFloat(state.rng, 0.0f, 800.0f), 300.0f}, {100.0f, -200.0f}, {100.0f, 200.0f}, BlockType::square, {}, {}});
+        }
+
+        auto start_time = Clock::now();
+        stage_game.RunCollisionStages(state);
+        total += SecondsSince(start_time);
+      }
+
+      cout << std::setw(10) << capacity
+           << std::setw(10) << (threads ? std::to_string(threads) : "serial")
+           << std::setw(10) << std::min(capacity, num_collisions)
+           << std::setw(12) << total / ticks * 1e3 << endl;
+    }
+  }
+}
+
+
+void BenchReplay()
+{
+  cout << "\n==== Replay playback (2000 blocks, 50 balls, 3000 frames)\n"
+       << endl;
+
+  Game game;
+  FixedTimestep live(MakeBenchGame(game, 2000, 50));
+  const int width = live.Current().width;
+  const int height = live.Current().height;
+
+  std::stringstream log;
+  const int num_frames = 3000;
+  {
+    ReplayRecorder recorder(log, game, 1234, live, 600);
+    Random rng(1);
+
+    for (int f = 0; f < num_frames; f++)
+    {
+      ReplayFrame frame;
+      frame.delta_time = 1.0f / 60.0f;
+      frame.width = width;
+      frame.height = height;
+
+      Intent move{IntentType::player_input, {PlayerInput::mouse_position}, {}};
+      move.position = {RandomFloat(rng, 0.0f, float(width)), 0.0f};
+      frame.intents.push_back(move);
+
+      recorder.RecordFrame(frame, live);
+      RunReplayFrame(game, live, frame);
+    }
+  }
+
+  auto load_start = Clock::now();
+  ReplayPlayer player(log);
+  double load_time = SecondsSince(load_start);
+
+  //Straight through, a frame at a time
+  auto play_start = Clock::now();
+  for (int f = 1; f <= num_frames; f++) player.Seek(game, f);
+  double play_time = SecondsSince(play_start);
+
+  //Jumping to the end from the start
+  player.Seek(game, 0);
+  auto seek_start = Clock::now();
+  int frames_run = player.Seek(game, num_frames - 1);
+  double seek_time = SecondsSince(seek_start);
+
+  cout << "log size:       " << log.str().size() / 1024.0 << " KiB" << endl;
+  cout << "load + index:   " << load_time * 1e3 << " ms" << endl;
+  cout << "playback:       " << num_frames / play_time << " frames/s" << endl;
+  cout << "seek to end:    " << seek_time * 1e3 << " ms (" << frames_run << " frames run, "
+       << play_time * (num_frames - 1) / num_frames * 1e3 << " ms from frame 0)" << endl;
+}
+
+
+//What the same state costs as text, one value at a time, to compare the
+//snapshot format against
+
+template<typename T>
+void WriteTextArray(std::ostream &out, const std::vector<T> &vec, int floats_per_element)
+{
+  out << vec.size() << "\n";
+  for (const T &element : vec)
+  {
+    const float *f = reinterpret_cast<const float *>(&element);
+    for (int i = 0; i < floats_per_element; i++) out << f[i] << " ";
+    out << "\n";
+  }
+}
+
+
+template<typename T>
+void ReadTextArray(std::istream &in, std::vector<T> &vec, int floats_per_element)
+{
+  size_t size = 0;
+  in >> size;
+
+  vec.resize(size);
+  for (T &element : vec)
+  {
+    float *f = reinterpret_cast<float *>(&element);
+    for (int i = 0; i < floats_per_element; i++) in >> f[i];
+  }
+}
+
+
+struct TextBlock
+{
+  float type, alive, x, y, r, g, b, a, first_line, num_lines, left, top, right, bottom;
+};
+
+
+void WriteTextState(std::ostream &out, const GameState &state)
+{
+  out.precision(std::numeric_limits<float>::max_digits10);
+  out << state.width << " " << state.height << " " << static_cast<int>(state.state) << "\n";
+
+  WriteTextArray(out, state.lines, sizeof(Line) / sizeof(float));
+
+  std::vector<TextBlock> blocks;
+  for (const Block &b : state.blocks)
+  {
+    blocks.push_back({float(b.type), float(b.alive), b.position.x, b.position.y, b.colour.r, b.colour.g, b.colour.b, b.colour.a,
+      float(b.first_line), float(b.num_lines), b.bounds.top_left.x, b.bounds.top_left.y, b.bounds.bottom_right.x, b.bounds.bottom_right.y});
+  }
+  WriteTextArray(out, blocks, sizeof(TextBlock) / sizeof(float));
+
+  for (const std::vector<float> *column : {&state.balls.x, &state.balls.y, &state.balls.vx, &state.balls.vy, &state.balls.radius})
+  {
+    WriteTextArray(out, *column, 1);
+  }
+
+  const ParticleStore &particles = state.particles;
+  for (const std::vector<float> *column : {&particles.ttl, &particles.radius, &particles.x, &particles.y, &particles.rotation, &particles.vx, &particles.vy, &particles.rot_vel})
+  {
+    WriteTextArray(out, *column, 1);
+  }
+  WriteTextArray(out, particles.colour, sizeof(col4) / sizeof(float));
+}
+
+
+void ReadTextState(std::istream &in, GameState &state)
+{
+  int state_number = 0;
+  in >> state.width >> state.height >> state_number;
+  state.state = static_cast<State>(state_number);
+
+  ReadTextArray(in, state.lines, sizeof(Line) / sizeof(float));
+
+  std::vector<TextBlock> blocks;
+  ReadTextArray(in, blocks, sizeof(TextBlock) / sizeof(float));
+  state.blocks.clear();
+  for (const TextBlock &t : blocks)
+  {
+    Block b;
+    b.type = static_cast<BlockType>(t.type);
+    b.alive = t.alive != 0.0f;
+    b.position = {t.x, t.y};
+    b.colour = {t.r, t.g, t.b, t.a};
+    b.first_line = t.first_line;
+    b.num_lines = t.num_lines;
+    b.bounds = {{t.left, t.top}, {t.right, t.bottom}};
+    state.blocks.Add(b);
+  }
+
+  for (std::vector<float> *column : {&state.balls.x, &state.balls.y, &state.balls.vx, &state.balls.vy, &state.balls.radius})
+  {
+    ReadTextArray(in, *column, 1);
+  }
+
+  ParticleStore &particles = state.particles;
+  for (std::vector<float> *column : {&particles.ttl, &particles.radius, &particles.x, &particles.y, &particles.rotation, &particles.vx, &particles.vy, &particles.rot_vel})
+  {
+    ReadTextArray(in, *column, 1);
+  }
+  ReadTextArray(in, particles.colour, sizeof(col4) / sizeof(float));
+}
+
+
+void BenchSnapshot()
+{
+  cout << "\n==== Saving and loading a GameState (10k blocks, 100 balls)\n"
+       << endl;
+
+  Game game;
+  GameState state = MakeBenchGame(game, 10000, 100);
+  for (int i = 0; i < 30; i++) game.SimulateInPlace(state, 1.0f / 60.0f);
+
+  const std::string snapshot_file = "bench_snapshot.pongsnap";
+  const std::string text_file = "bench_snapshot.txt";
+  const int runs = 10;
+
+  auto time_runs = [runs](auto &&func) {
+    auto start = Clock::now();
+    for (int i = 0; i < runs; i++) func();
+    return SecondsSince(start) / runs;
+  };
+
+  double snapshot_save = time_runs([&] { SaveSnapshot(snapshot_file, state); });
+  double snapshot_load = time_runs([&] { GameState loaded = LoadSnapshot(snapshot_file); });
+
+  double text_save = time_runs([&] {
+    std::ofstream out(text_file);
+    WriteTextState(out, state);
+  });
+  double text_load = time_runs([&] {
+    std::ifstream in(text_file);
+    GameState loaded;
+    ReadTextState(in, loaded);
+  });
+
+  //Reading straight out of the mapped file, touching every block
+  double view_load = time_runs([&] {
+    MappedFile file(snapshot_file);
+    SnapshotView view(file.GetData(), file.GetSize());
+    float sum = 0.0f;
+    for (const Block &block : view.GetBlocks()) sum += block.position.x;
+    volatile float sink = sum;
+    (void)sink;
+  });
+
+  std::ifstream snapshot_in(snapshot_file, std::ios::binary | std::ios::ate);
+  std::ifstream text_in(text_file, std::ios::binary | std::ios::ate);
+
+  cout << std::setw(12) << "format"
+       << std::setw(12) << "KiB"
+       << std::setw(12) << "save ms"
+       << std::setw(12) << "load ms" << endl;
+
+  cout << std::setw(12) << "text"
+       << std::setw(12) << text_in.tellg() / 1024.0
+       << std::setw(12) << text_save * 1e3
+       << std::setw(12) << text_load * 1e3 << endl;
+
+  cout << std::setw(12) << "snapshot"
+       << std::setw(12) << snapshot_in.tellg() / 1024.0
+       << std::setw(12) << snapshot_save * 1e3
+       << std::setw(12) << snapshot_load * 1e3 << endl;
+
+  cout << std::setw(12) << "mapped view"
+       << std::setw(12) << ""
+       << std::setw(12) << ""
+       << std::setw(12) << view_load * 1e3 << endl;
+
+  cout << "\nsnapshot loads " << text_load / snapshot_load << "x faster than text" << endl;
+
+  std::remove(snapshot_file.c_str());
+  std::remove(text_file.c_str());
+}
+
+
+void BenchLevelLoad()
+{
+  cout << "\n==== Loading levels (ms)\n"
+       << endl;
+
+  cout << std::setw(10) << "blocks"
+       << std::setw(12) << "text KiB"
+       << std::setw(12) << "text ms"
+       << std::setw(12) << "binary KiB"
+       << std::setw(12) << "binary ms"
+       << std::setw(14) << "NewBlock ms" << endl;
+
+  Game game;
+
+  for (int num_blocks : {1000, 10000, 100000})
+  {
+    GameState source = MakeBenchGame(game, num_blocks, 0);
+
+    std::ostringstream text;
+    SaveLevelText(text, source.blocks);
+    const std::string text_level = text.str();
+
+    std::ostringstream binary;
+    SaveLevelBinary(binary, source.blocks);
+    const std::string binary_level = binary.str();
+
+    auto time_load = [&](const std::string &level) {
+      const int runs = 5;
+      auto start = Clock::now();
+      for (int i = 0; i < runs; i++)
+      {
+        GameState state;
+        std::istringstream in(level);
+        LoadLevel(game, in, state);
+      }
+      return SecondsSince(start) / runs;
+    };
+
+    double text_time = time_load(text_level);
+    double binary_time = time_load(binary_level);
+
+    //Building the same blocks one NewBlock at a time, without any parsing
+    auto start = Clock::now();
+    {
+      GameState state;
+      for (const Block &block : source.blocks) state.blocks.Add(game.NewBlock(state, block.position, block.type));
+    }
+    double new_block_time = SecondsSince(start);
+
+    cout << std::setw(10) << num_blocks
+         << std::setw(12) << text_level.size() / 1024.0
+         << std::setw(12) << text_time * 1e3
+         << std::setw(12) << binary_level.size() / 1024.0
+         << std::setw(12) << binary_time * 1e3
+         << std::setw(14) << new_block_time * 1e3 << endl;
+  }
+}
+
+
+void BenchBatch()
+{
+  cout << "\n==== Batch of games (ticks per second)\n"
+       << endl;
+
+  cout << std::setw(8) << "threads"
+       << std::setw(16) << "ticks/s"
+       << std::setw(10) << "speedup" << endl;
+
+  Game game;
+  const int num_games = 32;
+  const int num_ticks = 120;
+  const float dt = 1.0f / 60.0f;
+
+  std::vector<BatchGame> start_games(num_games);
+  for (int g = 0; g < num_games; g++)
+  {
+    start_games[g].state = MakeBenchGame(game, 500, 20);
+    start_games[g].state.rng.Seed(g);
+  }
+
+  const int max_threads = std::max(1u, std::thread::hardware_concurrency());
+  double single_rate = 0.0;
+
+  for (int threads = 1; threads <= max_threads; threads *= 2)
+  {
+    BatchRunner runner(game, threads);
+    std::vector<BatchGame> games = start_games;
+
+    BatchResult result = runner.Run(games, num_ticks, dt);
+    if (threads == 1) single_rate = result.ticks_per_second;
+
+    cout << std::setw(8) << threads
+         << std::setw(16) << result.ticks_per_second
+         << std::setw(9) << result.ticks_per_second / single_rate << "x" << endl;
+  }
+}
+
+
+//Killing blocks a few per frame, the way a game does, until a tenth of them
+//are gone. The vector erases and closes the gap every frame, the slot map
+//fills each hole from the end. Both know which blocks died, the vector from
+//their alive flags and the slot map from their indexes.
+void BenchBlockRemoval()
+{
+  cout << "\n==== Removing dead blocks, 16 per frame (us per frame)\n"
+       << endl;
+
+  cout << std::setw(10) << "blocks"
+       << std::setw(14) << "vector erase"
+       << std::setw(12) << "slot map" << endl;
+
+  Game game;
+
+  for (int num_blocks : {1000, 10000, 100000})
+  {
+    const GameState source = MakeBenchGame(game, num_blocks, 0);
+    const int per_frame = 16;
+    const int frames = num_blocks / 10 / per_frame;
+
+    //The same blocks die in both
+    Random rng(99);
+    std::vector<int> kills;
+    for (int i = 0; i < frames * per_frame; i++) kills.push_back(RandomInt(rng, 0, num_blocks));
+
+    std::vector<Block> vec = source.blocks.items;
+    auto start = Clock::now();
+    for (int frame = 0; frame < frames; frame++)
+    {
+      for (int i = 0; i < per_frame; i++) vec[kills[frame * per_frame + i] % vec.size()].alive = false;
+
+      vec.erase(std::remove_if(vec.begin(), vec.end(), [](const Block &b) { return not b.alive; }), vec.end());
+    }
+    const double vector_time = SecondsSince(start) / frames;
+
+    SlotMap<Block> map = source.blocks;
+    std::vector<int> dead;
+    start = Clock::now();
+    for (int frame = 0; frame < frames; frame++)
+    {
+      dead.clear();
+      for (int i = 0; i < per_frame; i++) dead.push_back(kills[frame * per_frame + i] % map.size());
+
+      //Highest first like Simulate, the same block can die twice in a frame
+      std::sort(dead.begin(), dead.end());
+      dead.erase(std::unique(dead.begin(), dead.end()), dead.end());
+      for (auto i = dead.rbegin(); i != dead.rend(); ++i) map.RemoveAt(*i);
+    }
+    const double slot_map_time = SecondsSince(start) / frames;
+
+    if (map.size() != static_cast<int>(vec.size())) throw std::runtime_error("Removal benchmarks disagree");
+
+    cout << std::setw(10) << num_blocks
+         << std::setw(14) << vector_time * 1e6
+         << std::setw(12) << slot_map_time * 1e6 << endl;
+  }
+}
+
+
+//// Microbenchmarks
+//
+//  bench_pong micro [--out FILE] [--compare BASELINE] [--threshold PERCENT]
+//                   [--samples N] [--filter TEXT]
+//
+//Each one times a fixed amount of work, the same on every machine and every
+//run, so the results can be saved and compared later. The results are JSON,
+//on stdout unless --out is given. With --compare, anything that got slower
+//than the baseline by more than the threshold is listed and bench_pong exits
+//with 1. None of it needs a GL context.
+
+//Printed for --help, and after a bad option
+const char *const MICRO_USAGE =
+    "usage: bench_pong micro [--out FILE] [--compare BASELINE] [--threshold PERCENT]\n"
+    "                        [--samples N] [--filter TEXT]\n";
+
+struct MicroOptions
+{
+  int samples = 9;
+  std::string filter;
+};
+
+
+struct MicroResult
+{
+  std::string name;
+  int ops;
+
+  //Nanoseconds per op, over the samples
+  double median_ns;
+  double min_ns;
+  double max_ns;
+};
+
+
+//Somewhere for results to go so they aren't optimised away
+volatile float micro_sink = 0.0f;
+
+
+//setup runs before each sample and isn't timed, run does ops ops. One
+//sample is thrown away first to warm the caches.
+void AddMicro(const MicroOptions &options, std::vector<MicroResult> &results, const std::string &name, int ops,
+  const std::function<void()> &setup, const std::function<void()> &run)
+{
+  if (name.find(options.filter) == std::string::npos) return;
+
+  std::vector<double> times;
+  for (int sample = -1; sample < options.samples; sample++)
+  {
+    setup();
+    auto start = Clock::now();
+    run();
+    const double seconds = SecondsSince(start);
+
+    if (sample >= 0) times.push_back(seconds * 1e9 / ops);
+  }
+
+  std::sort(times.begin(), times.end());
+  results.push_back({name, ops, times[times.size() / 2], times.front(), times.back()});
+
+  std::cerr << std::left << std::setw(56) << name << std::right
+            << std::setw(14) << results.back().median_ns << " ns/op" << endl;
+}
+
+
+void MicroNearestPoint(const MicroOptions &options, std::vector<MicroResult> &results)
+{
+  Random rng(1234);
+  std::vector<vec2> points;
+  for (int i = 0; i < 3 * 1024; i++) points.push_back({RandomFloat(rng, 0.0f, 640.0f), RandomFloat(rng, 0.0f, 480.0f)});
+
+  const int passes = 200;
+
+  AddMicro(options, results, "nearest_point_on_line_segment", passes * 1024, [] {}, [&] {
+    float sum = 0.0f;
+    for (int pass = 0; pass < passes; pass++)
+    {
+      for (int i = 0; i < 3 * 1024; i += 3) sum += nearest_point_on_line_segment(points[i], points[i + 1], points[i + 2]).x;
+    }
+    micro_sink = micro_sink + sum;
+  });
+}
+
+
+void MicroBallCollision(const MicroOptions &options, std::vector<MicroResult> &results)
+{
+  Game game;
+  const int num_balls = 256;
+  const int passes = 32;
+
+  for (int num_blocks : {100, 1000, 10000})
+  {
+    GameState state = MakeBenchGame(game, num_blocks, num_balls);
+    game.PrepareBroadphase(state);
+
+    std::vector<Ball> balls;
+    for (int i = 0; i < num_balls; i++) balls.push_back(state.balls.Get(i));
+
+    std::vector<BlockHandle> hit_blocks;
+    vec2 normal{};
+
+    AddMicro(options, results, "CalculateBallCollision/blocks=" + std::to_string(num_blocks), passes * num_balls, [] {}, [&] {
+      int hits = 0;
+      for (int pass = 0; pass < passes; pass++)
+      {
+        for (const Ball &ball : balls) hits += game.CalculateBallCollision(state, ball, normal, hit_blocks);
+      }
+      micro_sink = micro_sink + hits;
+    });
+  }
+}
+
+
+//The balls go through the same blocks on every pass, the ones hit on the
+//first pass are dead after it, the same way each sample
+void MicroUpdatePhysics(const MicroOptions &options, std::vector<MicroResult> &results)
+{
+  Game game;
+  const int num_balls = 256;
+  const int passes = 32;
+  const float dt = 1.0f / 60.0f;
+
+  for (int num_blocks : {1000, 10000})
+  {
+    const GameState source = MakeBenchGame(game, num_blocks, num_balls);
+    GameState state;
+    CollisionRing collisions(COLLISION_RING_CAPACITY);
+
+    AddMicro(options, results, "UpdatePhysics/balls=256,blocks=" + std::to_string(num_blocks), passes * num_balls,
+      [&] {
+        state = source;
+        game.PrepareBroadphase(state);
+      },
+      [&] {
+        float sum = 0.0f;
+        for (int pass = 0; pass < passes; pass++)
+        {
+          for (int i = 0; i < num_balls; i++)
+          {
+            Ball ball = state.balls.Get(i);
+            sum += game.UpdatePhysics(state, dt, ball, collisions).position.x;
+          }
+          collisions.Clear();
+        }
+        micro_sink = micro_sink + sum;
+      });
+  }
+}
+
+
+//Every sample steps the same starting state the same number of ticks
+void MicroSimulate(const MicroOptions &options, std::vector<MicroResult> &results)
+{
+  Game game;
+  const int num_ticks = 30;
+  const float dt = 1.0f / 60.0f;
+
+  struct Size
+  {
+    int balls;
+    int blocks;
+    int particles;
+  };
+
+  for (const Size &size : {Size{10, 100, 0}, Size{100, 1000, 1000}, Size{1000, 10000, 10000}})
+  {
+    GameState source = MakeBenchGame(game, size.blocks, size.balls);
+    for (int i = 0; i < size.particles; i++)
+    {
+      vec2 pos{RandomFloat(source.rng, 0.0f, source.width), RandomFloat(source.rng, 0.0f, source.height)};
+      source.particles.Add(Particle(source.rng, pos, {0.0f, 0.0f}, 4.0f, RandomRGB(source.rng), 10.0f));
+    }
+
+    GameState state;
+
+    std::ostringstream name;
+    name << "Simulate/balls=" << size.balls << ",blocks=" << size.blocks << ",particles=" << size.particles;
+
+    AddMicro(options, results, name.str(), num_ticks, [&] { state = source; }, [&] {
+      for (int tick = 0; tick < num_ticks; tick++)
+      {
+        game.SimulateInPlace(state, dt);
+        state.sound_events.clear();
+      }
+      micro_sink = micro_sink + state.particles.size();
+    });
+  }
+}
+
+
+void MicroParticleInstances(const MicroOptions &options, std::vector<MicroResult> &results)
+{
+  for (int num_particles : {1000, 10000})
+  {
+    Random rng(1234);
+    ParticleStore particles;
+    for (int i = 0; i < num_particles; i++)
+    {
+      vec2 pos{RandomFloat(rng, 0.0f, 640.0f), RandomFloat(rng, 0.0f, 480.0f)};
+      particles.Add(Particle(rng, pos, {0.0f, 0.0f}, 4.0f, RandomRGB(rng), 1.0f));
+    }
+
+    const int calls = 200000 / num_particles;
+    std::vector<float> instances;
+
+    AddMicro(options, results, "MakeParticleInstances/particles=" + std::to_string(num_particles), calls, [] {}, [&] {
+      for (int call = 0; call < calls; call++)
+      {
+        MakeParticleInstances(particles, instances);
+        micro_sink = micro_sink + instances.back();
+      }
+    });
+  }
+}
+
+
+void MicroUpdateParticles(const MicroOptions &options, std::vector<MicroResult> &results)
+{
+  const int num_particles = 50000;
+  const int num_ticks = 60;
+  const float dt = 1.0f / 60.0f;
+
+  //Half of them run out during the run
+  Random rng(99);
+  ParticleStore source;
+  for (int i = 0; i < num_particles; i++)
+  {
+    vec2 pos{RandomFloat(rng, 0.0f, 640.0f), RandomFloat(rng, 0.0f, 480.0f)};
+    vec2 vel{RandomFloat(rng, -2.0f, 2.0f), RandomFloat(rng, -2.0f, 2.0f)};
+    source.Add(Particle(rng, pos, vel, 4.0f, RandomRGB(rng), (i % 2) ? 0.3f : 2.0f));
+  }
+
+  ParticleStore particles;
+  const std::string size = "/particles=" + std::to_string(num_particles);
+
+  AddMicro(options, results, "UpdateParticlesScalar" + size, num_ticks, [&] { particles = source; }, [&] {
+    for (int tick = 0; tick < num_ticks; tick++) UpdateParticlesScalar(particles, dt);
+    micro_sink = micro_sink + particles.x.back();
+  });
+
+  AddMicro(options, results, "UpdateParticles" + size, num_ticks, [&] { particles = source; }, [&] {
+    for (int tick = 0; tick < num_ticks; tick++) UpdateParticles(particles, dt);
+    micro_sink = micro_sink + particles.x.back();
+  });
+
+  AddMicro(options, results, "UpdateParticles+RemoveExpired" + size, num_ticks, [&] { particles = source; }, [&] {
+    for (int tick = 0; tick < num_ticks; tick++)
+    {
+      UpdateParticles(particles, dt);
+      particles.RemoveExpired();
+    }
+    micro_sink = micro_sink + particles.size();
+  });
+}
+
+
+void MicroEmitParticles(const MicroOptions &options, std::vector<MicroResult> &results)
+{
+  //A chain reaction, 100 blocks going at once with 100 particles each
+  const int num_bursts = 100;
+  const int burst_size = 100;
+
+  Random rng(5);
+  std::vector<vec2> origins;
+  for (int i = 0; i < 5; i++) origins.push_back({RandomFloat(rng, 0.0f, 640.0f), RandomFloat(rng, 0.0f, 480.0f)});
+  const vec2 still{0.0f, 0.0f};
+  const col4 colour = RandomRGB(rng);
+
+  ParticleStore particles;
+  particles.reserve(num_bursts * burst_size);
+  const std::string size = "/bursts=" + std::to_string(num_bursts) + ",size=" + std::to_string(burst_size);
+
+  //What Simulate did before EmitParticles
+  AddMicro(options, results, "Particle+Add" + size, num_bursts, [&] { particles.clear(); }, [&] {
+    for (int burst = 0; burst < num_bursts; burst++)
+    {
+      for (int i = 0; i < burst_size; i++)
+      {
+        const vec2 &origin = origins[RandomInt(rng, 0, origins.size())];
+        particles.Add(Particle(rng, origin, still, 4.0f, colour, 1.0f));
+      }
+    }
+    micro_sink = micro_sink + particles.x.back();
+  });
+
+  ParticleEmitter emitter;
+  emitter.origins = origins.data();
+  emitter.num_origins = origins.size();
+  emitter.velocities = &still;
+  emitter.num_velocities = 1;
+  emitter.size = 4.0f;
+  emitter.colour = colour;
+
+  AddMicro(options, results, "EmitParticles" + size, num_bursts, [&] { particles.clear(); }, [&] {
+    for (int burst = 0; burst < num_bursts; burst++) EmitParticles(particles, rng.Next64(), emitter, burst_size);
+    micro_sink = micro_sink + particles.x.back();
+  });
+}
+
+
+void MicroText(const MicroOptions &options, std::vector<MicroResult> &results)
+{
+  Text text;
+  const std::string str = "FPS: 60  BALLS: 1234  BLOCKS: 567  PARTICLES: 8901";
+  const int calls = 2000;
+
+  AddMicro(options, results, "Text::MakeString/chars=" + std::to_string(str.size()), calls, [] {}, [&] {
+    for (int call = 0; call < calls; call++)
+    {
+      micro_sink = micro_sink + text.MakeString(str, {10.0f, 10.0f}, {1.0f, 1.0f, 1.0f, 1.0f}).size();
+    }
+  });
+}
+
+
+//MakeGeometry was split into adding a new block's lines and moving them
+//along with the block, both are timed
+void MicroGeometry(const MicroOptions &options, std::vector<MicroResult> &results)
+{
+  Game game;
+  const GameState source = MakeBenchGame(game, 10000, 0);
+  const int passes = 10;
+
+  std::vector<Block> blocks;
+  std::vector<Line> lines;
+
+  AddMicro(options, results, "Game::AddGeometry", passes * source.blocks.size(),
+    [&] {
+      blocks = source.blocks.items;
+      lines.reserve(source.lines.size());
+    },
+    [&] {
+      for (int pass = 0; pass < passes; pass++)
+      {
+        lines.clear();
+        for (Block &block : blocks) game.AddGeometry(lines, block);
+      }
+    });
+
+  AddMicro(options, results, "Game::MoveGeometry", passes * source.blocks.size(),
+    [&] {
+      blocks = source.blocks.items;
+      lines.clear();
+      for (Block &block : blocks) game.AddGeometry(lines, block);
+    },
+    [&] {
+      for (int pass = 0; pass < passes; pass++)
+      {
+        for (Block &block : blocks)
+        {
+          block.position.x += 1.0f;
+          game.MoveGeometry(lines, block);
+        }
+      }
+    });
+}
+
+
+void WriteMicroJson(std::ostream &out, const MicroOptions &options, const std::vector<MicroResult> &results)
+{
+  out << std::setprecision(3) << std::fixed;
+  out << "{\n"
+      << "  \"suite\": \"pong micro\",\n"
+      << "  \"samples\": " << options.samples << ",\n"
+      << "  \"benchmarks\": [\n";
+
+  for (unsigned i = 0; i < results.size(); i++)
+  {
+    const MicroResult &r = results[i];
+    out << "    {\"name\": \"" << r.name << "\", \"ops\": " << r.ops
+        << ", \"ns_per_op\": " << r.median_ns
+        << ", \"min_ns\": " << r.min_ns
+        << ", \"max_ns\": " << r.max_ns << "}"
+        << (i + 1 < results.size() ? ",\n" : "\n");
+  }
+
+  out << "  ]\n"
+      << "}\n";
+}
+
+
+//Pulls the name and ns_per_op out of each object in a results file. Only
+//goes as far into JSON as those need, but doesn't mind how it's laid out.
+std::map<std::string, double> ReadMicroJson(const std::string &filename)
+{
+  std::ifstream file(filename);
+  if (not file) throw std::runtime_error("Can't open " + filename);
+
+  std::stringstream buffer;
+  buffer << file.rdbuf();
+  const std::string json = buffer.str();
+
+  std::map<std::string, double> out;
+  std::string key;
+  std::string name;
+  double ns = -1.0;
+
+  for (size_t i = 0; i < json.size(); i++)
+  {
+    const char ch = json[i];
+
+    if (ch == '"')
+    {
+      size_t end = i + 1;
+      while (end < json.size() and json[end] != '"') end += (json[end] == '\\') ? 2 : 1;
+      if (end >= json.size()) throw std::runtime_error("Unterminated string in " + filename);
+
+      const std::string str = json.substr(i + 1, end - i - 1);
+      i = end;
+
+      size_t next = json.find_first_not_of(" \t\r\n", i + 1);
+      if (next != std::string::npos and json[next] == ':')
+        key = str;
+      else if (key == "name")
+        name = str;
+    }
+    else if (key == "ns_per_op" and (isdigit(static_cast<unsigned char>(ch)) or ch == '-'))
+    {
+      size_t used = 0;
+      ns = std::stod(json.substr(i, 32), &used);
+      i += used - 1;
+      key.clear();
+    }
+    else if (ch == '{')
+    {
+      name.clear();
+      ns = -1.0;
+    }
+    else if (ch == '}' and not name.empty() and ns >= 0.0)
+    {
+      out[name] = ns;
+      name.clear();
+    }
+  }
+
+  return out;
+}
+
+
+//Lists every benchmark against the baseline, returns how many got slower
+//by more than threshold (a fraction)
+int CompareMicro(const std::vector<MicroResult> &results, const std::map<std::string, double> &baseline, double threshold)
+{
+  std::cerr << "\n==== Against the baseline (ns per op)\n"
+            << endl;
+
+  std::cerr << std::left << std::setw(56) << "benchmark" << std::right
+            << std::setw(14) << "baseline"
+            << std::setw(14) << "now"
+            << std::setw(10) << "change" << endl;
+
+  int regressions = 0;
+  for (const MicroResult &r : results)
+  {
+    std::cerr << std::left << std::setw(56) << r.name << std::right;
+
+    auto found = baseline.find(r.name);
+    if (found == baseline.end() or found->second <= 0.0)
+    {
+      std::cerr << std::setw(14) << "-" << std::setw(14) << r.median_ns << "       new" << endl;
+      continue;
+    }
+
+    const double change = r.median_ns / found->second - 1.0;
+    std::cerr << std::setw(14) << found->second
+              << std::setw(14) << r.median_ns
+              << std::setw(9) << change * 100.0 << "%";
+
+    if (change > threshold)
+    {
+      std::cerr << "  REGRESSION";
+      regressions++;
+    }
+    std::cerr << endl;
+  }
+
+  std::cerr << "\n"
+            << regressions << " regression(s) over " << threshold * 100.0 << "%" << endl;
+
+  return regressions;
+}
+
+
+int RunMicro(int argc, char *argv[])
+{
+  MicroOptions options;
+  std::string out_filename;
+  std::string baseline_filename;
+  double threshold = 0.15;
+
+  for (int i = 2; i < argc; i++)
+  {
+    const std::string arg = argv[i];
+    try
+    {
+      if (arg == "--out" and i + 1 < argc)
+        out_filename = argv[++i];
+      else if (arg == "--compare" and i + 1 < argc)
+        baseline_filename = argv[++i];
+      else if (arg == "--threshold" and i + 1 < argc)
+        threshold = std::stod(argv[++i]) / 100.0;
+      else if (arg == "--samples" and i + 1 < argc)
+        options.samples = std::max(1, std::stoi(argv[++i]));
+      else if (arg == "--filter" and i + 1 < argc)
+        options.filter = argv[++i];
+      else if (arg == "--help")
+      {
+        cout << MICRO_USAGE;
+        return EXIT_SUCCESS;
+      }
+      else
+      {
+        std::cerr << "Unknown or incomplete option " << arg << "\n\n" << MICRO_USAGE;
+        return EXIT_FAILURE;
+      }
+    }
+    catch (const std::logic_error &e) //std::stoi and std::stod's invalid_argument and out_of_range
+    {
+      std::cerr << "Bad value for " << arg << ": " << argv[i] << " (" << e.what() << ")\n\n" << MICRO_USAGE;
+      return EXIT_FAILURE;
+    }
+  }
+
+  //Read first, so a bad baseline doesn't waste a run
+  std::map<std::string, double> baseline;
+  if (not baseline_filename.empty()) baseline = ReadMicroJson(baseline_filename);
+
+  std::cerr.precision(1);
+  std::cerr << std::fixed;
+
+  std::vector<MicroResult> results;
+  MicroNearestPoint(options, results);
+  MicroBallCollision(options, results);
+  MicroUpdatePhysics(options, results);
+  MicroSimulate(options, results);
+  MicroParticleInstances(options, results);
+  MicroUpdateParticles(options, results);
+  MicroEmitParticles(options, results);
+  MicroText(options, results);
+  MicroGeometry(options, results);
+
+  if (out_filename.empty())
+  {
+    WriteMicroJson(cout, options, results);
+  }
+  else
+  {
+    std::ofstream out(out_filename);
+    if (not out) throw std::runtime_error("Can't write " + out_filename);
+    WriteMicroJson(out, options, results);
+  }
+
+  if (not baseline_filename.empty() and CompareMicro(results, baseline, threshold) > 0) return EXIT_FAILURE;
+
+  return EXIT_SUCCESS;
+}
+
+
+//bench_pong prints the comparisons above, bench_pong micro runs the
+//microbenchmarks (see RunMicro)
+int main(int argc, char *argv[])
+{
+  if (argc > 1 and std::string(argv[1]) == "micro") return RunMicro(argc, argv);
+
+  cout.precision(1);
+  cout << std::fixed;
+
+  BenchRandom();
+
+  BenchBallIntegration();
+
+  BenchBroadphase("uniform");
+  BenchBroadphase("clustered");
+
+  BenchParallelCollisions();
+
+  BenchCollisionStorm();
+
+  BenchBatch();
+
+  BenchReplay();
+
+  BenchSnapshot();
+
+  BenchLevelLoad();
+
+  BenchBlockRemoval();
+
+  return EXIT_SUCCESS;
+}
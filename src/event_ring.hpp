@@ -0,0 +1,141 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+
+//What EventRing::Push does once the ring is full
+enum class OverflowPolicy
+{
+  drop_newest, //the new event is thrown away, the first ones in are kept
+  drop_oldest //the new event takes the oldest one's place
+};
+
+
+//A run of events in a ring, oldest first
+template<typename T>
+struct EventSpan
+{
+  const T *i1;
+  const T *i2;
+
+  const T *begin() const { return i1; }
+  const T *end() const { return i2; }
+  int size() const { return i2 - i1; }
+  const T &operator[](int i) const { return i1[i]; }
+};
+
+
+//A queue of events that never holds more than its capacity, so however many
+//get pushed the cost of handling them is bounded. The memory is only used
+//as it fills, and Clear rewinds it, so a ring that is drained every tick
+//costs nothing to copy between ticks. The counters keep going across Clear.
+template<typename T>
+class EventRing
+{
+private:
+  std::vector<T> events; //grows up to capacity, then wraps around
+  int capacity;
+  OverflowPolicy policy;
+
+  int first = 0; //oldest event
+  int count = 0;
+
+  uint64_t num_pushed = 0;
+  uint64_t num_dropped = 0;
+  int high_water = 0;
+
+public:
+  explicit EventRing(int capacity, OverflowPolicy policy = OverflowPolicy::drop_newest)
+  : capacity(std::max(capacity, 1))
+  , policy(policy)
+  {
+  }
+
+  int GetCapacity() const { return capacity; }
+  OverflowPolicy GetOverflowPolicy() const { return policy; }
+  void SetOverflowPolicy(OverflowPolicy p) { policy = p; }
+
+  //Throws away anything in the ring
+  void SetCapacity(int new_capacity)
+  {
+    Clear();
+    events.shrink_to_fit();
+    capacity = std::max(new_capacity, 1);
+  }
+
+  int size() const { return count; }
+  bool empty() const { return count == 0; }
+
+  void reserve() { events.reserve(capacity); }
+
+  //Returns false if the event was dropped
+  bool Push(const T &event)
+  {
+    num_pushed++;
+
+    if (count == capacity)
+    {
+      num_dropped++;
+      if (policy == OverflowPolicy::drop_newest) return false;
+
+      events[first] = event;
+      first = (first + 1 == capacity) ? 0 : first + 1;
+      return true;
+    }
+
+    int slot = first + count;
+    if (slot >= capacity) slot -= capacity;
+
+    if (slot == static_cast<int>(events.size()))
+      events.push_back(event);
+    else
+      events[slot] = event;
+
+    count++;
+    high_water = std::max(high_water, count);
+    return true;
+  }
+
+  //Oldest first
+  const T &operator[](int i) const
+  {
+    int slot = first + i;
+    if (slot >= capacity) slot -= capacity;
+    return events[slot];
+  }
+
+  //Everything in the ring is run 0 followed by run 1, which is only there
+  //once the ring has wrapped around
+  EventSpan<T> GetRun(int run) const
+  {
+    const int first_run = std::min(count, capacity - first);
+    if (run == 0) return {events.data() + first, events.data() + first + first_run};
+    return {events.data(), events.data() + (count - first_run)};
+  }
+
+  void Clear()
+  {
+    events.clear();
+    first = 0;
+    count = 0;
+  }
+
+  //Every Push, including the dropped ones
+  uint64_t GetNumPushed() const { return num_pushed; }
+  uint64_t GetNumDropped() const { return num_dropped; }
+
+  //The most events the ring has held at once
+  int GetHighWater() const { return high_water; }
+
+  //For putting back a saved ring
+  void SetCounters(uint64_t pushed, uint64_t dropped, int high)
+  {
+    num_pushed = pushed;
+    num_dropped = dropped;
+    high_water = high;
+  }
+
+  void ResetCounters() { SetCounters(0, 0, 0); }
+};
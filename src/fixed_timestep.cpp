@@ -0,0 +1,83 @@
+#include "fixed_timestep.hpp"
+
+#include <stdexcept>
+
+#include "maths.hpp"
+
+
+void PreviousTick::Save(const GameState &state)
+{
+  //Assigning over the last tick's reuses the memory it already has
+  time = state.time;
+  ball_handles = state.balls.handles;
+  ball_x = state.balls.x;
+  ball_y = state.balls.y;
+}
+
+
+FixedTimestep::FixedTimestep(const GameState &start)
+: state(start)
+{
+  previous.Save(state);
+}
+
+
+void FixedTimestep::SetTickRate(float ticks_per_second)
+{
+  if (not(ticks_per_second > 0.0f)) throw std::runtime_error("Tick rate must be above zero");
+
+  tick_rate = ticks_per_second;
+  tick_dt = 1.0f / ticks_per_second;
+}
+
+
+void FixedTimestep::Reset(const GameState &new_state, double accumulated_time, long long ticks_so_far)
+{
+  state = new_state;
+  previous.Save(state);
+  accumulator = accumulated_time;
+  num_ticks = ticks_so_far;
+  dropped_time = 0.0;
+}
+
+
+int FixedTimestep::Advance(const Game &game, float frame_dt)
+{
+  accumulator += frame_dt;
+
+  int ticks = 0;
+  while (accumulator >= tick_dt)
+  {
+    if (ticks == max_catch_up)
+    {
+      //Too far behind, let the extra time go
+      dropped_time += accumulator;
+      accumulator = 0.0;
+      break;
+    }
+
+    game.ProcessStateGraph(state, tick_dt);
+    previous.Save(state);
+    game.SimulateInPlace(state, tick_dt);
+
+    accumulator -= tick_dt;
+    ticks++;
+  }
+
+  num_ticks += ticks;
+  return ticks;
+}
+
+
+vec2 InterpolateBallPosition(const PreviousTick &previous, const GameState &current, int i, float alpha)
+{
+  const vec2 now = current.balls.GetPosition(i);
+
+  //Balls move around the store as others are removed, the handle finds
+  //where this one was
+  const int j = previous.ball_handles.Find(current.balls.GetHandle(i));
+  if (j < 0) return now;
+
+  const vec2 then{previous.ball_x[j], previous.ball_y[j]};
+  return then + (now - then) * alpha;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <vector>
+
+#include "game.hpp"
+#include "slot_map.hpp"
+
+
+//Runs the Game at a fixed tick rate, whatever rate frames come in at. Frame
+//time piles up in an accumulator and is spent in whole ticks, so the results
+//only depend on the tick rate and not on how fast the machine is. After a
+//long stall at most max_catch_up ticks are run and the rest of the time is
+//dropped, rather than spiralling further and further behind.
+//
+//There is only the one GameState, stepped in place. Enough of the tick before
+//it is kept for the renderer to draw in between them, see GetAlpha() and
+//InterpolateBallPosition().
+
+
+//What drawing in between ticks needs of the tick before: where the balls were,
+//their handles to match them up by, and the time. Saved over the same vectors
+//every tick, so once they've grown to fit it doesn't allocate.
+struct PreviousTick
+{
+  double time = 0.0;
+  SlotTable ball_handles;
+  std::vector<float> ball_x;
+  std::vector<float> ball_y;
+
+  void Save(const GameState &state);
+};
+
+
+class FixedTimestep
+{
+private:
+  GameState state;
+  PreviousTick previous;
+
+  float tick_rate = 60.0f;
+  float tick_dt = 1.0f / 60.0f;
+  int max_catch_up = 8;
+
+  double accumulator = 0.0;
+  long long num_ticks = 0;
+  double dropped_time = 0.0;
+
+public:
+  FixedTimestep() = default;
+  explicit FixedTimestep(const GameState &start);
+
+  void SetTickRate(float ticks_per_second);
+  float GetTickRate() const { return tick_rate; }
+  float GetTickDelta() const { return tick_dt; }
+
+  void SetMaxCatchUp(int ticks) { max_catch_up = ticks; }
+  int GetMaxCatchUp() const { return max_catch_up; }
+
+  //Input should go into Current() before calling Advance
+  GameState &Current() { return state; }
+  const GameState &Current() const { return state; }
+  const PreviousTick &Previous() const { return previous; }
+
+  //Adds the frame time and runs however many ticks it pays for, returns how
+  //many that was
+  int Advance(const Game &game, float frame_dt);
+
+  //How far the leftover time is into the next tick, 0 to 1
+  float GetAlpha() const { return static_cast<float>(accumulator / tick_dt); }
+
+  long long GetNumTicks() const { return num_ticks; }
+  double GetDroppedTime() const { return dropped_time; }
+  double GetAccumulator() const { return accumulator; }
+
+  //Starts over from state with some time already banked towards the next
+  //tick, for picking up a saved run where it left off. Previous() is the
+  //same as Current() until the next tick.
+  void Reset(const GameState &new_state, double accumulated_time, long long ticks_so_far);
+};
+
+
+//Where to draw ball i, alpha of the way from the previous tick to the current
+//one. The ball is matched up with its previous position by its handle, one
+//that wasn't there last tick is just drawn where it is.
+vec2 InterpolateBallPosition(const PreviousTick &previous, const GameState &current, int i, float alpha);
@@ -1,47 +1,47 @@
 
 #include "game.hpp"
 
-#include <cstdlib>
-#include <ctime>
-
 #include <algorithm>
-#include <iostream>
+#include <cassert>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
 
 #include "input.hpp"
-#include "sound.hpp"
+#include "level.hpp"
 
 #include "maths.hpp"
 #include "maths_collisions.hpp"
-#include "to_string.hpp"
+#include "profiler.hpp"
+#include "thread_pool.hpp"
 
 
 
-Ball::Ball(const vec2 &position, const vec2 &velocity)
-: position(position)
-, velocity(velocity)
-, colour {}
-, bounds{}
+Line::Line(const vec2 &p1, const vec2 &p2)
+: p1(p1)
+, p2(p2)
+, normal(get_normal(p1, p2))
+, direction(p2 - p1)
+, length_sq(distance_squared(p1, p2))
 {
-  colour = RandomRGB();
-  UpdateBounds();
 }
 
 
-void Ball::UpdateBounds()
+LineRange Block::GetLines(const std::vector<Line> &lines) const
 {
-  bounds.top_left = {position.x - radius, position.y - radius};
-  bounds.bottom_right = {position.x + radius, position.y + radius};
+  const Line *first = lines.data() + first_line;
+  return {first, first + num_lines};
 }
 
 
-void Block::UpdateBounds()
+void Block::UpdateBounds(const std::vector<Line> &lines)
 {
   const Block &block = *this;
 
   vec2 tl = block.position;
   vec2 br = block.position;
 
-  for (auto line : block.geometry)
+  for (const Line &line : block.GetLines(lines))
   {
     for (auto point : {line.p1, line.p2})
     {
@@ -58,83 +58,108 @@ void Block::UpdateBounds()
 }
 
 
-Game::Game(Sound &sound)
-: sound(sound)
+Game::Game()
 {
-  srand(static_cast<unsigned>(time(nullptr)));
-
   SetupBlockGeometry();
+
+  AddCollisionStage({"sound", [](const Game &game, GameState &state, const CollisionSpan &collisions) {
+    for (const Collision &collision : collisions) game.PlayCollisionSound(collision, state);
+  }});
+
+  AddCollisionStage({"particles", [](const Game &game, GameState &state, const CollisionSpan &collisions) {
+    for (const Collision &collision : collisions) game.CreateCollisionParticles(collision, state);
+  }});
 }
 
 
-BlockType RandomBlockType()
+BlockType RandomBlockType(Random &rng)
 {
   const std::vector<BlockType> vec{
     BlockType::square,
     BlockType::triangle_left, BlockType::triangle_right,
     BlockType::rectangle,
     BlockType::rect_triangle_left, BlockType::rect_triangle_right};
-  return vec.at(RandomInt(0, vec.size()));
+  return vec.at(RandomInt(rng, 0, vec.size()));
 }
 
 
-std::vector<Block> NewWorldBorders(float border, int width, int height)
+//Replaces the borders, so handles to the old ones go stale
+void SetWorldBorders(std::vector<Line> &lines, SlotMap<Block> &borders, float border, int width, int height)
 {
   Block b;
   b.type = BlockType::world_border;
   b.position = {0.0f, 0.0f};
   b.colour = {1.0f, 1.0f, 1.0f, 1.0f};
-  b.geometry = {};
 
   Block outofbounds;
   outofbounds.type = BlockType::world_out_of_bounds;
   outofbounds.position = {0.0f, 0.0f};
   outofbounds.colour = {0.0f, 0.0f, 0.0f, 1.0f};
-  outofbounds.geometry = {};
 
   vec2 tl{border, border};
   vec2 tr{width - border, border};
   vec2 bl{border, height + 20.0f};
   vec2 br{width - border, height + 20.0f};
 
-  b.geometry.push_back({tl, tr});
-  b.geometry.push_back({tr, br});
-  outofbounds.geometry.push_back({br, bl});
-  b.geometry.push_back({bl, tl});
+  b.first_line = lines.size();
+  b.num_lines = 3;
+  lines.emplace_back(tl, tr);
+  lines.emplace_back(tr, br);
+  lines.emplace_back(bl, tl);
+
+  outofbounds.first_line = lines.size();
+  outofbounds.num_lines = 1;
+  lines.emplace_back(br, bl);
 
-  b.UpdateBounds();
-  outofbounds.UpdateBounds();
+  b.UpdateBounds(lines);
+  outofbounds.UpdateBounds(lines);
 
-  return {b, outofbounds};
+  borders.clear();
+  borders.Add(b);
+  borders.Add(outofbounds);
 }
 
 
 void Game::SetupBlockGeometry()
 {
+  block_shapes.assign(NUM_BLOCK_TYPES, BlockShape{});
+
+  auto add_shape = [this](BlockType bt, BlockGeometry lines) {
+    BlockShape &shape = block_shapes[static_cast<int>(bt)];
+    shape.lines = std::move(lines);
+
+    //Same as Block::UpdateBounds for a block at 0, 0
+    Block block;
+    block.position = {0.0f, 0.0f};
+    block.num_lines = shape.lines.size();
+    block.UpdateBounds(shape.lines);
+    shape.bounds = block.bounds;
+  };
+
   vec2 tl{0, 0};
   vec2 bl{0, 50};
   vec2 tr{50, 0};
   vec2 br{50, 50};
 
-  block_shapes.emplace(BlockType::square,
+  add_shape(BlockType::square,
     BlockGeometry{{tl, bl}, {bl, br}, {br, tr}, {tr, tl}});
 
-  block_shapes.emplace(BlockType::triangle_left,
+  add_shape(BlockType::triangle_left,
     BlockGeometry{{tr, tl}, {tl, br}, {br, tr}});
 
-  block_shapes.emplace(BlockType::triangle_right,
+  add_shape(BlockType::triangle_right,
     BlockGeometry{{tr, tl}, {tl, bl}, {bl, tr}});
 
   vec2 wtr{100, 0};
   vec2 wbr{100, 50};
 
-  block_shapes.emplace(BlockType::rectangle,
+  add_shape(BlockType::rectangle,
     BlockGeometry{{tl, bl}, {bl, wbr}, {wbr, wtr}, {wtr, tl}});
 
-  block_shapes.emplace(BlockType::rect_triangle_left,
+  add_shape(BlockType::rect_triangle_left,
     BlockGeometry{{wtr, tl}, {tl, br}, {br, wbr}, {wbr, wtr}});
 
-  block_shapes.emplace(BlockType::rect_triangle_right,
+  add_shape(BlockType::rect_triangle_right,
     BlockGeometry{{wtr, tl}, {tl, bl}, {bl, br}, {br, wtr}});
 
 
@@ -143,74 +168,129 @@ void Game::SetupBlockGeometry()
   vec2 pbl{-50, 40};
   vec2 pbr{50, 40};
 
-  block_shapes.emplace(BlockType::paddle,
+  add_shape(BlockType::paddle,
     BlockGeometry{{ptl, pbl}, {pbl, pbr}, {pbr, ptr}, {ptr, ptl}});
 }
 
 
-BlockGeometry Game::MakeGeometry(BlockType bt, const vec2 &offset) const
+const BlockShape &Game::GetBlockShape(BlockType bt) const
+{
+  const unsigned i = static_cast<unsigned>(bt);
+  if (i >= block_shapes.size() or block_shapes[i].lines.empty()) throw std::runtime_error("Block type has no shape");
+
+  return block_shapes[i];
+}
+
+
+//Appends the block's shape, moved to its position, to the end of the pool,
+//and sets its bounds to match
+void Game::AddGeometry(std::vector<Line> &lines, Block &block) const
+{
+  const BlockShape &shape = GetBlockShape(block.type);
+
+  block.first_line = lines.size();
+  block.num_lines = shape.lines.size();
+
+  for (const Line &line : shape.lines)
+  {
+    lines.emplace_back(line.p1 + block.position, line.p2 + block.position);
+  }
+
+  //Adding the position to every point moves the smallest and largest ones
+  //the same, so this matches UpdateBounds exactly
+  block.bounds.top_left = shape.bounds.top_left + block.position;
+  block.bounds.bottom_right = shape.bounds.bottom_right + block.position;
+}
+
+
+//Rewrites the block's lines in place after it has moved
+void Game::MoveGeometry(std::vector<Line> &lines, const Block &block) const
 {
-  BlockGeometry geom = block_shapes.at(bt);
+  const BlockGeometry &shape = GetBlockShape(block.type).lines;
 
-  for (auto &line : geom)
+  for (int i = 0; i < block.num_lines; i++)
   {
-    line.p1 += offset;
-    line.p2 += offset;
+    const Line &line = shape[i];
+    lines[block.first_line + i] = Line(line.p1 + block.position, line.p2 + block.position);
   }
-  return geom;
 }
 
 
-Block Game::NewBlock(const vec2 &position, BlockType bt) const
+Block Game::NewBlock(GameState &state, const vec2 &position, BlockType bt) const
 {
   Block b;
   b.type = bt;
 
   b.position = position;
-  b.colour = RandomRGB();
-  b.geometry = MakeGeometry(b.type, position);
-
-  b.UpdateBounds();
+  b.colour = RandomRGB(state.rng);
+  AddGeometry(state.lines, b);
 
   return b;
 }
 
 
-GameState Game::NewGame(int width, int height) const
+GameState Game::NewGame(int width, int height, uint64_t seed) const
 {
   GameState state;
 
+  state.rng.Seed(seed);
+
   state.width = width;
   state.height = height;
 
-  state.player = MakePlayer({width / 2.0f, height - 50.0f});
+  state.player = MakePlayer(state, {width / 2.0f, height - 50.0f});
 
   state.mouse_pointer = {width / 2.0f, height / 2.0f};
 
-  for (int x = 0; x < 5; x++)
+  if (not level_data.empty())
+  {
+    std::istringstream level(level_data);
+    LoadLevel(*this, level, state);
+  }
+  else
   {
-    for (int y = 0; y < 3; y++)
+    for (int x = 0; x < 5; x++)
     {
-      vec2 position{50.0f + (110.0f * x), 50.0f + (60.0f * y)};
-      state.blocks.push_back(NewBlock(position, RandomBlockType()));
+      for (int y = 0; y < 3; y++)
+      {
+        vec2 position{50.0f + (110.0f * x), 50.0f + (60.0f * y)};
+        state.blocks.Add(NewBlock(state, position, RandomBlockType(state.rng)));
+      }
     }
   }
 
-  state.border_lines = NewWorldBorders(5, width, height);
+  SetWorldBorders(state.lines, state.border_lines, 5, width, height);
 
   return state;
 }
 
 
-Paddle Game::MakePlayer(const vec2 &position) const
+void Game::SetLevel(const std::string &data)
 {
-  Block block = NewBlock({0, 0}, BlockType::paddle);
-  block.colour = {1.0f, 1.0f, 1.0f, 1.0f};
+  //Load it once now so a bad level fails here and not in the middle of a game
+  GameState check;
+  std::istringstream level(data);
+  LoadLevel(*this, level, check);
 
-  block.position = position;
-  block.geometry = MakeGeometry(BlockType::paddle, position);
+  level_data = data;
+}
+
+
+void Game::LoadLevelFile(const std::string &filename)
+{
+  std::ifstream file(filename, std::ios::binary);
+  if (not file) throw std::runtime_error("Couldn't open " + filename);
+
+  std::ostringstream data;
+  data << file.rdbuf();
+  SetLevel(data.str());
+}
 
-  block.UpdateBounds();
+
+Paddle Game::MakePlayer(GameState &state, const vec2 &position) const
+{
+  Block block = NewBlock(state, position, BlockType::paddle);
+  block.colour = {1.0f, 1.0f, 1.0f, 1.0f};
 
   Paddle player;
 
@@ -225,24 +305,23 @@ Paddle Game::MakePlayer(const vec2 &position) const
 }
 
 
-Paddle Game::UpdatePlayer(const Paddle &old, const vec2 &position) const
+void Game::UpdatePlayer(GameState &state, const vec2 &position) const
 {
-  Paddle player = old;
-  player.block.position.x = position.x;
-
-  player.block.geometry = MakeGeometry(BlockType::paddle, player.block.position);
+  Block &block = state.player.block;
+  block.position.x = position.x;
 
-  player.block.UpdateBounds();
+  MoveGeometry(state.lines, block);
 
-  return player;
+  block.UpdateBounds(state.lines);
 }
 
 
 void UpdatePaddleVelocity(Paddle &player)
 {
-  player.avg_velocity.push_back(player.block.position.x);
-
-  player.avg_velocity.erase(player.avg_velocity.begin());
+  //Drop the oldest sample off the front, without growing the vector
+  auto &vels = player.avg_velocity;
+  std::rotate(vels.begin(), vels.begin() + 1, vels.end());
+  vels.back() = player.block.position.x;
 }
 
 
@@ -260,15 +339,60 @@ float GetPaddleVelocity(const Paddle &player)
 }
 
 
-GameState Game::Resize(const GameState &state, int width, int height) const
+int CountLiveLines(const GameState &state)
 {
-  GameState out = state;
+  int count = state.player.block.num_lines;
+  for (const auto *vec : {&state.blocks, &state.border_lines})
+  {
+    for (const Block &block : *vec) count += block.num_lines;
+  }
+  return count;
+}
+
+
+//Once more than half the pool belongs to blocks that are gone, copy the
+//live lines down into a fresh pool. Block order is kept, so the pool ends
+//up in the same order the collision loops walk it.
+void CompactLinesIfSparse(GameState &state)
+{
+  const int live = CountLiveLines(state);
+  if (live * 2 >= static_cast<int>(state.lines.size())) return;
+
+  thread_local std::vector<Line> compacted;
+  compacted.clear();
+  compacted.reserve(live);
+
+  auto move_lines = [&](Block &block) {
+    const LineRange range = block.GetLines(state.lines);
+    block.first_line = compacted.size();
+    compacted.insert(compacted.end(), range.begin(), range.end());
+  };
+
+  for (Block &block : state.blocks) move_lines(block);
+  for (Block &block : state.border_lines) move_lines(block);
+  move_lines(state.player.block);
+
+  //The old pool's memory stays with this thread for next time
+  state.lines.swap(compacted);
+}
+
+
+void Game::ResizeInPlace(GameState &state, int width, int height) const
+{
+  state.width = width;
+  state.height = height;
 
-  out.width = width;
-  out.height = height;
+  SetWorldBorders(state.lines, state.border_lines, 5, width, height);
+  state.block_grid.Clear();
+
+  CompactLinesIfSparse(state);
+}
 
-  out.border_lines = NewWorldBorders(5, width, height);
 
+GameState Game::Resize(const GameState &state, int width, int height) const
+{
+  GameState out = state;
+  ResizeInPlace(out, width, height);
   return out;
 }
 
@@ -286,65 +410,134 @@ void Game::OnHitBlock(Ball &ball, Block &block) const
   }
 }
 
-//TODO maybe refactor this into a loop taking a lambda, eg, for_all_blocks(f)
+Block *Game::FindBlock(GameState &state, const BlockHandle &handle) const
+{
+  switch (handle.set)
+  {
+    case BlockSet::blocks: return state.blocks.Get(handle.slot);
+    case BlockSet::border_lines: return state.border_lines.Get(handle.slot);
+    case BlockSet::player: return &state.player.block;
+  }
+  return nullptr;
+}
+
 
-struct BlockIterator
+const Block *Game::FindBlock(const GameState &state, const BlockHandle &handle) const
 {
-  Block *i1;
-  Block *i2;
+  return FindBlock(const_cast<GameState &>(state), handle);
+}
+
+
+//The parts of a ball the collision tests look at, straight from a Ball or the
+//BallStore columns
+struct BallMotion
+{
+  vec2 position;
+  vec2 velocity;
+  float radius;
+  BoundingBox bounds;
+};
 
-  explicit BlockIterator(std::vector<Block> &vec)
-  : i1(vec.data())
-  , i2(vec.data() + vec.size())
+
+//Tests the ball against one block, accumulating the normals of any lines it is moving into
+void AccumulateBlockCollision(const BallMotion &ball, const Block &block, const BlockHandle &handle, const std::vector<Line> &lines, vec2 &normal_acc, int &num_normals, std::vector<BlockHandle> &out_hit_blocks)
+{
+  if (not BoundingBoxCollides(ball.bounds, block.bounds)) return;
+
+  for (const Line &line : block.GetLines(lines))
   {
+    if (CircleCollides(ball.position, ball.radius, line))
+    {
+      //Only the sign is needed, so neither side has to be normalized
+      vec2 contact_angle = ball.velocity * -1.0f;
+      float line_dot = dot(line.normal, contact_angle);
+
+      if (line_dot > 0)
+      {
+        normal_acc += line.normal;
+        num_normals++;
+
+        out_hit_blocks.push_back(handle);
+      }
+    }
   }
+}
 
-  explicit BlockIterator(Block &single)
-  : i1(&single)
-  , i2(i1 + 1)
+
+//Simulate keeps the broadphases in step as blocks die, anything else that adds
+//or removes blocks leaves them a different size and they're built again here
+void Game::PrepareBroadphase(GameState &state) const
+{
+  const int num_blocks = state.blocks.size();
+  SpatialGrid &grid = state.block_grid;
+  AABBTree &tree = state.block_tree;
+
+  if (broadphase == Broadphase::grid and (not grid.IsBuilt() or grid.GetNumBlocks() != num_blocks))
   {
+    grid.Build(state.blocks.items, state.width, state.height);
   }
 
-  Block *begin() { return i1; }
-  Block *end() { return i2; }
-};
+  if (broadphase == Broadphase::aabb_tree and (not tree.IsBuilt() or tree.GetNumBlocks() != num_blocks))
+  {
+    tree.Build(state.blocks.items);
+  }
+}
+
+
+//Fills out_blocks with the blocks that might touch the bounds, sorted. Returns
+//false if the broadphase hasn't been built, then every block needs testing.
+//One that has been built has to be up to date, see PrepareBroadphase.
+bool Game::QueryBroadphase(const GameState &state, const BoundingBox &bounds, std::vector<int> &out_blocks) const
+{
+  const SpatialGrid &grid = state.block_grid;
+  const AABBTree &tree = state.block_tree;
+
+  if (broadphase == Broadphase::grid and grid.IsBuilt())
+  {
+    assert(grid.GetNumBlocks() == state.blocks.size());
+    grid.Query(bounds, out_blocks);
+    return true;
+  }
+
+  if (broadphase == Broadphase::aabb_tree and tree.IsBuilt())
+  {
+    assert(tree.GetNumBlocks() == state.blocks.size());
+    tree.Query(bounds, out_blocks);
+    return true;
+  }
+
+  return false;
+}
 
 
-bool Game::CalculateBallCollision(GameState &state, const Ball &old_ball, vec2 &out_normal_vec, std::vector<Block *> &out_hit_blocks) const
+bool CalculateMotionCollision(const Game &game, GameState &state, const BallMotion &old_ball, vec2 &out_normal_vec, std::vector<BlockHandle> &out_hit_blocks)
 {
   vec2 normal_acc = {};
   int num_normals = 0;
   out_hit_blocks.clear();
 
-  for (auto vec : {BlockIterator(state.blocks), BlockIterator(state.border_lines), BlockIterator(state.player.block)})
-  {
-    for (Block &block : vec)
-    {
-      if (not BoundingBoxCollides(old_ball.bounds, block.bounds)) continue;
-
-      for (auto &line : block.geometry)
-      {
-        if (Collides(old_ball, line))
-        {
-          vec2 line_normal = get_normal(line.p1, line.p2);
+  thread_local std::vector<int> candidates;
 
-          vec2 contact_point = nearest_point_on_line_segment(line.p1, line.p2, old_ball.position);
-          vec2 contact_angle = normalize(old_ball.position - contact_point);
-          contact_angle = old_ball.velocity * -1.0f;
-          float line_dot = dot(normalize(line_normal), normalize(contact_angle));
+  auto test_block = [&](const Block &block, const BlockHandle &handle) {
+    AccumulateBlockCollision(old_ball, block, handle, state.lines, normal_acc, num_normals, out_hit_blocks);
+  };
 
-          if (line_dot > 0)
-          {
-            normal_acc += line_normal;
-            num_normals++;
+  if (game.QueryBroadphase(state, old_ball.bounds, candidates))
+  {
+    for (int i : candidates) test_block(state.blocks[i], {state.blocks.GetHandle(i), BlockSet::blocks});
+  }
+  else
+  {
+    for (int i = 0; i < state.blocks.size(); i++) test_block(state.blocks[i], {state.blocks.GetHandle(i), BlockSet::blocks});
+  }
 
-            out_hit_blocks.push_back(&block);
-          }
-        }
-      }
-    }
+  for (int i = 0; i < state.border_lines.size(); i++)
+  {
+    test_block(state.border_lines[i], {state.border_lines.GetHandle(i), BlockSet::border_lines});
   }
 
+  test_block(state.player.block, {SlotHandle{}, BlockSet::player});
+
   if (num_normals)
   {
     out_normal_vec = normal_acc / float(num_normals);
@@ -355,46 +548,202 @@ bool Game::CalculateBallCollision(GameState &state, const Ball &old_ball, vec2 &
 }
 
 
-Ball Game::UpdatePhysics(GameState &state, float dt, Ball &old_ball, std::vector<Collision> &collisions) const
+bool Game::CalculateBallCollision(GameState &state, const Ball &old_ball, vec2 &out_normal_vec, std::vector<BlockHandle> &out_hit_blocks) const
 {
-  Ball out = old_ball;
-  float orig_speed = get_length(old_ball.velocity);
+  const BallMotion motion{old_ball.position, old_ball.velocity, old_ball.radius, old_ball.bounds};
+  return CalculateMotionCollision(*this, state, motion, out_normal_vec, out_hit_blocks);
+}
 
-  out.position = old_ball.position + (old_ball.velocity * dt);
-  out.UpdateBounds();
+
+bool Game::CalculateBallCollision(GameState &state, int ball, vec2 &out_normal_vec, std::vector<BlockHandle> &out_hit_blocks) const
+{
+  const BallStore &balls = state.balls;
+  const BallMotion motion{balls.GetPosition(ball), balls.GetVelocity(ball), balls.radius[ball], balls.GetBounds(ball)};
+  return CalculateMotionCollision(*this, state, motion, out_normal_vec, out_hit_blocks);
+}
 
 
-  std::vector<Block *> hit_blocks{};
+//Bounces the ball off anything it touches at its current position, the
+//collision records are placed where it would have moved to this frame
+bool Game::CollideBall(GameState &state, float dt, Ball &ball, CollisionRing &collisions) const
+{
+  thread_local std::vector<BlockHandle> hit_blocks;
   vec2 normal_avg{};
-  if (CalculateBallCollision(state, old_ball, normal_avg, hit_blocks))
+  if (not CalculateBallCollision(state, ball, normal_avg, hit_blocks)) return false;
+
+  const vec2 moved_position = ball.position + (ball.velocity * dt);
+  BounceBall(state, ball, normal_avg, hit_blocks, moved_position, collisions);
+
+  return true;
+}
+
+
+//Reflects the ball off the normal and lets each block it hit react, the
+//collision records are placed at position
+void Game::BounceBall(GameState &state, Ball &ball, const vec2 &normal, const std::vector<BlockHandle> &hit_blocks, const vec2 &position, CollisionRing &collisions) const
+{
+  const vec2 old_velocity = ball.velocity;
+  float orig_speed = get_length(old_velocity);
+
+  vec2 refl = reflect(normalize(old_velocity), normalize(normal));
+
+  ball.velocity = normalize(refl) * orig_speed;
+
+  for (const BlockHandle &handle : hit_blocks)
   {
-    vec2 refl = reflect(normalize(old_ball.velocity), normalize(normal_avg));
+    Block *block = FindBlock(state, handle);
+    if (not block) continue;
 
-    out.velocity = normalize(refl) * orig_speed;
+    if (block->type == BlockType::paddle)
+    {
+      ball.velocity.x += GetPaddleVelocity(state.player) * 30.0f;
+    }
+    OnHitBlock(ball, *block);
+    collisions.Push({position, old_velocity, ball.velocity, block->type, handle, ball.handle});
+  }
+}
+
+
+//Moves the ball through the whole of dt, stopping to bounce off each thing it
+//runs into on the way. Unlike CollideBall a fast ball can't jump over a line
+//between one tick and the next, so big steps are safe.
+bool Game::SweepBall(GameState &state, float dt, int ball, CollisionRing &collisions) const
+{
+  struct Impact
+  {
+    float t;
+    vec2 normal;
+    BlockHandle block;
+  };
+
+  thread_local std::vector<Impact> impacts;
+  thread_local std::vector<BlockHandle> hit_blocks;
+  thread_local std::vector<BlockHandle> broken_blocks;
+  thread_local std::vector<int> candidates;
+
+  broken_blocks.clear();
 
-    for (Block *block : hit_blocks)
+  BallStore &balls = state.balls;
+  vec2 position = balls.GetPosition(ball);
+  const float radius = balls.radius[ball];
+
+  bool bounced = false;
+  float remaining = dt;
+
+  for (int bounce = 0; bounce < MAX_SWEEP_BOUNCES and remaining > 0.0f; bounce++)
+  {
+    const vec2 motion = balls.GetVelocity(ball) * remaining;
+    const vec2 end = position + motion;
+
+    const BoundingBox swept{
+      {std::min(position.x, end.x) - radius, std::min(position.y, end.y) - radius},
+      {std::max(position.x, end.x) + radius, std::max(position.y, end.y) + radius}};
+
+    impacts.clear();
+    float first = 1.0f;
+
+    auto sweep_block = [&](const Block &block, const BlockHandle &handle) {
+      if (not BoundingBoxCollides(swept, block.bounds)) return;
+
+      //A block this ball broke earlier in the tick is already gone
+      if (std::find(broken_blocks.begin(), broken_blocks.end(), handle) != broken_blocks.end()) return;
+
+      for (const Line &line : block.GetLines(state.lines))
+      {
+        float t = 1.0f;
+        vec2 normal{};
+        if (SweepCircleLine(position, motion, radius, line, t, normal))
+        {
+          impacts.push_back({t, normal, handle});
+          first = std::min(first, t);
+        }
+      }
+    };
+
+    if (QueryBroadphase(state, swept, candidates))
+    {
+      for (int i : candidates) sweep_block(state.blocks[i], {state.blocks.GetHandle(i), BlockSet::blocks});
+    }
+    else
+    {
+      for (int i = 0; i < state.blocks.size(); i++) sweep_block(state.blocks[i], {state.blocks.GetHandle(i), BlockSet::blocks});
+    }
+
+    for (int i = 0; i < state.border_lines.size(); i++)
+    {
+      sweep_block(state.border_lines[i], {state.border_lines.GetHandle(i), BlockSet::border_lines});
+    }
+
+    sweep_block(state.player.block, {SlotHandle{}, BlockSet::player});
+
+    if (impacts.empty())
+    {
+      position = end;
+      break;
+    }
+
+    position += motion * first;
+    remaining -= remaining * first;
+
+    //Everything touched at the same moment gets hit together, like both
+    //sides of a corner
+    vec2 normal_acc{};
+    vec2 first_normal{};
+    hit_blocks.clear();
+    for (const Impact &impact : impacts)
+    {
+      if (impact.t > first + SWEEP_TIME_EPSILON) continue;
+
+      if (hit_blocks.empty()) first_normal = impact.normal;
+      normal_acc += impact.normal;
+      if (std::find(hit_blocks.begin(), hit_blocks.end(), impact.block) == hit_blocks.end())
+      {
+        hit_blocks.push_back(impact.block);
+      }
+    }
+
+    //Contacts on opposite sides, like a ball grazing two corners as it slips
+    //between them, add up to nothing and can't be normalized
+    if (dot(normal_acc, normal_acc) < 1e-6f) normal_acc = first_normal;
+
+    //Only a ball that hits something is copied out whole
+    Ball bouncing = balls.Get(ball);
+    bouncing.position = position;
+    BounceBall(state, bouncing, normal_acc, hit_blocks, position, collisions);
+    balls.Set(ball, bouncing);
+    bounced = true;
+
+    for (const BlockHandle &handle : hit_blocks)
     {
-      if (block->type == BlockType::paddle)
+      const BlockType type = FindBlock(state, handle)->type;
+      if (type != BlockType::paddle and type != BlockType::world_border)
       {
-        out.velocity.x += GetPaddleVelocity(state.player) * 30.0f;
+        broken_blocks.push_back(handle);
       }
-      OnHitBlock(out, *block);
-      collisions.push_back({out.position, old_ball.velocity, out.velocity, block->type});
     }
 
-    out.position = old_ball.position;
-    out.UpdateBounds();
+    if (not balls.IsAlive(ball)) break;
   }
 
-  return out;
+  balls.x[ball] = position.x;
+  balls.y[ball] = position.y;
+  balls.UpdateBounds(ball);
+
+  return bounced;
 }
 
 
-template<typename CONT, typename PRED>
-void remove_inplace(CONT &container, const PRED &pred)
+Ball Game::UpdatePhysics(GameState &state, float dt, Ball &old_ball, CollisionRing &collisions) const
 {
-  container.erase(
-    std::remove_if(container.begin(), container.end(), pred), container.end());
+  Ball out = old_ball;
+
+  //Balls that bounce stay where they are this frame
+  if (CollideBall(state, dt, out, collisions)) return out;
+
+  out.position = old_ball.position + (old_ball.velocity * dt);
+  out.UpdateBounds();
+
+  return out;
 }
 
 
@@ -405,7 +754,7 @@ void Game::ProcessGameInput(GameState &state, const Intent &intent) const
     case IntentType::quit:
     case IntentType::menu:
       SetState(state, State::pause_menu);
-      if (not state.sound_muted) sound.PlaySound("menu_beep", 0.5f);
+      PlaySound(state, SoundEffect::menu_beep, 0.5f);
       break;
 
     case IntentType::toggle_debug:
@@ -413,12 +762,12 @@ void Game::ProcessGameInput(GameState &state, const Intent &intent) const
       break;
 
     case IntentType::new_game:
-      state = NewGame(state.width, state.height);
+      state = NewGame(state.width, state.height, state.rng.Next64());
       break;
 
     case IntentType::reset_ball:
       state.balls.clear();
-      if (not state.sound_muted) sound.PlaySound("lost_ball", 0.5f);
+      PlaySound(state, SoundEffect::lost_ball, 0.5f);
       break;
 
     case IntentType::player_input:
@@ -435,7 +784,7 @@ void Game::ProcessGameInput(GameState &state, const Intent &intent) const
 
           float b = 50 + 10;
           vec2 pos = {clamp(b, state.width - b, intent.position.x), intent.position.y};
-          state.player = UpdatePlayer(state.player, pos);
+          UpdatePlayer(state, pos);
         }
         break;
 
@@ -444,26 +793,27 @@ void Game::ProcessGameInput(GameState &state, const Intent &intent) const
           {
             if (state.player.sticky_ball)
             {
-              auto b = Ball(state.player.block.position + state.player.sticky_ball_offset, {0.0f, -300.0f});
+              auto b = Ball(state.player.block.position + state.player.sticky_ball_offset, {0.0f, -300.0f}, RandomRGB(state.rng));
               b.velocity.x += GetPaddleVelocity(state.player) * 30.0f;
-              state.balls.push_back(b);
-              if (not state.sound_muted) sound.PlaySound("paddle_bounce", state.player.block.position.x / state.width);
+              state.balls.Add(b);
+              PlaySound(state, SoundEffect::paddle_bounce, state.player.block.position.x / state.width);
               state.player.sticky_ball = false;
             }
             else
             {
-              if (not state.sound_muted) sound.PlaySound("error", state.player.block.position.x / state.width);
+              PlaySound(state, SoundEffect::error, state.player.block.position.x / state.width);
             }
 
             const vec2 particle_vel{0.0f, -1.0f};
-            const col4 particle_col{1.0f, 1.0f, 0.5f, 1.0f};
 
-            for (int i = 0; i < 10; i++)
-            {
-              state.particles.emplace_back(
-                Particle(state.player.block.position, particle_vel,
-                  1.0f, particle_col, 1.0f));
-            }
+            ParticleEmitter emitter;
+            emitter.origins = &state.player.block.position;
+            emitter.num_origins = 1;
+            emitter.velocities = &particle_vel;
+            emitter.num_velocities = 1;
+            emitter.colour = {1.0f, 1.0f, 0.5f, 1.0f};
+
+            AddParticles(state, emitter, 10);
           }
           break;
       }
@@ -487,19 +837,19 @@ void Game::ProcessMenuInput(GameState &state, const Intent &intent) const
       if (state.state == State::pause_menu)
       {
         SetState(state, State::mid_game);
-        if (not state.sound_muted) sound.PlaySound("menu_beep", 0.5f);
+        PlaySound(state, SoundEffect::menu_beep, 0.5f);
       }
       break;
 
     case IntentType::menu_up:
       state.selected_menu_item--;
       if (state.selected_menu_item < 0) state.selected_menu_item = state.menu_items.size() - 1;
-      if (not state.sound_muted) sound.PlaySound("menu_beep", 0.5f);
+      PlaySound(state, SoundEffect::menu_beep, 0.5f);
       break;
 
     case IntentType::menu_down:
       state.selected_menu_item = (state.selected_menu_item + 1) % state.menu_items.size();
-      if (not state.sound_muted) sound.PlaySound("menu_beep", 0.5f);
+      PlaySound(state, SoundEffect::menu_beep, 0.5f);
       break;
 
     case IntentType::menu_activate:
@@ -516,6 +866,8 @@ void Game::ProcessMenuInput(GameState &state, const Intent &intent) const
 void Game::ProcessIntents(GameState &state,
   const std::vector<struct Intent> &intent_stream) const
 {
+  PROFILE_ZONE("ProcessIntents");
+
   for (auto &intent : intent_stream)
   {
     if (state.state == State::main_menu or state.state == State::pause_menu)
@@ -533,8 +885,6 @@ void Game::ProcessIntents(GameState &state,
 
 void Game::SetState(GameState &state, State new_state) const
 {
-  std::cout << "SetState(" << ToString(new_state) << ")" << std::endl;
-
   state.state_timer = 0.0f;
   state.state = new_state;
 
@@ -553,7 +903,7 @@ void Game::SetState(GameState &state, State new_state) const
       break;
 
     case State::new_level:
-      state = NewGame(state.width, state.height);
+      state = NewGame(state.width, state.height, state.rng.Next64());
       break;
 
     case State::ball_launch:
@@ -565,7 +915,7 @@ void Game::SetState(GameState &state, State new_state) const
 
     case State::ball_reset:
       state.balls.clear();
-      if (not state.sound_muted) sound.PlaySound("lost_ball", 0.5f);
+      PlaySound(state, SoundEffect::lost_ball, 0.5f);
       break;
 
     case State::ball_died:
@@ -584,6 +934,8 @@ void Game::SetState(GameState &state, State new_state) const
 
 void Game::ProcessStateGraph(GameState &state, float dt) const
 {
+  PROFILE_ZONE("ProcessStateGraph");
+
   state.state_timer += dt;
 
   switch (state.state)
@@ -601,7 +953,7 @@ void Game::ProcessStateGraph(GameState &state, float dt) const
         }
         if (item == "Quit") state.running = false;
 
-        if (not state.sound_muted) sound.PlaySound("menu_activated", 0.5f);
+        PlaySound(state, SoundEffect::menu_activated, 0.5f);
       }
       break;
 
@@ -620,7 +972,7 @@ void Game::ProcessStateGraph(GameState &state, float dt) const
         }
         if (item == "Quit") state.running = false;
 
-        if (not state.sound_muted) sound.PlaySound("menu_activated", 0.5f);
+        PlaySound(state, SoundEffect::menu_activated, 0.5f);
       }
       break;
 
@@ -657,134 +1009,388 @@ void Game::ProcessStateGraph(GameState &state, float dt) const
       }
       break;
   }
-
-  TRACE << "State: " << ToString(state.state) << "  ";
 }
 
 
-void Game::PlayCollisionSound(const Collision &collision, const GameState &state) const
+void Game::PlaySound(GameState &state, SoundEffect effect, float balance) const
 {
   if (state.sound_muted) return;
 
+  state.sound_events.push_back({effect, balance});
+}
+
+
+void Game::PlayCollisionSound(const Collision &collision, GameState &state) const
+{
   float balance = (collision.position.x / state.width);
 
   if (collision.block_type == BlockType::world_out_of_bounds)
   {
-    sound.PlaySound("lost_ball", balance);
+    PlaySound(state, SoundEffect::lost_ball, balance);
   }
   else if (collision.block_type == BlockType::world_border)
   {
-    sound.PlaySound("bounce", balance);
+    PlaySound(state, SoundEffect::bounce, balance);
   }
   else if (collision.block_type == BlockType::paddle)
   {
-    sound.PlaySound("paddle_bounce", balance);
+    PlaySound(state, SoundEffect::paddle_bounce, balance);
   }
   else
   {
-    sound.PlaySound("bounce_hit", balance);
+    PlaySound(state, SoundEffect::bounce_hit, balance);
   }
 }
 
 
-std::vector<Particle> Game::CreateCollisionParticles(const Collision &collision) const
+void Game::CreateCollisionParticles(const Collision &collision, GameState &state) const
 {
-  std::vector<Particle> particles;
-
   // const vec2 particle_vel = collision.in_vel / 50.0f;
-  const col4 particle_col{1.0f, 1.0f, 0.5f, 1.0f};
+  const vec2 particle_vels[] = {collision.in_vel / 150.0f, collision.out_vel / 150.0f, {0.0f, 0.0f}};
 
-  for (int i = 0; i < 20; i++)
-  {
-    vec2 particle_vel {};
-    const int r = RandomInt(0, 3);
-    if (r == 0)
-      particle_vel = collision.in_vel / 150.0f;
-    else if (r == 1)
-      particle_vel = collision.out_vel / 150.0f;
-    else
-      particle_vel = {0.0, 0.0};
+  ParticleEmitter emitter;
+  emitter.origins = &collision.position;
+  emitter.num_origins = 1;
+  emitter.velocities = particle_vels;
+  emitter.num_velocities = 3;
+  emitter.size = 0.5f;
+  emitter.colour = {1.0f, 1.0f, 0.5f, 1.0f};
 
-    particles.emplace_back(
-      Particle(collision.position, particle_vel, 0.5f, particle_col, 1.0f));
+  AddParticles(state, emitter, 20);
+}
+
+
+void Game::AddParticles(GameState &state, const ParticleEmitter &emitter, int count) const
+{
+  const uint64_t key = state.rng.Next64();
+
+  if (particle_mode == ParticleMode::simulated)
+  {
+    EmitParticles(state.particles, key, emitter, count);
+  }
+  else if (static_cast<int>(state.particle_bursts.size()) < PARTICLE_BURST_CAPACITY)
+  {
+    state.particle_bursts.push_back(MakeParticleBurst(key, emitter, count, state.time));
   }
+}
+
 
-  return particles;
+CollisionStage MakeTelemetryStage(CollisionTelemetry &telemetry)
+{
+  return {"telemetry", [&telemetry](const Game &, GameState &, const CollisionSpan &collisions) {
+    for (const Collision &collision : collisions)
+    {
+      telemetry.by_block_type[static_cast<int>(collision.block_type)]++;
+    }
+
+    telemetry.num_collisions += collisions.size();
+    telemetry.num_spans++;
+    telemetry.largest_span = std::max(telemetry.largest_span, collisions.size());
+  }};
 }
 
 
-GameState Game::Simulate(const GameState &state, float dt) const
+GameMetrics::GameMetrics(MetricsRegistry &registry)
+: balls(registry.GetGauge("balls"))
+, blocks(registry.GetGauge("blocks"))
+, particles(registry.GetGauge("particles"))
+, particle_bursts(registry.GetGauge("particle_bursts"))
+, collisions(registry.GetCounter("collisions"))
+, frames(registry.GetCounter("frames"))
+, ticks(registry.GetCounter("ticks"))
+, draw_calls(registry.GetGauge("draw_calls"))
+, frame_time(registry.GetHistogram("frame_time_ms", {1.0, 2.0, 4.0, 8.0, 16.7, 33.3, 50.0, 100.0, 250.0}))
 {
-  if (state.state == State::pause_menu or state.state == State::main_menu)
-    return state;
+}
 
-  GameState out = state;
 
-  for (Ball &b : out.balls)
+void GameMetrics::SetCounts(const GameState &state)
+{
+  balls.Set(state.balls.size());
+  blocks.Set(state.blocks.size());
+  particles.Set(state.particles.size());
+  particle_bursts.Set(state.particle_bursts.size());
+}
+
+
+CollisionStage MakeMetricsStage(GameMetrics &metrics)
+{
+  return {"metrics", [&metrics](const Game &, GameState &, const CollisionSpan &collisions) {
+    metrics.collisions.Add(collisions.size());
+  }};
+}
+
+
+void Game::RunCollisionStages(GameState &state) const
+{
+  if (state.collisions.empty()) return;
+
+  struct Stages
+  {
+    const Game &game;
+    GameState &state;
+    const std::vector<CollisionStage> &stages;
+
+    void Run(int stage) const
+    {
+      for (int run = 0; run < 2; run++)
+      {
+        const CollisionSpan collisions = state.collisions.GetRun(run);
+        if (collisions.size()) stages[stage].consume(game, state, collisions);
+      }
+    }
+  };
+
+  const Stages stages{*this, state, collision_stages};
+  const int num_stages = collision_stages.size();
+
+  if (thread_pool and num_stages > 1 and state.collisions.size() >= MIN_PARALLEL_COLLISIONS)
+  {
+    //Captured by reference alone so std::function doesn't allocate
+    thread_pool->ParallelFor(num_stages, [&stages](int stage) { stages.Run(stage); });
+  }
+  else
   {
-    b = UpdatePhysics(out, dt, b, out.collisions);
+    for (int stage = 0; stage < num_stages; stage++) stages.Run(stage);
   }
 
+  state.collisions.Clear();
+}
+
+
+//A ball that bounced this tick, it stays where it is instead of moving
+struct HeldBall
+{
+  int index;
+  vec2 position;
+};
 
-  for (Collision &collision : out.collisions)
+
+//What the read only half of CollideBallsParallel found for a run of balls.
+//Each hit's blocks are num_blocks entries of blocks starting at first_block.
+struct BallHits
+{
+  struct Hit
   {
-    PlayCollisionSound(collision, out);
+    int ball;
+    vec2 normal;
+    int first_block;
+    int num_blocks;
+  };
+
+  std::vector<Hit> hits;
+  std::vector<BlockHandle> blocks;
+};
 
-    std::vector<Particle> new_particles = CreateCollisionParticles(collision);
-    out.particles.insert(out.particles.end(), new_particles.begin(), new_particles.end());
-  }
-  out.collisions.clear();
 
+//The discrete collision step for every ball, in two halves. First each run of
+//BALLS_PER_TASK balls is tested against the blocks on the pool, which only
+//reads the state. Hitting a block only kills it and the tests don't look at
+//whether blocks are alive, so no ball's hits depend on another's. Then the
+//hits are applied on this thread in ball order, which bounces the balls,
+//calls OnHitBlock and adds the Collisions in the same order as the one ball
+//at a time loop, so the results are bit for bit the same.
+void CollideBallsParallel(const Game &game, ThreadPool &pool, GameState &state, float dt, std::vector<HeldBall> &held_balls)
+{
+  const int num_balls = state.balls.size();
+  const int num_tasks = (num_balls + BALLS_PER_TASK - 1) / BALLS_PER_TASK;
+
+  thread_local std::vector<BallHits> task_hits;
+  if (static_cast<int>(task_hits.size()) < num_tasks) task_hits.resize(num_tasks);
+
+  struct Narrowphase
+  {
+    const Game &game;
+    GameState &state;
+    std::vector<BallHits> &task_hits;
+    int num_balls;
+
+    void Run(int task) const
+    {
+      PROFILE_ZONE("narrowphase task");
+
+      thread_local std::vector<BlockHandle> hit_blocks;
+
+      BallHits &out = task_hits[task];
+      out.hits.clear();
+      out.blocks.clear();
+
+      const int end = std::min(num_balls, (task + 1) * BALLS_PER_TASK);
+      for (int i = task * BALLS_PER_TASK; i < end; i++)
+      {
+        vec2 normal{};
+        if (not game.CalculateBallCollision(state, i, normal, hit_blocks)) continue;
+
+        out.hits.push_back({i, normal, static_cast<int>(out.blocks.size()), static_cast<int>(hit_blocks.size())});
+        out.blocks.insert(out.blocks.end(), hit_blocks.begin(), hit_blocks.end());
+      }
+    }
+  };
+
+  //Captured by reference alone so std::function doesn't allocate
+  const Narrowphase narrowphase{game, state, task_hits, num_balls};
+  pool.ParallelFor(num_tasks, [&narrowphase](int task) { narrowphase.Run(task); });
 
-  for (Particle &p : out.particles)
+  thread_local std::vector<BlockHandle> hit_blocks;
+
+  for (int task = 0; task < num_tasks; task++)
   {
-    p = UpdateParticle(p, dt);
+    const BallHits &found = task_hits[task];
+
+    for (const BallHits::Hit &hit : found.hits)
+    {
+      hit_blocks.assign(found.blocks.begin() + hit.first_block,
+        found.blocks.begin() + hit.first_block + hit.num_blocks);
+
+      Ball ball = state.balls.Get(hit.ball);
+      const vec2 moved_position = ball.position + (ball.velocity * dt);
+      game.BounceBall(state, ball, hit.normal, hit_blocks, moved_position, state.collisions);
+
+      state.balls.Set(hit.ball, ball);
+      held_balls.push_back({hit.ball, ball.position});
+    }
   }
+}
 
 
-  auto destroyed_blocks = std::stable_partition(out.blocks.begin(), out.blocks.end(),
-    [](Block &b) { return b.alive; });
+//Steps the state forward where it is. Once the vectors in the state have
+//grown to fit, a frame makes no heap allocations.
+void Game::SimulateInPlace(GameState &state, float dt) const
+{
+  PROFILE_ZONE("Simulate");
+
+  if (state.state == State::pause_menu or state.state == State::main_menu)
+    return;
+
+  state.time += dt;
 
-  for (auto it = destroyed_blocks; it != out.blocks.end(); it++)
   {
-    Block &block = *it;
-    // block.alive = true;
-    for (int i = 0; i < 100; i++)
+    PROFILE_ZONE("physics");
+
+    PrepareBroadphase(state);
+
+    if (collision_mode == CollisionMode::swept)
     {
-      int whichline = RandomInt(-1, block.geometry.size());
-      vec2 pos{0.0f, 0.0f};
-      if (whichline >= 0)
+      for (int i = 0; i < state.balls.size(); i++) SweepBall(state, dt, i, state.collisions);
+    }
+    else
+    {
+      //Same as UpdatePhysics on each ball, but the integration step runs over
+      //all of them at once. Balls that bounce get put back where they were.
+      thread_local std::vector<HeldBall> held_balls;
+      held_balls.clear();
+
+      if (thread_pool and state.balls.size() > BALLS_PER_TASK)
       {
-        const Line &line = block.geometry[whichline];
-        pos = (line.p1 + line.p2) / 2.0f;
+        CollideBallsParallel(*this, *thread_pool, state, dt, held_balls);
       }
       else
       {
-        for (const auto &line : block.geometry)
+        thread_local std::vector<BlockHandle> hit_blocks;
+
+        for (int i = 0; i < state.balls.size(); i++)
         {
-          pos += line.p1 + line.p2;
+          vec2 normal{};
+          if (not CalculateBallCollision(state, i, normal, hit_blocks)) continue;
+
+          //What CollideBall does, but only balls that hit something are
+          //copied out whole
+          Ball ball = state.balls.Get(i);
+          BounceBall(state, ball, normal, hit_blocks, ball.position + (ball.velocity * dt), state.collisions);
+          state.balls.Set(i, ball);
+          held_balls.push_back({i, ball.position});
         }
-        pos /= (block.geometry.size() * 2.0f);
       }
 
-      vec2 vel = {0.0, 0.0f};
-      auto particle = Particle(pos, vel, 4.0f, block.colour, 1.0f);
-      out.particles.push_back(particle);
+      IntegrateBalls(state.balls, dt);
+
+      for (const HeldBall &held : held_balls)
+      {
+        state.balls.x[held.index] = held.position.x;
+        state.balls.y[held.index] = held.position.y;
+        state.balls.UpdateBounds(held.index);
+      }
     }
   }
-  out.blocks.erase(destroyed_blocks, out.blocks.end());
 
 
-  remove_inplace(out.balls, [=](auto &b) { return not b.alive; });
+  {
+    PROFILE_ZONE("collisions");
+    RunCollisionStages(state);
+  }
+
 
+  {
+    PROFILE_ZONE("particles");
 
-  remove_inplace(out.particles, [=](auto &p) { return p.ttl < 0.0f; });
+    UpdateParticles(state.particles, dt);
 
+    //Before the dead blocks add theirs, which are all still alive
+    state.particles.RemoveExpired();
+    RemoveExpiredBursts(state.particle_bursts, state.time);
+  }
 
-  UpdatePaddleVelocity(out.player);
 
-  TRACE << "blocks: " << out.blocks.size() << " balls:" << out.balls.size()
-        << "particles: " << out.particles.size() << "  ";
+  {
+    PROFILE_ZONE("block cleanup");
 
+    thread_local std::vector<int> dead_blocks;
+    dead_blocks.clear();
+
+    //Particles burst out from the middle of each line, and the middle of the block
+    thread_local std::vector<vec2> origins;
+    const vec2 still{0.0f, 0.0f};
+
+    for (int b = 0; b < state.blocks.size(); b++)
+    {
+      const Block &block = state.blocks[b];
+      if (block.alive) continue;
+      dead_blocks.push_back(b);
+
+      const LineRange geometry = block.GetLines(state.lines);
+      // block.alive = true;
+      vec2 centre{0.0f, 0.0f};
+      for (const auto &line : geometry) centre += line.p1 + line.p2;
+
+      //The centre first, bursts only keep the first few
+      origins.clear();
+      origins.push_back(geometry.size() > 0 ? centre / (geometry.size() * 2.0f) : block.position);
+      for (const auto &line : geometry) origins.push_back((line.p1 + line.p2) / 2.0f);
+
+      ParticleEmitter emitter;
+      emitter.origins = origins.data();
+      emitter.num_origins = origins.size();
+      emitter.velocities = &still;
+      emitter.num_velocities = 1;
+      emitter.size = 4.0f;
+      emitter.colour = block.colour;
+
+      AddParticles(state, emitter, 100);
+    }
+    //Highest first, so the block swapped into each hole is always one that is
+    //staying. The broadphases make the same swaps.
+    for (auto b = dead_blocks.rbegin(); b != dead_blocks.rend(); ++b)
+    {
+      state.block_grid.SwapRemoveBlock(state.blocks.items, *b);
+      state.block_tree.SwapRemoveBlock(*b);
+      state.blocks.RemoveAt(*b);
+    }
+
+    if (not dead_blocks.empty()) CompactLinesIfSparse(state);
+  }
+
+
+  state.balls.RemoveDead();
+
+
+  UpdatePaddleVelocity(state.player);
+}
+
+
+GameState Game::Simulate(const GameState &state, float dt) const
+{
+  GameState out = state;
+  SimulateInPlace(out, dt);
   return out;
 }
+
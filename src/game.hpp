@@ -1,40 +1,51 @@
 #pragma once
 
+#include <functional>
 #include <vector>
-#include <map>
+#include <string>
 
 #include "maths_types.hpp"
 
+#include "aabb_tree.hpp"
+#include "balls.hpp"
+#include "event_ring.hpp"
+#include "metrics.hpp"
 #include "particles.hpp"
+#include "random.hpp"
+#include "slot_map.hpp"
+#include "spatial_grid.hpp"
 
+class Game;
+struct GameState;
+class ThreadPool;
 
-struct BoundingBox
-{
-  vec2 top_left;
-  vec2 bottom_right;
-};
 
-
-struct Ball
+//The normal, direction (p2 - p1) and squared length are worked out once when
+//the line is made, so the collision tests don't have to
+struct Line
 {
-  float radius = 10.0f;
-  bool alive = true;
-  vec2 position;
-  vec2 velocity;
-  col4 colour;
-
-  BoundingBox bounds;
+  vec2 p1;
+  vec2 p2;
 
-  Ball(const vec2 &position, const vec2 &velocity);
+  vec2 normal;
+  vec2 direction;
+  float length_sq;
 
-  void UpdateBounds();
+  Line() = default;
+  Line(const vec2 &p1, const vec2 &p2);
 };
 
 
-struct Line
+//A block's lines, a view into GameState::lines
+struct LineRange
 {
-  vec2 p1;
-  vec2 p2;
+  const Line *i1;
+  const Line *i2;
+
+  const Line *begin() const { return i1; }
+  const Line *end() const { return i2; }
+  int size() const { return i2 - i1; }
+  const Line &operator[](int i) const { return i1[i]; }
 };
 
 
@@ -54,9 +65,21 @@ enum class BlockType
 };
 
 
+constexpr int NUM_BLOCK_TYPES = static_cast<int>(BlockType::rect_triangle_right) + 1;
+
+
 using BlockGeometry = std::vector<Line>;
 
 
+//A block type's lines around its position, and the bounds they (and the
+//position itself) take up
+struct BlockShape
+{
+  BlockGeometry lines;
+  BoundingBox bounds;
+};
+
+
 struct Block
 {
   BlockType type = BlockType::none;
@@ -65,14 +88,42 @@ struct Block
   vec2 position;
   col4 colour;
 
-  BlockGeometry geometry;
+  //Where this block's lines are in GameState::lines
+  int first_line = 0;
+  int num_lines = 0;
 
   BoundingBox bounds;
 
-  void UpdateBounds();
+  LineRange GetLines(const std::vector<Line> &lines) const;
+  void UpdateBounds(const std::vector<Line> &lines);
+};
+
+
+//Which of the GameState's blocks a BlockHandle is for. The player's paddle
+//is a single block, its handle's slot isn't used.
+enum class BlockSet : uint8_t
+{
+  blocks,
+  border_lines,
+  player
 };
 
 
+//Finds a block wherever it lives, or nothing once it has been removed (see
+//Game::FindBlock), so it can be kept across frames and threads
+struct BlockHandle
+{
+  SlotHandle slot;
+  BlockSet set = BlockSet::blocks;
+};
+
+
+inline bool operator==(const BlockHandle &a, const BlockHandle &b)
+{
+  return a.slot == b.slot and a.set == b.set;
+}
+
+
 struct Paddle
 {
   Block block;
@@ -94,6 +145,138 @@ struct Collision
   vec2 out_vel;
 
   BlockType block_type;
+
+  BlockHandle block;
+  SlotHandle ball;
+};
+
+
+//Collisions found in a tick wait here for the collision stages. A tick with
+//more than this many keeps the ones the ring's OverflowPolicy says to.
+constexpr int COLLISION_RING_CAPACITY = 1024;
+
+using CollisionRing = EventRing<Collision>;
+using CollisionSpan = EventSpan<Collision>;
+
+
+//Something done with each tick's collisions, like playing their sounds. A
+//stage gets them oldest first, in one or two spans, after the balls have
+//all moved.
+struct CollisionStage
+{
+  std::string name;
+  std::function<void(const Game &game, GameState &state, const CollisionSpan &collisions)> consume;
+};
+
+
+//With a thread pool set, ticks with at least this many collisions run the
+//collision stages at the same time, one per thread
+constexpr int MIN_PARALLEL_COLLISIONS = 256;
+
+
+//Counts of what went through the collision stages, see MakeTelemetryStage
+struct CollisionTelemetry
+{
+  uint64_t num_collisions = 0;
+  uint64_t by_block_type[NUM_BLOCK_TYPES] = {};
+
+  int num_spans = 0;
+  int largest_span = 0;
+};
+
+
+//A stage that adds to telemetry, which has to outlive the Game it is added to
+CollisionStage MakeTelemetryStage(CollisionTelemetry &telemetry);
+
+
+//The game's metrics, in whichever registry they were made in (see
+//metrics.hpp). Found once, then cheap to set every frame.
+struct GameMetrics
+{
+  Gauge &balls;
+  Gauge &blocks;
+  Gauge &particles;
+  Gauge &particle_bursts;
+
+  Counter &collisions;
+  Counter &frames;
+  Counter &ticks;
+
+  Gauge &draw_calls;
+  Histogram &frame_time; //milliseconds
+
+  explicit GameMetrics(MetricsRegistry &registry);
+
+  //The gauges from the state as it is now
+  void SetCounts(const GameState &state);
+};
+
+
+//A stage that counts collisions into metrics, which has to outlive the Game
+//it is added to
+CollisionStage MakeMetricsStage(GameMetrics &metrics);
+
+
+//How CalculateBallCollision finds the blocks near a ball, all of them give
+//the same results
+enum class Broadphase
+{
+  brute_force,
+  grid,
+  aabb_tree
+};
+
+
+//How balls find what they hit. Discrete tests for overlap where the ball is
+//at the start of the tick, swept follows its path through the whole tick so
+//fast balls and big time steps can't tunnel through lines.
+enum class CollisionMode
+{
+  discrete,
+  swept
+};
+
+
+//Where the particles from block deaths, collisions and the paddle go.
+//Simulated ones are added to GameState::particles and stepped every tick,
+//bursts are added to GameState::particle_bursts as one record each and left
+//for the renderer to work out (see ParticleBurst).
+enum class ParticleMode
+{
+  simulated,
+  bursts
+};
+
+
+//Limits for CollisionMode::swept, bounces per ball per tick, and how close
+//together two impacts are to count as one (as a fraction of the step)
+constexpr int MAX_SWEEP_BOUNCES = 8;
+constexpr float SWEEP_TIME_EPSILON = 1e-5f;
+
+
+//With a thread pool set, discrete collisions are tested this many balls to a
+//task. Fewer balls than this are done on the calling thread.
+constexpr int BALLS_PER_TASK = 32;
+
+
+enum class SoundEffect
+{
+  bounce,
+  bounce_hit,
+  paddle_bounce,
+  lost_ball,
+  error,
+  menu_beep,
+  menu_activated
+};
+
+
+//Sounds are not played by the Game, they are queued up in the GameState
+//and the front end (see main.cpp) drains them after each frame
+struct SoundEvent
+{
+  SoundEffect effect;
+  float balance;
 };
 
 
@@ -119,18 +302,35 @@ struct GameState
 
   bool debug_enabled = false;
 
-  std::vector<Ball> balls;
-  std::vector<Block> blocks;
-  std::vector<Block> border_lines;
+  BallStore balls;
+
+  //Lines for the blocks, borders and paddle all live in here. Destroyed
+  //blocks leave theirs behind until Simulate decides to compact it.
+  std::vector<Line> lines;
+
+  SlotMap<Block> blocks;
+  SlotMap<Block> border_lines;
+
+  //Built lazily by Simulate, Clear() them after changing blocks by hand
+  SpatialGrid block_grid;
+  AABBTree block_tree;
 
   float state_timer;
   State state = State::new_level;
 
+  //Seconds simulated, not counting time in the menus
+  double time = 0.0;
+
+  Random rng;
+
   Paddle player;
   vec2 mouse_pointer;
 
-  std::vector<Collision> collisions;
-  std::vector<Particle> particles;
+  CollisionRing collisions{COLLISION_RING_CAPACITY};
+  ParticleStore particles;
+  std::vector<ParticleBurst> particle_bursts;
+
+  std::vector<SoundEvent> sound_events;
 
   int selected_menu_item = -1;
   std::vector<std::string> menu_items;
@@ -141,29 +341,85 @@ struct GameState
 class Game
 {
 private:
-  class Sound &sound;
+  //Indexed by BlockType, types with no shape have no lines
+  std::vector<BlockShape> block_shapes;
 
-  std::map<BlockType, BlockGeometry> block_shapes;
+  //Used by NewGame instead of the random grid when set, see level.hpp
+  std::string level_data;
+
+  Broadphase broadphase = Broadphase::grid;
+  CollisionMode collision_mode = CollisionMode::discrete;
+  ParticleMode particle_mode = ParticleMode::simulated;
+
+  //Not owned, nullptr runs everything on the calling thread
+  ThreadPool *thread_pool = nullptr;
+
+  //Sound and particles to start with
+  std::vector<CollisionStage> collision_stages;
 
 public:
-  Game(Sound &sound);
+  Game();
+
+  void SetBroadphase(Broadphase bp) { broadphase = bp; }
+  Broadphase GetBroadphase() const { return broadphase; }
+
+  void SetCollisionMode(CollisionMode mode) { collision_mode = mode; }
+  CollisionMode GetCollisionMode() const { return collision_mode; }
+
+  void SetParticleMode(ParticleMode mode) { particle_mode = mode; }
+  ParticleMode GetParticleMode() const { return particle_mode; }
+
+  //Spreads the discrete ball collision tests over the pool. The results are
+  //the same as without one, whatever the thread count.
+  void SetThreadPool(ThreadPool *pool) { thread_pool = pool; }
+  ThreadPool *GetThreadPool() const { return thread_pool; }
+
+  //Stages run in the order they were added, or all at once with a thread
+  //pool, so each one must only change its own part of the state (the sound
+  //stage only adds sound_events, the particle stage only particles,
+  //particle_bursts and rng)
+  void AddCollisionStage(const CollisionStage &stage) { collision_stages.push_back(stage); }
+  void ClearCollisionStages() { collision_stages.clear(); }
+  const std::vector<CollisionStage> &GetCollisionStages() const { return collision_stages; }
 
   void SetupBlockGeometry();
-  BlockGeometry MakeGeometry(BlockType bt, const vec2 &offset) const;
+  const BlockShape &GetBlockShape(BlockType bt) const;
+  void AddGeometry(std::vector<Line> &lines, Block &block) const;
+  void MoveGeometry(std::vector<Line> &lines, const Block &block) const;
 
   Ball NewBall(const vec2 &position, const vec2 &velocity) const;
-  Block NewBlock(const vec2 &position, BlockType bt) const;
-  Paddle MakePlayer(const vec2 &position) const;
-  Paddle UpdatePlayer(const Paddle &old, const vec2 &position) const;
+  Block NewBlock(GameState &state, const vec2 &position, BlockType bt) const;
+  Paddle MakePlayer(GameState &state, const vec2 &position) const;
+  void UpdatePlayer(GameState &state, const vec2 &position) const;
+
+  //Everything random in the game comes from GameState::rng, seeded here
+  GameState NewGame(int width, int height, uint64_t seed) const;
 
-  GameState NewGame(int width, int height) const;
+  //New games use these blocks from now on instead of a random grid. Throws
+  //if the level doesn't load.
+  void SetLevel(const std::string &data);
+  void LoadLevelFile(const std::string &filename);
+  void ClearLevel() { level_data.clear(); }
 
+  void ResizeInPlace(GameState &state, int width, int height) const;
   GameState Resize(const GameState &state, int width, int height) const;
 
   void OnHitBlock(Ball &ball, Block &block) const;
 
-  bool CalculateBallCollision(GameState &state, const Ball &old_ball, vec2 &out_normal_vec, std::vector<Block *> &out_hit_blocks) const;
-  Ball UpdatePhysics(GameState &state, float dt, Ball &old_ball, std::vector<Collision> &collisions) const;
+  //nullptr if the block has been removed
+  Block *FindBlock(GameState &state, const BlockHandle &handle) const;
+  const Block *FindBlock(const GameState &state, const BlockHandle &handle) const;
+
+  void PrepareBroadphase(GameState &state) const;
+  bool QueryBroadphase(const GameState &state, const BoundingBox &bounds, std::vector<int> &out_blocks) const;
+  bool CalculateBallCollision(GameState &state, const Ball &old_ball, vec2 &out_normal_vec, std::vector<BlockHandle> &out_hit_blocks) const;
+  //The same for the ball at that index in state.balls, read from its columns
+  bool CalculateBallCollision(GameState &state, int ball, vec2 &out_normal_vec, std::vector<BlockHandle> &out_hit_blocks) const;
+  bool CollideBall(GameState &state, float dt, Ball &ball, CollisionRing &collisions) const;
+  //Moves the ball at that index in state.balls
+  bool SweepBall(GameState &state, float dt, int ball, CollisionRing &collisions) const;
+  void BounceBall(GameState &state, Ball &ball, const vec2 &normal, const std::vector<BlockHandle> &hit_blocks, const vec2 &position, CollisionRing &collisions) const;
+  Ball UpdatePhysics(GameState &state, float dt, Ball &old_ball, CollisionRing &collisions) const;
 
   void ProcessGameInput(GameState &state, const struct Intent &intent) const;
   void ProcessMenuInput(GameState &state, const struct Intent &intent) const;
@@ -172,8 +428,18 @@ public:
   void SetState(GameState &state, State new_state) const;
   void ProcessStateGraph(GameState &state, float dt) const;
 
-  void PlayCollisionSound(const Collision &collision, const GameState &state) const;
-  std::vector<Particle> CreateCollisionParticles(const Collision &collision) const;
+  void PlaySound(GameState &state, SoundEffect effect, float balance) const;
+  void PlayCollisionSound(const Collision &collision, GameState &state) const;
+  void CreateCollisionParticles(const Collision &collision, GameState &state) const;
 
+  //count particles as the particle mode says, simulated or as a burst
+  void AddParticles(GameState &state, const ParticleEmitter &emitter, int count) const;
+
+  //Hands the tick's collisions to every stage, then empties the ring
+  void RunCollisionStages(GameState &state) const;
+
+  //SimulateInPlace steps the state it is given, Simulate steps a copy
+  void SimulateInPlace(GameState &state, float dt) const;
   GameState Simulate(const GameState &state, float dt) const;
 };
+
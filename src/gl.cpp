@@ -3,16 +3,44 @@
 
 #include <cstring>
 #include <iostream>
-#include <map>
-#include <vector>
-
-#include "to_string.hpp"
+#include <stdexcept>
 
 static_assert(sizeof(GLfloat) == sizeof(float), "opengl float wrong size");
 static_assert(sizeof(GLint) == sizeof(int), "opengl int wrong size");
 static_assert(sizeof(GLenum) == sizeof(int), "opengl enum wrong size");
 
 
+std::string ToString(const GLenum &e)
+{
+    switch(e)
+    {
+
+        case GL_DEBUG_SEVERITY_HIGH: return "SEVERITY_HIGH";
+        case GL_DEBUG_SEVERITY_MEDIUM: return "SEVERITY_MEDIUM";
+        case GL_DEBUG_SEVERITY_LOW: return "SEVERITY_LOW";
+        case GL_DEBUG_SEVERITY_NOTIFICATION: return "NOTIFICATION";
+        case GL_DEBUG_TYPE_ERROR: return "ERROR";
+        case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: return "DEPRECATED_BEHAVIOR";
+        case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR: return "UNDEFINED_BEHAVIOR";
+        case GL_DEBUG_TYPE_PORTABILITY: return "PORTABILITY";
+        case GL_DEBUG_TYPE_PERFORMANCE: return "PERFORMANCE";
+        case GL_DEBUG_TYPE_MARKER: return "MARKER";
+        case GL_DEBUG_TYPE_PUSH_GROUP: return "PUSH_GROUP";
+        case GL_DEBUG_TYPE_POP_GROUP: return "POP_GROUP";
+        case GL_DEBUG_TYPE_OTHER: return "OTHER";
+        case GL_DEBUG_SOURCE_API: return "SOURCE_API";
+        case GL_DEBUG_SOURCE_WINDOW_SYSTEM: return "SOURCE_WINDOW_SYSTEM";
+        case GL_DEBUG_SOURCE_SHADER_COMPILER: return "SHADER_COMPILER";
+        case GL_DEBUG_SOURCE_THIRD_PARTY: return "SOURCE_THIRD_PARTY";
+        case GL_DEBUG_SOURCE_APPLICATION: return "SOURCE_APPLICATION";
+        case GL_DEBUG_SOURCE_OTHER: return "SOURCE_OTHER";
+
+        default: return "[ERROR: Unknown GLenum]";
+    }
+}
+
+
+
 namespace GL {
 
 
@@ -93,10 +121,8 @@ std::string GetShaderLog(int shader_id)
   int log_length = GetShaderi(shader_id, GL_INFO_LOG_LENGTH);
   if (log_length == 0) return "";
 
-  std::vector<GLchar> log_data(log_length);
-  glGetShaderInfoLog(shader_id, log_length, nullptr, log_data.data());
-
-  std::string log_str{log_data.begin(), log_data.begin() + log_length};
+  std::string log_str(log_length, '\0');
+  glGetShaderInfoLog(shader_id, log_length, nullptr, &log_str[0]);
 
   return log_str;
 }
@@ -107,10 +133,8 @@ std::string GetProgramLog(int program_id)
   int log_length = GetProgrami(program_id, GL_INFO_LOG_LENGTH);
   if (log_length == 0) return "";
 
-  std::vector<GLchar> log_data(log_length);
-  glGetProgramInfoLog(program_id, log_length, nullptr, log_data.data());
-
-  std::string log_str{log_data.begin(), log_data.begin() + log_length};
+  std::string log_str(log_length, '\0');
+  glGetProgramInfoLog(program_id, log_length, nullptr, &log_str[0]);
 
   return log_str;
 }
@@ -118,10 +142,10 @@ std::string GetProgramLog(int program_id)
 
 int CreateShader(int shader_type, const std::string &shader_source)
 {
-  std::array<const GLchar*,1> source_ptrs {{shader_source.c_str()}};
+  const GLchar *source_ptr = shader_source.c_str();
 
   int shader_id = glCreateShader(shader_type);
-  glShaderSource(shader_id, 1, source_ptrs.data(), nullptr);
+  glShaderSource(shader_id, 1, &source_ptr, nullptr);
   glCompileShader(shader_id);
 
   int status = GetShaderi(shader_id, GL_COMPILE_STATUS);
@@ -5,6 +5,9 @@
 #include <GL/glew.h>
 
 
+std::string ToString(const GLenum &e);
+
+
 namespace GL {
 
 void Debuging(bool enable);
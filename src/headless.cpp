@@ -0,0 +1,521 @@
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+using std::cout;
+using std::endl;
+
+#include "game.hpp"
+#include "input.hpp"
+#include "level.hpp"
+#include "maths.hpp"
+#include "metrics.hpp"
+#include "profiler.hpp"
+#include "thread_pool.hpp"
+#include "to_string.hpp"
+
+
+//Runs the game loop with no window, GL or sound, as fast as it will go, and
+//says where the time went. For finding out how many games (or how big a
+//game) a machine can take.
+//
+//  pong_headless [--ticks N] [--seed N] [--width W] [--height H]
+//                [--columns N] [--rows N] [--level FILE] [--balls N]
+//                [--input random|track|none] [--script FILE]
+//                [--threads N] [--broadphase brute|grid|tree] [--swept]
+//                [--profile FILE] [--metrics FILE|udp:PORT]
+//
+//Each tick is what FixedTimestep and the main loop do to it: the intents go
+//in, then ProcessStateGraph, then Simulate, at a fixed 60 ticks a second.
+//--profile saves a Chrome trace of the run (see profiler.hpp), --metrics
+//exports the game's metrics every second of the run (see metrics.hpp).
+//
+//A script is the intents to send, one per line, with the tick to send it on:
+//
+//  # comments and blank lines are skipped
+//  0 mouse 320 400
+//  1 shoot down
+//  2 shoot up
+//  600 reset_ball
+//
+//The intents are mouse X Y, left/right/shoot down/up, and quit,
+//toggle_debug, new_game, reset_ball, menu, menu_up, menu_down and
+//menu_activate. Ticks past the end of the script get no input.
+
+
+//Printed for --help, and after a bad option
+const char *const HEADLESS_USAGE =
+    "usage: pong_headless [--ticks N] [--seed N] [--width W] [--height H]\n"
+    "                     [--columns N] [--rows N] [--level FILE] [--balls N]\n"
+    "                     [--input random|track|none] [--script FILE]\n"
+    "                     [--threads N] [--broadphase brute|grid|tree] [--swept]\n"
+    "                     [--profile FILE] [--metrics FILE|udp:PORT]\n";
+
+
+using Clock = std::chrono::steady_clock;
+
+
+double SecondsSince(Clock::time_point start)
+{
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+
+struct HeadlessOptions
+{
+  int ticks = 3600;
+  uint64_t seed = 1234;
+
+  int width = 0; //0 fits the block grid
+  int height = 0;
+  int columns = 5;
+  int rows = 3;
+  std::string level_filename;
+
+  int balls = 0; //launched at the start, as well as the player's
+
+  std::string input = "track";
+  std::string script_filename;
+
+  int threads = 0; //0 runs on the calling thread
+  Broadphase broadphase = Broadphase::grid;
+  bool swept = false;
+
+  std::string profile_filename;
+  std::string metrics_target;
+};
+
+
+[[noreturn]] void ScriptError(int line_number, const std::string &what)
+{
+  throw std::runtime_error("Script line " + std::to_string(line_number) + ": " + what);
+}
+
+
+//Every tick's intents, indexed by tick
+std::vector<std::vector<Intent>> LoadScript(const std::string &filename)
+{
+  std::ifstream file(filename);
+  if (not file) throw std::runtime_error("Can't open " + filename);
+
+  const std::pair<const char *, IntentType> commands[] = {
+    {"quit", IntentType::quit},
+    {"toggle_debug", IntentType::toggle_debug},
+    {"new_game", IntentType::new_game},
+    {"reset_ball", IntentType::reset_ball},
+    {"menu", IntentType::menu},
+    {"menu_up", IntentType::menu_up},
+    {"menu_down", IntentType::menu_down},
+    {"menu_activate", IntentType::menu_activate}};
+
+  const std::pair<const char *, PlayerInput> buttons[] = {
+    {"left", PlayerInput::move_left},
+    {"right", PlayerInput::move_right},
+    {"shoot", PlayerInput::shoot}};
+
+  std::vector<std::vector<Intent>> script;
+  std::string text;
+  int line_number = 0;
+
+  while (std::getline(file, text))
+  {
+    line_number++;
+
+    std::istringstream line(text.substr(0, text.find('#')));
+    int tick;
+    std::string name;
+    if (not(line >> tick)) continue;
+    if (tick < 0) ScriptError(line_number, "negative tick");
+    if (not(line >> name)) ScriptError(line_number, "no intent");
+
+    Intent intent{IntentType::player_input, {}, {}};
+    bool found = false;
+
+    for (const auto &command : commands)
+    {
+      if (name == command.first)
+      {
+        intent.type = command.second;
+        found = true;
+      }
+    }
+
+    for (const auto &button : buttons)
+    {
+      if (name == button.first)
+      {
+        std::string state;
+        if (not(line >> state) or not(state == "down" or state == "up")) ScriptError(line_number, name + " needs down or up");
+
+        intent.player_input = button.second;
+        intent.down = (state == "down");
+        found = true;
+      }
+    }
+
+    if (name == "mouse")
+    {
+      intent.player_input = PlayerInput::mouse_position;
+      if (not(line >> intent.position.x >> intent.position.y)) ScriptError(line_number, "mouse needs an x and y");
+      found = true;
+    }
+
+    if (not found) ScriptError(line_number, "unknown intent " + name);
+
+    std::string extra;
+    if (line >> extra) ScriptError(line_number, "unexpected " + extra);
+
+    if (tick >= static_cast<int>(script.size())) script.resize(tick + 1);
+    script[tick].push_back(intent);
+  }
+
+  return script;
+}
+
+
+//Where the built in players put the paddle. Random wanders about and
+//sometimes shoots, track follows the lowest ball and shoots as soon as the
+//ball is on the paddle, so the game keeps going.
+class InputGenerator
+{
+private:
+  std::string mode;
+  Random rng;
+  float target_x = 0.0f;
+
+public:
+  InputGenerator(const std::string &mode, uint64_t seed)
+  : mode(mode)
+  , rng(seed)
+  {
+    if (not(mode == "random" or mode == "track" or mode == "none")) throw std::runtime_error("Unknown input " + mode);
+  }
+
+  void MakeIntents(const GameState &state, std::vector<Intent> &out)
+  {
+    if (mode == "none") return;
+
+    const vec2 paddle = state.player.block.position;
+    float x = paddle.x;
+
+    if (mode == "random")
+    {
+      if (RandomInt(rng, 0, 60) == 0) target_x = RandomFloat(rng, 0.0f, state.width);
+      x += clamp(-8.0f, 8.0f, target_x - paddle.x);
+    }
+    else
+    {
+      float lowest = -1.0f;
+      for (int i = 0; i < state.balls.size(); i++)
+      {
+        const vec2 ball = state.balls.GetPosition(i);
+        if (ball.y > lowest)
+        {
+          lowest = ball.y;
+          x = ball.x;
+        }
+      }
+    }
+
+    Intent move{IntentType::player_input, {PlayerInput::mouse_position}, {}};
+    move.position = {x, paddle.y};
+    out.push_back(move);
+
+    if (state.player.sticky_ball and (mode == "track" or RandomInt(rng, 0, 30) == 0))
+    {
+      Intent shoot{IntentType::player_input, {PlayerInput::shoot}, {}};
+      shoot.down = true;
+      out.push_back(shoot);
+    }
+  }
+};
+
+
+//columns x rows of random blocks, saved as a level so new games get them too
+void SetBlockGrid(Game &game, const HeadlessOptions &options)
+{
+  const BlockType types[] = {BlockType::square, BlockType::triangle_left,
+    BlockType::triangle_right, BlockType::rectangle,
+    BlockType::rect_triangle_left, BlockType::rect_triangle_right};
+
+  GameState scratch;
+  Random rng(options.seed);
+
+  for (int y = 0; y < options.rows; y++)
+  {
+    for (int x = 0; x < options.columns; x++)
+    {
+      vec2 position{50.0f + (110.0f * x), 50.0f + (60.0f * y)};
+      scratch.blocks.Add(game.NewBlock(scratch, position, types[RandomInt(rng, 0, 6)]));
+    }
+  }
+
+  std::ostringstream level;
+  SaveLevelBinary(level, scratch.blocks);
+  game.SetLevel(level.str());
+}
+
+
+GameState MakeHeadlessGame(Game &game, HeadlessOptions &options)
+{
+  if (not options.level_filename.empty())
+    game.LoadLevelFile(options.level_filename);
+  else
+    SetBlockGrid(game, options);
+
+  if (options.width <= 0) options.width = std::max(640, 100 + 110 * options.columns);
+  if (options.height <= 0) options.height = std::max(480, 300 + 60 * options.rows);
+
+  GameState state = game.NewGame(options.width, options.height, options.seed);
+  state.sound_muted = true;
+
+  //Launched upwards from under the blocks
+  for (int i = 0; i < options.balls; i++)
+  {
+    vec2 position{RandomFloat(state.rng, 50.0f, options.width - 50.0f), RandomFloat(state.rng, options.height * 0.6f, options.height - 100.0f)};
+    vec2 velocity = angle_to_vec2(RandomFloat(state.rng, PI * 1.1f, PI * 1.9f), 300.0f);
+    state.balls.Add(Ball(position, velocity, RandomRGB(state.rng)));
+  }
+
+  if (options.balls > 0) state.player.sticky_ball = false;
+
+  return state;
+}
+
+
+struct PhaseTime
+{
+  const char *name;
+  double total = 0.0;
+  double longest = 0.0;
+
+  void Add(double seconds)
+  {
+    total += seconds;
+    longest = std::max(longest, seconds);
+  }
+};
+
+
+void RunHeadless(HeadlessOptions &options)
+{
+  Game game;
+  game.SetBroadphase(options.broadphase);
+  if (options.swept) game.SetCollisionMode(CollisionMode::swept);
+
+  std::unique_ptr<ThreadPool> pool;
+  if (options.threads > 0)
+  {
+    pool = std::make_unique<ThreadPool>(options.threads);
+    game.SetThreadPool(pool.get());
+  }
+
+  GameState state = MakeHeadlessGame(game, options);
+
+  GameMetrics metrics(GetMetrics());
+  game.AddCollisionStage(MakeMetricsStage(metrics));
+
+  std::unique_ptr<MetricsExporter> exporter;
+  if (not options.metrics_target.empty()) exporter = std::make_unique<MetricsExporter>(GetMetrics(), options.metrics_target, 1.0);
+
+  std::vector<std::vector<Intent>> script;
+  if (not options.script_filename.empty()) script = LoadScript(options.script_filename);
+
+  InputGenerator generator(options.script_filename.empty() ? options.input : "none", options.seed + 1);
+
+  const float dt = 1.0f / 60.0f;
+
+  PhaseTime intents_time{"intents"};
+  PhaseTime graph_time{"state graph"};
+  PhaseTime simulate_time{"simulate"};
+
+  int peak_balls = state.balls.size();
+  int peak_particles = state.particles.size();
+  uint64_t peak_collisions = 0;
+  int games_won = 0;
+  int balls_lost = 0;
+
+  std::vector<Intent> intents;
+  int tick = 0;
+
+  if (not options.profile_filename.empty()) Profiler::BeginCapture();
+
+  const auto start = Clock::now();
+  for (; tick < options.ticks and state.running; tick++)
+  {
+    PROFILE_FRAME();
+    const auto tick_start = Clock::now();
+
+    intents.clear();
+    if (tick < static_cast<int>(script.size())) intents = script[tick];
+    generator.MakeIntents(state, intents);
+
+    auto phase_start = Clock::now();
+    game.ProcessIntents(state, intents);
+    intents_time.Add(SecondsSince(phase_start));
+
+    const State before = state.state;
+
+    phase_start = Clock::now();
+    game.ProcessStateGraph(state, dt);
+    graph_time.Add(SecondsSince(phase_start));
+
+    if (state.state != before and state.state == State::game_won) games_won++;
+    if (state.state != before and state.state == State::ball_died) balls_lost++;
+
+    const uint64_t pushed = state.collisions.GetNumPushed();
+
+    phase_start = Clock::now();
+    game.SimulateInPlace(state, dt);
+    simulate_time.Add(SecondsSince(phase_start));
+
+    //Nothing plays them
+    state.sound_events.clear();
+
+    metrics.ticks.Add();
+    metrics.frame_time.Observe(SecondsSince(tick_start) * 1e3);
+    metrics.SetCounts(state);
+
+    peak_balls = std::max(peak_balls, state.balls.size());
+    peak_particles = std::max(peak_particles, state.particles.size());
+    peak_collisions = std::max(peak_collisions, state.collisions.GetNumPushed() - pushed);
+  }
+  const double seconds = SecondsSince(start);
+
+  if (not options.profile_filename.empty())
+  {
+    Profiler::EndCapture();
+    Profiler::SaveChromeTrace(options.profile_filename);
+  }
+
+  cout << "==== pong_headless, " << options.width << "x" << options.height
+       << ", seed " << options.seed << ", " << (options.threads > 0 ? options.threads : 1) << " thread(s)\n"
+       << endl;
+
+  cout << "ticks:            " << tick << " in " << std::setprecision(3) << seconds << std::setprecision(1) << " s, " << tick / seconds << " ticks/s ("
+       << tick / seconds / 60.0 << "x real time)" << endl;
+  cout << "final state:      " << ToString(state.state) << (state.running ? "" : ", quit") << endl;
+  cout << "games won:        " << games_won << endl;
+  cout << "balls lost:       " << balls_lost << endl;
+  cout << "blocks left:      " << state.blocks.size() << endl;
+  cout << "peak balls:       " << peak_balls << endl;
+  cout << "peak particles:   " << peak_particles << endl;
+  cout << "peak collisions:  " << peak_collisions << " in a tick (ring held at most "
+       << state.collisions.GetHighWater() << " of " << state.collisions.GetCapacity() << ", "
+       << state.collisions.GetNumDropped() << " dropped)" << endl;
+
+  cout << "\n"
+       << std::setw(14) << "phase"
+       << std::setw(12) << "total ms"
+       << std::setw(12) << "us/tick"
+       << std::setw(12) << "max us"
+       << std::setw(10) << "share" << endl;
+
+  for (const PhaseTime *phase : {&intents_time, &graph_time, &simulate_time})
+  {
+    cout << std::setw(14) << phase->name
+         << std::setw(12) << phase->total * 1e3
+         << std::setw(12) << phase->total * 1e6 / std::max(tick, 1)
+         << std::setw(12) << phase->longest * 1e6
+         << std::setw(9) << phase->total / seconds * 100.0 << "%" << endl;
+  }
+
+  if (not options.profile_filename.empty())
+  {
+    cout << "\nprofile:          " << options.profile_filename << ", " << Profiler::GetNumEvents() << " zones, "
+         << Profiler::GetNumDropped() << " dropped" << endl;
+  }
+}
+
+
+Broadphase ParseBroadphase(const std::string &name)
+{
+  if (name == "brute") return Broadphase::brute_force;
+  if (name == "grid") return Broadphase::grid;
+  if (name == "tree") return Broadphase::aabb_tree;
+  throw std::runtime_error("Unknown broadphase " + name);
+}
+
+
+int main(int argc, char *argv[])
+{
+  HeadlessOptions options;
+
+  for (int i = 1; i < argc; i++)
+  {
+    const std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+
+    try
+    {
+      if (arg == "--ticks" and has_value)
+        options.ticks = std::stoi(argv[++i]);
+      else if (arg == "--seed" and has_value)
+        options.seed = std::stoull(argv[++i]);
+      else if (arg == "--width" and has_value)
+        options.width = std::stoi(argv[++i]);
+      else if (arg == "--height" and has_value)
+        options.height = std::stoi(argv[++i]);
+      else if (arg == "--columns" and has_value)
+        options.columns = std::stoi(argv[++i]);
+      else if (arg == "--rows" and has_value)
+        options.rows = std::stoi(argv[++i]);
+      else if (arg == "--level" and has_value)
+        options.level_filename = argv[++i];
+      else if (arg == "--balls" and has_value)
+        options.balls = std::stoi(argv[++i]);
+      else if (arg == "--input" and has_value)
+        options.input = argv[++i];
+      else if (arg == "--script" and has_value)
+        options.script_filename = argv[++i];
+      else if (arg == "--threads" and has_value)
+        options.threads = std::stoi(argv[++i]);
+      else if (arg == "--broadphase" and has_value)
+        options.broadphase = ParseBroadphase(argv[++i]);
+      else if (arg == "--swept")
+        options.swept = true;
+      else if (arg == "--profile" and has_value)
+        options.profile_filename = argv[++i];
+      else if (arg == "--metrics" and has_value)
+        options.metrics_target = argv[++i];
+      else if (arg == "--help")
+      {
+        cout << HEADLESS_USAGE;
+        return EXIT_SUCCESS;
+      }
+      else
+      {
+        std::cerr << "Unknown or incomplete option " << arg << "\n\n" << HEADLESS_USAGE;
+        return EXIT_FAILURE;
+      }
+    }
+    catch (const std::exception &e) //std::stoi's invalid_argument and out_of_range, or ParseBroadphase
+    {
+      std::cerr << "Bad value for " << arg << ": " << argv[i] << " (" << e.what() << ")\n\n" << HEADLESS_USAGE;
+      return EXIT_FAILURE;
+    }
+  }
+
+  cout.precision(1);
+  cout << std::fixed;
+
+  try
+  {
+    RunHeadless(options);
+  }
+  catch (const std::exception &e)
+  {
+    std::cerr << "pong_headless: " << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,324 @@
+#include "level.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+
+constexpr char LEVEL_MAGIC[8] = {'P', 'O', 'N', 'G', 'L', 'E', 'V', 'L'};
+
+//x, y, type, r, g, b, a
+constexpr size_t LEVEL_RECORD_SIZE = 4 + 4 + 1 + 4;
+
+//Blocks reserved up front when the stream can't say how much is left in it
+constexpr size_t LEVEL_UNCHECKED_RESERVE = 1 << 16;
+
+
+//Names in text levels, by BlockType. The ones without a name can't be used
+//in a level.
+const char *const BLOCK_TYPE_NAMES[NUM_BLOCK_TYPES] = {
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  "square",
+  "triangle_left",
+  "triangle_right",
+  "rectangle",
+  "rect_triangle_left",
+  "rect_triangle_right"};
+
+
+bool IsLevelBlockType(int type)
+{
+  return type >= 0 and type < NUM_BLOCK_TYPES and BLOCK_TYPE_NAMES[type];
+}
+
+
+void AddLevelBlock(const Game &game, GameState &state, BlockType type, const vec2 &position, const uint8_t rgba[4])
+{
+  Block block;
+  block.type = type;
+  block.position = position;
+  block.colour = {rgba[0] / 255.0f, rgba[1] / 255.0f, rgba[2] / 255.0f, rgba[3] / 255.0f};
+
+  game.AddGeometry(state.lines, block);
+  state.blocks.Add(block);
+}
+
+
+uint8_t ColourByte(float c)
+{
+  return static_cast<uint8_t>(std::lround(std::min(1.0f, std::max(0.0f, c)) * 255.0f));
+}
+
+
+[[noreturn]] void LevelError(int line_number, const std::string &what)
+{
+  throw std::runtime_error("Level line " + std::to_string(line_number) + ": " + what);
+}
+
+
+const char *SkipSpace(const char *p)
+{
+  while (*p and std::isspace(static_cast<unsigned char>(*p))) p++;
+  return p;
+}
+
+
+const char *SkipWord(const char *p)
+{
+  while (*p and not std::isspace(static_cast<unsigned char>(*p))) p++;
+  return p;
+}
+
+
+float ParseFloat(const char *&p, int line_number)
+{
+  char *end = nullptr;
+  const float value = std::strtof(p, &end);
+  if (end == p) LevelError(line_number, "expected a number");
+  if (not std::isfinite(value)) LevelError(line_number, "numbers can't be infinite or nan");
+
+  p = end;
+  return value;
+}
+
+
+int HexDigit(char c)
+{
+  if (c >= '0' and c <= '9') return c - '0';
+  if (c >= 'a' and c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' and c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+
+//#rrggbb or #rrggbbaa
+void ParseColour(const char *&p, int line_number, uint8_t rgba[4])
+{
+  if (*p != '#') LevelError(line_number, "expected a colour like #ff8040");
+  p++;
+
+  const char *end = SkipWord(p);
+  const int digits = end - p;
+  if (digits != 6 and digits != 8) LevelError(line_number, "colours have 6 or 8 hex digits");
+
+  rgba[3] = 255;
+  for (int i = 0; i < digits / 2; i++)
+  {
+    const int high = HexDigit(p[i * 2]);
+    const int low = HexDigit(p[i * 2 + 1]);
+    if (high < 0 or low < 0) LevelError(line_number, "colours have 6 or 8 hex digits");
+
+    rgba[i] = high * 16 + low;
+  }
+
+  p = end;
+}
+
+
+BlockType ParseBlockType(const char *&p, int line_number)
+{
+  const char *end = SkipWord(p);
+  const size_t length = end - p;
+
+  for (int type = 0; type < NUM_BLOCK_TYPES; type++)
+  {
+    const char *name = BLOCK_TYPE_NAMES[type];
+    if (name and std::strlen(name) == length and std::strncmp(name, p, length) == 0)
+    {
+      p = end;
+      return static_cast<BlockType>(type);
+    }
+  }
+
+  LevelError(line_number, "unknown block type '" + std::string(p, length) + "'");
+}
+
+
+int LoadLevelText(const Game &game, std::istream &in, GameState &state)
+{
+  std::string line;
+  int line_number = 0;
+  bool seen_header = false;
+  int num_blocks = 0;
+
+  while (std::getline(in, line))
+  {
+    line_number++;
+
+    const char *p = SkipSpace(line.c_str());
+    if (*p == '\0' or *p == '#') continue;
+
+    if (not seen_header)
+    {
+      const char *end = SkipWord(p);
+      if (std::string(p, end) != "pong_level") LevelError(line_number, "levels start with pong_level");
+
+      char *version_end = nullptr;
+      const long version = std::strtol(end, &version_end, 10);
+      if (version_end == end) LevelError(line_number, "expected a version after pong_level");
+      if (version != static_cast<long>(LEVEL_VERSION)) LevelError(line_number, "unsupported level version " + std::to_string(version));
+
+      seen_header = true;
+      continue;
+    }
+
+    const BlockType type = ParseBlockType(p, line_number);
+    const float x = ParseFloat(p, line_number);
+    const float y = ParseFloat(p, line_number);
+
+    uint8_t rgba[4];
+    p = SkipSpace(p);
+    ParseColour(p, line_number, rgba);
+
+    if (*SkipSpace(p) != '\0') LevelError(line_number, "unexpected text after the colour");
+
+    AddLevelBlock(game, state, type, {x, y}, rgba);
+    num_blocks++;
+  }
+
+  if (not seen_header) throw std::runtime_error("Not a level");
+
+  return num_blocks;
+}
+
+
+int LoadLevelBinary(const Game &game, std::istream &in, GameState &state)
+{
+  char magic[sizeof(LEVEL_MAGIC)];
+  uint32_t version = 0;
+  uint32_t num_blocks = 0;
+
+  in.read(magic, sizeof(magic));
+  in.read(reinterpret_cast<char *>(&version), sizeof(version));
+  in.read(reinterpret_cast<char *>(&num_blocks), sizeof(num_blocks));
+
+  if (not in or std::memcmp(magic, LEVEL_MAGIC, sizeof(magic)) != 0) throw std::runtime_error("Not a level");
+  if (version != LEVEL_VERSION) throw std::runtime_error("Unsupported level version " + std::to_string(version));
+
+  if (num_blocks > static_cast<uint32_t>(std::numeric_limits<int>::max())) throw std::runtime_error("Level has too many blocks");
+
+  //The count is only believed as far as the rest of the stream could hold it,
+  //so a bad one can't make the reserves below ask for gigabytes
+  size_t reserve_blocks = std::min<size_t>(num_blocks, LEVEL_UNCHECKED_RESERVE);
+  const std::streampos start = in.tellg();
+  if (start != std::streampos(-1))
+  {
+    in.seekg(0, std::ios::end);
+    const std::streamoff left = in.tellg() - start;
+    in.seekg(start);
+
+    if (left < static_cast<std::streamoff>(num_blocks * LEVEL_RECORD_SIZE)) throw std::runtime_error("Level is cut short");
+    reserve_blocks = num_blocks;
+  }
+
+  state.blocks.reserve(state.blocks.size() + reserve_blocks);
+  state.lines.reserve(state.lines.size() + reserve_blocks * size_t(4));
+
+  //A chunk of records at a time
+  constexpr uint32_t chunk_size = 1024;
+  char buffer[chunk_size * LEVEL_RECORD_SIZE];
+
+  for (uint32_t done = 0; done < num_blocks;)
+  {
+    const uint32_t count = std::min(chunk_size, num_blocks - done);
+
+    in.read(buffer, count * LEVEL_RECORD_SIZE);
+    if (in.gcount() != static_cast<std::streamsize>(count * LEVEL_RECORD_SIZE)) throw std::runtime_error("Level is cut short");
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+      const char *record = buffer + i * LEVEL_RECORD_SIZE;
+
+      vec2 position;
+      std::memcpy(&position.x, record, 4);
+      std::memcpy(&position.y, record + 4, 4);
+      if (not std::isfinite(position.x) or not std::isfinite(position.y))
+      {
+        throw std::runtime_error("Level block " + std::to_string(done + i) + " isn't at a finite position");
+      }
+
+      const int type = static_cast<uint8_t>(record[8]);
+      if (not IsLevelBlockType(type)) throw std::runtime_error("Level block " + std::to_string(done + i) + " has an unknown type");
+
+      uint8_t rgba[4];
+      std::memcpy(rgba, record + 9, 4);
+
+      AddLevelBlock(game, state, static_cast<BlockType>(type), position, rgba);
+    }
+
+    done += count;
+  }
+
+  return num_blocks;
+}
+
+
+int LoadLevel(const Game &game, std::istream &in, GameState &state)
+{
+  if (in.peek() == LEVEL_MAGIC[0]) return LoadLevelBinary(game, in, state);
+
+  return LoadLevelText(game, in, state);
+}
+
+
+int LevelBlockType(const Block &block)
+{
+  const int type = static_cast<int>(block.type);
+  if (not IsLevelBlockType(type)) throw std::runtime_error("Block type can't be saved in a level");
+
+  return type;
+}
+
+
+void SaveLevelText(std::ostream &out, const SlotMap<Block> &blocks)
+{
+  static const char hex[] = "0123456789abcdef";
+
+  out.precision(std::numeric_limits<float>::max_digits10);
+  out << "pong_level " << LEVEL_VERSION << "\n";
+  out << "# type x y colour\n";
+
+  for (const Block &block : blocks)
+  {
+    const uint8_t rgba[4] = {ColourByte(block.colour.r), ColourByte(block.colour.g), ColourByte(block.colour.b), ColourByte(block.colour.a)};
+
+    out << BLOCK_TYPE_NAMES[LevelBlockType(block)] << " " << block.position.x << " " << block.position.y << " #";
+    for (int i = 0; i < ((rgba[3] == 255) ? 3 : 4); i++)
+    {
+      out << hex[rgba[i] >> 4] << hex[rgba[i] & 15];
+    }
+    out << "\n";
+  }
+}
+
+
+void SaveLevelBinary(std::ostream &out, const SlotMap<Block> &blocks)
+{
+  const uint32_t num_blocks = blocks.size();
+
+  out.write(LEVEL_MAGIC, sizeof(LEVEL_MAGIC));
+  out.write(reinterpret_cast<const char *>(&LEVEL_VERSION), sizeof(LEVEL_VERSION));
+  out.write(reinterpret_cast<const char *>(&num_blocks), sizeof(num_blocks));
+
+  for (const Block &block : blocks)
+  {
+    char record[LEVEL_RECORD_SIZE];
+    std::memcpy(record, &block.position.x, 4);
+    std::memcpy(record + 4, &block.position.y, 4);
+
+    record[8] = static_cast<char>(LevelBlockType(block));
+
+    const uint8_t rgba[4] = {ColourByte(block.colour.r), ColourByte(block.colour.g), ColourByte(block.colour.b), ColourByte(block.colour.a)};
+    std::memcpy(record + 9, rgba, 4);
+
+    out.write(record, sizeof(record));
+  }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+
+#include "game.hpp"
+
+
+//Levels are a list of blocks, each with a position, type and colour. There
+//are two ways of writing one down, both loaded by LoadLevel.
+//
+//Text, for editing by hand:
+//
+//  pong_level 1
+//  # comments and blank lines are skipped
+//  square 50 50 #ff8040
+//  triangle_left 160 50 #20c0ffff
+//
+//  The type is one of square, triangle_left, triangle_right, rectangle,
+//  rect_triangle_left or rect_triangle_right, and the colour is #rrggbb or
+//  #rrggbbaa.
+//
+//Binary, for big levels, little-endian:
+//
+//  "PONGLEVL", version, block count, then per block x, y (floats), type,
+//  r, g, b, a (bytes), packed together with no padding
+
+constexpr uint32_t LEVEL_VERSION = 1;
+
+
+//Builds the level's blocks straight into the state as it reads them, lines,
+//bounds and all, in the order they are in the level. Returns how many there
+//were. Throws on anything it doesn't understand, saying where.
+int LoadLevel(const Game &game, std::istream &in, GameState &state);
+
+
+void SaveLevelText(std::ostream &out, const SlotMap<Block> &blocks);
+void SaveLevelBinary(std::ostream &out, const SlotMap<Block> &blocks);
@@ -1,6 +1,8 @@
 
 #include <ctime>
+#include <fstream>
 #include <iostream>
+#include <memory>
 #include <sstream>
 #include <stdexcept>
 
@@ -25,10 +27,14 @@ constexpr int GL_MINOR{5};
 #include <GLFW/glfw3.h>
 
 
+#include "fixed_timestep.hpp"
 #include "game.hpp"
 #include "input.hpp"
 #include "maths.hpp"
+#include "metrics.hpp"
+#include "profiler.hpp"
 #include "renderer.hpp"
+#include "replay.hpp"
 #include "sound.hpp"
 #include "to_string.hpp"
 
@@ -53,6 +59,7 @@ class Timer
 private:
   int frame_count = 0;
   int last_fps = 0;
+  bool new_second = false;
   float frame_last_time = 1.0f;
   float time_last = 0.0f;
 
@@ -74,7 +81,8 @@ public:
 
     frame_count++;
 
-    if (time_now >= frame_last_time)
+    new_second = (time_now >= frame_last_time);
+    if (new_second)
     {
       last_fps = frame_count;
       frame_last_time += 1.0f;
@@ -85,29 +93,34 @@ public:
   }
 
   int FPS() const { return last_fps; }
+
+  //True for the first frame of each second
+  bool NewSecond() const { return new_second; }
 };
 
 
-void SetTitle(GLFWwindow *window, const Timer &timer, const std::string &msg)
+//Builds a string, so only once a second
+void SetTitle(GLFWwindow *window, const Timer &timer, const GameState &state, const GameMetrics &metrics)
 {
   std::stringstream ss;
-  ss << std::fixed;
-  ss.precision(2);
-  TRACE << std::fixed;
-  TRACE.precision(2);
-
-  ss << "FPS: " << timer.FPS() << "  "; //seconds: " << frame_timer;
 
-  ss << "   " << msg;
+  ss << "FPS: " << timer.FPS() << "     "
+     << "State: " << ToString(state.state) << "  "
+     << "blocks: " << metrics.blocks.Get() << "  balls: " << metrics.balls.Get()
+     << "  particles: " << metrics.particles.Get() << "  bursts: " << metrics.particle_bursts.Get()
+     << "  draw calls: " << metrics.draw_calls.Get();
 
   set_display_title(window, ss.str());
 }
 
 
-void ClearTrace(std::ostringstream &TRACE)
+void PlaySoundEvents(Sound &sound, GameState &state)
 {
-  TRACE.str({});
-  TRACE.clear();
+  for (const SoundEvent &event : state.sound_events)
+  {
+    sound.PlaySound(ToString(event.effect), event.balance);
+  }
+  state.sound_events.clear();
 }
 
 
@@ -136,7 +149,16 @@ public:
 };
 
 
-void main_game()
+struct CommandLine
+{
+  std::string record_filename;
+  std::string level_filename;
+  std::string profile_filename;
+  std::string metrics_target;
+};
+
+
+void main_game(const CommandLine &options)
 {
   std::cout << "Hello, world" << std::endl;
   std::cout.precision(2);
@@ -219,60 +241,118 @@ void main_game()
 
   glfwGetFramebufferSize(window, &width, &height);
 
-  Game game{sound};
-  GameState gamestate = game.NewGame(width, height);
+  Game game;
+  if (not options.level_filename.empty()) game.LoadLevelFile(options.level_filename);
+
+  //The particles are worked out on the GPU, see Shader::Bursts
+  game.SetParticleMode(ParticleMode::bursts);
 
-  game.SetState(gamestate, State::main_menu);
+  GameMetrics metrics(GetMetrics());
+  game.AddCollisionStage(MakeMetricsStage(metrics));
+
+  std::unique_ptr<MetricsExporter> exporter;
+  if (not options.metrics_target.empty())
+  {
+    exporter = std::make_unique<MetricsExporter>(GetMetrics(), options.metrics_target, 1.0);
+    std::cout << "Exporting metrics to " << options.metrics_target << std::endl;
+  }
+
+  const uint64_t seed = time(nullptr);
+  GameState initial_state = game.NewGame(width, height, seed);
+
+  game.SetState(initial_state, State::main_menu);
 
 #if !NDEBUG
   //If in Debug mode, quick start and mute sound
-  game.SetState(gamestate, State::new_level);
-  gamestate.sound_muted = true;
+  game.SetState(initial_state, State::new_level);
+  initial_state.sound_muted = true;
 #endif
 
+  //The game ticks at a steady rate, frames draw somewhere in between ticks
+  FixedTimestep simulation(initial_state);
+
   Input input(window);
 
+  //Everything that goes into the game gets logged, see replay.hpp
+  std::ofstream record_file;
+  std::unique_ptr<ReplayRecorder> recorder;
+  if (not options.record_filename.empty())
+  {
+    record_file.open(options.record_filename, std::ios::binary);
+    if (not record_file) throw std::runtime_error("Couldn't open " + options.record_filename);
+
+    recorder = std::make_unique<ReplayRecorder>(record_file, game, seed, simulation);
+    std::cout << "Recording replay to " << options.record_filename << std::endl;
+  }
+
   TIMELOG.END();
 
+  //The whole session goes in one capture, up to PROFILER_EVENTS_PER_THREAD
+  if (not options.profile_filename.empty()) Profiler::BeginCapture();
+
   // Main Loop
-  while ((not glfwWindowShouldClose(window)) and gamestate.running)
+  while ((not glfwWindowShouldClose(window)) and simulation.Current().running)
   {
+    PROFILE_FRAME();
+
     glfwPollEvents();
 
-    float delta_time = timer.Update();
+    ReplayFrame frame;
+    frame.delta_time = timer.Update();
+    frame.intents = input.GetIntentStream();
+    glfwGetFramebufferSize(window, &frame.width, &frame.height);
 
-    game.ProcessIntents(gamestate, input.GetIntentStream());
+    //Check framebuffer size
+    const bool resized = not(frame.width == simulation.Current().width and frame.height == simulation.Current().height);
 
-    game.ProcessStateGraph(gamestate, delta_time);
+    if (recorder) recorder->RecordFrame(frame, simulation);
 
-    gamestate = game.Simulate(gamestate, delta_time);
+    const long long ticks_before = simulation.GetNumTicks();
+    RunReplayFrame(game, simulation, frame);
 
+    GameState &gamestate = simulation.Current();
 
-    SetTitle(window, timer, TRACE.str());
-    ClearTrace(TRACE);
+    PlaySoundEvents(sound, gamestate);
 
+    metrics.frames.Add();
+    metrics.ticks.Add(simulation.GetNumTicks() - ticks_before);
+    metrics.frame_time.Observe(frame.delta_time * 1000.0);
+    metrics.SetCounts(gamestate);
 
-    //Check framebuffer size
-    glfwGetFramebufferSize(window, &width, &height);
-    if (not(width == gamestate.width and height == gamestate.height))
+    if (timer.NewSecond()) SetTitle(window, timer, gamestate, metrics);
+
+
+    if (resized)
     {
-      renderer.Resize(width, height);
-      gamestate = game.Resize(gamestate, width, height);
+      renderer.Resize(frame.width, frame.height);
       //float ratio = width / (float) height;
-      glViewport(0, 0, width, height);
+      glViewport(0, 0, frame.width, frame.height);
     }
 
     // Render
     glClearColor(0.1, 0.2, 0.3, 1.0);
     glClear(GL_COLOR_BUFFER_BIT);
 
-    renderer.DrawGameState(gamestate);
+    renderer.DrawGameState(gamestate, simulation.Previous(), simulation.GetAlpha());
+    metrics.draw_calls.Set(renderer.GetDrawCalls());
 
-    glfwSwapBuffers(window);
+    {
+      PROFILE_ZONE("glfwSwapBuffers");
+      glfwSwapBuffers(window);
+    }
 
   } // end main loop
 
 
+  if (not options.profile_filename.empty())
+  {
+    Profiler::EndCapture();
+    Profiler::SaveChromeTrace(options.profile_filename);
+    std::cout << "Saved profile to " << options.profile_filename << " (" << Profiler::GetNumEvents() << " zones, "
+              << Profiler::GetNumDropped() << " dropped)" << std::endl;
+  }
+
+
   TIMELOG.BEGIN("Cleanup");
 
   //Clean up
@@ -289,20 +369,33 @@ void main_game()
 
 //#define CATCH_EXCEPTIONS true
 
-int main([[maybe_unused]] int argc, [[maybe_unused]] char *argv[])
+int main(int argc, char *argv[])
 {
+  //pong --record <file> logs the session for replaying later
+  //pong --level <file> plays a level instead of a random grid (see level.hpp)
+  //pong --profile <file> saves a Chrome trace of the session (see profiler.hpp)
+  //pong --metrics <file or udp:port> exports the metrics every second (see metrics.hpp)
+  CommandLine options;
+  for (int i = 1; i < argc; i++)
+  {
+    const std::string arg = argv[i];
+    if (arg == "--record" and i + 1 < argc) options.record_filename = argv[++i];
+    if (arg == "--level" and i + 1 < argc) options.level_filename = argv[++i];
+    if (arg == "--profile" and i + 1 < argc) options.profile_filename = argv[++i];
+    if (arg == "--metrics" and i + 1 < argc) options.metrics_target = argv[++i];
+  }
 
 #if CATCH_EXCEPTIONS
   try
   {
-    main_game();
+    main_game(options);
   }
   catch (std::exception &e)
   {
     std::cout << "std::exception thrown -- " << e.what() << std::endl;
   }
 #else
-  main_game();
+  main_game(options);
 #endif
 
   return EXIT_SUCCESS;
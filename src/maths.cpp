@@ -1,6 +1,7 @@
 
 #include "maths.hpp"
 
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
@@ -248,35 +249,37 @@ float clamp(float min, float max, float val)
 }
 
 
-float RandomFloat()
+float RandomFloat(Random &rng)
 {
-  return static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
+  //Top 24 bits, as many as a float holds
+  return static_cast<float>(rng.Next() >> 8) * (1.0f / 16777216.0f);
 }
 
 
-float RandomFloat(const float r1, const float r2)
+float RandomFloat(Random &rng, const float r1, const float r2)
 {
   const float range = r2 - r1;
-  return (r1 + (RandomFloat() * range));
+  return (r1 + (RandomFloat(rng) * range));
 }
 
 
-int RandomInt(int r1, int r2)
+int RandomInt(Random &rng, int r1, int r2)
 {
-  const int range = r2 - r1;
-  return (r1 + (rand() % range));
+  //Scales instead of taking a remainder, no division needed
+  const uint32_t range = r2 - r1;
+  return (r1 + static_cast<int>((uint64_t{rng.Next()} * range) >> 32));
 }
 
 
-col4 RandomRGB()
+col4 RandomRGB(Random &rng)
 {
-  return {RandomFloat(), RandomFloat(), RandomFloat(), 1.0f};
+  return {RandomFloat(rng), RandomFloat(rng), RandomFloat(rng), 1.0f};
 }
 
 
-col4 RandomRGBA()
+col4 RandomRGBA(Random &rng)
 {
-  return {RandomFloat(), RandomFloat(), RandomFloat(), RandomFloat()};
+  return {RandomFloat(rng), RandomFloat(rng), RandomFloat(rng), RandomFloat(rng)};
 }
 
 
@@ -291,21 +294,66 @@ bool BoundingBoxCollides(const BoundingBox &a, const BoundingBox &b)
 }
 
 
-bool Collides(const Ball &ball, Line const &line)
+bool SegmentCollides(const BoundingBox &box, const vec2 &p1, const vec2 &p2)
 {
-  vec2 collision_point = nearest_point_on_line_segment(line.p1, line.p2, ball.position);
+  //Slab test, clip the segment against the x then y extents of the box
+  float t_min = 0.0f;
+  float t_max = 1.0f;
+
+  const float start[2] = {p1.x, p1.y};
+  const float delta[2] = {p2.x - p1.x, p2.y - p1.y};
+  const float box_min[2] = {box.top_left.x, box.top_left.y};
+  const float box_max[2] = {box.bottom_right.x, box.bottom_right.y};
 
-  float dist = distance(collision_point, ball.position);
+  for (int axis = 0; axis < 2; axis++)
+  {
+    if (delta[axis] == 0.0f)
+    {
+      if (not in_range(box_min[axis], box_max[axis], start[axis])) return false;
+      continue;
+    }
+
+    float t1 = (box_min[axis] - start[axis]) / delta[axis];
+    float t2 = (box_max[axis] - start[axis]) / delta[axis];
+    if (t1 > t2) std::swap(t1, t2);
+
+    t_min = std::max(t_min, t1);
+    t_max = std::min(t_max, t2);
+    if (t_min > t_max) return false;
+  }
 
-  return (dist < ball.radius);
+  return true;
 }
 
 
-bool Collides(const Ball &ball, const Block &block)
+bool CircleCollides(const vec2 &centre, float radius, Line const &line)
+{
+  //nearest_point_on_line_segment, with the direction and length from the line
+  vec2 collision_point = line.p1;
+  if (line.length_sq != 0.0)
+  {
+    float t = dot(centre - line.p1, line.direction) / line.length_sq;
+    t = std::max(0.0f, std::min(1.0f, t));
+    collision_point = line.p1 + line.direction * t;
+  }
+
+  float dist = distance(collision_point, centre);
+
+  return (dist < radius);
+}
+
+
+bool Collides(const Ball &ball, Line const &line)
+{
+  return CircleCollides(ball.position, ball.radius, line);
+}
+
+
+bool Collides(const Ball &ball, const Block &block, const std::vector<Line> &lines)
 {
   if (not BoundingBoxCollides(ball.bounds, block.bounds)) return false;
 
-  for (auto const &line : block.geometry)
+  for (auto const &line : block.GetLines(lines))
   {
     if (Collides(ball, line)) return true;
   }
@@ -313,6 +361,74 @@ bool Collides(const Ball &ball, const Block &block)
 }
 
 
+bool SweepCircleLine(const vec2 &position, const vec2 &motion, float radius, const Line &line, float &out_t, vec2 &out_normal)
+{
+  bool hit = false;
+
+  //Against the face, the line pushed out by the radius towards the circle
+  if (line.length_sq != 0.0f)
+  {
+    const float gap = dot(position - line.p1, line.normal);
+    const float side = (gap >= 0.0f) ? 1.0f : -1.0f;
+    const float closing = -dot(motion, line.normal) * side;
+
+    if (closing > 0.0f)
+    {
+      //Already touching counts as an impact straight away
+      const float t = std::max(0.0f, (gap * side - radius) / closing);
+
+      if (t <= out_t)
+      {
+        const vec2 centre = position + motion * t;
+        const float along = dot(centre - line.p1, line.direction) / line.length_sq;
+
+        if (along >= 0.0f and along <= 1.0f)
+        {
+          out_t = t;
+          out_normal = line.normal * side;
+          hit = true;
+        }
+      }
+    }
+  }
+
+  //Against the end points, solving |position + motion t - end| = radius
+  const float a = dot(motion, motion);
+  if (a == 0.0f) return hit;
+
+  for (const vec2 &end : {line.p1, line.p2})
+  {
+    const vec2 offset = position - end;
+    const float b = dot(offset, motion);
+    const float c = dot(offset, offset) - radius * radius;
+
+    //Moving away from it
+    if (b >= 0.0f) continue;
+
+    float t = 0.0f;
+    if (c > 0.0f)
+    {
+      const float discriminant = b * b - a * c;
+      if (discriminant < 0.0f) continue;
+
+      t = (-b - sqrtf(discriminant)) / a;
+    }
+
+    if (t <= out_t)
+    {
+      const vec2 normal = (position + motion * t) - end;
+      if (dot(normal, normal) == 0.0f) continue;
+
+      out_t = t;
+      out_normal = normalize(normal);
+      hit = true;
+    }
+  }
+
+  return hit;
+}
+
+
 bool Collides(const Ball &b1, const vec2 &point)
 {
   float dist = distance(b1.position, point);
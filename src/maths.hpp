@@ -2,6 +2,7 @@
 #pragma once
 
 #include "maths_types.hpp"
+#include "random.hpp"
 
 #include <math.h>
 
@@ -49,11 +50,11 @@ bool in_range(float beg, float end, float p);
 float clamp(float min, float max, float val);
 
 
-float RandomFloat();
-float RandomFloat(const float r1, const float r2);
-int RandomInt(int r1, int r2);
-col4 RandomRGB();
-col4 RandomRGBA();
+float RandomFloat(Random &rng); //0 to 1
+float RandomFloat(Random &rng, const float r1, const float r2);
+int RandomInt(Random &rng, int r1, int r2); //r1 up to but not including r2
+col4 RandomRGB(Random &rng);
+col4 RandomRGBA(Random &rng);
 
 
 mat4 mat4_identity();
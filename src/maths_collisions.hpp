@@ -4,7 +4,14 @@
 #include "game.hpp"
 
 bool BoundingBoxCollides(const BoundingBox &a, const BoundingBox &b);
+bool SegmentCollides(const BoundingBox &box, const vec2 &p1, const vec2 &p2);
+bool CircleCollides(const vec2 &centre, float radius, Line const &line);
 bool Collides(const Ball &ball, Line const &line);
-bool Collides(const Ball &ball, const Block &block);
+bool Collides(const Ball &ball, const Block &block, const std::vector<Line> &lines);
 bool Collides(const Ball &b1, const vec2 &point);
 bool Collides(const Ball &b1, const Ball &b2);
+
+//Time of impact of a circle moving by motion against a line, as a fraction of
+//motion. Only impacts at or before out_t are reported, so out_t can be passed
+//in as the best found so far. out_normal points from the line to the circle.
+bool SweepCircleLine(const vec2 &position, const vec2 &motion, float radius, const Line &line, float &out_t, vec2 &out_normal);
@@ -35,6 +35,13 @@ struct col4
 };
 
 
+struct BoundingBox
+{
+  vec2 top_left;
+  vec2 bottom_right;
+};
+
+
 struct mat4
 {
   float elements[4][4];
@@ -0,0 +1,327 @@
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <winsock2.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+
+int64_t MetricsNow()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+int GetMetricShard()
+{
+  static std::atomic<int> next_shard{0};
+  thread_local const int shard = next_shard.fetch_add(1, std::memory_order_relaxed) % METRIC_SHARDS;
+  return shard;
+}
+
+
+void *MetricAllocation::operator new(size_t size)
+{
+  //Room to move up to the next slot boundary, with the block's real start
+  //kept just below where the metric goes
+  char *block = static_cast<char *>(::operator new(size + METRIC_SHARD_SIZE + sizeof(void *)));
+
+  const uintptr_t start = reinterpret_cast<uintptr_t>(block) + sizeof(void *);
+  void **aligned = reinterpret_cast<void **>((start + METRIC_SHARD_SIZE - 1) & ~uintptr_t(METRIC_SHARD_SIZE - 1));
+
+  aligned[-1] = block;
+  return aligned;
+}
+
+
+void MetricAllocation::operator delete(void *p)
+{
+  if (p) ::operator delete(static_cast<void **>(p)[-1]);
+}
+
+
+uint64_t Counter::Get() const
+{
+  uint64_t total = 0;
+  for (const Shard &shard : shards) total += shard.value.load(std::memory_order_relaxed);
+  return total;
+}
+
+
+Histogram::Histogram(const std::vector<double> &bounds)
+: bounds(bounds)
+{
+  if (not std::is_sorted(bounds.begin(), bounds.end())) throw std::runtime_error("Histogram bounds have to go up");
+  if (GetNumBuckets() > METRIC_MAX_BUCKETS) throw std::runtime_error("Histogram has too many buckets");
+
+  for (Shard &shard : shards)
+  {
+    for (std::atomic<uint64_t> &count : shard.counts) count.store(0, std::memory_order_relaxed);
+  }
+}
+
+
+void Histogram::Observe(double value)
+{
+  const int bucket = std::lower_bound(bounds.begin(), bounds.end(), value) - bounds.begin();
+
+  Shard &shard = shards[GetMetricShard()];
+  shard.counts[bucket].fetch_add(1, std::memory_order_relaxed);
+
+  //No fetch_add for doubles, but the slot is normally this thread's alone so
+  //it goes through first time
+  double sum = shard.sum.load(std::memory_order_relaxed);
+  while (not shard.sum.compare_exchange_weak(sum, sum + value, std::memory_order_relaxed))
+  {
+  }
+}
+
+
+std::vector<uint64_t> Histogram::GetCounts() const
+{
+  std::vector<uint64_t> out(GetNumBuckets(), 0);
+  for (const Shard &shard : shards)
+  {
+    for (int i = 0; i < GetNumBuckets(); i++) out[i] += shard.counts[i].load(std::memory_order_relaxed);
+  }
+  return out;
+}
+
+
+uint64_t Histogram::GetCount() const
+{
+  uint64_t total = 0;
+  for (uint64_t count : GetCounts()) total += count;
+  return total;
+}
+
+
+double Histogram::GetSum() const
+{
+  double total = 0.0;
+  for (const Shard &shard : shards) total += shard.sum.load(std::memory_order_relaxed);
+  return total;
+}
+
+
+MetricsRegistry::MetricsRegistry()
+: start_time(MetricsNow())
+{
+}
+
+
+//The metric called name in list, made with args if it isn't there yet
+template<typename T, typename... ARGS>
+T &FindOrAddMetric(std::vector<std::pair<std::string, std::unique_ptr<T>>> &list, const std::string &name, const ARGS &... args)
+{
+  for (auto &metric : list)
+  {
+    if (metric.first == name) return *metric.second;
+  }
+
+  list.emplace_back(name, std::make_unique<T>(args...));
+  return *list.back().second;
+}
+
+
+Counter &MetricsRegistry::GetCounter(const std::string &name)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return FindOrAddMetric(counters, name);
+}
+
+
+Gauge &MetricsRegistry::GetGauge(const std::string &name)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return FindOrAddMetric(gauges, name);
+}
+
+
+Histogram &MetricsRegistry::GetHistogram(const std::string &name, const std::vector<double> &bounds)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  Histogram &histogram = FindOrAddMetric(histograms, name, bounds);
+  if (histogram.GetBounds() != bounds) throw std::runtime_error("Histogram " + name + " already has other bounds");
+
+  return histogram;
+}
+
+
+MetricsSnapshot MetricsRegistry::Snapshot() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  MetricsSnapshot out;
+  out.time = (MetricsNow() - start_time) / 1e6;
+
+  for (auto &counter : counters) out.counters.emplace_back(counter.first, counter.second->Get());
+  for (auto &gauge : gauges) out.gauges.emplace_back(gauge.first, gauge.second->Get());
+
+  for (auto &histogram : histograms)
+  {
+    const Histogram &h = *histogram.second;
+    std::vector<uint64_t> counts = h.GetCounts();
+
+    uint64_t count = 0;
+    for (uint64_t c : counts) count += c;
+
+    out.histograms.push_back({histogram.first, h.GetBounds(), counts, count, h.GetSum()});
+  }
+
+  return out;
+}
+
+
+MetricsRegistry &GetMetrics()
+{
+  static MetricsRegistry registry;
+  return registry;
+}
+
+
+void WriteMetricsJson(std::ostream &out, const MetricsSnapshot &snapshot)
+{
+  std::ostringstream line;
+  line << std::setprecision(9);
+
+  line << "{\"time\": " << snapshot.time;
+
+  line << ", \"counters\": {";
+  for (size_t i = 0; i < snapshot.counters.size(); i++)
+  {
+    line << (i ? ", " : "") << '"' << snapshot.counters[i].first << "\": " << snapshot.counters[i].second;
+  }
+
+  line << "}, \"gauges\": {";
+  for (size_t i = 0; i < snapshot.gauges.size(); i++)
+  {
+    line << (i ? ", " : "") << '"' << snapshot.gauges[i].first << "\": " << snapshot.gauges[i].second;
+  }
+
+  line << "}, \"histograms\": {";
+  for (size_t i = 0; i < snapshot.histograms.size(); i++)
+  {
+    const MetricsSnapshot::HistogramValues &h = snapshot.histograms[i];
+    line << (i ? ", " : "") << '"' << h.name << "\": {\"count\": " << h.count << ", \"sum\": " << h.sum << ", \"bounds\": [";
+    for (size_t b = 0; b < h.bounds.size(); b++) line << (b ? ", " : "") << h.bounds[b];
+    line << "], \"counts\": [";
+    for (size_t b = 0; b < h.counts.size(); b++) line << (b ? ", " : "") << h.counts[b];
+    line << "]}";
+  }
+
+  line << "}}\n";
+
+  out << line.str();
+}
+
+
+MetricsExporter::MetricsExporter(const MetricsRegistry &registry, const std::string &target, double interval_seconds)
+: registry(registry)
+, interval(interval_seconds)
+{
+  if (target.compare(0, 4, "udp:") == 0)
+  {
+    port = std::stoi(target.substr(4));
+    if (port <= 0 or port > 65535) throw std::runtime_error("Bad metrics port " + target);
+
+#ifdef _WIN32
+    WSADATA wsa_data;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) throw std::runtime_error("Couldn't start Winsock");
+    const SOCKET s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (s == INVALID_SOCKET) throw std::runtime_error("Couldn't open a socket for " + target);
+#else
+    const int s = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s < 0) throw std::runtime_error("Couldn't open a socket for " + target);
+#endif
+    socket_handle = static_cast<intptr_t>(s);
+  }
+  else
+  {
+    file = std::make_unique<std::ofstream>(target, std::ios::app);
+    if (not *file) throw std::runtime_error("Couldn't open " + target);
+  }
+
+  thread = std::thread([this] { Run(); });
+}
+
+
+MetricsExporter::~MetricsExporter()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_one();
+  thread.join();
+
+  ExportNow();
+
+  if (socket_handle >= 0)
+  {
+#ifdef _WIN32
+    closesocket(static_cast<SOCKET>(socket_handle));
+    WSACleanup();
+#else
+    close(static_cast<int>(socket_handle));
+#endif
+  }
+}
+
+
+void MetricsExporter::Run()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+
+  while (not stopping)
+  {
+    wake.wait_for(lock, std::chrono::duration<double>(interval));
+    if (stopping) break;
+
+    lock.unlock();
+    ExportNow();
+    lock.lock();
+  }
+}
+
+
+void MetricsExporter::ExportNow()
+{
+  std::ostringstream line;
+  WriteMetricsJson(line, registry.Snapshot());
+  const std::string text = line.str();
+
+  //Only the exporter's thread and then the destructor get here, never both
+  if (file)
+  {
+    *file << text;
+    file->flush();
+  }
+  else
+  {
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    //Nobody listening isn't an error, the snapshot is just gone
+#ifdef _WIN32
+    sendto(static_cast<SOCKET>(socket_handle), text.data(), text.size(), 0, reinterpret_cast<const sockaddr *>(&address), sizeof(address));
+#else
+    sendto(static_cast<int>(socket_handle), text.data(), text.size(), 0, reinterpret_cast<const sockaddr *>(&address), sizeof(address));
+#endif
+  }
+}
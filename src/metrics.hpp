@@ -0,0 +1,190 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+//Counters, gauges and histograms that are cheap enough to always leave on.
+//Metrics are made (or found) by name in a MetricsRegistry once, at startup,
+//and kept by reference after that. Updating one is a relaxed atomic on a
+//slot of the calling thread's, reading one adds the slots up, and neither
+//locks or allocates.
+//
+//Threads get a slot each until they run out, then share them, which still
+//adds up right but makes them contend.
+
+constexpr int METRIC_SHARDS = 8;
+
+//Each slot gets a cache line to itself
+constexpr int METRIC_SHARD_SIZE = 64;
+
+//Buckets a Histogram can have, counting the one for values over the last
+//bound. A slot's sum and counts then fill two cache lines exactly.
+constexpr int METRIC_MAX_BUCKETS = 15;
+
+
+//The calling thread's slot
+int GetMetricShard();
+
+
+//C++14's new doesn't know about alignments as big as a slot, so metrics made
+//with it get their memory from here instead, lined up on METRIC_SHARD_SIZE
+struct MetricAllocation
+{
+  static void *operator new(size_t size);
+  static void operator delete(void *p);
+};
+
+
+//Only goes up
+class Counter : public MetricAllocation
+{
+private:
+  struct alignas(METRIC_SHARD_SIZE) Shard
+  {
+    std::atomic<uint64_t> value{0};
+  };
+
+  Shard shards[METRIC_SHARDS];
+
+public:
+  void Add(uint64_t n = 1) { shards[GetMetricShard()].value.fetch_add(n, std::memory_order_relaxed); }
+  uint64_t Get() const;
+};
+
+
+//The last value set, from whichever thread
+class Gauge
+{
+private:
+  std::atomic<double> value{0.0};
+
+public:
+  void Set(double v) { value.store(v, std::memory_order_relaxed); }
+  double Get() const { return value.load(std::memory_order_relaxed); }
+};
+
+
+//Counts of values falling in fixed buckets. Bucket i holds values up to and
+//including bounds[i] (and over bounds[i - 1]), and one more bucket on the end
+//holds everything over the last bound.
+class Histogram : public MetricAllocation
+{
+private:
+  //The counts are in the slot so they're on its cache lines too
+  struct alignas(METRIC_SHARD_SIZE) Shard
+  {
+    std::atomic<double> sum{0.0};
+    std::atomic<uint64_t> counts[METRIC_MAX_BUCKETS];
+  };
+  static_assert(sizeof(Shard) == 2 * METRIC_SHARD_SIZE, "histogram slots should be two whole cache lines");
+
+  std::vector<double> bounds;
+  Shard shards[METRIC_SHARDS];
+
+public:
+  //bounds must go up, and there can be up to METRIC_MAX_BUCKETS - 1 of them
+  explicit Histogram(const std::vector<double> &bounds);
+
+  void Observe(double value);
+
+  const std::vector<double> &GetBounds() const { return bounds; }
+  int GetNumBuckets() const { return bounds.size() + 1; }
+
+  std::vector<uint64_t> GetCounts() const;
+  uint64_t GetCount() const;
+  double GetSum() const;
+};
+
+
+//Everything in a registry at one moment
+struct MetricsSnapshot
+{
+  struct HistogramValues
+  {
+    std::string name;
+    std::vector<double> bounds;
+    std::vector<uint64_t> counts;
+    uint64_t count;
+    double sum;
+  };
+
+  double time = 0.0; //seconds since the registry was made
+  std::vector<std::pair<std::string, uint64_t>> counters;
+  std::vector<std::pair<std::string, double>> gauges;
+  std::vector<HistogramValues> histograms;
+};
+
+
+class MetricsRegistry
+{
+private:
+  mutable std::mutex mutex;
+
+  std::vector<std::pair<std::string, std::unique_ptr<Counter>>> counters;
+  std::vector<std::pair<std::string, std::unique_ptr<Gauge>>> gauges;
+  std::vector<std::pair<std::string, std::unique_ptr<Histogram>>> histograms;
+
+  int64_t start_time;
+
+public:
+  MetricsRegistry();
+
+  //Made the first time they're asked for, the same one after that. These
+  //lock, so don't call them every frame.
+  Counter &GetCounter(const std::string &name);
+  Gauge &GetGauge(const std::string &name);
+
+  //Throws if there is already one by that name with other bounds
+  Histogram &GetHistogram(const std::string &name, const std::vector<double> &bounds);
+
+  MetricsSnapshot Snapshot() const;
+};
+
+
+//The whole program's registry
+MetricsRegistry &GetMetrics();
+
+
+//A snapshot as one line of JSON
+void WriteMetricsJson(std::ostream &out, const MetricsSnapshot &snapshot);
+
+
+//Writes a snapshot of the registry every interval on a thread of its own,
+//and a last one when it is destroyed. The target is a file, which gets a
+//line of JSON per snapshot added to the end, or udp:PORT to send each line
+//as a datagram to that port on 127.0.0.1.
+class MetricsExporter
+{
+private:
+  const MetricsRegistry &registry;
+  double interval;
+
+  std::unique_ptr<std::ostream> file;
+  intptr_t socket_handle = -1;
+  int port = 0;
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool stopping = false;
+  std::thread thread;
+
+  void Run();
+  void ExportNow();
+
+public:
+  //Throws if the target can't be opened
+  MetricsExporter(const MetricsRegistry &registry, const std::string &target, double interval_seconds);
+  ~MetricsExporter();
+
+  MetricsExporter(const MetricsExporter &) = delete;
+  MetricsExporter &operator=(const MetricsExporter &) = delete;
+};
@@ -1,94 +1,368 @@
 
 #include "particles.hpp"
 
+#include <algorithm>
+
 #include "maths.hpp"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 
-float RandomSpread(float spread)
+float RandomSpread(Random &rng, float spread)
 {
-  float accum = RandomFloat(-spread, spread) + RandomFloat(-spread, spread);
+  float accum = RandomFloat(rng, -spread, spread) + RandomFloat(rng, -spread, spread);
   return accum / 2.0f;
 }
 
 
-vec2 RandomVec2(float spread)
+vec2 RandomVec2(Random &rng, float spread)
 {
-  return {RandomSpread(spread), RandomSpread(spread)};
+  return {RandomSpread(rng, spread), RandomSpread(rng, spread)};
 }
 
 
-Particle::Particle(vec2 location, vec2 vel, float size, const col4 &col, float ttl)
+Particle::Particle(Random &rng, vec2 location, vec2 vel, float size, const col4 &col, float ttl)
 : ttl(ttl)
 , size(size)
 , colour(col)
 , position(location)
 , velocity(vel)
 {
-  this->ttl += RandomFloat(-0.2f, 0.3f);
-  this->size += RandomFloat(0.0f, 5.0f);
+  this->ttl += RandomFloat(rng, -0.2f, 0.3f);
+  this->size += RandomFloat(rng, 0.0f, 5.0f);
+
+  position += RandomVec2(rng, 10.0f);
+  rotation = RandomFloat(rng, 0, TWO_PI);
+
+  this->velocity += RandomVec2(rng, 1.0f);
+  rot_vel = RandomSpread(rng, 0.1f);
+}
+
+
+void ParticleStore::reserve(int count)
+{
+  for (auto *vec : {&ttl, &radius, &x, &y, &rotation, &vx, &vy, &rot_vel})
+  {
+    vec->reserve(count);
+  }
+  colour.reserve(count);
+}
+
+
+void ParticleStore::resize(int count)
+{
+  for (auto *vec : {&ttl, &radius, &x, &y, &rotation, &vx, &vy, &rot_vel})
+  {
+    vec->resize(count);
+  }
+  colour.resize(count);
+}
+
+
+bool ParticleStore::Add(const Particle &p)
+{
+  if (size() == PARTICLE_CAPACITY) return false;
+
+  ttl.push_back(p.ttl);
+  radius.push_back(p.size);
+  colour.push_back(p.colour);
+
+  x.push_back(p.position.x);
+  y.push_back(p.position.y);
+  rotation.push_back(p.rotation);
+
+  vx.push_back(p.velocity.x);
+  vy.push_back(p.velocity.y);
+  rot_vel.push_back(p.rot_vel);
+
+  return true;
+}
+
+
+void ParticleStore::RemoveExpired()
+{
+  //Swaps everything first and cuts the columns down once at the end. The
+  //particle moved into a hole gets checked in its turn.
+  int n = size();
+  for (int i = 0; i < n;)
+  {
+    if (ttl[i] >= 0.0f)
+    {
+      i++;
+      continue;
+    }
+
+    n--;
+    for (auto *vec : {&ttl, &radius, &x, &y, &rotation, &vx, &vy, &rot_vel})
+    {
+      (*vec)[i] = (*vec)[n];
+    }
+    colour[i] = colour[n];
+  }
+
+  resize(n);
+}
+
+
+//Particles are emitted this many at a time, so their random numbers stay in
+//cache between being made and used
+constexpr int PARTICLE_EMIT_CHUNK = 256;
+
+//Each emitted particle takes 16 random numbers of 16 bits each, the halves of
+//four pairs of 32 bit ones from Threefry2x32. 16 bits is plenty for jitter a
+//few pixels wide.
+constexpr int EMIT_RANDOM_WORDS = 8;
+
+static_assert(PARTICLE_EMIT_CHUNK % THREEFRY_FILL_WIDTH == 0, "emitted chunks have to be whole Threefry fills");
+
+
+//Which half of which word each one is
+enum EmitRandom
+{
+  emit_ttl,
+  emit_size,
+  emit_x1,
+  emit_x2,
+  emit_y1,
+  emit_y2,
+  emit_rotation,
+  emit_vx1,
+  emit_vx2,
+  emit_vy1,
+  emit_vy2,
+  emit_rot_vel1,
+  emit_rot_vel2,
+  emit_origin,
+  emit_velocity,
+  emit_unused
+};
+
+
+struct EmitBits
+{
+  uint32_t words[EMIT_RANDOM_WORDS][PARTICLE_EMIT_CHUNK];
+
+  uint32_t Get(EmitRandom which, int i) const { return (words[which / 2][i] >> (16 * (which % 2))) & 0xffff; }
+
+  //Like RandomFloat and RandomSpread with 16 bit numbers
+  float Float(EmitRandom which, int i, float r1, float r2) const { return r1 + ((Get(which, i) * (1.0f / 65536.0f)) * (r2 - r1)); }
+  float Spread(EmitRandom first, int i, float spread) const
+  {
+    const EmitRandom second = static_cast<EmitRandom>(first + 1);
+    return (Float(first, i, -spread, spread) + Float(second, i, -spread, spread)) / 2.0f;
+  }
+
+  //Like RandomInt, 0 up to count
+  int Index(EmitRandom which, int i, int count) const { return (Get(which, i) * static_cast<uint32_t>(count)) >> 16; }
+};
+
+
+int EmitParticles(ParticleStore &particles, uint64_t key, const ParticleEmitter &e, int count)
+{
+  count = std::min(count, PARTICLE_CAPACITY - particles.size());
+  if (count <= 0 or e.num_origins <= 0 or e.num_velocities <= 0) return 0;
+
+  const int first = particles.size();
+  particles.resize(first + count);
+
+  EmitBits bits;
+
+  for (int chunk = 0; chunk < count; chunk += PARTICLE_EMIT_CHUNK)
+  {
+    const int n = std::min(PARTICLE_EMIT_CHUNK, count - chunk);
+
+    //Counter is the particle and which pair of words it is. Making a few
+    //spare ones to fill the last vectors is cheaper than the scalar version.
+    const int filled = std::min(PARTICLE_EMIT_CHUNK, (n + THREEFRY_FILL_WIDTH - 1) / THREEFRY_FILL_WIDTH * THREEFRY_FILL_WIDTH);
+    for (int pair = 0; pair < EMIT_RANDOM_WORDS / 2; pair++)
+    {
+      FillThreefry2x32(key, chunk, pair, filled, bits.words[pair * 2], bits.words[pair * 2 + 1]);
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+      const int p = first + chunk + i;
+      const vec2 &origin = e.origins[bits.Index(emit_origin, i, e.num_origins)];
+      const vec2 &velocity = e.velocities[bits.Index(emit_velocity, i, e.num_velocities)];
+
+      particles.ttl[p] = e.ttl + bits.Float(emit_ttl, i, e.min_ttl_jitter, e.max_ttl_jitter);
+      particles.radius[p] = e.size + bits.Float(emit_size, i, 0.0f, e.max_size_jitter);
+      particles.colour[p] = e.colour;
+
+      particles.x[p] = origin.x + bits.Spread(emit_x1, i, e.position_spread);
+      particles.y[p] = origin.y + bits.Spread(emit_y1, i, e.position_spread);
+      particles.rotation[p] = bits.Float(emit_rotation, i, 0.0f, TWO_PI);
 
-  position += RandomVec2(10.0f);
-  rotation = RandomFloat(0, TWO_PI);
+      particles.vx[p] = velocity.x + bits.Spread(emit_vx1, i, e.velocity_spread);
+      particles.vy[p] = velocity.y + bits.Spread(emit_vy1, i, e.velocity_spread);
+      particles.rot_vel[p] = bits.Spread(emit_rot_vel1, i, e.rot_vel_spread);
+    }
+  }
 
-  this->velocity += RandomVec2(1.0f);
-  rot_vel = RandomSpread(0.1f);
+  return count;
 }
 
 
-Particle UpdateParticle(const Particle &p, float dt)
+//Particle velocities are given in pixels (and radians) per 1/60th of a second
+constexpr float PARTICLE_STEP_RATE = 60.0f;
+
+
+//Reference version, the SIMD loops do the same operations in the same order
+void UpdateParticleRange(ParticleStore &particles, int begin, int end, float dt, float steps)
 {
-  Particle out = p;
+  for (int i = begin; i < end; i++)
+  {
+    particles.ttl[i] = particles.ttl[i] - dt;
+    particles.x[i] = particles.x[i] + particles.vx[i] * steps;
+    particles.y[i] = particles.y[i] + particles.vy[i] * steps;
+    particles.rotation[i] = particles.rotation[i] + particles.rot_vel[i] * steps;
+  }
+}
 
-  out.ttl -= dt;
-  out.position += p.velocity;
-  out.rotation += p.rot_vel;
 
-  return out;
+void UpdateParticlesScalar(ParticleStore &particles, float dt)
+{
+  UpdateParticleRange(particles, 0, particles.size(), dt, dt * PARTICLE_STEP_RATE);
 }
 
-constexpr int PARTICLE_VERTEX_SIZE = (3 * (2 + 4));
-#include <cassert>
 
-std::vector<float> MakeParticleVertexes(const Particle &p)
+void UpdateParticles(ParticleStore &particles, float dt)
 {
-  std::vector<float> out;
-  out.reserve(PARTICLE_VERTEX_SIZE);
+  const int n = particles.size();
+  const float steps = dt * PARTICLE_STEP_RATE;
+  int i = 0;
+
+#if defined(__SSE2__)
+  float *ttl = particles.ttl.data();
+  float *x = particles.x.data();
+  float *y = particles.y.data();
+  float *rotation = particles.rotation.data();
+  const float *vx = particles.vx.data();
+  const float *vy = particles.vy.data();
+  const float *rot_vel = particles.rot_vel.data();
 
-  float alpha = p.ttl < 0.8f ? p.ttl / 0.8f : 1.0f;
+  const __m128 age = _mm_set1_ps(dt);
+  const __m128 step = _mm_set1_ps(steps);
 
-  for (int i = 0; i < 3; i++)
+  for (; i + 4 <= n; i += 4)
   {
-    float angle = (i / 3.0f) * TWO_PI;
-    angle += p.rotation;
-    float x = cosf(angle) * p.size;
-    float y = sinf(angle) * p.size;
-
-    out.push_back(x + p.position.x);
-    out.push_back(y + p.position.y);
-    out.push_back(p.colour.r);
-    out.push_back(p.colour.g);
-    out.push_back(p.colour.b);
-    out.push_back(alpha * p.colour.a);
+    _mm_storeu_ps(ttl + i, _mm_sub_ps(_mm_loadu_ps(ttl + i), age));
+    _mm_storeu_ps(x + i, _mm_add_ps(_mm_loadu_ps(x + i), _mm_mul_ps(_mm_loadu_ps(vx + i), step)));
+    _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(_mm_loadu_ps(vy + i), step)));
+    _mm_storeu_ps(rotation + i, _mm_add_ps(_mm_loadu_ps(rotation + i), _mm_mul_ps(_mm_loadu_ps(rot_vel + i), step)));
   }
+#endif
+
+  //Whatever doesn't fill a whole vector
+  UpdateParticleRange(particles, i, n, dt, steps);
+}
+
 
-  assert(out.size() == PARTICLE_VERTEX_SIZE);
+ParticleBurst MakeParticleBurst(uint64_t key, const ParticleEmitter &emitter, int count, float time)
+{
+  ParticleBurst burst{};
+  burst.key[0] = static_cast<uint32_t>(key);
+  burst.key[1] = static_cast<uint32_t>(key >> 32);
+  burst.count = std::min(std::max(count, 0), BURST_MAX_PARTICLES);
+  burst.num_origins = std::min(emitter.num_origins, BURST_MAX_ORIGINS);
+  burst.num_velocities = std::min(emitter.num_velocities, BURST_MAX_VELOCITIES);
 
-  return out;
+  burst.time = time;
+  burst.size = emitter.size;
+  burst.ttl = emitter.ttl;
+  burst.colour = emitter.colour;
+
+  burst.position_spread = emitter.position_spread;
+  burst.velocity_spread = emitter.velocity_spread;
+  burst.rot_vel_spread = emitter.rot_vel_spread;
+  burst.min_ttl_jitter = emitter.min_ttl_jitter;
+  burst.max_ttl_jitter = emitter.max_ttl_jitter;
+  burst.max_size_jitter = emitter.max_size_jitter;
+
+  std::copy(emitter.origins, emitter.origins + burst.num_origins, burst.origins);
+  std::copy(emitter.velocities, emitter.velocities + burst.num_velocities, burst.velocities);
+
+  return burst;
+}
+
+
+ParticleEmitter GetBurstEmitter(const ParticleBurst &burst)
+{
+  ParticleEmitter emitter;
+  emitter.origins = burst.origins;
+  emitter.num_origins = burst.num_origins;
+  emitter.velocities = burst.velocities;
+  emitter.num_velocities = burst.num_velocities;
+
+  emitter.size = burst.size;
+  emitter.colour = burst.colour;
+  emitter.ttl = burst.ttl;
+
+  emitter.position_spread = burst.position_spread;
+  emitter.velocity_spread = burst.velocity_spread;
+  emitter.rot_vel_spread = burst.rot_vel_spread;
+  emitter.min_ttl_jitter = burst.min_ttl_jitter;
+  emitter.max_ttl_jitter = burst.max_ttl_jitter;
+  emitter.max_size_jitter = burst.max_size_jitter;
+
+  return emitter;
 }
 
 
-std::vector<float> MakeParticleVertexes(const std::vector<Particle> &particle_list)
+void EvaluateParticleBurst(ParticleStore &particles, const ParticleBurst &burst, float age)
 {
-  std::vector<float> out;
-  out.reserve(particle_list.size() * PARTICLE_VERTEX_SIZE);
+  const int first = particles.size();
+  const uint64_t key = (uint64_t{burst.key[1]} << 32) | burst.key[0];
+  EmitParticles(particles, key, GetBurstEmitter(burst), burst.count);
 
-  for (const Particle &particle : particle_list)
+  //All of UpdateParticles' steps at once
+  const float steps = age * PARTICLE_STEP_RATE;
+  for (int i = first; i < particles.size(); i++)
   {
-    const auto v_data = MakeParticleVertexes(particle);
-    out.insert(out.end(), v_data.begin(), v_data.end());
+    particles.ttl[i] = particles.ttl[i] - age;
+    particles.x[i] = particles.x[i] + particles.vx[i] * steps;
+    particles.y[i] = particles.y[i] + particles.vy[i] * steps;
+    particles.rotation[i] = particles.rotation[i] + particles.rot_vel[i] * steps;
   }
+}
 
-  assert(out.size() == (particle_list.size() * PARTICLE_VERTEX_SIZE));
 
-  return out;
+void RemoveExpiredBursts(std::vector<ParticleBurst> &bursts, float time)
+{
+  for (size_t i = 0; i < bursts.size();)
+  {
+    if (time - bursts[i].time <= GetBurstLifetime(bursts[i]))
+    {
+      i++;
+      continue;
+    }
+
+    bursts[i] = bursts.back();
+    bursts.pop_back();
+  }
+}
+
+
+void MakeParticleInstances(const ParticleStore &particles, std::vector<float> &out)
+{
+  out.resize(particles.size() * PARTICLE_INSTANCE_SIZE);
+  float *v = out.data();
+
+  for (int p = 0; p < particles.size(); p++)
+  {
+    const float ttl = particles.ttl[p];
+    const float alpha = ttl < 0.8f ? ttl / 0.8f : 1.0f;
+    const col4 &colour = particles.colour[p];
+
+    *v++ = particles.x[p];
+    *v++ = particles.y[p];
+    *v++ = particles.radius[p];
+    *v++ = particles.rotation[p];
+    *v++ = colour.r;
+    *v++ = colour.g;
+    *v++ = colour.b;
+    *v++ = alpha * colour.a;
+  }
 }
@@ -1,11 +1,13 @@
-
 #pragma once
 
+#include <cstdint>
 #include <vector>
 
 #include "maths_types.hpp"
+#include "random.hpp"
 
 
+//One particle, for making them. They are stored in a ParticleStore.
 struct Particle
 {
   float ttl = 0;
@@ -19,12 +21,146 @@ struct Particle
   vec2 velocity;
   float rot_vel = 0;
 
-  Particle(vec2 location, vec2 vel, float size, const col4 &col, float ttl);
+  Particle(Random &rng, vec2 location, vec2 vel, float size, const col4 &col, float ttl);
+};
+
+
+//Particles past this many are dropped as they're added. Explosions in the
+//busiest levels peak at around 50k.
+constexpr int PARTICLE_CAPACITY = 1 << 17;
+
+
+//Structure of arrays storage for the particles, like BallStore, so
+//UpdateParticles can step several at once. The order of the particles isn't
+//kept, expired ones are replaced by the last.
+struct ParticleStore
+{
+  std::vector<float> ttl;
+  std::vector<float> radius; //Particle::size, centre to corner
+  std::vector<col4> colour;
+
+  std::vector<float> x;
+  std::vector<float> y;
+  std::vector<float> rotation;
+
+  std::vector<float> vx;
+  std::vector<float> vy;
+  std::vector<float> rot_vel;
+
+  int size() const { return ttl.size(); }
+  bool empty() const { return ttl.empty(); }
+
+  void clear() { resize(0); }
+  void reserve(int count);
+  void resize(int count);
+
+  //False if it was dropped because the store is full
+  bool Add(const Particle &p);
+
+  vec2 GetPosition(int i) const { return {x[i], y[i]}; }
+
+  //Drops every particle whose ttl has run out, each one's place is taken by
+  //the last particle
+  void RemoveExpired();
+};
+
+
+//A burst of particles. Each one starts at one of the origins and moves at one
+//of the velocities, picked at random, and is then jittered like Particle's
+//constructor does by the spreads below.
+struct ParticleEmitter
+{
+  const vec2 *origins = nullptr;
+  int num_origins = 0;
+  const vec2 *velocities = nullptr;
+  int num_velocities = 0;
+
+  float size = 1.0f;
+  col4 colour;
+  float ttl = 1.0f;
+
+  float position_spread = 10.0f;
+  float velocity_spread = 1.0f;
+  float rot_vel_spread = 0.1f;
+  float min_ttl_jitter = -0.2f;
+  float max_ttl_jitter = 0.3f;
+  float max_size_jitter = 5.0f;
 };
 
 
-Particle UpdateParticle(const Particle &p, float dt);
+//Adds count particles to the end of the store, as many as fit, and returns
+//how many that was. Their random numbers come from Threefry2x32 with key, so
+//the same key makes the same burst.
+int EmitParticles(ParticleStore &particles, uint64_t key, const ParticleEmitter &emitter, int count);
+
+
+//Bursts hold up to this many particles, and are drawn as if they all did
+constexpr int BURST_MAX_PARTICLES = 128;
+constexpr int BURST_MAX_ORIGINS = 6;
+constexpr int BURST_MAX_VELOCITIES = 3;
+
+//Bursts past this many are dropped as they're added
+constexpr int PARTICLE_BURST_CAPACITY = 8192;
+
+
+//An emitter kept as it was when it went off instead of the particles it made.
+//Particles only ever move in straight lines at a steady spin, so where each
+//one is at any age can be worked out from this alone (see
+//EvaluateParticleBurst), which lets the GPU draw them with no per particle
+//work on the CPU (see Shader::Bursts). Laid out to be uploaded as it is.
+struct ParticleBurst
+{
+  uint32_t key[2];
+  int32_t count;
+  int32_t num_origins;
+  int32_t num_velocities;
+
+  float time; //GameState::time when it went off
+  float size;
+  float ttl;
+  col4 colour;
+
+  float position_spread;
+  float velocity_spread;
+  float rot_vel_spread;
+  float min_ttl_jitter;
+  float max_ttl_jitter;
+  float max_size_jitter;
+
+  vec2 origins[BURST_MAX_ORIGINS];
+  vec2 velocities[BURST_MAX_VELOCITIES];
+};
+
+
+//Only the first BURST_MAX_ORIGINS origins and BURST_MAX_VELOCITIES velocities
+//are kept, and at most BURST_MAX_PARTICLES particles
+ParticleBurst MakeParticleBurst(uint64_t key, const ParticleEmitter &emitter, int count, float time);
+
+//Pointing into the burst
+ParticleEmitter GetBurstEmitter(const ParticleBurst &burst);
+
+//Every particle of the burst has run out by this age
+inline float GetBurstLifetime(const ParticleBurst &burst) { return burst.ttl + burst.max_ttl_jitter; }
+
+//Adds every particle of the burst as it is at age, including those that have
+//run out (their ttl is negative). The same sums as the burst shader.
+void EvaluateParticleBurst(ParticleStore &particles, const ParticleBurst &burst, float age);
+
+//Drops the bursts whose particles have all run out by time, each one's place
+//is taken by the last burst
+void RemoveExpiredBursts(std::vector<ParticleBurst> &bursts, float time);
+
+
+//Counts ttl down and moves every particle on by dt, using SSE2 where
+//available. UpdateParticlesScalar gives the same results one at a time.
+void UpdateParticles(ParticleStore &particles, float dt);
+void UpdateParticlesScalar(ParticleStore &particles, float dt);
+
 
-std::vector<float> MakeParticleVertexes(const Particle &p);
+//What Shader::Particles needs of each particle, x, y, radius, rotation and
+//then the colour with the alpha already faded out for the ttl
+constexpr int PARTICLE_INSTANCE_SIZE = 8;
 
-std::vector<float> MakeParticleVertexes(const std::vector<Particle> &particle_list);
+//Fills out with every particle's instance, out keeps its memory between
+//calls so this only allocates when the particles outgrow it
+void MakeParticleInstances(const ParticleStore &particles, std::vector<float> &out);
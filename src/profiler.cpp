@@ -0,0 +1,184 @@
+#include "profiler.hpp"
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+
+std::atomic<bool> Profiler::capturing{false};
+
+
+//Only its own thread writes to it. The count is stored with release after
+//each event, so whoever writes the trace out only sees whole events.
+struct ProfileThreadBuffer
+{
+  int thread_id = 0;
+  std::unique_ptr<ProfileEvent[]> events{new ProfileEvent[PROFILER_EVENTS_PER_THREAD]};
+  std::atomic<int> count{0};
+  std::atomic<int> dropped{0};
+};
+
+
+//A thread gets its buffer the first time it records something, and it stays
+//here after the thread has gone so it can still be written out
+std::mutex profile_buffers_mutex;
+std::vector<std::unique_ptr<ProfileThreadBuffer>> profile_buffers;
+
+int64_t profile_capture_start = 0;
+
+
+ProfileThreadBuffer &GetProfileThreadBuffer()
+{
+  thread_local ProfileThreadBuffer *buffer = nullptr;
+
+  if (not buffer)
+  {
+    std::lock_guard<std::mutex> lock(profile_buffers_mutex);
+    profile_buffers.push_back(std::make_unique<ProfileThreadBuffer>());
+    buffer = profile_buffers.back().get();
+    buffer->thread_id = profile_buffers.size() - 1;
+  }
+
+  return *buffer;
+}
+
+
+int64_t Profiler::Now()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+void Profiler::Record(const char *name, int64_t start, int64_t duration)
+{
+  ProfileThreadBuffer &buffer = GetProfileThreadBuffer();
+
+  const int i = buffer.count.load(std::memory_order_relaxed);
+  if (i == PROFILER_EVENTS_PER_THREAD)
+  {
+    buffer.dropped.store(buffer.dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    return;
+  }
+
+  buffer.events[i] = {name, start, duration};
+  buffer.count.store(i + 1, std::memory_order_release);
+}
+
+
+void Profiler::BeginCapture()
+{
+  std::lock_guard<std::mutex> lock(profile_buffers_mutex);
+
+  for (auto &buffer : profile_buffers)
+  {
+    buffer->count.store(0, std::memory_order_relaxed);
+    buffer->dropped.store(0, std::memory_order_relaxed);
+  }
+
+  profile_capture_start = Now();
+  capturing.store(true, std::memory_order_release);
+}
+
+
+void Profiler::EndCapture()
+{
+  capturing.store(false, std::memory_order_release);
+}
+
+
+void Profiler::MarkFrame()
+{
+  if (IsCapturing()) Record("frame", Now(), -1);
+}
+
+
+int Profiler::GetNumEvents()
+{
+  std::lock_guard<std::mutex> lock(profile_buffers_mutex);
+
+  int total = 0;
+  for (auto &buffer : profile_buffers) total += buffer->count.load(std::memory_order_acquire);
+  return total;
+}
+
+
+int Profiler::GetNumDropped()
+{
+  std::lock_guard<std::mutex> lock(profile_buffers_mutex);
+
+  int total = 0;
+  for (auto &buffer : profile_buffers) total += buffer->dropped.load(std::memory_order_relaxed);
+  return total;
+}
+
+
+void WriteJsonString(std::ostream &out, const char *str)
+{
+  out << '"';
+  for (; *str; str++)
+  {
+    if (*str == '"' or *str == '\\') out << '\\';
+    out << *str;
+  }
+  out << '"';
+}
+
+
+void Profiler::WriteChromeTrace(std::ostream &out)
+{
+  std::lock_guard<std::mutex> lock(profile_buffers_mutex);
+
+  const auto flags = out.flags();
+  const auto precision = out.precision();
+  out << std::fixed << std::setprecision(3);
+
+  //Times are in microseconds from the start of the capture
+  auto micros = [](int64_t ns) { return (ns - profile_capture_start) / 1000.0; };
+
+  out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+
+  bool first = true;
+  for (auto &buffer : profile_buffers)
+  {
+    const int count = buffer->count.load(std::memory_order_acquire);
+    if (count == 0) continue;
+
+    out << (first ? "" : ",\n")
+        << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer->thread_id
+        << ", \"args\": {\"name\": \"thread " << buffer->thread_id << "\"}}";
+    first = false;
+
+    for (int i = 0; i < count; i++)
+    {
+      const ProfileEvent &event = buffer->events[i];
+
+      out << ",\n{\"name\": ";
+      WriteJsonString(out, event.name);
+
+      if (event.duration < 0)
+        out << ", \"ph\": \"i\", \"s\": \"g\"";
+      else
+        out << ", \"ph\": \"X\", \"dur\": " << event.duration / 1000.0;
+
+      out << ", \"pid\": 1, \"tid\": " << buffer->thread_id << ", \"ts\": " << micros(event.start) << "}";
+    }
+  }
+
+  out << "\n]}\n";
+
+  out.flags(flags);
+  out.precision(precision);
+}
+
+
+void Profiler::SaveChromeTrace(const std::string &filename)
+{
+  std::ofstream file(filename);
+  if (not file) throw std::runtime_error("Couldn't open " + filename);
+
+  WriteChromeTrace(file);
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+
+//A frame profiler. PROFILE_ZONE("name") times from where it is to the end of
+//the scope, zones inside it show up nested under it. Nothing is recorded
+//until a capture is started, and then each thread writes its zones to its
+//own buffer, so there is no locking while a capture runs. A capture is saved
+//as Chrome trace-event JSON, for chrome://tracing or ui.perfetto.dev.
+//
+//Building with PROFILER off (see CMakeLists.txt) turns the macros into
+//nothing at all.
+//
+//Names have to be string literals, or otherwise live until the capture is
+//written out, only the pointer is kept.
+
+#ifndef PROFILER
+#define PROFILER 0
+#endif
+
+//Zones past this many in a capture are dropped, per thread
+constexpr int PROFILER_EVENTS_PER_THREAD = 1 << 17;
+
+
+struct ProfileEvent
+{
+  const char *name;
+  int64_t start; //nanoseconds, steady clock
+  int64_t duration; //-1 for a frame marker
+};
+
+
+namespace Profiler
+{
+  extern std::atomic<bool> capturing;
+
+  int64_t Now();
+  void Record(const char *name, int64_t start, int64_t duration);
+
+  //Starting throws away the last capture. Both should be called between
+  //frames, with nothing else running zones.
+  void BeginCapture();
+  void EndCapture();
+  inline bool IsCapturing() { return capturing.load(std::memory_order_relaxed); }
+
+  //Where one frame ends and the next starts
+  void MarkFrame();
+
+  //In the capture so far, over every thread
+  int GetNumEvents();
+  int GetNumDropped();
+
+  void WriteChromeTrace(std::ostream &out);
+  void SaveChromeTrace(const std::string &filename);
+}
+
+
+class ProfileZone
+{
+private:
+  const char *name;
+  int64_t start;
+
+public:
+  explicit ProfileZone(const char *name)
+  : name(name)
+  , start(Profiler::IsCapturing() ? Profiler::Now() : -1)
+  {
+  }
+
+  ~ProfileZone()
+  {
+    if (start >= 0) Profiler::Record(name, start, Profiler::Now() - start);
+  }
+
+  ProfileZone(const ProfileZone &) = delete;
+  ProfileZone &operator=(const ProfileZone &) = delete;
+};
+
+
+#if PROFILER
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+#define PROFILE_FRAME() Profiler::MarkFrame()
+#else
+#define PROFILE_ZONE(name) static_cast<void>(0)
+#define PROFILE_FRAME() static_cast<void>(0)
+#endif
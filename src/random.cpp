@@ -0,0 +1,141 @@
+#include "random.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+void Random::Seed(uint64_t seed)
+{
+  //splitmix64 spreads any seed, even 0, over the whole state
+  for (uint32_t &word : s)
+  {
+    seed += 0x9e3779b97f4a7c15;
+    uint64_t z = seed;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    word = static_cast<uint32_t>((z ^ (z >> 31)) >> 32);
+  }
+}
+
+
+constexpr int THREEFRY_ROUNDS = 20;
+constexpr int THREEFRY_ROTATIONS[8] = {13, 15, 26, 6, 17, 29, 16, 24};
+constexpr uint32_t THREEFRY_PARITY = 0x1BD11BDA;
+
+
+void Threefry2x32(uint64_t key, uint32_t counter0, uint32_t counter1, uint32_t &out0, uint32_t &out1)
+{
+  const uint32_t ks[3] = {static_cast<uint32_t>(key), static_cast<uint32_t>(key >> 32),
+    THREEFRY_PARITY ^ static_cast<uint32_t>(key) ^ static_cast<uint32_t>(key >> 32)};
+
+  uint32_t x0 = counter0 + ks[0];
+  uint32_t x1 = counter1 + ks[1];
+
+  for (int round = 0; round < THREEFRY_ROUNDS; round++)
+  {
+    x0 += x1;
+    x1 = Random::Rotl(x1, THREEFRY_ROTATIONS[round % 8]);
+    x1 ^= x0;
+
+    //The key goes back in every four rounds
+    if (round % 4 == 3)
+    {
+      const int s = (round + 1) / 4;
+      x0 += ks[s % 3];
+      x1 += ks[(s + 1) % 3] + s;
+    }
+  }
+
+  out0 = x0;
+  out1 = x1;
+}
+
+
+void FillThreefry2x32Scalar(uint64_t key, uint32_t first, uint32_t counter1, int count, uint32_t *out0, uint32_t *out1)
+{
+  for (int i = 0; i < count; i++) Threefry2x32(key, first + i, counter1, out0[i], out1[i]);
+}
+
+
+#if defined(__SSE2__)
+
+//Vectors of four counters run at once, so each one's rounds fill the gaps
+//while the others wait on theirs
+constexpr int THREEFRY_VECTORS = 4;
+
+
+template<int R>
+void ThreefryRound(__m128i (&x0)[THREEFRY_VECTORS], __m128i (&x1)[THREEFRY_VECTORS])
+{
+  for (int v = 0; v < THREEFRY_VECTORS; v++)
+  {
+    x0[v] = _mm_add_epi32(x0[v], x1[v]);
+    x1[v] = _mm_or_si128(_mm_slli_epi32(x1[v], R), _mm_srli_epi32(x1[v], 32 - R));
+    x1[v] = _mm_xor_si128(x1[v], x0[v]);
+  }
+}
+
+
+//Four rounds and then the key goes back in, as the s'th injection
+template<int R0, int R1, int R2, int R3>
+void ThreefryRounds(__m128i (&x0)[THREEFRY_VECTORS], __m128i (&x1)[THREEFRY_VECTORS], const __m128i (&ks)[3], int s)
+{
+  ThreefryRound<R0>(x0, x1);
+  ThreefryRound<R1>(x0, x1);
+  ThreefryRound<R2>(x0, x1);
+  ThreefryRound<R3>(x0, x1);
+
+  const __m128i k0 = ks[s % 3];
+  const __m128i k1 = _mm_add_epi32(ks[(s + 1) % 3], _mm_set1_epi32(s));
+  for (int v = 0; v < THREEFRY_VECTORS; v++)
+  {
+    x0[v] = _mm_add_epi32(x0[v], k0);
+    x1[v] = _mm_add_epi32(x1[v], k1);
+  }
+}
+
+#endif
+
+
+void FillThreefry2x32(uint64_t key, uint32_t first, uint32_t counter1, int count, uint32_t *out0, uint32_t *out1)
+{
+  int i = 0;
+
+#if defined(__SSE2__)
+  static_assert(THREEFRY_ROUNDS == 20, "the rounds are written out below");
+  static_assert(4 * THREEFRY_VECTORS == THREEFRY_FILL_WIDTH, "THREEFRY_FILL_WIDTH is out of date");
+
+  const uint32_t k0 = static_cast<uint32_t>(key);
+  const uint32_t k1 = static_cast<uint32_t>(key >> 32);
+  const __m128i ks[3] = {_mm_set1_epi32(k0), _mm_set1_epi32(k1), _mm_set1_epi32(THREEFRY_PARITY ^ k0 ^ k1)};
+  const __m128i start1 = _mm_add_epi32(_mm_set1_epi32(counter1), ks[1]);
+
+  for (; i + THREEFRY_FILL_WIDTH <= count; i += THREEFRY_FILL_WIDTH)
+  {
+    __m128i x0[THREEFRY_VECTORS];
+    __m128i x1[THREEFRY_VECTORS];
+    for (int v = 0; v < THREEFRY_VECTORS; v++)
+    {
+      const uint32_t c = first + i + v * 4;
+      x0[v] = _mm_add_epi32(_mm_set_epi32(c + 3, c + 2, c + 1, c), ks[0]);
+      x1[v] = start1;
+    }
+
+    ThreefryRounds<13, 15, 26, 6>(x0, x1, ks, 1);
+    ThreefryRounds<17, 29, 16, 24>(x0, x1, ks, 2);
+    ThreefryRounds<13, 15, 26, 6>(x0, x1, ks, 3);
+    ThreefryRounds<17, 29, 16, 24>(x0, x1, ks, 4);
+    ThreefryRounds<13, 15, 26, 6>(x0, x1, ks, 5);
+
+    for (int v = 0; v < THREEFRY_VECTORS; v++)
+    {
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(out0 + i + v * 4), x0[v]);
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(out1 + i + v * 4), x1[v]);
+    }
+  }
+#endif
+
+  //Whatever doesn't fill all the vectors
+  FillThreefry2x32Scalar(key, first + i, counter1, count - i, out0 + i, out1 + i);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+
+
+//xoshiro128** (Blackman and Vigna), a small and fast generator. Each GameState
+//has its own, seeded by NewGame, so a game can be played back exactly from its
+//seed and separate games can run on separate threads.
+struct Random
+{
+  uint32_t s[4];
+
+  explicit Random(uint64_t seed = 0) { Seed(seed); }
+
+  void Seed(uint64_t seed);
+
+  uint32_t Next()
+  {
+    const uint32_t result = Rotl(s[1] * 5, 7) * 9;
+    const uint32_t t = s[1] << 9;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = Rotl(s[3], 11);
+
+    return result;
+  }
+
+  uint64_t Next64() { return (uint64_t{Next()} << 32) | Next(); }
+
+  static uint32_t Rotl(uint32_t x, int k) { return (x << k) | (x >> (32 - k)); }
+};
+
+
+//Threefry-2x32 with 20 rounds (Salmon et al., "Parallel Random Numbers: As
+//Easy as 1, 2, 3"). Counter based: each pair of numbers is a hash of a key
+//and a counter, so any of them can be made without making the ones before,
+//in any order, or many at once.
+void Threefry2x32(uint64_t key, uint32_t counter0, uint32_t counter1, uint32_t &out0, uint32_t &out1);
+
+//The pairs for counters {first + i, counter1}, i up to count. With SSE2 they
+//are made THREEFRY_FILL_WIDTH at a time and any left over one at a time, so
+//counts that are a multiple of it are quickest. The Scalar version gives the
+//same numbers.
+constexpr int THREEFRY_FILL_WIDTH = 16;
+
+void FillThreefry2x32(uint64_t key, uint32_t first, uint32_t counter1, int count, uint32_t *out0, uint32_t *out1);
+void FillThreefry2x32Scalar(uint64_t key, uint32_t first, uint32_t counter1, int count, uint32_t *out0, uint32_t *out1);
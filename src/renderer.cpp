@@ -1,11 +1,17 @@
 
 #include "renderer.hpp"
 
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
 #include <vector>
 
+#include "fixed_timestep.hpp"
 #include "game.hpp"
 #include "gl.hpp"
 #include "maths.hpp"
+#include "profiler.hpp"
 #include "to_string.hpp"
 
 
@@ -83,6 +89,8 @@ void VertexData::AddVertex(const vec2 &position, const col4 &colour)
 
 void VertexData::UpdateVertexes()
 {
+  PROFILE_ZONE("upload vertexes");
+
 #if OLD_OPENGL
   glBindBuffer(GL_ARRAY_BUFFER, buffer_id);
   glBufferData(GL_ARRAY_BUFFER, sizeof(float) * vertex_data.size(), vertex_data.data(), usage);
@@ -111,6 +119,12 @@ int VertexData::GetVAO() const
 }
 
 
+int VertexData::GetBuffer() const
+{
+  return buffer_id;
+}
+
+
 void VertexData::AttachAttribute(int attrib_id, int size, int offset, GLenum type)
 {
 #if OLD_OPENGL
@@ -143,6 +157,266 @@ void VertexData::DetachAttribute(int attrib_id)
 }
 
 
+ShapeInstances::ShapeInstances(const VertexData &shapes)
+{
+  buffer_id = GL::CreateBuffers();
+  vao_id = GL::CreateVertexArrays();
+
+  //The shapes' vertexes are laid out as in VertexData
+  const int shape_stride = (2 + 4) * sizeof(float);
+
+#if OLD_OPENGL
+  glBindVertexArray(vao_id);
+  glBindBuffer(GL_ARRAY_BUFFER, shapes.GetBuffer());
+  glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, shape_stride, nullptr);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, shape_stride, reinterpret_cast<GLvoid *>(2 * sizeof(float)));
+  glEnableVertexAttribArray(1);
+
+  AttachInstanceAttributes(0);
+  glVertexAttribDivisor(2, 1);
+  glEnableVertexAttribArray(2);
+  glVertexAttribDivisor(3, 1);
+  glEnableVertexAttribArray(3);
+
+  glBindVertexArray(0);
+#else
+  constexpr int shape_index = 0;
+  constexpr int instance_index = 1;
+  glVertexArrayVertexBuffer(vao_id, shape_index, shapes.GetBuffer(), 0, shape_stride);
+  AttachInstanceAttributes(0);
+  glVertexArrayBindingDivisor(vao_id, instance_index, 1);
+
+  //The locations in Shader::Shapes, vertex position and colour then the
+  //instance's placement and colour
+  const int bindings[] = {shape_index, shape_index, instance_index, instance_index};
+  const int sizes[] = {2, 4, 3, 4};
+  const int offsets[] = {0, 2, 0, 3};
+  for (int attrib_id = 0; attrib_id < 4; attrib_id++)
+  {
+    glEnableVertexArrayAttrib(vao_id, attrib_id);
+    glVertexArrayAttribFormat(vao_id, attrib_id, sizes[attrib_id], GL_FLOAT, GL_FALSE, offsets[attrib_id] * sizeof(float));
+    glVertexArrayAttribBinding(vao_id, attrib_id, bindings[attrib_id]);
+  }
+#endif
+}
+
+
+ShapeInstances::~ShapeInstances()
+{
+  GL::DeleteBuffers(buffer_id);
+
+  glBindVertexArray(0);
+  GL::DeleteVertexArrays(vao_id);
+}
+
+
+//With the VAO bound for OLD_OPENGL
+void ShapeInstances::AttachInstanceAttributes(int first)
+{
+  const size_t offset = size_t(first) * stride;
+
+#if OLD_OPENGL
+  glBindBuffer(GL_ARRAY_BUFFER, buffer_id);
+  glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, reinterpret_cast<GLvoid *>(offset));
+  glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, stride, reinterpret_cast<GLvoid *>(offset + 3 * sizeof(float)));
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+#else
+  constexpr int instance_index = 1;
+  glVertexArrayVertexBuffer(vao_id, instance_index, buffer_id, offset, stride);
+#endif
+}
+
+
+void ShapeInstances::Resize(int count)
+{
+  instances.resize(count * floats_per_instance);
+}
+
+
+void ShapeInstances::Set(int i, const vec2 &offset, float zoom, const col4 &colour)
+{
+  float *v = instances.data() + i * floats_per_instance;
+
+  v[0] = offset.x;
+  v[1] = offset.y;
+  v[2] = zoom;
+  v[3] = colour.r;
+  v[4] = colour.g;
+  v[5] = colour.b;
+  v[6] = colour.a;
+}
+
+
+void ShapeInstances::Update()
+{
+  PROFILE_ZONE("upload instances");
+
+#if OLD_OPENGL
+  glBindBuffer(GL_ARRAY_BUFFER, buffer_id);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(float) * instances.size(), instances.data(), GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+#else
+  glNamedBufferData(buffer_id, sizeof(float) * instances.size(), instances.data(), GL_DYNAMIC_DRAW);
+#endif
+}
+
+
+void ShapeInstances::SetFirstInstance(int first)
+{
+  AttachInstanceAttributes(first);
+}
+
+
+ParticleData::ParticleData()
+{
+  buffer_id = GL::CreateBuffers();
+  vao_id = GL::CreateVertexArrays();
+
+  const int stride = PARTICLE_INSTANCE_SIZE * sizeof(float);
+
+  //The locations in Shader::Particles, the particle then its colour
+#if OLD_OPENGL
+  glBindVertexArray(vao_id);
+  glBindBuffer(GL_ARRAY_BUFFER, buffer_id);
+  for (int attrib_id : {0, 1})
+  {
+    const GLvoid *offset_ptr = reinterpret_cast<GLvoid *>(attrib_id * 4 * sizeof(float));
+    glVertexAttribPointer(attrib_id, 4, GL_FLOAT, GL_FALSE, stride, offset_ptr);
+    glVertexAttribDivisor(attrib_id, 1);
+    glEnableVertexAttribArray(attrib_id);
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindVertexArray(0);
+#else
+  constexpr int buffer_index = 0;
+  glVertexArrayVertexBuffer(vao_id, buffer_index, buffer_id, 0, stride);
+  glVertexArrayBindingDivisor(vao_id, buffer_index, 1);
+  for (int attrib_id : {0, 1})
+  {
+    glEnableVertexArrayAttrib(vao_id, attrib_id);
+    glVertexArrayAttribFormat(vao_id, attrib_id, 4, GL_FLOAT, GL_FALSE, attrib_id * 4 * sizeof(float));
+    glVertexArrayAttribBinding(vao_id, attrib_id, buffer_index);
+  }
+#endif
+}
+
+
+ParticleData::~ParticleData()
+{
+  GL::DeleteBuffers(buffer_id);
+
+  glBindVertexArray(0);
+  GL::DeleteVertexArrays(vao_id);
+}
+
+
+void ParticleData::Update(const ParticleStore &particles)
+{
+  PROFILE_ZONE("upload particles");
+
+  MakeParticleInstances(particles, instances);
+
+#if OLD_OPENGL
+  glBindBuffer(GL_ARRAY_BUFFER, buffer_id);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(float) * instances.size(), instances.data(), GL_STREAM_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+#else
+  glNamedBufferData(buffer_id, sizeof(float) * instances.size(), instances.data(), GL_STREAM_DRAW);
+#endif
+}
+
+
+BurstData::BurstData()
+{
+  buffer_id = GL::CreateBuffers();
+  vao_id = GL::CreateVertexArrays();
+
+#if OLD_OPENGL
+  glBindVertexArray(vao_id);
+  glBindBuffer(GL_ARRAY_BUFFER, buffer_id);
+#else
+  constexpr int buffer_index = 0;
+  glVertexArrayVertexBuffer(vao_id, buffer_index, buffer_id, 0, sizeof(ParticleBurst));
+  glVertexArrayBindingDivisor(vao_id, buffer_index, BURST_MAX_PARTICLES);
+#endif
+
+  //The locations in Shader::Bursts
+  AttachAttribute(0, 2, GL_UNSIGNED_INT, offsetof(ParticleBurst, key));
+  AttachAttribute(1, 3, GL_INT, offsetof(ParticleBurst, count));
+  AttachAttribute(2, 3, GL_FLOAT, offsetof(ParticleBurst, time));
+  AttachAttribute(3, 4, GL_FLOAT, offsetof(ParticleBurst, colour));
+  AttachAttribute(4, 3, GL_FLOAT, offsetof(ParticleBurst, position_spread));
+  AttachAttribute(5, 3, GL_FLOAT, offsetof(ParticleBurst, min_ttl_jitter));
+  for (int i = 0; i < 3; i++)
+  {
+    AttachAttribute(6 + i, 4, GL_FLOAT, offsetof(ParticleBurst, origins) + sizeof(vec2) * 2 * i);
+  }
+  AttachAttribute(9, 4, GL_FLOAT, offsetof(ParticleBurst, velocities));
+  AttachAttribute(10, 2, GL_FLOAT, offsetof(ParticleBurst, velocities) + sizeof(vec2) * 2);
+
+#if OLD_OPENGL
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindVertexArray(0);
+#endif
+}
+
+
+BurstData::~BurstData()
+{
+  GL::DeleteBuffers(buffer_id);
+
+  glBindVertexArray(0);
+  GL::DeleteVertexArrays(vao_id);
+}
+
+
+void BurstData::AttachAttribute(int attrib_id, int size, GLenum type, int offset)
+{
+  const bool integer = type != GL_FLOAT;
+
+#if OLD_OPENGL
+  const GLvoid *offset_ptr = reinterpret_cast<GLvoid *>(size_t(offset));
+  if (integer)
+    glVertexAttribIPointer(attrib_id, size, type, sizeof(ParticleBurst), offset_ptr);
+  else
+    glVertexAttribPointer(attrib_id, size, type, GL_FALSE, sizeof(ParticleBurst), offset_ptr);
+  glVertexAttribDivisor(attrib_id, BURST_MAX_PARTICLES);
+  glEnableVertexAttribArray(attrib_id);
+#else
+  constexpr int buffer_index = 0;
+  glEnableVertexArrayAttrib(vao_id, attrib_id);
+  if (integer)
+    glVertexArrayAttribIFormat(vao_id, attrib_id, size, type, offset);
+  else
+    glVertexArrayAttribFormat(vao_id, attrib_id, size, type, GL_FALSE, offset);
+  glVertexArrayAttribBinding(vao_id, attrib_id, buffer_index);
+#endif
+}
+
+
+void BurstData::Update(const std::vector<ParticleBurst> &bursts)
+{
+  //Bursts only come and go now and then, most frames there's nothing to send
+  if (bursts.size() == uploaded.size() and (bursts.empty() or std::memcmp(bursts.data(), uploaded.data(), sizeof(ParticleBurst) * bursts.size()) == 0))
+  {
+    return;
+  }
+
+  PROFILE_ZONE("upload bursts");
+
+  uploaded = bursts;
+
+#if OLD_OPENGL
+  glBindBuffer(GL_ARRAY_BUFFER, buffer_id);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(ParticleBurst) * uploaded.size(), uploaded.data(), GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+#else
+  glNamedBufferData(buffer_id, sizeof(ParticleBurst) * uploaded.size(), uploaded.data(), GL_DYNAMIC_DRAW);
+#endif
+}
+
+
 std::vector<float> MakeCircle(float radius, int segments, const col4 &colour)
 {
   std::vector<float> out;
@@ -228,10 +502,11 @@ std::vector<float> MakeRect(float width, float height, col4 colour)
 
 Renderer::Renderer()
 : shapes_data(GL_STATIC_DRAW)
+, block_instances(shapes_data)
+, ball_instances(shapes_data)
 , circle_shape{}
 , arrow_shape{}
 , lines_data(GL_DYNAMIC_DRAW)
-, particle_data(GL_DYNAMIC_DRAW)
 {
   SetupShapes();
 
@@ -287,6 +562,9 @@ void Renderer::DisableBlend()
 void Renderer::Resize(int width, int height)
 {
   basic_shader.SetResolution(width, height);
+  shape_shader.SetResolution(width, height);
+  particle_shader.SetResolution(width, height);
+  burst_shader.SetResolution(width, height);
 }
 
 
@@ -297,6 +575,20 @@ void Renderer::DynamicLine(vec2 const &v1, vec2 const &v2, const col4 &colour)
 }
 
 
+void Renderer::DrawArrays(GLenum draw_type, int first, int count)
+{
+  glDrawArrays(draw_type, first, count);
+  draw_calls++;
+}
+
+
+void Renderer::DrawArraysInstanced(GLenum draw_type, int first, int count, int instances)
+{
+  glDrawArraysInstanced(draw_type, first, count, instances);
+  draw_calls++;
+}
+
+
 void Renderer::DrawVertexData(GLenum draw_type, const VertexData &vertex_data)
 {
   UseProgram(basic_shader.GetProgramId());
@@ -307,7 +599,7 @@ void Renderer::DrawVertexData(GLenum draw_type, const VertexData &vertex_data)
   basic_shader.SetZoom(1.0f);
   basic_shader.SetColour(1.0f, 1.0f, 1.0f, 1.0f);
 
-  glDrawArrays(draw_type, 0, vertex_data.GetNumVertexes());
+  DrawArrays(draw_type, 0, vertex_data.GetNumVertexes());
 }
 
 
@@ -396,12 +688,31 @@ void Renderer::SetupBlockShapes()
   AddTri(vec, ptr, pbl, pbr, col1);
 
   block_shapes.emplace(BlockType::paddle, shapes_data.AddShape(vec));
+
+
+  //Outlines go round the same corners as the block's lines in Game, white so
+  //the instance colour is the colour they're drawn in
+  col4 white{1.0f, 1.0f, 1.0f, 1.0f};
+
+  auto add_outline = [&](BlockType type, std::initializer_list<vec2> corners) {
+    vec.clear();
+    for (const vec2 &corner : corners) AddVertex(vec, corner, white);
+    block_outlines.emplace(type, shapes_data.AddShape(vec));
+  };
+
+  add_outline(BlockType::square, {tl, bl, br, tr});
+  add_outline(BlockType::triangle_left, {tr, tl, br});
+  add_outline(BlockType::triangle_right, {tr, tl, bl});
+  add_outline(BlockType::rectangle, {tl, bl, wbr, wtr});
+  add_outline(BlockType::rect_triangle_left, {wtr, tl, br, wbr});
+  add_outline(BlockType::rect_triangle_right, {wtr, tl, bl, br});
+  add_outline(BlockType::paddle, {ptl, pbl, pbr, ptr});
 }
 
 
 void Renderer::DrawShape(GLenum draw_type, shape_def const &shape)
 {
-  glDrawArrays(draw_type, shape.offset, shape.count);
+  DrawArrays(draw_type, shape.offset, shape.count);
 }
 
 
@@ -410,7 +721,7 @@ void Renderer::DrawCircle(int radius, float x, float y)
   basic_shader.SetOffset(x, y);
   basic_shader.SetZoom(radius);
 
-  glDrawArrays(GL_LINE_LOOP, circle_shape.offset, circle_shape.count);
+  DrawArrays(GL_LINE_LOOP, circle_shape.offset, circle_shape.count);
 }
 
 
@@ -419,7 +730,7 @@ void Renderer::FillCircle(int radius, float x, float y)
   basic_shader.SetOffset(x, y);
   basic_shader.SetZoom(radius);
 
-  glDrawArrays(GL_TRIANGLE_FAN, circle_shape.offset, circle_shape.count);
+  DrawArrays(GL_TRIANGLE_FAN, circle_shape.offset, circle_shape.count);
 }
 
 
@@ -435,7 +746,7 @@ void Renderer::RenderBall(const Ball &ball, bool draw_outline)
 
   basic_shader.SetColour(ball.colour.r, ball.colour.g, ball.colour.b, ball.colour.a * 0.3f);
 
-  glDrawArrays(GL_TRIANGLE_FAN, circle_shape.offset, circle_shape.count);
+  DrawArrays(GL_TRIANGLE_FAN, circle_shape.offset, circle_shape.count);
 
   if (draw_outline)
   {
@@ -443,11 +754,39 @@ void Renderer::RenderBall(const Ball &ball, bool draw_outline)
     col4 colour_bright = ball.colour * bright;
     basic_shader.SetColour(colour_bright);
 
-    glDrawArrays(GL_LINE_LOOP, circle_shape.offset, circle_shape.count);
+    DrawArrays(GL_LINE_LOOP, circle_shape.offset, circle_shape.count);
   }
 }
 
 
+void Renderer::RenderBalls(const GameState &state, const PreviousTick &previous, float alpha)
+{
+  const int num_balls = state.balls.size();
+  if (num_balls == 0) return;
+
+  ball_instances.Resize(num_balls);
+  for (int i = 0; i < num_balls; i++)
+  {
+    ball_instances.Set(i, InterpolateBallPosition(previous, state, i, alpha), state.balls.radius[i], state.balls.colour[i]);
+  }
+  ball_instances.Update();
+
+  UseProgram(shape_shader.GetProgramId());
+  UseVAO(ball_instances.GetVAO());
+
+  //As RenderBall does it, faint inside and a bright outline
+  shape_shader.SetColour(1.0f, 1.0f, 1.0f, 0.3f);
+  DrawArraysInstanced(GL_TRIANGLE_FAN, circle_shape.offset, circle_shape.count, num_balls);
+
+  const float bright = 1.3f;
+  shape_shader.SetColour(bright, bright, bright, bright);
+  DrawArraysInstanced(GL_LINE_LOOP, circle_shape.offset, circle_shape.count, num_balls);
+
+  UseProgram(basic_shader.GetProgramId());
+  UseVAO(shapes_data.GetVAO());
+}
+
+
 void Renderer::RenderArrow(const vec2 &position, float rot)
 {
   //glLineWidth(2.0f);
@@ -475,7 +814,7 @@ shape_def Renderer::GetRectShape(int w, int h)
 }
 
 
-void Renderer::RenderBlock(const Block &block, bool draw_normals)
+void Renderer::RenderBlock(const Block &block, const std::vector<Line> &lines, bool draw_normals)
 {
   auto shape = block_shapes[block.type];
 
@@ -487,24 +826,71 @@ void Renderer::RenderBlock(const Block &block, bool draw_normals)
   if (shape.offset != 0 and shape.count != 0)
     DrawShape(GL_TRIANGLES, shape);
 
+  auto outline = block_outlines[block.type];
+  if (outline.count != 0)
+    DrawShape(GL_LINE_LOOP, outline);
+
+  if (draw_normals) AddBlockNormals(block, lines);
+}
+
 
-  if (true)
+void Renderer::AddBlockNormals(const Block &block, const std::vector<Line> &lines)
+{
+  for (const auto &line : block.GetLines(lines))
   {
-    for (auto line : block.geometry)
-    {
-      const auto p1 = line.p1; // + block.position;
-      const auto p2 = line.p2; // + block.position;
+    vec2 center = (line.p1 + line.p2) / 2.0f;
+    DynamicLine(center, center + (line.normal * 4.0f), col4{1.0f, 1.0f, 1.0f, 1.0f});
+  }
+}
 
-      DynamicLine(p1, p2, block.colour);
 
-      if (draw_normals)
-      {
-        vec2 normal = get_normal(p1, p2);
-        vec2 center = (p1 + p2) / 2.0f;
-        DynamicLine(center, center + (normal * 4.0f), col4{1.0f, 1.0f, 1.0f, 1.0f});
-      }
+void Renderer::RenderBlocks(const SlotMap<Block> &blocks)
+{
+  if (blocks.empty()) return;
+
+  //Blocks don't move or change colour, so the instances only go stale when
+  //blocks come or go
+  if (blocks.GetVersion() != block_instances_version)
+  {
+    //Sorted by type, so each type's instances are together. Where each type
+    //starts, and the end of the last one.
+    int *firsts = block_type_firsts;
+    std::fill(firsts, firsts + NUM_BLOCK_TYPES + 1, 0);
+    for (const Block &block : blocks) firsts[static_cast<int>(block.type) + 1]++;
+    for (int t = 0; t < NUM_BLOCK_TYPES; t++) firsts[t + 1] += firsts[t];
+
+    int next[NUM_BLOCK_TYPES];
+    std::copy(firsts, firsts + NUM_BLOCK_TYPES, next);
+
+    block_instances.Resize(blocks.size());
+    for (const Block &block : blocks)
+    {
+      block_instances.Set(next[static_cast<int>(block.type)]++, block.position, 1.0f, block.colour);
     }
+
+    block_instances.Update();
+    block_instances_version = blocks.GetVersion();
+  }
+
+  UseProgram(shape_shader.GetProgramId());
+  UseVAO(block_instances.GetVAO());
+  shape_shader.SetColour(1.0f, 1.0f, 1.0f, 1.0f);
+
+  for (const auto &shape : block_shapes)
+  {
+    const int t = static_cast<int>(shape.first);
+    const int count = block_type_firsts[t + 1] - block_type_firsts[t];
+    if (count == 0) continue;
+
+    const shape_def &outline = block_outlines[shape.first];
+
+    block_instances.SetFirstInstance(block_type_firsts[t]);
+    if (shape.second.count != 0) DrawArraysInstanced(GL_TRIANGLES, shape.second.offset, shape.second.count, count);
+    if (outline.count != 0) DrawArraysInstanced(GL_LINE_LOOP, outline.offset, outline.count, count);
   }
+
+  UseProgram(basic_shader.GetProgramId());
+  UseVAO(shapes_data.GetVAO());
 }
 
 
@@ -564,8 +950,10 @@ void Renderer::RenderMenu(const GameState &state)
 }
 
 
-void Renderer::RenderGame(const GameState &state)
+void Renderer::RenderGame(const GameState &state, const PreviousTick &previous, float alpha)
 {
+  PROFILE_ZONE("RenderGame");
+
   const bool draw_normals = state.debug_enabled;
   const bool draw_velocity = state.debug_enabled;
   const bool draw_bounds = state.debug_enabled;
@@ -578,23 +966,30 @@ void Renderer::RenderGame(const GameState &state)
   UseVAO(shapes_data.GetVAO());
 
 
-  for (const auto &ball : state.balls)
+  if (draw_bounds)
   {
-    if (draw_bounds) RenderBounds(ball.bounds);
+    for (int i = 0; i < state.balls.size(); i++)
+    {
+      Ball ball = state.balls.Get(i);
+      ball.position = InterpolateBallPosition(previous, state, i, alpha);
+      ball.UpdateBounds();
 
-    RenderBall(ball, true);
+      RenderBounds(ball.bounds);
+    }
   }
 
+  RenderBalls(state, previous, alpha);
+
+  RenderBlocks(state.blocks);
+
+  //Debug drawing goes block by block
   for (const auto &block : state.blocks)
   {
     if (draw_bounds) RenderBounds(block.bounds);
-
-    RenderBlock(block, draw_normals);
+    if (draw_normals) AddBlockNormals(block, state.lines);
   }
 
-  TRACE << "Player.block.type = " << static_cast<int>(state.player.block.type) << "  ";
-
-  RenderBlock(state.player.block, draw_normals);
+  RenderBlock(state.player.block, state.lines, draw_normals);
   if (draw_bounds) RenderBounds(state.player.block.bounds);
   if (state.player.sticky_ball)
   {
@@ -605,11 +1000,31 @@ void Renderer::RenderGame(const GameState &state)
 
   if (not state.particles.empty())
   {
-    particle_data.Clear();
-    particle_data.AddShape(MakeParticleVertexes(state.particles));
-    particle_data.UpdateVertexes();
+    particle_data.Update(state.particles);
+
+    UseProgram(particle_shader.GetProgramId());
+    UseVAO(particle_data.GetVAO());
+
+    DrawArraysInstanced(GL_TRIANGLES, 0, 3, particle_data.GetNumParticles());
+
+    UseProgram(basic_shader.GetProgramId());
+    UseVAO(shapes_data.GetVAO());
+  }
+
+  if (not state.particle_bursts.empty())
+  {
+    burst_data.Update(state.particle_bursts);
 
-    DrawVertexData(GL_TRIANGLES, particle_data);
+    UseProgram(burst_shader.GetProgramId());
+    UseVAO(burst_data.GetVAO());
+
+    //In between the ticks, like the balls
+    const double time = previous.time + (state.time - previous.time) * alpha;
+    burst_shader.SetTime(static_cast<float>(time));
+    DrawArraysInstanced(GL_TRIANGLES, 0, 3, burst_data.GetNumBursts() * BURST_MAX_PARTICLES);
+
+    UseProgram(basic_shader.GetProgramId());
+    UseVAO(shapes_data.GetVAO());
   }
 
 
@@ -626,15 +1041,14 @@ void Renderer::RenderGame(const GameState &state)
   {
     for (const auto &block : vec)
     {
-      for (const auto &line : block.geometry)
+      for (const auto &line : block.GetLines(state.lines))
       {
         DynamicLine(line.p1, line.p2, block.colour);
 
         if (draw_normals)
         {
-          vec2 normal = get_normal(line.p1, line.p2);
           vec2 center = (line.p1 + line.p2) / 2.0f;
-          DynamicLine(center, center + (normal * 20.0f), col4{1.0f, 1.0f, 1.0f, 1.0f});
+          DynamicLine(center, center + (line.normal * 20.0f), col4{1.0f, 1.0f, 1.0f, 1.0f});
         }
       }
     }
@@ -643,10 +1057,11 @@ void Renderer::RenderGame(const GameState &state)
 
   if (draw_velocity)
   {
-    for (const auto &ball : state.balls)
+    for (int i = 0; i < state.balls.size(); i++)
     {
-      vec2 dir = (ball.velocity);
-      DynamicLine(ball.position, ball.position + dir * 1.0f, col4{1.0f, 1.0f, 1.0f, 1.0f});
+      vec2 position = state.balls.GetPosition(i);
+      vec2 dir = state.balls.GetVelocity(i);
+      DynamicLine(position, position + dir * 1.0f, col4{1.0f, 1.0f, 1.0f, 1.0f});
     }
   }
 
@@ -674,13 +1089,23 @@ void Renderer::RenderGame(const GameState &state)
 
 void Renderer::DrawGameState(const GameState &state)
 {
+  //Nothing to match the balls up with, so they're drawn where they are
+  const PreviousTick none;
+  DrawGameState(state, none, 1.0f);
+}
+
+
+void Renderer::DrawGameState(const GameState &state, const PreviousTick &previous, float alpha)
+{
+  draw_calls = 0;
+
   if (state.state == State::main_menu or state.state == State::pause_menu)
   {
     RenderMenu(state);
   }
   else
   {
-    RenderGame(state);
+    RenderGame(state, previous, alpha);
   }
 
 
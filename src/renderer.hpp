@@ -9,6 +9,8 @@
 
 typedef uint32_t GLenum;
 
+struct PreviousTick;
+
 struct GLState
 {
   int program = 0;
@@ -52,30 +54,118 @@ public:
   int GetNumVertexes() const;
 
   int GetVAO() const;
+  int GetBuffer() const;
 
   void AttachAttribute(int attrib_id, int size, int offset, GLenum type);
   void DetachAttribute(int attrib_id);
 };
 
 
+//Places to draw shapes from a VertexData, for Shader::Shapes, one instance
+//each. Sent to the GL by Update, the owner knows when they've changed.
+class ShapeInstances
+{
+private:
+  std::vector<float> instances;
+  int buffer_id = 0;
+  int vao_id = 0;
+
+  const int floats_per_instance = 3 + 4;
+  const int stride = floats_per_instance * sizeof(float);
+
+  void AttachInstanceAttributes(int first);
+
+public:
+  //shapes has to outlive this
+  explicit ShapeInstances(const VertexData &shapes);
+  ~ShapeInstances();
+
+  void Resize(int count);
+  void Set(int i, const vec2 &offset, float zoom, const col4 &colour);
+
+  void Update();
+
+  //Instanced draws start from instance first, the VAO has to be bound
+  void SetFirstInstance(int first);
+
+  int GetNumInstances() const { return instances.size() / floats_per_instance; }
+  int GetVAO() const { return vao_id; }
+};
+
+
+//A ParticleStore's particles for Shader::Particles, one instance each. The
+//instances are kept between frames so making them doesn't allocate.
+class ParticleData
+{
+private:
+  std::vector<float> instances;
+  int buffer_id = 0;
+  int vao_id = 0;
+
+public:
+  ParticleData();
+  ~ParticleData();
+
+  void Update(const ParticleStore &particles);
+
+  int GetNumParticles() const { return instances.size() / PARTICLE_INSTANCE_SIZE; }
+  int GetVAO() const { return vao_id; }
+};
+
+
+//The ParticleBursts as they are, for Shader::Bursts. Each one is used for
+//BURST_MAX_PARTICLES instances in a row. Only sent again when they change.
+class BurstData
+{
+private:
+  std::vector<ParticleBurst> uploaded;
+  int buffer_id = 0;
+  int vao_id = 0;
+
+  void AttachAttribute(int attrib_id, int size, GLenum type, int offset);
+
+public:
+  BurstData();
+  ~BurstData();
+
+  void Update(const std::vector<ParticleBurst> &bursts);
+
+  int GetNumBursts() const { return uploaded.size(); }
+  int GetVAO() const { return vao_id; }
+};
+
+
 class Renderer
 {
 private:
   GLState gl_state;
+  int draw_calls = 0;
 
   Shader::Basic basic_shader;
+  Shader::Shapes shape_shader;
+  Shader::Particles particle_shader;
+  Shader::Bursts burst_shader;
 
   VertexData shapes_data;
+  ShapeInstances block_instances;
+  ShapeInstances ball_instances;
 
   shape_def circle_shape;
   shape_def arrow_shape;
   std::map<int, std::map<int, shape_def>> rect_shapes;
   std::map<BlockType, shape_def> block_shapes;
+  std::map<BlockType, shape_def> block_outlines; //line loops, in white
+
+  //block_instances are the blocks sorted by type, made from the blocks with
+  //this SlotMap version, and where each type starts in them
+  uint64_t block_instances_version = 0;
+  int block_type_firsts[NUM_BLOCK_TYPES + 1] = {};
 
   Text text;
 
   VertexData lines_data;
-  VertexData particle_data;
+  ParticleData particle_data;
+  BurstData burst_data;
 
 public:
   Renderer();
@@ -89,6 +179,8 @@ public:
   void Resize(int width, int height);
 
   void DynamicLine(vec2 const &v1, vec2 const &v2, const col4 &colour);
+  void DrawArrays(GLenum draw_type, int first, int count);
+  void DrawArraysInstanced(GLenum draw_type, int first, int count, int instances);
   void DrawVertexData(GLenum draw_type, const VertexData &vertex_data);
 
   void SetupShapes();
@@ -99,15 +191,27 @@ public:
   void DrawCircle(int radius, float x, float y);
   void FillCircle(int radius, float x, float y);
   void RenderBall(const Ball &ball, bool draw_outline = true);
+  void RenderBalls(const GameState &state, const PreviousTick &previous, float alpha);
 
   void RenderArrow(const vec2 &position, float rot);
 
   shape_def GetRectShape(int w, int h);
-  void RenderBlock(const Block &block, bool draw_normals = false);
+  void RenderBlock(const Block &block, const std::vector<Line> &lines, bool draw_normals = false);
+  void AddBlockNormals(const Block &block, const std::vector<Line> &lines);
+
+  //Two instanced draws for each type of block, the insides and the outlines,
+  //however many there are. The instances are only made again when blocks
+  //have been added or removed.
+  void RenderBlocks(const SlotMap<Block> &blocks);
   void RenderBounds(const BoundingBox &bounds);
 
   void RenderMenu(const GameState &state);
-  void RenderGame(const GameState &state);
+  void RenderGame(const GameState &state, const PreviousTick &previous, float alpha);
 
+  //Balls are drawn alpha of the way from their previous to current positions
+  void DrawGameState(const GameState &state, const PreviousTick &previous, float alpha);
   void DrawGameState(const GameState &state);
+
+  //In the last DrawGameState
+  int GetDrawCalls() const { return draw_calls; }
 };
@@ -0,0 +1,321 @@
+#include "replay.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <type_traits>
+
+#include "snapshot.hpp"
+
+
+constexpr char REPLAY_MAGIC[8] = {'P', 'O', 'N', 'G', 'R', 'P', 'L', 'Y'};
+
+
+//Values are written as they are in memory, which is little-endian on
+//everything we build for
+
+template<typename T>
+void WriteValue(std::ostream &out, const T &value)
+{
+  static_assert(std::is_trivially_copyable<T>::value, "only plain data can be written as is");
+  out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+
+struct ReplayReader
+{
+  const char *p;
+  const char *end;
+
+  void Need(size_t bytes) const
+  {
+    if (static_cast<size_t>(end - p) < bytes) throw std::runtime_error("Replay is cut short");
+  }
+
+  template<typename T>
+  T Read()
+  {
+    static_assert(std::is_trivially_copyable<T>::value, "only plain data can be read as is");
+    Need(sizeof(T));
+
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type value;
+    std::memcpy(&value, p, sizeof(T));
+    p += sizeof(T);
+    return *reinterpret_cast<T *>(&value);
+  }
+};
+
+
+void WriteIntent(std::ostream &out, const Intent &intent)
+{
+  WriteValue(out, static_cast<uint8_t>(intent.type));
+  if (intent.type != IntentType::player_input) return;
+
+  WriteValue(out, static_cast<uint8_t>(intent.player_input));
+  if (intent.player_input == PlayerInput::mouse_position)
+  {
+    WriteValue(out, intent.position.x);
+    WriteValue(out, intent.position.y);
+  }
+  else
+  {
+    WriteValue(out, static_cast<uint8_t>(intent.down));
+  }
+}
+
+
+Intent ReadIntent(ReplayReader &reader)
+{
+  Intent intent{};
+
+  const uint8_t type = reader.Read<uint8_t>();
+  if (type > static_cast<uint8_t>(IntentType::menu_activate)) throw std::runtime_error("Replay has a bad intent");
+  intent.type = static_cast<IntentType>(type);
+  if (intent.type != IntentType::player_input) return intent;
+
+  const uint8_t input = reader.Read<uint8_t>();
+  if (input > static_cast<uint8_t>(PlayerInput::shoot)) throw std::runtime_error("Replay has a bad intent");
+  intent.player_input = static_cast<PlayerInput>(input);
+
+  if (intent.player_input == PlayerInput::mouse_position)
+  {
+    intent.position.x = reader.Read<float>();
+    intent.position.y = reader.Read<float>();
+  }
+  else
+  {
+    intent.down = reader.Read<uint8_t>() != 0;
+  }
+
+  return intent;
+}
+
+
+//One of the game's mode enums, which are all small
+template<typename T>
+T ReadMode(ReplayReader &reader, T last)
+{
+  const uint8_t mode = reader.Read<uint8_t>();
+  if (mode > static_cast<uint8_t>(last)) throw std::runtime_error("Replay has a bad game mode");
+  return static_cast<T>(mode);
+}
+
+
+void RunReplayFrame(const Game &game, FixedTimestep &simulation, const ReplayFrame &frame)
+{
+  game.ProcessIntents(simulation.Current(), frame.intents);
+
+  simulation.Advance(game, frame.delta_time);
+
+  GameState &state = simulation.Current();
+  if (not(frame.width == state.width and frame.height == state.height))
+  {
+    game.ResizeInPlace(state, frame.width, frame.height);
+  }
+}
+
+
+void WriteKeyframe(std::ostream &out, int frame, const FixedTimestep &simulation)
+{
+  std::ostringstream state;
+  WriteSnapshot(state, simulation.Current());
+  const std::string bytes = state.str();
+
+  WriteValue(out, 'K');
+  WriteValue(out, static_cast<int32_t>(frame));
+  WriteValue(out, simulation.GetAccumulator());
+  WriteValue(out, static_cast<int64_t>(simulation.GetNumTicks()));
+  WriteValue(out, static_cast<uint64_t>(bytes.size()));
+  out.write(bytes.data(), bytes.size());
+}
+
+
+ReplayRecorder::ReplayRecorder(std::ostream &out, const Game &game, uint64_t seed, const FixedTimestep &simulation, int keyframe_interval)
+: out(out)
+, keyframe_interval(keyframe_interval)
+{
+  if (keyframe_interval <= 0) throw std::runtime_error("Keyframe interval must be above zero");
+
+  out.write(REPLAY_MAGIC, sizeof(REPLAY_MAGIC));
+  WriteValue(out, REPLAY_VERSION);
+  WriteValue(out, seed);
+  WriteValue(out, simulation.GetTickRate());
+  WriteValue(out, static_cast<int32_t>(simulation.GetMaxCatchUp()));
+  WriteValue(out, static_cast<int32_t>(keyframe_interval));
+  WriteValue(out, static_cast<uint8_t>(game.GetBroadphase()));
+  WriteValue(out, static_cast<uint8_t>(game.GetCollisionMode()));
+  WriteValue(out, static_cast<uint8_t>(game.GetParticleMode()));
+
+  WriteKeyframe(out, 0, simulation);
+}
+
+
+void ReplayRecorder::RecordFrame(const ReplayFrame &frame, const FixedTimestep &simulation)
+{
+  if (num_frames > 0 and num_frames % keyframe_interval == 0)
+  {
+    WriteKeyframe(out, num_frames, simulation);
+  }
+
+  WriteValue(out, 'F');
+  WriteValue(out, frame.delta_time);
+  WriteValue(out, static_cast<int32_t>(frame.width));
+  WriteValue(out, static_cast<int32_t>(frame.height));
+  WriteValue(out, static_cast<uint32_t>(frame.intents.size()));
+  for (const Intent &intent : frame.intents) WriteIntent(out, intent);
+
+  num_frames++;
+}
+
+
+ReplayPlayer::ReplayPlayer(std::istream &in)
+: data(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>())
+{
+  ReplayReader reader{data.data(), data.data() + data.size()};
+
+  reader.Need(sizeof(REPLAY_MAGIC));
+  if (not std::equal(std::begin(REPLAY_MAGIC), std::end(REPLAY_MAGIC), reader.p))
+  {
+    throw std::runtime_error("Not a replay file");
+  }
+  reader.p += sizeof(REPLAY_MAGIC);
+
+  const uint32_t version = reader.Read<uint32_t>();
+  if (version != REPLAY_VERSION) throw std::runtime_error("Unsupported replay version " + std::to_string(version));
+
+  seed = reader.Read<uint64_t>();
+  tick_rate = reader.Read<float>();
+  max_catch_up = reader.Read<int32_t>();
+  keyframe_interval = reader.Read<int32_t>();
+  broadphase = ReadMode(reader, Broadphase::aabb_tree);
+  collision_mode = ReadMode(reader, CollisionMode::swept);
+  particle_mode = ReadMode(reader, ParticleMode::bursts);
+
+  while (reader.p != reader.end)
+  {
+    const char tag = reader.Read<char>();
+
+    if (tag == 'F')
+    {
+      FrameRecord frame;
+      frame.delta_time = reader.Read<float>();
+      frame.width = reader.Read<int32_t>();
+      frame.height = reader.Read<int32_t>();
+
+      const uint32_t num_intents = reader.Read<uint32_t>();
+      //Every intent takes at least a byte
+      reader.Need(num_intents);
+      frame.first_intent = intents.size();
+      frame.num_intents = num_intents;
+      for (uint32_t i = 0; i < num_intents; i++) intents.push_back(ReadIntent(reader));
+
+      frames.push_back(frame);
+    }
+    else if (tag == 'K')
+    {
+      const Keyframe keyframe{static_cast<int>(frames.size()), static_cast<size_t>(reader.p - data.data())};
+
+      if (reader.Read<int32_t>() != keyframe.frame) throw std::runtime_error("Replay keyframe is out of place");
+      reader.Read<double>();
+      reader.Read<int64_t>();
+
+      const uint64_t size = reader.Read<uint64_t>();
+      reader.Need(size);
+      reader.p += size;
+
+      keyframes.push_back(keyframe);
+    }
+    else
+    {
+      throw std::runtime_error("Replay is corrupt");
+    }
+  }
+
+  if (keyframes.empty()) throw std::runtime_error("Replay has no starting keyframe");
+
+  simulation.SetTickRate(tick_rate);
+  simulation.SetMaxCatchUp(max_catch_up);
+  LoadKeyframe(keyframes.front());
+}
+
+
+void ReplayPlayer::LoadKeyframe(const Keyframe &keyframe)
+{
+  ReplayReader reader{data.data() + keyframe.offset, data.data() + data.size()};
+
+  reader.Read<int32_t>();
+  const double accumulator = reader.Read<double>();
+  const int64_t num_ticks = reader.Read<int64_t>();
+  const uint64_t size = reader.Read<uint64_t>();
+
+  //Snapshots have to be aligned, and the log packs keyframes in anywhere
+  keyframe_buffer.resize(size / sizeof(uint64_t) + 1);
+  std::memcpy(keyframe_buffer.data(), reader.p, size);
+
+  simulation.Reset(SnapshotView(keyframe_buffer.data(), size).ToGameState(), accumulator, num_ticks);
+  current_frame = keyframe.frame;
+}
+
+
+void ReplayPlayer::SetUpGame(Game &game) const
+{
+  game.SetBroadphase(broadphase);
+  game.SetCollisionMode(collision_mode);
+  game.SetParticleMode(particle_mode);
+}
+
+
+ReplayFrame ReplayPlayer::GetReplayFrame(int frame) const
+{
+  const FrameRecord &record = frames.at(frame);
+
+  ReplayFrame out;
+  out.delta_time = record.delta_time;
+  out.width = record.width;
+  out.height = record.height;
+  out.intents.assign(intents.begin() + record.first_intent,
+    intents.begin() + record.first_intent + record.num_intents);
+
+  return out;
+}
+
+
+int ReplayPlayer::Seek(const Game &game, int frame)
+{
+  if (frame < 0 or frame > GetNumFrames()) throw std::runtime_error("Seeking outside the replay");
+  if (game.GetCollisionMode() != collision_mode or game.GetParticleMode() != particle_mode)
+  {
+    throw std::runtime_error("Replay was recorded with other game modes, see SetUpGame");
+  }
+
+  //The last keyframe at or before the frame
+  auto after = std::upper_bound(keyframes.begin(), keyframes.end(), frame,
+    [](int f, const Keyframe &keyframe) { return f < keyframe.frame; });
+  const Keyframe &start = *(after - 1);
+
+  if (not(current_frame >= start.frame and current_frame <= frame))
+  {
+    LoadKeyframe(start);
+  }
+
+  int frames_run = 0;
+  ReplayFrame replay_frame;
+
+  for (; current_frame < frame; current_frame++)
+  {
+    const FrameRecord &record = frames[current_frame];
+
+    replay_frame.delta_time = record.delta_time;
+    replay_frame.width = record.width;
+    replay_frame.height = record.height;
+    replay_frame.intents.assign(intents.begin() + record.first_intent,
+      intents.begin() + record.first_intent + record.num_intents);
+
+    RunReplayFrame(game, simulation, replay_frame);
+    frames_run++;
+  }
+
+  return frames_run;
+}
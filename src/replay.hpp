@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "fixed_timestep.hpp"
+#include "game.hpp"
+#include "input.hpp"
+
+
+//Replays are a log of everything that went into a session, so it can be run
+//again exactly without a window: the seed, how the Game was set up, and each
+//frame's delta time, window size and intents. Every keyframe_interval frames the whole
+//FixedTimestep is saved as well, so playback can jump to any frame by
+//starting from the keyframe before it.
+//
+//Layout, all little-endian:
+//  header    "PONGRPLY", version, seed, tick rate, max catch up, keyframe
+//            interval, broadphase, collision mode, particle mode
+//  records   'F' delta time, width, height, intent count, intents
+//            'K' frame number, accumulator, tick count, snapshot size,
+//                snapshot (see snapshot.hpp)
+//
+//An intent is its type, then for player input which input it is, then the
+//mouse position or whether the button went down. Nothing else in an Intent
+//means anything, so nothing else is saved.
+//
+//A keyframe comes before the frame it was taken at, and frame 0 always has
+//one, so a replay doesn't depend on how its first state was set up.
+
+constexpr uint32_t REPLAY_VERSION = 3;
+
+
+//One frame of the main loop, see RunReplayFrame
+struct ReplayFrame
+{
+  float delta_time = 0.0f;
+  int width = 0;
+  int height = 0;
+
+  std::vector<Intent> intents;
+};
+
+
+//What the main loop does to the game each frame: the frame's intents go in,
+//the simulation advances, and the state follows the window size. Recording
+//and playback both go through this so they can't drift apart.
+void RunReplayFrame(const Game &game, FixedTimestep &simulation, const ReplayFrame &frame);
+
+
+class ReplayRecorder
+{
+private:
+  std::ostream &out;
+
+  int keyframe_interval;
+  int num_frames = 0;
+
+public:
+  //Writes the header straight away, with the game's modes as they are now
+  ReplayRecorder(std::ostream &out, const Game &game, uint64_t seed, const FixedTimestep &simulation, int keyframe_interval = 600);
+
+  //Call before RunReplayFrame, with the simulation as it is before the frame
+  void RecordFrame(const ReplayFrame &frame, const FixedTimestep &simulation);
+
+  int GetNumFrames() const { return num_frames; }
+};
+
+
+class ReplayPlayer
+{
+private:
+  struct FrameRecord
+  {
+    float delta_time;
+    int width;
+    int height;
+    int first_intent;
+    int num_intents;
+  };
+
+  struct Keyframe
+  {
+    int frame;
+    size_t offset;
+  };
+
+  std::string data;
+
+  uint64_t seed = 0;
+  float tick_rate = 60.0f;
+  int max_catch_up = 8;
+  int keyframe_interval = 0;
+
+  Broadphase broadphase = Broadphase::grid;
+  CollisionMode collision_mode = CollisionMode::discrete;
+  ParticleMode particle_mode = ParticleMode::simulated;
+
+  std::vector<FrameRecord> frames;
+  std::vector<Intent> intents;
+  std::vector<Keyframe> keyframes;
+
+  FixedTimestep simulation;
+  int current_frame = 0;
+
+  std::vector<uint64_t> keyframe_buffer;
+
+  void LoadKeyframe(const Keyframe &keyframe);
+
+public:
+  //Reads the whole log and indexes it, throws if it isn't a replay
+  explicit ReplayPlayer(std::istream &in);
+
+  uint64_t GetSeed() const { return seed; }
+  int GetNumFrames() const { return frames.size(); }
+  int GetKeyframeInterval() const { return keyframe_interval; }
+
+  //Puts the game in the modes it was recorded with. Seek refuses a game with
+  //other collision or particle modes, any broadphase gives the same results.
+  void SetUpGame(Game &game) const;
+
+  //The frame that will run next, GetNumFrames() once it is all played
+  int GetFrame() const { return current_frame; }
+
+  ReplayFrame GetReplayFrame(int frame) const;
+
+  //Gets the simulation to how it was just before frame ran, going from the
+  //current frame if that is on the way and otherwise from the last keyframe
+  //before it. Returns how many frames had to be run.
+  int Seek(const Game &game, int frame);
+
+  //Runs everything from the current frame to the end
+  int PlayToEnd(const Game &game) { return Seek(game, GetNumFrames()); }
+
+  FixedTimestep &GetSimulation() { return simulation; }
+  const GameState &Current() const { return simulation.Current(); }
+};
@@ -7,6 +7,7 @@
 #include "gl.hpp"
 
 #include "maths.hpp"
+#include "particles.hpp"
 
 
 namespace Shader {
@@ -170,4 +171,398 @@ void main(void)
 )";
 
 
+Shapes::Shapes()
+{
+  vertex_shader_id = GL::CreateShader(GL_VERTEX_SHADER, vertex_src);
+  fragment_shader_id = GL::CreateShader(GL_FRAGMENT_SHADER, fragment_src);
+
+  program_id = glCreateProgram();
+
+  glAttachShader(program_id, vertex_shader_id);
+  glAttachShader(program_id, fragment_shader_id);
+
+  GL::LinkProgram(program_id);
+
+  uniforms.screen_resolution = glGetUniformLocation(program_id, "screen_resolution");
+  uniforms.colour = glGetUniformLocation(program_id, "colour");
+
+  for (auto& u : {uniforms.screen_resolution, uniforms.colour})
+  {
+    if (u == -1) throw std::runtime_error("uniform is not valid");
+  }
+
+  SetResolution(640, 480);
+  SetColour(1.0f, 1.0f, 1.0f, 1.0f);
+}
+
+
+Shapes::~Shapes()
+{
+  glDetachShader(program_id, vertex_shader_id);
+  glDetachShader(program_id, fragment_shader_id);
+
+  glDeleteShader(vertex_shader_id);
+  glDeleteShader(fragment_shader_id);
+
+  glDeleteProgram(program_id);
+}
+
+
+void Shapes::SetResolution(int width, int height)
+{
+  glProgramUniform2i(program_id, uniforms.screen_resolution, width, height);
+}
+
+
+void Shapes::SetColour(float r, float g, float b, float a)
+{
+  glProgramUniform4f(program_id, uniforms.colour, r, g, b, a);
+}
+
+
+const std::string Shapes::vertex_src =
+  R"(#version 330
+
+layout(location=0) in vec2 v;
+layout(location=1) in vec4 col;
+layout(location=2) in vec3 placement; //offset x, y, zoom
+layout(location=3) in vec4 instance_colour;
+
+out vec4 vertex_colour;
+
+uniform ivec2 screen_resolution;
+
+vec2 ScreenToClip(const vec2 screen)
+{
+  float x = ((screen.x / float(screen_resolution.x)) * 2.0) - 1.0;
+  float y = ((1.0 - (screen.y / float(screen_resolution.y))) * 2.0) - 1.0;
+  return vec2(x,y);
+}
+
+void main(void)
+{
+  vec2 screen_pos = v * placement.z + placement.xy;
+
+  gl_Position = vec4(ScreenToClip(screen_pos), 0.0, 1.0);
+  vertex_colour = instance_colour * col;
+}
+)";
+
+
+const std::string Shapes::fragment_src =
+  R"(#version 330
+
+uniform vec4 colour;
+
+in vec4 vertex_colour;
+out vec4 out_colour;
+
+void main(void)
+{
+  out_colour = colour * vertex_colour;
+}
+
+)";
+
+
+Particles::Particles()
+{
+  vertex_shader_id = GL::CreateShader(GL_VERTEX_SHADER, vertex_src);
+  fragment_shader_id = GL::CreateShader(GL_FRAGMENT_SHADER, fragment_src);
+
+  program_id = glCreateProgram();
+
+  glAttachShader(program_id, vertex_shader_id);
+  glAttachShader(program_id, fragment_shader_id);
+
+  GL::LinkProgram(program_id);
+
+  uniforms.screen_resolution = glGetUniformLocation(program_id, "screen_resolution");
+  if (uniforms.screen_resolution == -1) throw std::runtime_error("uniform is not valid");
+
+  SetResolution(640, 480);
+}
+
+
+Particles::~Particles()
+{
+  glDetachShader(program_id, vertex_shader_id);
+  glDetachShader(program_id, fragment_shader_id);
+
+  glDeleteShader(vertex_shader_id);
+  glDeleteShader(fragment_shader_id);
+
+  glDeleteProgram(program_id);
+}
+
+
+void Particles::SetResolution(int width, int height)
+{
+  glProgramUniform2i(program_id, uniforms.screen_resolution, width, height);
+}
+
+
+//Each instance is a triangle with its corners radius out from the centre
+const std::string Particles::vertex_src =
+  R"(#version 330
+
+layout(location=0) in vec4 particle; //x, y, radius, rotation
+layout(location=1) in vec4 colour;
+
+out vec4 vertex_colour;
+
+uniform ivec2 screen_resolution;
+
+const float TWO_PI = 6.28318530718;
+
+vec2 ScreenToClip(const vec2 screen)
+{
+  float x = ((screen.x / float(screen_resolution.x)) * 2.0) - 1.0;
+  float y = ((1.0 - (screen.y / float(screen_resolution.y))) * 2.0) - 1.0;
+  return vec2(x,y);
+}
+
+void main(void)
+{
+  float angle = (float(gl_VertexID) / 3.0) * TWO_PI + particle.w;
+  vec2 screen_pos = particle.xy + vec2(cos(angle), sin(angle)) * particle.z;
+
+  gl_Position = vec4(ScreenToClip(screen_pos), 0.0, 1.0);
+  vertex_colour = colour;
+}
+)";
+
+
+const std::string Particles::fragment_src =
+  R"(#version 330
+
+in vec4 vertex_colour;
+out vec4 out_colour;
+
+void main(void)
+{
+  out_colour = vertex_colour;
+}
+
+)";
+
+
+Bursts::Bursts()
+{
+  vertex_shader_id = GL::CreateShader(GL_VERTEX_SHADER, vertex_src);
+  fragment_shader_id = GL::CreateShader(GL_FRAGMENT_SHADER, fragment_src);
+
+  program_id = glCreateProgram();
+
+  glAttachShader(program_id, vertex_shader_id);
+  glAttachShader(program_id, fragment_shader_id);
+
+  GL::LinkProgram(program_id);
+
+  uniforms.screen_resolution = glGetUniformLocation(program_id, "screen_resolution");
+  uniforms.time = glGetUniformLocation(program_id, "time");
+
+  for (auto& u : {uniforms.screen_resolution, uniforms.time})
+  {
+    if (u == -1) throw std::runtime_error("uniform is not valid");
+  }
+
+  SetResolution(640, 480);
+  SetTime(0.0f);
+}
+
+
+Bursts::~Bursts()
+{
+  glDetachShader(program_id, vertex_shader_id);
+  glDetachShader(program_id, fragment_shader_id);
+
+  glDeleteShader(vertex_shader_id);
+  glDeleteShader(fragment_shader_id);
+
+  glDeleteProgram(program_id);
+}
+
+
+void Bursts::SetResolution(int width, int height)
+{
+  glProgramUniform2i(program_id, uniforms.screen_resolution, width, height);
+}
+
+
+void Bursts::SetTime(float time)
+{
+  glProgramUniform1f(program_id, uniforms.time, time);
+}
+
+
+//The attributes below are written for these
+static_assert(BURST_MAX_ORIGINS == 6 and BURST_MAX_VELOCITIES == 3, "the burst shader's attributes are out of date");
+
+
+//Threefry2x32 is the one in random.cpp, and the numbers are used the way
+//EmitParticles uses them (particles.cpp), so the particles are the ones it
+//would have made
+const std::string Bursts::vertex_src =
+  R"(#version 330
+
+const int MAX_PARTICLES = )" + std::to_string(BURST_MAX_PARTICLES) + R"(;
+
+layout(location=0) in uvec2 key;
+layout(location=1) in ivec3 counts; //particles, origins, velocities
+layout(location=2) in vec3 emitted; //time, size, ttl
+layout(location=3) in vec4 colour;
+layout(location=4) in vec3 spreads; //position, velocity, rotation speed
+layout(location=5) in vec3 jitters; //least and most ttl, most size
+layout(location=6) in vec4 origins01;
+layout(location=7) in vec4 origins23;
+layout(location=8) in vec4 origins45;
+layout(location=9) in vec4 velocities01;
+layout(location=10) in vec2 velocities2;
+
+out vec4 vertex_colour;
+
+uniform ivec2 screen_resolution;
+uniform float time;
+
+const float TWO_PI = 6.28318530718;
+const float STEP_RATE = 60.0;
+
+//EmitRandom
+const int emit_ttl = 0;
+const int emit_size = 1;
+const int emit_x1 = 2;
+const int emit_y1 = 4;
+const int emit_rotation = 6;
+const int emit_vx1 = 7;
+const int emit_vy1 = 9;
+const int emit_rot_vel1 = 11;
+const int emit_origin = 13;
+const int emit_velocity = 14;
+
+uint words[8];
+
+vec2 ScreenToClip(const vec2 screen)
+{
+  float x = ((screen.x / float(screen_resolution.x)) * 2.0) - 1.0;
+  float y = ((1.0 - (screen.y / float(screen_resolution.y))) * 2.0) - 1.0;
+  return vec2(x,y);
+}
+
+uint Rotl(uint x, int k)
+{
+  return (x << k) | (x >> (32 - k));
+}
+
+uvec2 Threefry2x32(uint counter0, uint counter1)
+{
+  const int rotations[8] = int[8](13, 15, 26, 6, 17, 29, 16, 24);
+  uint ks[3] = uint[3](key.x, key.y, 0x1BD11BDAu ^ key.x ^ key.y);
+
+  uint x0 = counter0 + ks[0];
+  uint x1 = counter1 + ks[1];
+
+  for (int round = 0; round < 20; round++)
+  {
+    x0 += x1;
+    x1 = Rotl(x1, rotations[round % 8]);
+    x1 ^= x0;
+
+    if (round % 4 == 3)
+    {
+      int s = (round + 1) / 4;
+      x0 += ks[s % 3];
+      x1 += ks[(s + 1) % 3] + uint(s);
+    }
+  }
+
+  return uvec2(x0, x1);
+}
+
+uint Bits(int which)
+{
+  return (words[which / 2] >> uint(16 * (which % 2))) & 0xFFFFu;
+}
+
+float Float(int which, float r1, float r2)
+{
+  return r1 + ((float(Bits(which)) * (1.0 / 65536.0)) * (r2 - r1));
+}
+
+float Spread(int first, float spread)
+{
+  return (Float(first, -spread, spread) + Float(first + 1, -spread, spread)) / 2.0;
+}
+
+int Index(int which, int count)
+{
+  return int((Bits(which) * uint(count)) >> 16);
+}
+
+void Hide()
+{
+  gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+  vertex_colour = vec4(0.0);
+}
+
+void main(void)
+{
+  int particle = gl_InstanceID % MAX_PARTICLES;
+  if (particle >= counts.x)
+  {
+    Hide();
+    return;
+  }
+
+  for (int pair = 0; pair < 4; pair++)
+  {
+    uvec2 pair_words = Threefry2x32(uint(particle), uint(pair));
+    words[pair * 2] = pair_words.x;
+    words[pair * 2 + 1] = pair_words.y;
+  }
+
+  float age = time - emitted.x;
+  float ttl = emitted.z + Float(emit_ttl, jitters.x, jitters.y) - age;
+  if (ttl < 0.0)
+  {
+    Hide();
+    return;
+  }
+
+  vec2 origins[6] = vec2[6](origins01.xy, origins01.zw, origins23.xy, origins23.zw, origins45.xy, origins45.zw);
+  vec2 velocities[3] = vec2[3](velocities01.xy, velocities01.zw, velocities2);
+
+  vec2 start = origins[Index(emit_origin, counts.y)] + vec2(Spread(emit_x1, spreads.x), Spread(emit_y1, spreads.x));
+  vec2 velocity = velocities[Index(emit_velocity, counts.z)] + vec2(Spread(emit_vx1, spreads.y), Spread(emit_vy1, spreads.y));
+  float size = emitted.y + Float(emit_size, 0.0, jitters.z);
+
+  float steps = age * STEP_RATE;
+  vec2 position = start + velocity * steps;
+  float rotation = Float(emit_rotation, 0.0, TWO_PI) + Spread(emit_rot_vel1, spreads.z) * steps;
+
+  float angle = (float(gl_VertexID) / 3.0) * TWO_PI + rotation;
+  vec2 screen_pos = position + vec2(cos(angle), sin(angle)) * size;
+
+  float alpha = ttl < 0.8 ? ttl / 0.8 : 1.0;
+
+  gl_Position = vec4(ScreenToClip(screen_pos), 0.0, 1.0);
+  vertex_colour = vec4(colour.rgb, colour.a * alpha);
+}
+)";
+
+
+const std::string Bursts::fragment_src =
+  R"(#version 330
+
+in vec4 vertex_colour;
+out vec4 out_colour;
+
+void main(void)
+{
+  out_colour = vertex_colour;
+}
+
+)";
+
+
 } //namespace Shader
@@ -47,4 +47,99 @@ public:
 };
 
 
+//Draws a shape the way Basic does, but many times at once, with the offset,
+//zoom and colour of each one as per instance attributes (see ShapeInstances
+//in renderer.hpp). Never rotated.
+class Shapes
+{
+private:
+  static const std::string vertex_src;
+  static const std::string fragment_src;
+
+  int program_id = 0;
+  int vertex_shader_id = 0;
+  int fragment_shader_id = 0;
+
+  struct uniform
+  {
+    int screen_resolution = -1;
+    int colour = -1;
+  };
+  uniform uniforms;
+
+public:
+  Shapes();
+  ~Shapes();
+
+  void SetResolution(int width, int height);
+
+  //Every instance's colour is multiplied by this
+  void SetColour(float r, float g, float b, float a);
+
+  int GetProgramId() const { return program_id; }
+};
+
+
+//Draws a ParticleStore's particles as triangles, one instance each from
+//MakeParticleInstances (see ParticleData in renderer.hpp)
+class Particles
+{
+private:
+  static const std::string vertex_src;
+  static const std::string fragment_src;
+
+  int program_id = 0;
+  int vertex_shader_id = 0;
+  int fragment_shader_id = 0;
+
+  struct uniform
+  {
+    int screen_resolution = -1;
+  };
+  uniform uniforms;
+
+public:
+  Particles();
+  ~Particles();
+
+  void SetResolution(int width, int height);
+
+  int GetProgramId() const { return program_id; }
+};
+
+
+//Draws ParticleBursts, with one instance per particle each burst could hold
+//and the bursts as per instance attributes (see BurstData in renderer.hpp).
+//Each particle is worked out from its burst and its age the same way
+//EvaluateParticleBurst does, so the CPU does nothing per particle.
+class Bursts
+{
+private:
+  static const std::string vertex_src;
+  static const std::string fragment_src;
+
+  int program_id = 0;
+  int vertex_shader_id = 0;
+  int fragment_shader_id = 0;
+
+  struct uniform
+  {
+    int screen_resolution = -1;
+    int time = -1;
+  };
+  uniform uniforms;
+
+public:
+  Bursts();
+  ~Bursts();
+
+  void SetResolution(int width, int height);
+
+  //GameState::time
+  void SetTime(float time);
+
+  int GetProgramId() const { return program_id; }
+};
+
+
 } //namespace Shader
@@ -0,0 +1,99 @@
+#include "slot_map.hpp"
+
+#include <atomic>
+#include <cstddef>
+
+
+void SlotTable::clear()
+{
+  //Freed from the back so the slots get handed out again in dense order
+  for (int i = size() - 1; i >= 0; i--)
+  {
+    Slot &s = slots[dense_slots[i]];
+    s.generation++;
+    s.dense = free_slot;
+    free_slot = dense_slots[i];
+  }
+
+  dense_slots.clear();
+}
+
+
+void SlotTable::reserve(int count)
+{
+  slots.reserve(count);
+  dense_slots.reserve(count);
+}
+
+
+SlotHandle SlotTable::Add()
+{
+  const uint32_t dense = dense_slots.size();
+
+  uint32_t slot = free_slot;
+  if (slot == NULL_SLOT)
+  {
+    slot = slots.size();
+    slots.push_back({dense, 0});
+  }
+  else
+  {
+    free_slot = slots[slot].dense;
+    slots[slot].dense = dense;
+  }
+
+  dense_slots.push_back(slot);
+  return {slot, slots[slot].generation};
+}
+
+
+void SlotTable::SwapRemove(int dense)
+{
+  const uint32_t slot = dense_slots[dense];
+  const uint32_t last = dense_slots.back();
+
+  dense_slots[dense] = last;
+  slots[last].dense = dense;
+  dense_slots.pop_back();
+
+  FreeSlot(slot);
+}
+
+
+void SlotTable::FreeSlot(uint32_t slot)
+{
+  Slot &s = slots[slot];
+  s.generation++;
+  s.dense = free_slot;
+  free_slot = slot;
+}
+
+
+bool SlotTable::IsConsistent(int num_items) const
+{
+  if (size() != num_items) return false;
+
+  for (int i = 0; i < size(); i++)
+  {
+    if (dense_slots[i] >= slots.size() or slots[dense_slots[i]].dense != static_cast<uint32_t>(i)) return false;
+  }
+
+  //Every slot is either in use or on the free list, once
+  size_t num_free = 0;
+  for (uint32_t slot = free_slot; slot != NULL_SLOT; slot = slots[slot].dense)
+  {
+    if (slot >= slots.size() or ++num_free > slots.size()) return false;
+
+    const uint32_t next = slots[slot].dense;
+    if (next < dense_slots.size() and dense_slots[next] == slot) return false;
+  }
+
+  return num_free + dense_slots.size() == slots.size();
+}
+
+
+uint64_t NewSlotMapVersion()
+{
+  static std::atomic<uint64_t> next_version{1};
+  return next_version.fetch_add(1, std::memory_order_relaxed);
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+
+//Slot maps keep their items packed together in a dense array, and hand out
+//handles that find an item wherever it has been moved to. A handle is a slot
+//number and the generation that slot was on when the handle was made, every
+//removal bumps the slot's generation so old handles stop finding anything
+//instead of finding whatever took their place.
+//
+//Removing swaps the last item into the hole, so it is O(1) and nothing else
+//moves. Iteration is over the dense array, which only changes order when
+//something is removed, and then the same way every time, so every run (and
+//every broadphase) walks the items in the same order.
+
+constexpr uint32_t NULL_SLOT = 0xffffffff;
+
+
+struct SlotHandle
+{
+  uint32_t slot = NULL_SLOT;
+  uint32_t generation = 0;
+};
+
+
+inline bool operator==(const SlotHandle &a, const SlotHandle &b)
+{
+  return a.slot == b.slot and a.generation == b.generation;
+}
+
+inline bool operator!=(const SlotHandle &a, const SlotHandle &b)
+{
+  return not(a == b);
+}
+
+
+//The handle bookkeeping on its own, for stores that keep their items some
+//other way (BallStore keeps them as columns). The owner keeps its items in
+//step with the dense indexes: Add is for a new item on the end, and after
+//SwapRemove the item that was last goes where the removed one was.
+struct SlotTable
+{
+  struct Slot
+  {
+    uint32_t dense; //where the item is, or the next free slot once it's removed
+    uint32_t generation;
+  };
+
+  std::vector<Slot> slots;
+  std::vector<uint32_t> dense_slots; //the slot of each dense item
+  uint32_t free_slot = NULL_SLOT;
+
+  int size() const { return dense_slots.size(); }
+
+  //Frees every slot, so all the handles given out so far go stale
+  void clear();
+  void reserve(int count);
+
+  SlotHandle Add();
+  void SwapRemove(int dense);
+
+  //Removes every item that removed(dense) is true for, the rest move down to
+  //fill the gaps in the same order. The owner does the same to its items.
+  template<typename PRED>
+  void RemoveKeepingOrder(PRED removed);
+
+  SlotHandle GetHandle(int dense) const { return {dense_slots[dense], slots[dense_slots[dense]].generation}; }
+
+  //The item's dense index, or -1 if the handle is stale
+  int Find(const SlotHandle &handle) const
+  {
+    if (handle.slot >= slots.size()) return -1;
+
+    const Slot &s = slots[handle.slot];
+    return (s.generation == handle.generation and s.dense < dense_slots.size() and dense_slots[s.dense] == handle.slot) ? s.dense : -1;
+  }
+
+  //For tables read from outside, checks that every slot and dense index
+  //points back at each other and that the free list is sound
+  bool IsConsistent(int num_items) const;
+
+private:
+  void FreeSlot(uint32_t slot);
+};
+
+
+template<typename PRED>
+void SlotTable::RemoveKeepingOrder(PRED removed)
+{
+  uint32_t kept = 0;
+  for (uint32_t dense = 0; dense < dense_slots.size(); dense++)
+  {
+    const uint32_t slot = dense_slots[dense];
+    if (removed(static_cast<int>(dense)))
+    {
+      FreeSlot(slot);
+      continue;
+    }
+
+    dense_slots[kept] = slot;
+    slots[slot].dense = kept;
+    kept++;
+  }
+
+  dense_slots.resize(kept);
+}
+
+
+//A number no SlotMap has had before, see SlotMap::GetVersion
+uint64_t NewSlotMapVersion();
+
+
+template<typename T>
+struct SlotMap
+{
+  //Change these through the functions below, the snapshot code fills them
+  //in directly
+  std::vector<T> items;
+  SlotTable table;
+
+  //New every time items are added or removed, so two maps only share one if
+  //one is a copy of the other with nothing added or removed since. Lets
+  //caches of the whole map (like the renderer's) tell when they're stale.
+  uint64_t version = NewSlotMapVersion();
+
+  uint64_t GetVersion() const { return version; }
+
+  int size() const { return items.size(); }
+  bool empty() const { return items.empty(); }
+
+  T *begin() { return items.data(); }
+  T *end() { return items.data() + items.size(); }
+  const T *begin() const { return items.data(); }
+  const T *end() const { return items.data() + items.size(); }
+
+  //By dense index
+  T &operator[](int i) { return items[i]; }
+  const T &operator[](int i) const { return items[i]; }
+
+  void clear()
+  {
+    items.clear();
+    table.clear();
+    version = NewSlotMapVersion();
+  }
+
+  void reserve(int count)
+  {
+    items.reserve(count);
+    table.reserve(count);
+  }
+
+  SlotHandle Add(const T &item)
+  {
+    items.push_back(item);
+    version = NewSlotMapVersion();
+    return table.Add();
+  }
+
+  SlotHandle GetHandle(int i) const { return table.GetHandle(i); }
+  int Find(const SlotHandle &handle) const { return table.Find(handle); }
+
+  T *Get(const SlotHandle &handle)
+  {
+    const int i = table.Find(handle);
+    return (i < 0) ? nullptr : &items[i];
+  }
+
+  const T *Get(const SlotHandle &handle) const
+  {
+    const int i = table.Find(handle);
+    return (i < 0) ? nullptr : &items[i];
+  }
+
+  //Does nothing if the handle is stale
+  void Remove(const SlotHandle &handle)
+  {
+    const int i = table.Find(handle);
+    if (i >= 0) RemoveAt(i);
+  }
+
+  //Moves the last item into i's place
+  void RemoveAt(int i)
+  {
+    table.SwapRemove(i);
+    if (i != size() - 1) items[i] = items.back();
+    items.pop_back();
+    version = NewSlotMapVersion();
+  }
+};
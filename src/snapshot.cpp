@@ -0,0 +1,442 @@
+#include "snapshot.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+constexpr char SNAPSHOT_MAGIC[8] = {'P', 'O', 'N', 'G', 'S', 'N', 'A', 'P'};
+constexpr uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+
+
+//The file is these structs as they are in memory. If one of these fails the
+//layout has changed, so bump SNAPSHOT_VERSION along with the size.
+static_assert(sizeof(vec2) == 8, "snapshot layout of vec2 changed");
+static_assert(sizeof(col4) == 16, "snapshot layout of col4 changed");
+static_assert(sizeof(Line) == 36, "snapshot layout of Line changed");
+static_assert(sizeof(Block) == 56, "snapshot layout of Block changed");
+static_assert(sizeof(Collision) == 48, "snapshot layout of Collision changed");
+static_assert(sizeof(SoundEvent) == 8, "snapshot layout of SoundEvent changed");
+static_assert(sizeof(SlotTable::Slot) == 8, "snapshot layout of SlotTable::Slot changed");
+static_assert(sizeof(ParticleBurst) == 144, "snapshot layout of ParticleBurst changed");
+static_assert(sizeof(SnapshotScalars) == 176, "snapshot layout of SnapshotScalars changed");
+
+static_assert(std::is_trivially_copyable<Block>::value and std::is_trivially_copyable<Collision>::value and
+    std::is_trivially_copyable<ParticleBurst>::value,
+  "snapshot arrays are copied as raw memory");
+
+
+bool IsLittleEndian()
+{
+  const uint32_t one = 1;
+  char first_byte;
+  std::memcpy(&first_byte, &one, 1);
+  return first_byte == 1;
+}
+
+
+size_t AlignUp(size_t offset)
+{
+  return (offset + SNAPSHOT_ALIGNMENT - 1) & ~(SNAPSHOT_ALIGNMENT - 1);
+}
+
+
+//Where each array comes from when writing
+struct SectionSource
+{
+  const void *data;
+  size_t count;
+  size_t element_size;
+};
+
+
+template<typename T>
+SectionSource Source(const std::vector<T> &vec)
+{
+  return {vec.data(), vec.size(), sizeof(T)};
+}
+
+
+void WriteSnapshot(std::ostream &out, const GameState &state)
+{
+  if (not IsLittleEndian()) throw std::runtime_error("Snapshots are only written on little-endian machines");
+
+  std::string menu_text;
+  std::vector<uint32_t> menu_ends;
+  for (const std::string &item : state.menu_items)
+  {
+    menu_text += item;
+    menu_ends.push_back(menu_text.size());
+  }
+
+  //Oldest first, wherever the ring has got to
+  std::vector<Collision> collisions;
+  for (int i = 0; i < state.collisions.size(); i++) collisions.push_back(state.collisions[i]);
+
+  const BallStore &balls = state.balls;
+  const ParticleStore &particles = state.particles;
+  const SectionSource sources[] = {
+    Source(balls.x),
+    Source(balls.y),
+    Source(balls.vx),
+    Source(balls.vy),
+    Source(balls.radius),
+    Source(balls.min_x),
+    Source(balls.min_y),
+    Source(balls.max_x),
+    Source(balls.max_y),
+    Source(balls.colour),
+    Source(balls.alive_mask),
+    Source(balls.handles.dense_slots),
+    Source(balls.handles.slots),
+    Source(state.lines),
+    Source(state.blocks.items),
+    Source(state.blocks.table.dense_slots),
+    Source(state.blocks.table.slots),
+    Source(state.border_lines.items),
+    Source(state.border_lines.table.dense_slots),
+    Source(state.border_lines.table.slots),
+    Source(state.player.avg_velocity),
+    Source(collisions),
+    Source(state.sound_events),
+    Source(particles.ttl),
+    Source(particles.radius),
+    Source(particles.colour),
+    Source(particles.x),
+    Source(particles.y),
+    Source(particles.rotation),
+    Source(particles.vx),
+    Source(particles.vy),
+    Source(particles.rot_vel),
+    Source(state.particle_bursts),
+    {menu_text.data(), menu_text.size(), 1},
+    Source(menu_ends)};
+
+  static_assert(sizeof(sources) / sizeof(sources[0]) == static_cast<size_t>(SnapshotSection::count), "a snapshot section is missing");
+
+  SnapshotHeader header;
+  std::memset(static_cast<void *>(&header), 0, sizeof(header));
+
+  std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+  header.version = SNAPSHOT_VERSION;
+  header.byte_order = SNAPSHOT_BYTE_ORDER;
+
+  SnapshotScalars &scalars = header.scalars;
+  scalars.width = state.width;
+  scalars.height = state.height;
+  scalars.running = state.running;
+  scalars.sound_muted = state.sound_muted;
+  scalars.debug_enabled = state.debug_enabled;
+  scalars.player_alive = state.player.alive;
+  scalars.player_sticky_ball = state.player.sticky_ball;
+  scalars.state = static_cast<int32_t>(state.state);
+  scalars.state_timer = state.state_timer;
+  scalars.time = state.time;
+  std::memcpy(scalars.rng, state.rng.s, sizeof(scalars.rng));
+  scalars.player_block = state.player.block;
+  scalars.player_sticky_ball_offset = state.player.sticky_ball_offset;
+  scalars.mouse_pointer = state.mouse_pointer;
+  scalars.selected_menu_item = state.selected_menu_item;
+  scalars.activated_menu_item = state.activated_menu_item;
+  scalars.ball_free_slot = balls.handles.free_slot;
+  scalars.block_free_slot = state.blocks.table.free_slot;
+  scalars.border_free_slot = state.border_lines.table.free_slot;
+  scalars.collision_capacity = state.collisions.GetCapacity();
+  scalars.collision_policy = static_cast<int32_t>(state.collisions.GetOverflowPolicy());
+  scalars.collision_high_water = state.collisions.GetHighWater();
+  scalars.collisions_pushed = state.collisions.GetNumPushed();
+  scalars.collisions_dropped = state.collisions.GetNumDropped();
+
+  size_t offset = AlignUp(sizeof(SnapshotHeader));
+  for (int i = 0; i < static_cast<int>(SnapshotSection::count); i++)
+  {
+    header.sections[i].offset = offset;
+    header.sections[i].count = sources[i].count;
+    header.sections[i].element_size = sources[i].element_size;
+
+    offset = AlignUp(offset + sources[i].count * sources[i].element_size);
+  }
+  header.size = offset;
+
+  const char zeros[SNAPSHOT_ALIGNMENT] = {};
+  size_t written = 0;
+
+  auto write = [&](const void *data, size_t bytes) {
+    out.write(static_cast<const char *>(data), bytes);
+    written += bytes;
+  };
+
+  write(&header, sizeof(header));
+
+  for (int i = 0; i < static_cast<int>(SnapshotSection::count); i++)
+  {
+    write(zeros, header.sections[i].offset - written);
+    write(sources[i].data, sources[i].count * sources[i].element_size);
+  }
+  write(zeros, header.size - written);
+}
+
+
+void SaveSnapshot(const std::string &filename, const GameState &state)
+{
+  std::ofstream file(filename, std::ios::binary);
+  if (not file) throw std::runtime_error("Couldn't open " + filename + " for writing");
+
+  WriteSnapshot(file, state);
+
+  if (not file) throw std::runtime_error("Couldn't write " + filename);
+}
+
+
+SnapshotView::SnapshotView(const void *memory, size_t size)
+: data(static_cast<const char *>(memory))
+, header(static_cast<const SnapshotHeader *>(memory))
+{
+  if (reinterpret_cast<uintptr_t>(memory) % alignof(uint64_t) != 0) throw std::runtime_error("Snapshot memory isn't aligned");
+  if (size < sizeof(SnapshotHeader)) throw std::runtime_error("Snapshot is too small");
+
+  if (std::memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) throw std::runtime_error("Not a snapshot");
+  if (header->byte_order != SNAPSHOT_BYTE_ORDER) throw std::runtime_error("Snapshot byte order doesn't match this machine");
+  if (header->version != SNAPSHOT_VERSION) throw std::runtime_error("Unsupported snapshot version " + std::to_string(header->version));
+  if (header->size > size) throw std::runtime_error("Snapshot is cut short");
+
+  for (const SnapshotSectionEntry &section : header->sections)
+  {
+    const bool fits = section.offset % SNAPSHOT_ALIGNMENT == 0 and
+      section.offset <= header->size and
+      section.count <= (header->size - section.offset) / std::max<uint64_t>(section.element_size, 1);
+
+    if (not fits) throw std::runtime_error("Snapshot section is out of bounds");
+  }
+}
+
+
+template<typename T>
+void CopyArray(const SnapshotArray<T> &array, std::vector<T> &out)
+{
+  out.assign(array.begin(), array.end());
+}
+
+
+void SnapshotView::CopySlotTable(SnapshotSection dense_slots, SnapshotSection slots, uint32_t free_slot, int num_items, SlotTable &out) const
+{
+  CopyArray(Get<uint32_t>(dense_slots), out.dense_slots);
+  CopyArray(Get<SlotTable::Slot>(slots), out.slots);
+  out.free_slot = free_slot;
+
+  if (not out.IsConsistent(num_items)) throw std::runtime_error("Snapshot slot table is corrupt");
+}
+
+
+//Blocks are used as they are by Simulate and the renderer, so one from a
+//damaged snapshot mustn't point outside the lines
+void CheckSnapshotBlock(const Block &block, const std::vector<Line> &lines)
+{
+  if (static_cast<int>(block.type) < 0 or static_cast<int>(block.type) >= NUM_BLOCK_TYPES)
+  {
+    throw std::runtime_error("Snapshot has a block of unknown type");
+  }
+
+  if (block.first_line < 0 or block.num_lines < 0 or int64_t(block.first_line) + block.num_lines > int64_t(lines.size()))
+  {
+    throw std::runtime_error("Snapshot has a block whose lines are out of bounds");
+  }
+}
+
+
+GameState SnapshotView::ToGameState() const
+{
+  GameState state;
+
+  const SnapshotScalars &scalars = header->scalars;
+  state.width = scalars.width;
+  state.height = scalars.height;
+  state.running = scalars.running;
+  state.sound_muted = scalars.sound_muted;
+  state.debug_enabled = scalars.debug_enabled;
+  state.player.alive = scalars.player_alive;
+  state.player.sticky_ball = scalars.player_sticky_ball;
+  if (scalars.state < static_cast<int32_t>(State::new_level) or scalars.state > static_cast<int32_t>(State::pause_menu))
+  {
+    throw std::runtime_error("Snapshot has an unknown game state");
+  }
+  state.state = static_cast<State>(scalars.state);
+  state.state_timer = scalars.state_timer;
+  state.time = scalars.time;
+  std::memcpy(state.rng.s, scalars.rng, sizeof(scalars.rng));
+  state.player.block = scalars.player_block;
+  state.player.sticky_ball_offset = scalars.player_sticky_ball_offset;
+  state.mouse_pointer = scalars.mouse_pointer;
+  state.selected_menu_item = scalars.selected_menu_item;
+  state.activated_menu_item = scalars.activated_menu_item;
+
+  BallStore &balls = state.balls;
+  CopyArray(Get<float>(SnapshotSection::ball_x), balls.x);
+  CopyArray(Get<float>(SnapshotSection::ball_y), balls.y);
+  CopyArray(Get<float>(SnapshotSection::ball_vx), balls.vx);
+  CopyArray(Get<float>(SnapshotSection::ball_vy), balls.vy);
+  CopyArray(Get<float>(SnapshotSection::ball_radius), balls.radius);
+  CopyArray(Get<float>(SnapshotSection::ball_min_x), balls.min_x);
+  CopyArray(Get<float>(SnapshotSection::ball_min_y), balls.min_y);
+  CopyArray(Get<float>(SnapshotSection::ball_max_x), balls.max_x);
+  CopyArray(Get<float>(SnapshotSection::ball_max_y), balls.max_y);
+  CopyArray(Get<col4>(SnapshotSection::ball_colour), balls.colour);
+  CopyArray(Get<uint64_t>(SnapshotSection::ball_alive_mask), balls.alive_mask);
+  for (const std::vector<float> *column : {&balls.y, &balls.vx, &balls.vy, &balls.radius, &balls.min_x, &balls.min_y, &balls.max_x, &balls.max_y})
+  {
+    if (column->size() != balls.x.size()) throw std::runtime_error("Snapshot ball columns are different lengths");
+  }
+  if (balls.colour.size() != balls.x.size()) throw std::runtime_error("Snapshot ball columns are different lengths");
+  if (balls.alive_mask.size() != (balls.x.size() + 63) / 64) throw std::runtime_error("Snapshot ball alive mask is the wrong length");
+  CopySlotTable(SnapshotSection::ball_dense_slots, SnapshotSection::ball_slots, scalars.ball_free_slot, balls.size(), balls.handles);
+
+  CopyArray(Get<Line>(SnapshotSection::lines), state.lines);
+  CopyArray(Get<Block>(SnapshotSection::blocks), state.blocks.items);
+  CopySlotTable(SnapshotSection::block_dense_slots, SnapshotSection::block_slots, scalars.block_free_slot, state.blocks.size(), state.blocks.table);
+  CopyArray(Get<Block>(SnapshotSection::border_lines), state.border_lines.items);
+  CopySlotTable(SnapshotSection::border_dense_slots, SnapshotSection::border_slots, scalars.border_free_slot, state.border_lines.size(), state.border_lines.table);
+  CopyArray(Get<float>(SnapshotSection::paddle_avg_velocity), state.player.avg_velocity);
+
+  CheckSnapshotBlock(state.player.block, state.lines);
+  for (const Block &block : state.blocks) CheckSnapshotBlock(block, state.lines);
+  for (const Block &block : state.border_lines) CheckSnapshotBlock(block, state.lines);
+
+  const SnapshotArray<Collision> collisions = Get<Collision>(SnapshotSection::collisions);
+  if (collisions.size() > scalars.collision_capacity) throw std::runtime_error("Snapshot has more collisions than its ring holds");
+  if (scalars.collision_policy != static_cast<int32_t>(OverflowPolicy::drop_newest) and
+    scalars.collision_policy != static_cast<int32_t>(OverflowPolicy::drop_oldest))
+  {
+    throw std::runtime_error("Snapshot has an unknown collision overflow policy");
+  }
+
+  state.collisions.SetCapacity(scalars.collision_capacity);
+  state.collisions.SetOverflowPolicy(static_cast<OverflowPolicy>(scalars.collision_policy));
+  for (const Collision &collision : collisions) state.collisions.Push(collision);
+  state.collisions.SetCounters(scalars.collisions_pushed, scalars.collisions_dropped, scalars.collision_high_water);
+  CopyArray(Get<SoundEvent>(SnapshotSection::sound_events), state.sound_events);
+
+  ParticleStore &particles = state.particles;
+  CopyArray(Get<float>(SnapshotSection::particle_ttl), particles.ttl);
+  CopyArray(Get<float>(SnapshotSection::particle_radius), particles.radius);
+  CopyArray(Get<col4>(SnapshotSection::particle_colour), particles.colour);
+  CopyArray(Get<float>(SnapshotSection::particle_x), particles.x);
+  CopyArray(Get<float>(SnapshotSection::particle_y), particles.y);
+  CopyArray(Get<float>(SnapshotSection::particle_rotation), particles.rotation);
+  CopyArray(Get<float>(SnapshotSection::particle_vx), particles.vx);
+  CopyArray(Get<float>(SnapshotSection::particle_vy), particles.vy);
+  CopyArray(Get<float>(SnapshotSection::particle_rot_vel), particles.rot_vel);
+  for (const std::vector<float> *column : {&particles.radius, &particles.x, &particles.y, &particles.rotation, &particles.vx, &particles.vy, &particles.rot_vel})
+  {
+    if (static_cast<int>(column->size()) != particles.size()) throw std::runtime_error("Snapshot particle columns are different lengths");
+  }
+  if (static_cast<int>(particles.colour.size()) != particles.size()) throw std::runtime_error("Snapshot particle columns are different lengths");
+
+  CopyArray(Get<ParticleBurst>(SnapshotSection::particle_bursts), state.particle_bursts);
+  for (const ParticleBurst &burst : state.particle_bursts)
+  {
+    if (burst.count < 0 or burst.count > BURST_MAX_PARTICLES or
+      burst.num_origins < 0 or burst.num_origins > BURST_MAX_ORIGINS or
+      burst.num_velocities < 0 or burst.num_velocities > BURST_MAX_VELOCITIES)
+    {
+      throw std::runtime_error("Snapshot has a particle burst out of bounds");
+    }
+  }
+
+  const SnapshotArray<char> menu_text = Get<char>(SnapshotSection::menu_text);
+  uint32_t start = 0;
+  for (uint32_t end : Get<uint32_t>(SnapshotSection::menu_ends))
+  {
+    if (end < start or end > static_cast<uint32_t>(menu_text.size())) throw std::runtime_error("Snapshot menu text is out of bounds");
+
+    state.menu_items.emplace_back(menu_text.begin() + start, menu_text.begin() + end);
+    start = end;
+  }
+
+  return state;
+}
+
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string &filename)
+{
+  file_handle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file_handle == INVALID_HANDLE_VALUE) throw std::runtime_error("Couldn't open " + filename);
+
+  LARGE_INTEGER file_size;
+  GetFileSizeEx(file_handle, &file_size);
+  size = file_size.QuadPart;
+
+  mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (not mapping_handle)
+  {
+    CloseHandle(file_handle);
+    throw std::runtime_error("Couldn't map " + filename);
+  }
+
+  data = static_cast<const char *>(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+  if (not data)
+  {
+    CloseHandle(mapping_handle);
+    CloseHandle(file_handle);
+    throw std::runtime_error("Couldn't map " + filename);
+  }
+}
+
+
+MappedFile::~MappedFile()
+{
+  UnmapViewOfFile(data);
+  CloseHandle(mapping_handle);
+  CloseHandle(file_handle);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string &filename)
+{
+  const int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) throw std::runtime_error("Couldn't open " + filename);
+
+  struct stat info;
+  if (fstat(fd, &info) != 0 or info.st_size == 0)
+  {
+    close(fd);
+    throw std::runtime_error("Couldn't map " + filename);
+  }
+  size = info.st_size;
+
+  void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (mapped == MAP_FAILED) throw std::runtime_error("Couldn't map " + filename);
+  data = static_cast<const char *>(mapped);
+}
+
+
+MappedFile::~MappedFile()
+{
+  munmap(const_cast<char *>(data), size);
+}
+
+#endif
+
+
+GameState LoadSnapshot(const std::string &filename)
+{
+  MappedFile file(filename);
+  return SnapshotView(file.GetData(), file.GetSize()).ToGameState();
+}
@@ -0,0 +1,229 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+
+#include "game.hpp"
+
+
+//A GameState saved as one block of memory, for checkpoints, restarts and
+//handing a game to another process. The file is the in-memory layout of the
+//structs, little-endian, so loading it is checking the header and then
+//either pointing into it (SnapshotView) or copying whole arrays out of it
+//(ToGameState), with no parsing of single fields.
+//
+//Layout:
+//  SnapshotHeader   magic, version, byte order, size, the scalar fields and
+//                   a table of where each array is
+//  arrays           one after another, each on a SNAPSHOT_ALIGNMENT boundary
+//
+//The slot tables are saved along with the items so handles (see
+//slot_map.hpp) keep working. The broadphase structures are not saved,
+//Simulate builds them again.
+//Changing any of the saved structs changes the layout, which needs a new
+//SNAPSHOT_VERSION (see the size checks in snapshot.cpp).
+
+constexpr uint32_t SNAPSHOT_VERSION = 5;
+constexpr size_t SNAPSHOT_ALIGNMENT = 16;
+
+
+enum class SnapshotSection : uint32_t
+{
+  ball_x,
+  ball_y,
+  ball_vx,
+  ball_vy,
+  ball_radius,
+  ball_min_x,
+  ball_min_y,
+  ball_max_x,
+  ball_max_y,
+  ball_colour,
+  ball_alive_mask,
+  ball_dense_slots,
+  ball_slots,
+
+  lines,
+  blocks,
+  block_dense_slots,
+  block_slots,
+  border_lines,
+  border_dense_slots,
+  border_slots,
+  paddle_avg_velocity,
+
+  collisions,
+  sound_events,
+
+  particle_ttl,
+  particle_radius,
+  particle_colour,
+  particle_x,
+  particle_y,
+  particle_rotation,
+  particle_vx,
+  particle_vy,
+  particle_rot_vel,
+  particle_bursts,
+
+  //All the menu item strings end to end, and where each one ends
+  menu_text,
+  menu_ends,
+
+  count
+};
+
+
+struct SnapshotSectionEntry
+{
+  uint64_t offset;
+  uint64_t count;
+  uint32_t element_size;
+  uint32_t padding;
+};
+
+
+//Everything in GameState that isn't an array
+struct SnapshotScalars
+{
+  int32_t width;
+  int32_t height;
+
+  uint8_t running;
+  uint8_t sound_muted;
+  uint8_t debug_enabled;
+  uint8_t player_alive;
+  uint8_t player_sticky_ball;
+  uint8_t padding[3];
+
+  int32_t state;
+  float state_timer;
+  uint32_t rng[4];
+
+  Block player_block;
+  vec2 player_sticky_ball_offset;
+  vec2 mouse_pointer;
+
+  int32_t selected_menu_item;
+  int32_t activated_menu_item;
+
+  //Heads of the slot tables' free lists
+  uint32_t ball_free_slot;
+  uint32_t block_free_slot;
+  uint32_t border_free_slot;
+  uint32_t padding2;
+
+  //The collisions ring's settings and counters, its events are a section
+  int32_t collision_capacity;
+  int32_t collision_policy;
+  int32_t collision_high_water;
+  uint32_t padding3;
+  uint64_t collisions_pushed;
+  uint64_t collisions_dropped;
+
+  double time;
+};
+
+
+struct SnapshotHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t size;
+
+  SnapshotScalars scalars;
+
+  SnapshotSectionEntry sections[static_cast<int>(SnapshotSection::count)];
+};
+
+
+//A read only run of elements inside a snapshot
+template<typename T>
+struct SnapshotArray
+{
+  const T *i1;
+  const T *i2;
+
+  const T *begin() const { return i1; }
+  const T *end() const { return i2; }
+  int size() const { return i2 - i1; }
+  const T &operator[](int i) const { return i1[i]; }
+};
+
+
+void WriteSnapshot(std::ostream &out, const GameState &state);
+void SaveSnapshot(const std::string &filename, const GameState &state);
+
+
+//A snapshot somewhere in memory, checked but not copied. The memory has to
+//stay put while the view is used, and start on an 8 byte boundary.
+class SnapshotView
+{
+private:
+  const char *data;
+  const SnapshotHeader *header;
+
+  template<typename T>
+  SnapshotArray<T> Get(SnapshotSection section) const;
+
+  //Throws if the table doesn't fit the items
+  void CopySlotTable(SnapshotSection dense_slots, SnapshotSection slots, uint32_t free_slot, int num_items, SlotTable &out) const;
+
+public:
+  //Throws if it isn't a snapshot this version can read
+  SnapshotView(const void *data, size_t size);
+
+  const SnapshotScalars &GetScalars() const { return header->scalars; }
+
+  SnapshotArray<Line> GetLines() const { return Get<Line>(SnapshotSection::lines); }
+  SnapshotArray<Block> GetBlocks() const { return Get<Block>(SnapshotSection::blocks); }
+  SnapshotArray<Block> GetBorderLines() const { return Get<Block>(SnapshotSection::border_lines); }
+  SnapshotArray<float> GetParticleColumn(SnapshotSection column) const { return Get<float>(column); }
+  SnapshotArray<float> GetBallColumn(SnapshotSection column) const { return Get<float>(column); }
+
+  //Copies it all out into a GameState, an array at a time
+  GameState ToGameState() const;
+};
+
+
+template<typename T>
+SnapshotArray<T> SnapshotView::Get(SnapshotSection section) const
+{
+  const SnapshotSectionEntry &entry = header->sections[static_cast<int>(section)];
+  if (entry.element_size != sizeof(T)) throw std::runtime_error("Snapshot section has the wrong element size");
+
+  const T *first = reinterpret_cast<const T *>(data + entry.offset);
+  return {first, first + entry.count};
+}
+
+
+//A whole file mapped into memory, read only
+class MappedFile
+{
+private:
+  const char *data = nullptr;
+  size_t size = 0;
+
+#ifdef _WIN32
+  void *file_handle = nullptr;
+  void *mapping_handle = nullptr;
+#endif
+
+public:
+  explicit MappedFile(const std::string &filename);
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  const char *GetData() const { return data; }
+  size_t GetSize() const { return size; }
+};
+
+
+//Maps the file and copies the state out of it
+GameState LoadSnapshot(const std::string &filename);
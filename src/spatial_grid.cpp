@@ -0,0 +1,203 @@
+#include "spatial_grid.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "game.hpp"
+
+
+SpatialGrid::SpatialGrid(float cell_size)
+: cell_size(cell_size)
+{
+}
+
+
+void SpatialGrid::GetCellRange(const BoundingBox &bounds, int &x1, int &y1, int &x2, int &y2) const
+{
+  //Anything outside the play field gets clamped into the edge cells
+  auto cell = [this](float v, int count) {
+    int c = static_cast<int>(std::floor(v / cell_size));
+    return std::min(std::max(c, 0), count - 1);
+  };
+
+  x1 = cell(bounds.top_left.x, columns);
+  y1 = cell(bounds.top_left.y, rows);
+  x2 = cell(bounds.bottom_right.x, columns);
+  y2 = cell(bounds.bottom_right.y, rows);
+}
+
+
+void SpatialGrid::Build(const std::vector<Block> &blocks, int width, int height)
+{
+  columns = std::max(1, static_cast<int>(std::ceil(width / cell_size)));
+  rows = std::max(1, static_cast<int>(std::ceil(height / cell_size)));
+
+  const int num_cells = columns * rows;
+
+  //Two passes, count blocks per cell then fill
+  cell_start.assign(num_cells + 1, 0);
+
+  for (const Block &block : blocks)
+  {
+    int x1, y1, x2, y2;
+    GetCellRange(block.bounds, x1, y1, x2, y2);
+
+    for (int y = y1; y <= y2; y++)
+      for (int x = x1; x <= x2; x++)
+        cell_start[y * columns + x + 1]++;
+  }
+
+  for (int i = 0; i < num_cells; i++)
+  {
+    cell_start[i + 1] += cell_start[i];
+  }
+
+  entries.assign(cell_start[num_cells], -1);
+
+  std::vector<int> fill(cell_start.begin(), cell_start.end() - 1);
+
+  for (int i = 0; i < static_cast<int>(blocks.size()); i++)
+  {
+    int x1, y1, x2, y2;
+    GetCellRange(blocks[i].bounds, x1, y1, x2, y2);
+
+    for (int y = y1; y <= y2; y++)
+      for (int x = x1; x <= x2; x++)
+        entries[fill[y * columns + x]++] = i;
+  }
+
+  num_blocks = blocks.size();
+  num_removed = 0;
+  built = true;
+}
+
+
+void SpatialGrid::Clear()
+{
+  columns = 0;
+  rows = 0;
+  cell_start.clear();
+  entries.clear();
+  num_blocks = 0;
+  num_removed = 0;
+  built = false;
+}
+
+
+void SpatialGrid::SwapRemoveBlock(const std::vector<Block> &blocks, int i)
+{
+  if (not built) return;
+
+  const int last = num_blocks - 1;
+  if (static_cast<int>(blocks.size()) != num_blocks or i > last)
+  {
+    Clear();
+    return;
+  }
+
+  //A block is listed once in each cell it touches
+  int x1, y1, x2, y2;
+  GetCellRange(blocks[i].bounds, x1, y1, x2, y2);
+
+  for (int y = y1; y <= y2; y++)
+  {
+    for (int x = x1; x <= x2; x++)
+    {
+      const int cell = y * columns + x;
+      auto end = entries.begin() + cell_start[cell + 1];
+      auto found = std::find(entries.begin() + cell_start[cell], end, i);
+      if (found == end)
+      {
+        //The block moved since the grid was built
+        Clear();
+        return;
+      }
+
+      *found = -1;
+      num_removed++;
+    }
+  }
+
+  if (i != last)
+  {
+    GetCellRange(blocks[last].bounds, x1, y1, x2, y2);
+
+    for (int y = y1; y <= y2; y++)
+    {
+      for (int x = x1; x <= x2; x++)
+      {
+        const int cell = y * columns + x;
+        const int begin = cell_start[cell];
+        const int end = cell_start[cell + 1];
+        int e = std::find(entries.begin() + begin, entries.begin() + end, last) - entries.begin();
+        if (e == end)
+        {
+          Clear();
+          return;
+        }
+
+        entries[e] = i;
+
+        //The last block was the highest in the cell, i has to move down past
+        //any higher ones (and holes) for Query to see them in order
+        for (; e > begin and (entries[e - 1] < 0 or entries[e - 1] > i); e--)
+        {
+          std::swap(entries[e - 1], entries[e]);
+        }
+      }
+    }
+  }
+
+  num_blocks--;
+
+  //Squeeze out the holes once they are the majority of the array
+  if (num_removed * 2 > static_cast<int>(entries.size()))
+  {
+    int write = 0;
+    for (int cell = 0; cell < columns * rows; cell++)
+    {
+      const int begin = cell_start[cell];
+      const int end = cell_start[cell + 1];
+      cell_start[cell] = write;
+
+      for (int i = begin; i < end; i++)
+      {
+        if (entries[i] >= 0) entries[write++] = entries[i];
+      }
+    }
+    cell_start[columns * rows] = write;
+    entries.resize(write);
+    num_removed = 0;
+  }
+}
+
+
+void SpatialGrid::Query(const BoundingBox &bounds, std::vector<int> &out_blocks) const
+{
+  out_blocks.clear();
+  if (not built) return;
+
+  int x1, y1, x2, y2;
+  GetCellRange(bounds, x1, y1, x2, y2);
+
+  for (int y = y1; y <= y2; y++)
+  {
+    for (int x = x1; x <= x2; x++)
+    {
+      const int cell = y * columns + x;
+      for (int i = cell_start[cell]; i < cell_start[cell + 1]; i++)
+      {
+        if (entries[i] >= 0) out_blocks.push_back(entries[i]);
+      }
+    }
+  }
+
+  //Cells are kept in ascending order, but blocks spanning several cells show
+  //up more than once and the collision code must see them in the same order
+  //as a walk over GameState::blocks
+  if (x1 != x2 or y1 != y2)
+  {
+    std::sort(out_blocks.begin(), out_blocks.end());
+    out_blocks.erase(std::unique(out_blocks.begin(), out_blocks.end()), out_blocks.end());
+  }
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vector>
+
+#include "maths_types.hpp"
+
+
+//Uniform grid over the play field, used as a broadphase for ball vs block
+//collisions. Cells store block indices (into GameState::blocks) in one flat
+//array, a block is listed in every cell its bounds touch.
+
+class SpatialGrid
+{
+private:
+  float cell_size = 64.0f;
+  int columns = 0;
+  int rows = 0;
+  bool built = false;
+
+  //cell i owns entries[cell_start[i] .. cell_start[i+1]), removed blocks are -1
+  std::vector<int> cell_start;
+  std::vector<int> entries;
+  int num_blocks = 0;
+  int num_removed = 0;
+
+  void GetCellRange(const BoundingBox &bounds, int &x1, int &y1, int &x2, int &y2) const;
+
+public:
+  SpatialGrid() = default;
+  explicit SpatialGrid(float cell_size);
+
+  void Build(const std::vector<struct Block> &blocks, int width, int height);
+  void Clear();
+
+  bool IsBuilt() const { return built; }
+  int GetNumBlocks() const { return num_blocks; }
+
+  //Call before GameState::blocks removes block i, drops it from its cells
+  //and gives the last block its index, the way SlotMap::RemoveAt moves it
+  void SwapRemoveBlock(const std::vector<struct Block> &blocks, int i);
+
+  //Indexes of all blocks sharing a cell with bounds, sorted and unique
+  void Query(const BoundingBox &bounds, std::vector<int> &out_blocks) const;
+};
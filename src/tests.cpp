@@ -1,13 +1,65 @@
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <new>
+#include <sstream>
+#include <stdexcept>
 using std::cout;
 using std::endl;
 
+#include "batch.hpp"
+#include "fixed_timestep.hpp"
+#include "game.hpp"
+#include "level.hpp"
 #include "maths.hpp"
+#include "maths_collisions.hpp"
+#include "metrics.hpp"
+#include "profiler.hpp"
+#include "replay.hpp"
+#include "snapshot.hpp"
+#include "thread_pool.hpp"
 #include "to_string.hpp"
 
 
-//std::ostringstream TRACE;
+//Every heap allocation in the test program goes through here, so tests can
+//check that a piece of code doesn't make any
+std::atomic<long> num_allocations{0};
+
+void *operator new(std::size_t size)
+{
+  num_allocations++;
+  if (void *p = std::malloc(size ? size : 1)) return p;
+  throw std::bad_alloc();
+}
+
+//GCC can't tell the new above is malloc once these are inlined, and warns
+//that free gets what new returned
+#if defined(__GNUC__) and not defined(__clang__) and __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void *p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+  std::free(p);
+}
+
+#if defined(__GNUC__) and not defined(__clang__) and __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
 
 
 vec2 GetGLStyle(const float *data)
@@ -152,9 +204,1951 @@ void TestMaths()
   TestMat4();
 }
 
-int main()
+void Check(bool condition, const std::string &what)
 {
-  TestMaths();
+  if (not condition) throw std::runtime_error("Test failed: " + what);
+}
+
+
+//A wide field packed with blocks and a bunch of balls already in play
+GameState MakeBusyGame(const Game &game, int width, int height, int num_balls, uint64_t seed = 1234)
+{
+  const BlockType types[] = {BlockType::square, BlockType::triangle_left,
+    BlockType::triangle_right, BlockType::rectangle,
+    BlockType::rect_triangle_left, BlockType::rect_triangle_right};
+
+  GameState state = game.NewGame(width, height, seed);
+  state.blocks.clear();
+
+  int n = 0;
+  for (float y = 50.0f; y < height / 2.0f; y += 60.0f)
+  {
+    for (float x = 50.0f; x < width - 150.0f; x += 110.0f)
+    {
+      state.blocks.Add(game.NewBlock(state, {x, y}, types[n++ % 6]));
+    }
+  }
+
+  for (int i = 0; i < num_balls; i++)
+  {
+    vec2 pos{RandomFloat(state.rng, 50.0f, width - 50.0f), RandomFloat(state.rng, height / 2.0f, height - 100.0f)};
+    state.balls.Add(Ball(pos, angle_to_vec2(RandomFloat(state.rng, 0.0f, TWO_PI), 300.0f), RandomRGB(state.rng)));
+  }
+
+  state.player.sticky_ball = false;
+  state.state = State::mid_game;
+
+  return state;
+}
+
+
+GameState RunBusyGame(Broadphase broadphase, int frames)
+{
+  Game game;
+  game.SetBroadphase(broadphase);
+
+  GameState state = MakeBusyGame(game, 2000, 1500, 50);
+
+  for (int i = 0; i < frames; i++)
+  {
+    game.SimulateInPlace(state, 1.0f / 60.0f);
+  }
+
+  return state;
+}
+
+
+void CheckSameGame(const GameState &expected, const GameState &state, const std::string &name)
+{
+  Check(expected.blocks.size() == state.blocks.size(), name + " block count matches brute force");
+  Check(expected.balls.size() == state.balls.size(), name + " ball count matches brute force");
+  Check(expected.particles.size() == state.particles.size(), name + " particle count matches brute force");
+
+  for (int i = 0; i < expected.blocks.size(); i++)
+  {
+    Check(expected.blocks[i].position.x == state.blocks[i].position.x and
+        expected.blocks[i].position.y == state.blocks[i].position.y,
+      name + " leaves the same blocks");
+  }
+
+  for (int i = 0; i < expected.balls.size(); i++)
+  {
+    const Ball a = expected.balls.Get(i);
+    const Ball b = state.balls.Get(i);
+    Check(a.position.x == b.position.x and a.position.y == b.position.y and
+        a.velocity.x == b.velocity.x and a.velocity.y == b.velocity.y,
+      name + " ball state matches brute force");
+  }
+}
+
+
+void CheckSameRandom(const GameState &expected, const GameState &state, const std::string &name)
+{
+  Check(std::equal(std::begin(expected.rng.s), std::end(expected.rng.s), std::begin(state.rng.s)), name + " use the same random numbers");
+}
+
+
+void TestBroadphase()
+{
+  cout << "\n\n==== Testing Broadphase\n"
+       << endl;
+
+  GameState brute = RunBusyGame(Broadphase::brute_force, 300);
+  GameState grid = RunBusyGame(Broadphase::grid, 300);
+  GameState tree = RunBusyGame(Broadphase::aabb_tree, 300);
+
+  cout << "blocks left: " << brute.blocks.size() << " / " << grid.blocks.size() << " / " << tree.blocks.size() << endl;
+  cout << "balls left: " << brute.balls.size() << " / " << grid.balls.size() << " / " << tree.balls.size() << endl;
+  cout << "particles: " << brute.particles.size() << " / " << grid.particles.size() << " / " << tree.particles.size() << endl;
+
+  CheckSameGame(brute, grid, "grid");
+  CheckSameGame(brute, tree, "aabb_tree");
+
+  //A block added to a game that has already ticked gets the broadphase built
+  //again, rather than every query going back to testing every block
+  for (Broadphase broadphase : {Broadphase::grid, Broadphase::aabb_tree})
+  {
+    Game game;
+    game.SetBroadphase(broadphase);
+    GameState state = MakeBusyGame(game, 2000, 1500, 50);
+    for (int i = 0; i < 10; i++) game.SimulateInPlace(state, 1.0f / 60.0f);
+
+    state.blocks.Add(game.NewBlock(state, {1900.0f, 1300.0f}, BlockType::square));
+    game.SimulateInPlace(state, 1.0f / 60.0f);
+
+    const int num_blocks = (broadphase == Broadphase::grid) ? state.block_grid.GetNumBlocks() : state.block_tree.GetNumBlocks();
+    Check(num_blocks == state.blocks.size(), "broadphase is rebuilt after a block is added");
+
+    std::vector<int> found;
+    Check(game.QueryBroadphase(state, state.blocks[state.blocks.size() - 1].bounds, found), "broadphase is used after a block is added");
+    Check(not found.empty() and found.back() == state.blocks.size() - 1, "broadphase finds the added block");
+  }
+}
+
+
+void TestAABBTreeSegments()
+{
+  cout << "\n\n==== Testing AABBTree segment queries\n"
+       << endl;
+
+  Game game;
+  Random rng(99);
+  GameState state = MakeBusyGame(game, 2000, 1500, 0, 99);
+
+  //Kill off some blocks so the queries run against a refitted tree
+  AABBTree tree;
+  tree.Build(state.blocks.items);
+  for (int i = state.blocks.size() - 1; i >= 0; i--)
+  {
+    if (i % 3) continue;
+
+    tree.SwapRemoveBlock(i);
+    state.blocks.RemoveAt(i);
+  }
+
+  cout << "blocks: " << state.blocks.size() << "  tree depth: " << tree.GetDepth() << endl;
+
+  std::vector<int> found;
+  int total = 0;
+  for (int i = 0; i < 200; i++)
+  {
+    vec2 p1{RandomFloat(rng, 0.0f, 2000.0f), RandomFloat(rng, 0.0f, 1500.0f)};
+    vec2 p2{RandomFloat(rng, 0.0f, 2000.0f), RandomFloat(rng, 0.0f, 1500.0f)};
+
+    std::vector<int> expected;
+    for (int b = 0; b < static_cast<int>(state.blocks.size()); b++)
+    {
+      if (SegmentCollides(state.blocks[b].bounds, p1, p2)) expected.push_back(b);
+    }
+
+    tree.QuerySegment(p1, p2, found);
+    Check(found == expected, "segment query matches brute force");
+    total += found.size();
+  }
+
+  cout << "segment hits: " << total << endl;
+
+  const vec2 inside = state.blocks[0].bounds.top_left + vec2{1.0f, 1.0f};
+  tree.QueryRay(inside, {1.0f, 0.0f}, 10.0f, found);
+  Check(std::find(found.begin(), found.end(), 0) != found.end(), "ray query finds the block it starts in");
+  tree.QueryRay(inside, {0.0f, 0.0f}, 10.0f, found);
+  Check(found.empty(), "ray with no direction finds nothing");
+}
+
+
+void CheckBlockLines(const GameState &state, const Block &block)
+{
+  Check(block.first_line >= 0 and block.first_line + block.num_lines <= static_cast<int>(state.lines.size()),
+    "block lines are inside the pool");
+
+  for (const Line &line : block.GetLines(state.lines))
+  {
+    const vec2 normal = get_normal(line.p1, line.p2);
+    const vec2 direction = line.p2 - line.p1;
+
+    Check(line.normal.x == normal.x and line.normal.y == normal.y, "line normal is precomputed");
+    Check(line.direction.x == direction.x and line.direction.y == direction.y, "line direction is precomputed");
+    Check(line.length_sq == distance_squared(line.p1, line.p2), "line length is precomputed");
+
+    for (vec2 p : {line.p1, line.p2})
+    {
+      Check(in_range(block.bounds.top_left.x, block.bounds.bottom_right.x, p.x) and
+          in_range(block.bounds.top_left.y, block.bounds.bottom_right.y, p.y),
+        "block lines are inside its bounds");
+    }
+  }
+}
+
+
+void TestLinePool()
+{
+  cout << "\n\n==== Testing line pool\n"
+       << endl;
+
+  Game game;
+  GameState state = MakeBusyGame(game, 2000, 1500, 50);
+  const int start_lines = state.lines.size();
+
+  for (int i = 0; i < 300; i++)
+  {
+    game.SimulateInPlace(state, 1.0f / 60.0f);
+  }
+
+  //Knock out most of what is left so the next frame has to compact
+  for (int i = 0; i < state.blocks.size(); i++)
+  {
+    if (i % 4) state.blocks[i].alive = false;
+  }
+  game.SimulateInPlace(state, 1.0f / 60.0f);
+
+  //Moving the paddle rewrites its lines where they are
+  const int paddle_line = state.player.block.first_line;
+  game.UpdatePlayer(state, {300.0f, 0.0f});
+  Check(state.player.block.first_line == paddle_line, "paddle keeps its lines");
+
+  int live = state.player.block.num_lines;
+  for (const auto *vec : {&state.blocks, &state.border_lines})
+  {
+    for (const Block &block : *vec)
+    {
+      CheckBlockLines(state, block);
+      live += block.num_lines;
+    }
+  }
+  CheckBlockLines(state, state.player.block);
+
+  cout << "lines: " << start_lines << " -> " << state.lines.size() << "  live: " << live << endl;
+
+  Check(static_cast<int>(state.lines.size()) < start_lines, "pool is compacted after blocks die");
+  Check(live * 2 >= static_cast<int>(state.lines.size()), "pool is at least half live lines");
+}
+
+
+void TestInPlaceSimulate()
+{
+  cout << "\n\n==== Testing SimulateInPlace\n"
+       << endl;
+
+  Game game;
+  const GameState start = MakeBusyGame(game, 2000, 1500, 50);
+
+  //The copying Simulate and the in place one agree
+  GameState copied = start;
+  for (int i = 0; i < 200; i++)
+  {
+    const GameState &last = copied;
+    copied = game.Simulate(last, 1.0f / 60.0f);
+  }
+
+  GameState in_place = start;
+  for (int i = 0; i < 200; i++)
+  {
+    game.SimulateInPlace(in_place, 1.0f / 60.0f);
+  }
+
+  CheckSameGame(copied, in_place, "SimulateInPlace");
+
+  //Once everything has grown to fit, frames should not touch the heap
+  auto reserve = [](GameState &state) {
+    state.particles.reserve(100000);
+    state.collisions.reserve();
+    state.sound_events.reserve(1000);
+  };
+
+  GameState state = start;
+  reserve(state);
+
+  //Copies don't keep capacity, so reserve in the FixedTimestep's own state
+  FixedTimestep steady(state);
+  reserve(steady.Current());
+
+  for (int i = 0; i < 60; i++)
+  {
+    game.SimulateInPlace(state, 1.0f / 60.0f);
+    state.sound_events.clear();
+
+    steady.Advance(game, 1.0f / 60.0f);
+    steady.Current().sound_events.clear();
+  }
+
+  const long in_place_before = num_allocations;
+  for (int i = 0; i < 300; i++)
+  {
+    game.SimulateInPlace(state, 1.0f / 60.0f);
+    state.sound_events.clear();
+  }
+  const long in_place_allocations = num_allocations - in_place_before;
+
+  const long steady_before = num_allocations;
+  for (int i = 0; i < 300; i++)
+  {
+    steady.Advance(game, 1.0f / 60.0f);
+    steady.Current().sound_events.clear();
+  }
+  const long steady_allocations = num_allocations - steady_before;
+
+  cout << "blocks left: " << state.blocks.size() << "  particles: " << state.particles.size() << endl;
+  cout << "allocations over 300 frames: in place " << in_place_allocations
+       << ", fixed timestep " << steady_allocations << endl;
+
+  Check(in_place_allocations == 0, "SimulateInPlace doesn't allocate");
+  Check(steady_allocations == 0, "FixedTimestep::Advance doesn't allocate");
+  Check(steady.GetNumTicks() == 360, "FixedTimestep runs a tick a frame");
+}
+
+
+//Runs the busy game for the given frame times through a FixedTimestep
+FixedTimestep RunFixedTimestep(const Game &game, const std::vector<float> &frames)
+{
+  FixedTimestep sim(MakeBusyGame(game, 2000, 1500, 50));
+  sim.SetMaxCatchUp(1000);
+
+  for (float frame_dt : frames)
+  {
+    sim.Advance(game, frame_dt);
+    Check(sim.GetAlpha() >= 0.0f and sim.GetAlpha() < 1.0f, "alpha is inside the tick");
+  }
+
+  return sim;
+}
+
+
+void TestFixedTimestep()
+{
+  cout << "\n\n==== Testing FixedTimestep\n"
+       << endl;
+
+  Game game;
+
+  //Four seconds and half a tick, cut into frames three different ways
+  const float seconds = 4.0f + (0.5f / 60.0f);
+
+  Random rng(5);
+  auto split = [seconds, &rng](float frame_dt) {
+    std::vector<float> frames;
+    float total = 0.0f;
+    while (total < seconds)
+    {
+      float dt = (frame_dt > 0.0f) ? frame_dt : RandomFloat(rng, 0.001f, 0.05f);
+      frames.push_back(std::min(dt, seconds - total));
+      total += frames.back();
+    }
+    return frames;
+  };
+
+  FixedTimestep a = RunFixedTimestep(game, split(1.0f / 20.0f));
+  FixedTimestep b = RunFixedTimestep(game, split(1.0f / 144.0f));
+  FixedTimestep c = RunFixedTimestep(game, split(0.0f));
+
+  cout << "ticks: " << a.GetNumTicks() << " / " << b.GetNumTicks() << " / " << c.GetNumTicks() << endl;
+  cout << "balls: " << a.Current().balls.size() << "  blocks: " << a.Current().blocks.size() << endl;
+
+  //Same ticks give the same game, however the frames were cut up
+  Check(a.GetNumTicks() == 240, "four seconds of ticks");
+  Check(a.GetNumTicks() == b.GetNumTicks() and a.GetNumTicks() == c.GetNumTicks(), "tick count doesn't depend on frames");
+  CheckSameGame(a.Current(), b.Current(), "144Hz frames");
+  CheckSameGame(a.Current(), c.Current(), "uneven frames");
+
+  //A long stall only runs up to the catch up limit
+  FixedTimestep stalled(a.Current());
+  stalled.SetMaxCatchUp(5);
+  Check(stalled.Advance(game, 2.0f) == 5, "catch up is capped");
+  Check(stalled.GetDroppedTime() > 1.0, "stalled time is dropped");
+  Check(stalled.GetAlpha() == 0.0f, "nothing left over after a stall");
+
+  stalled.SetTickRate(120.0f);
+  Check(stalled.Advance(game, 1.0f / 60.0f + 0.001f) == 2, "ticks at the new rate");
+
+  //Drawing halfway between ticks puts balls halfway along
+  const PreviousTick &prev = a.Previous();
+  const GameState &curr = a.Current();
+  Check(prev.time < curr.time, "the tick before is kept");
+
+  int matched = 0;
+  for (int i = 0; i < curr.balls.size(); i++)
+  {
+    const int j = prev.ball_handles.Find(curr.balls.GetHandle(i));
+    if (j < 0) continue;
+    matched++;
+
+    const vec2 p0{prev.ball_x[j], prev.ball_y[j]};
+    const vec2 p1 = curr.balls.GetPosition(i);
+    const vec2 mid = InterpolateBallPosition(prev, curr, i, 0.5f);
+    Check(mid.x == p0.x + (p1.x - p0.x) * 0.5f and mid.y == p0.y + (p1.y - p0.y) * 0.5f, "interpolated ball position");
+  }
+  Check(matched > 0, "balls are matched up with the tick before");
+
+  //A ball the tick before didn't have is drawn where it is
+  FixedTimestep fresh(a.Current());
+  fresh.Current().balls.Add(Ball({5.0f, 5.0f}, {1.0f, 1.0f}, {1.0f, 1.0f, 1.0f, 1.0f}));
+  const int added = fresh.Current().balls.size() - 1;
+  const vec2 drawn = InterpolateBallPosition(fresh.Previous(), fresh.Current(), added, 0.5f);
+  Check(drawn.x == 5.0f and drawn.y == 5.0f, "new balls aren't interpolated");
+}
+
+
+void TestSweepCircleLine()
+{
+  //Ball of radius 10 moving 100 right, towards a wall at x = 50
+  const Line wall({50.0f, 20.0f}, {50.0f, -20.0f});
+
+  float t = 1.0f;
+  vec2 normal{};
+  Check(SweepCircleLine({0.0f, 0.0f}, {100.0f, 0.0f}, 10.0f, wall, t, normal), "sweep hits the wall");
+  Check(fabsf(t - 0.4f) < 1e-6f and normal.x == -1.0f and normal.y == 0.0f, "sweep time and normal");
+
+  //Just past the end of the wall it clips the end point instead
+  t = 1.0f;
+  Check(SweepCircleLine({0.0f, 25.0f}, {100.0f, 0.0f}, 10.0f, wall, t, normal), "sweep hits the end point");
+  Check(t > 0.4f and t < 0.5f and normal.x < 0.0f and normal.y > 0.0f, "end point time and normal");
+
+  //Moving away, or passing by, or an earlier hit already found
+  t = 1.0f;
+  Check(not SweepCircleLine({0.0f, 0.0f}, {-100.0f, 0.0f}, 10.0f, wall, t, normal), "sweep moving away");
+  Check(not SweepCircleLine({0.0f, 40.0f}, {100.0f, 0.0f}, 10.0f, wall, t, normal), "sweep passing by");
+  t = 0.2f;
+  Check(not SweepCircleLine({0.0f, 0.0f}, {100.0f, 0.0f}, 10.0f, wall, t, normal), "sweep later than best");
+}
+
+
+//A single block and a very fast ball heading straight at it
+GameState MakeTunnelGame(const Game &game)
+{
+  GameState state = game.NewGame(1000, 1000, 1);
+  state.blocks.clear();
+  state.blocks.Add(game.NewBlock(state, {500.0f, 300.0f}, BlockType::square));
+  state.balls.Add(Ball({525.0f, 600.0f}, {0.0f, -20000.0f}, {1.0f, 1.0f, 1.0f, 1.0f}));
+  state.player.sticky_ball = false;
+  state.state = State::mid_game;
+  return state;
+}
+
+
+void TestSweptCollisions()
+{
+  cout << "\n\n==== Testing swept collisions\n"
+       << endl;
+
+  TestSweepCircleLine();
+
+  //Discrete steps jump right over the block, swept ones hit it
+  Game game;
+  GameState discrete = MakeTunnelGame(game);
+  game.SimulateInPlace(discrete, 1.0f / 60.0f);
+  Check(discrete.blocks.size() == 1 and discrete.balls.GetPosition(0).y < 300.0f, "discrete collisions tunnel through");
+
+  game.SetCollisionMode(CollisionMode::swept);
+  GameState swept = MakeTunnelGame(game);
+  game.SimulateInPlace(swept, 1.0f / 60.0f);
+  Check(swept.blocks.empty(), "swept collision breaks the block");
+  Check(swept.balls.GetVelocity(0).y > 0.0f, "swept collision bounces the ball");
+  Check(swept.balls.GetPosition(0).y > 350.0f, "ball ends up below the block");
+
+  //Halfway along it slips between two corners exactly a radius either side of
+  //its path, grazing both at once, and their normals cancel out
+  GameState wedged = MakeTunnelGame(game);
+  wedged.blocks.clear();
+  wedged.blocks.Add(game.NewBlock(wedged, {538.0f, 416.0f}, BlockType::square));
+  wedged.blocks.Add(game.NewBlock(wedged, {604.0f, 478.0f}, BlockType::square));
+  wedged.balls.Set(0, Ball({500.0f, 600.0f}, {12288.0f, -16384.0f}, {1.0f, 1.0f, 1.0f, 1.0f}));
+  Check(game.SweepBall(wedged, 1.0f / 64.0f, 0, wedged.collisions), "ball grazes both corners");
+
+  const vec2 wedged_velocity = wedged.balls.GetVelocity(0);
+  Check(std::isfinite(wedged_velocity.x) and std::isfinite(wedged_velocity.y), "opposite normals don't give a nan velocity");
+  Check(std::isfinite(wedged.balls.GetPosition(0).y), "opposite normals don't give a nan position");
+
+  //Huge steps with every broadphase, balls stay on the field and all agree
+  auto run = [](Broadphase broadphase) {
+    Game game;
+    game.SetBroadphase(broadphase);
+    game.SetCollisionMode(CollisionMode::swept);
+
+    GameState state = MakeBusyGame(game, 2000, 1500, 50);
+    for (int i = 0; i < 20; i++)
+    {
+      game.SimulateInPlace(state, 0.5f);
+
+      for (int b = 0; b < state.balls.size(); b++)
+      {
+        const vec2 pos = state.balls.GetPosition(b);
+        Check(in_range(0.0f, 2000.0f, pos.x) and pos.y >= 0.0f, "swept balls stay in the field");
+      }
+    }
+    return state;
+  };
+
+  GameState brute = run(Broadphase::brute_force);
+  GameState grid = run(Broadphase::grid);
+  GameState tree = run(Broadphase::aabb_tree);
+
+  cout << "blocks left: " << brute.blocks.size() << "  balls left: " << brute.balls.size() << endl;
+  Check(brute.blocks.size() < 204, "swept balls break blocks");
+
+  CheckSameGame(brute, grid, "swept grid");
+  CheckSameGame(brute, tree, "swept aabb_tree");
+}
+
+
+void TestRandom()
+{
+  cout << "\n\n==== Testing Random\n"
+       << endl;
+
+  Random a(42);
+  Random b(42);
+  Random c(43);
+
+  int same = 0;
+  for (int i = 0; i < 1000; i++)
+  {
+    const uint32_t x = a.Next();
+    Check(x == b.Next(), "same seed gives the same numbers");
+    if (x == c.Next()) same++;
+  }
+  Check(same < 5, "different seeds give different numbers");
+
+  int counts[5] = {};
+  for (int i = 0; i < 10000; i++)
+  {
+    const float f = RandomFloat(a);
+    Check(f >= 0.0f and f < 1.0f, "RandomFloat is from 0 up to 1");
+
+    const int n = RandomInt(a, -2, 3);
+    Check(n >= -2 and n < 3, "RandomInt stays below the top of its range");
+    counts[n + 2]++;
+  }
+  for (int count : counts)
+  {
+    Check(count > 1500, "RandomInt hits every value");
+  }
+
+  //Whole games replay exactly from their seed
+  Game game;
+  GameState first = MakeBusyGame(game, 2000, 1500, 50, 7);
+  GameState second = MakeBusyGame(game, 2000, 1500, 50, 7);
+  GameState other = MakeBusyGame(game, 2000, 1500, 50, 8);
+
+  for (int i = 0; i < 300; i++)
+  {
+    for (GameState *state : {&first, &second, &other})
+    {
+      game.SimulateInPlace(*state, 1.0f / 60.0f);
+    }
+  }
+
+  CheckSameGame(first, second, "same seed");
+  for (int i = 0; i < first.particles.size(); i++)
+  {
+    Check(first.particles.x[i] == second.particles.x[i] and
+        first.particles.colour[i].r == second.particles.colour[i].r,
+      "same seed gives the same particles");
+  }
+
+  const bool differs = first.balls.size() != other.balls.size() or
+    first.blocks.size() != other.blocks.size() or
+    first.balls.GetPosition(0).x != other.balls.GetPosition(0).x;
+  Check(differs, "different seeds give different games");
+
+  cout << "seed 7: " << first.blocks.size() << " blocks, seed 8: " << other.blocks.size() << " blocks" << endl;
+}
+
+
+void TestIntegrateBalls()
+{
+  cout << "\n\n==== Testing IntegrateBalls\n"
+       << endl;
+
+  Random rng(7);
+  const float dt = 1.0f / 60.0f;
+
+  //Odd sizes to cover the leftovers after the vector loop
+  for (int n : {0, 1, 3, 4, 7, 8, 9, 17, 37})
+  {
+    BallStore simd;
+    std::vector<Ball> reference;
+
+    for (int i = 0; i < n; i++)
+    {
+      Ball ball({RandomFloat(rng, 0.0f, 640.0f), RandomFloat(rng, 0.0f, 480.0f)},
+        angle_to_vec2(RandomFloat(rng, 0.0f, TWO_PI), RandomFloat(rng, 0.0f, 3000.0f)),
+        RandomRGB(rng));
+      ball.radius = RandomFloat(rng, 1.0f, 20.0f);
+      ball.UpdateBounds();
+
+      simd.Add(ball);
+      reference.push_back(ball);
+    }
+
+    BallStore scalar = simd;
+
+    IntegrateBalls(simd, dt);
+    IntegrateBallsScalar(scalar, dt);
+
+    for (int i = 0; i < n; i++)
+    {
+      //Same step as UpdatePhysics takes when nothing is hit
+      Ball &ball = reference[i];
+      ball.position = ball.position + (ball.velocity * dt);
+      ball.UpdateBounds();
+
+      for (const BallStore *store : {&simd, &scalar})
+      {
+        const Ball b = store->Get(i);
+        Check(b.position.x == ball.position.x and b.position.y == ball.position.y,
+          "integrated position matches UpdatePhysics");
+        Check(b.bounds.top_left.x == ball.bounds.top_left.x and
+            b.bounds.top_left.y == ball.bounds.top_left.y and
+            b.bounds.bottom_right.x == ball.bounds.bottom_right.x and
+            b.bounds.bottom_right.y == ball.bounds.bottom_right.y,
+          "integrated bounds match UpdatePhysics");
+      }
+    }
+  }
+
+  BallStore store;
+  std::vector<SlotHandle> handles;
+  for (int i = 0; i < 130; i++)
+  {
+    Ball ball({float(i), 0.0f}, {0.0f, 0.0f}, RandomRGB(rng));
+    ball.alive = (i % 3 != 0);
+    handles.push_back(store.Add(ball));
+  }
+  store.RemoveDead();
+
+  cout << "balls left after RemoveDead: " << store.size() << endl;
+  Check(store.size() == 86, "RemoveDead drops every dead ball");
+  for (int i = 0; i < store.size(); i++)
+  {
+    Check(store.IsAlive(i) and int(store.x[i]) % 3 != 0, "RemoveDead keeps the live balls");
+    Check(i == 0 or store.x[i - 1] < store.x[i], "RemoveDead keeps the balls in order");
+  }
+  Check(store.handles.IsConsistent(store.size()) and store.alive_mask.size() == 2, "RemoveDead leaves a sound handle table and alive mask");
+  for (int i = 0; i < 130; i++)
+  {
+    const int found = store.Find(handles[i]);
+    Check((found >= 0) == (i % 3 != 0), "dead balls' handles go stale");
+    Check(found < 0 or (store.x[found] == float(i) and store.Get(found).handle == handles[i]), "live balls' handles follow them");
+  }
+}
+
+
+void TestUpdateParticles()
+{
+  cout << "\n\n==== Testing UpdateParticles\n"
+       << endl;
+
+  Random rng(11);
+  const float dt = 1.0f / 60.0f;
+
+  //Odd sizes to cover the leftovers after the vector loop
+  for (int n : {0, 1, 3, 4, 7, 8, 9, 17, 37})
+  {
+    ParticleStore simd;
+    std::vector<Particle> reference;
+
+    for (int i = 0; i < n; i++)
+    {
+      vec2 pos{RandomFloat(rng, 0.0f, 640.0f), RandomFloat(rng, 0.0f, 480.0f)};
+      vec2 vel{RandomFloat(rng, -3.0f, 3.0f), RandomFloat(rng, -3.0f, 3.0f)};
+      const Particle p(rng, pos, vel, 4.0f, RandomRGB(rng), 1.0f);
+
+      simd.Add(p);
+      reference.push_back(p);
+    }
+
+    ParticleStore scalar = simd;
+
+    UpdateParticles(simd, dt);
+    UpdateParticlesScalar(scalar, dt);
+
+    for (int i = 0; i < n; i++)
+    {
+      //The step the per Particle code used to take
+      Particle &p = reference[i];
+      const float steps = dt * 60.0f;
+      p.ttl -= dt;
+      p.position += p.velocity * steps;
+      p.rotation += p.rot_vel * steps;
+
+      for (const ParticleStore *store : {&simd, &scalar})
+      {
+        Check(store->ttl[i] == p.ttl and store->rotation[i] == p.rotation, "particle ttl and rotation match");
+        Check(store->x[i] == p.position.x and store->y[i] == p.position.y, "particle position matches");
+      }
+    }
+  }
+
+  ParticleStore store;
+  for (int i = 0; i < 130; i++)
+  {
+    Particle p(rng, {0.0f, 0.0f}, {0.0f, 0.0f}, 1.0f, RandomRGB(rng), 1.0f);
+    p.ttl = (i % 3 == 0) ? -1.0f : 1.0f;
+    store.Add(p);
+    store.x.back() = float(i);
+  }
+  store.RemoveExpired();
+
+  cout << "particles left after RemoveExpired: " << store.size() << endl;
+  Check(store.size() == 86, "RemoveExpired drops every expired particle");
+
+  std::vector<float> kept = store.x;
+  std::sort(kept.begin(), kept.end());
+  bool all_kept = kept.size() == 86;
+  for (int i = 0, k = 0; i < 130 and all_kept; i++)
+  {
+    if (i % 3 != 0) all_kept = kept[k++] == float(i);
+  }
+  Check(all_kept, "RemoveExpired keeps the live particles");
+  Check(store.colour.size() == 86 and store.rot_vel.size() == 86, "RemoveExpired shortens every column");
+
+  store.ttl[1] = 0.4f;
+  std::vector<float> instances;
+  MakeParticleInstances(store, instances);
+  const float *first_instance = instances.data();
+  MakeParticleInstances(store, instances);
+
+  const float *second = instances.data() + PARTICLE_INSTANCE_SIZE;
+  Check(instances.size() == size_t(86 * PARTICLE_INSTANCE_SIZE), "one instance per particle");
+  Check(second[0] == store.x[1] and second[1] == store.y[1] and second[2] == store.radius[1] and second[3] == store.rotation[1], "instance has the particle's place, radius and rotation");
+  Check(second[4] == store.colour[1].r and second[7] == store.colour[1].a * 0.5f, "instance fades its alpha with the ttl");
+  Check(instances.data() == first_instance, "instances reuse their memory");
+
+  const Particle extra(rng, {0.0f, 0.0f}, {0.0f, 0.0f}, 1.0f, RandomRGB(rng), 1.0f);
+  while (store.size() < PARTICLE_CAPACITY) store.Add(extra);
+  Check(not store.Add(extra) and store.size() == PARTICLE_CAPACITY, "particles past the capacity are dropped");
+}
+
+
+void TestEmitParticles()
+{
+  cout << "\n\n==== Testing EmitParticles\n"
+       << endl;
+
+  //Known answers from the Random123 distribution
+  uint32_t out0, out1;
+  Threefry2x32(0, 0, 0, out0, out1);
+  Check(out0 == 0x6b200159 and out1 == 0x99ba4efe, "Threefry2x32 of zeros");
+  Threefry2x32(0x0370734413198a2e, 0x243f6a88, 0x85a308d3, out0, out1);
+  Check(out0 == 0xc4923a9c and out1 == 0x483df7a0, "Threefry2x32 of pi");
+
+  //Odd sizes to cover the leftovers after the vector loop
+  for (int n : {1, 3, 4, 7, 37})
+  {
+    std::vector<uint32_t> simd0(n), simd1(n), scalar0(n), scalar1(n);
+    FillThreefry2x32(77, 1000, 3, n, simd0.data(), simd1.data());
+    FillThreefry2x32Scalar(77, 1000, 3, n, scalar0.data(), scalar1.data());
+    Check(simd0 == scalar0 and simd1 == scalar1, "FillThreefry2x32 matches the scalar version");
+  }
+
+  const vec2 origins[] = {{100.0f, 100.0f}, {500.0f, 300.0f}};
+  const vec2 velocities[] = {{-5.0f, 0.0f}, {5.0f, 0.0f}};
+
+  ParticleEmitter emitter;
+  emitter.origins = origins;
+  emitter.num_origins = 2;
+  emitter.velocities = velocities;
+  emitter.num_velocities = 2;
+  emitter.size = 4.0f;
+  emitter.colour = {0.25f, 0.5f, 0.75f, 1.0f};
+
+  //More than a chunk
+  ParticleStore burst;
+  Check(EmitParticles(burst, 1234, emitter, 1000) == 1000 and burst.size() == 1000, "EmitParticles adds them all");
+
+  int near_first = 0;
+  int going_left = 0;
+  bool in_range = true;
+  for (int i = 0; i < burst.size(); i++)
+  {
+    const bool first = burst.x[i] < 300.0f;
+    const vec2 &origin = origins[first ? 0 : 1];
+    near_first += first;
+    going_left += burst.vx[i] < 0.0f;
+
+    in_range = in_range and std::abs(burst.x[i] - origin.x) <= 10.0f and std::abs(burst.y[i] - origin.y) <= 10.0f and
+      std::abs(std::abs(burst.vx[i]) - 5.0f) <= 1.0f and std::abs(burst.vy[i]) <= 1.0f and
+      burst.ttl[i] >= 0.8f and burst.ttl[i] <= 1.3f and burst.radius[i] >= 4.0f and burst.radius[i] <= 9.0f and
+      burst.rotation[i] >= 0.0f and burst.rotation[i] <= TWO_PI and std::abs(burst.rot_vel[i]) <= 0.1f and
+      burst.colour[i].g == 0.5f;
+  }
+  cout << "from the first origin: " << near_first << "  going left: " << going_left << endl;
+  Check(in_range, "emitted particles are spread like Particle's");
+  Check(near_first > 400 and near_first < 600 and going_left > 400 and going_left < 600, "origins and velocities are picked evenly");
+
+  ParticleStore again;
+  EmitParticles(again, 1234, emitter, 1000);
+  Check(again.x == burst.x and again.rot_vel == burst.rot_vel, "the same key makes the same burst");
+
+  ParticleStore other;
+  EmitParticles(other, 1235, emitter, 1000);
+  Check(other.x != burst.x, "another key makes another burst");
+
+  ParticleStore full;
+  full.resize(PARTICLE_CAPACITY - 10);
+  Check(EmitParticles(full, 1, emitter, 100) == 10 and full.size() == PARTICLE_CAPACITY, "EmitParticles stops at the capacity");
+}
+
+
+void TestParticleBursts()
+{
+  cout << "\n\n==== Testing particle bursts\n"
+       << endl;
+
+  const vec2 origins[] = {{300.0f, 200.0f}, {320.0f, 200.0f}, {340.0f, 210.0f}};
+  const vec2 velocities[] = {{-2.0f, 1.0f}, {0.0f, 0.0f}};
+
+  ParticleEmitter emitter;
+  emitter.origins = origins;
+  emitter.num_origins = 3;
+  emitter.velocities = velocities;
+  emitter.num_velocities = 2;
+  emitter.size = 4.0f;
+  emitter.colour = {1.0f, 0.5f, 0.25f, 1.0f};
+
+  //Stepped a tick at a time against worked out in one go
+  const float dt = 1.0f / 60.0f;
+  const int ticks = 50;
+
+  ParticleStore stepped;
+  EmitParticles(stepped, 99, emitter, 100);
+  for (int i = 0; i < ticks; i++) UpdateParticles(stepped, dt);
+
+  const ParticleBurst burst = MakeParticleBurst(99, emitter, 100, 2.0f);
+  ParticleStore evaluated;
+  EvaluateParticleBurst(evaluated, burst, ticks * dt);
+
+  float worst = 0.0f;
+  for (int i = 0; i < stepped.size(); i++)
+  {
+    for (float error : {stepped.x[i] - evaluated.x[i], stepped.y[i] - evaluated.y[i],
+           stepped.rotation[i] - evaluated.rotation[i], (stepped.ttl[i] - evaluated.ttl[i]) * 100.0f})
+    {
+      worst = std::max(worst, std::abs(error));
+    }
+  }
+  cout << "worst difference from stepping: " << worst << endl;
+  Check(evaluated.size() == 100 and worst < 0.01f, "bursts end up where stepped particles do");
+  Check(std::equal(stepped.colour.begin(), stepped.colour.end(), evaluated.colour.begin(),
+          [](const col4 &a, const col4 &b) { return a.r == b.r and a.a == b.a; }),
+    "bursts are the colour they were emitted");
+
+  //Gone once the last particle is
+  std::vector<ParticleBurst> bursts = {burst, MakeParticleBurst(100, emitter, 100, 2.5f)};
+  RemoveExpiredBursts(bursts, 2.0f + GetBurstLifetime(burst));
+  Check(bursts.size() == 2, "bursts stay while any particle is alive");
+  RemoveExpiredBursts(bursts, 2.1f + GetBurstLifetime(burst));
+  Check(bursts.size() == 1 and bursts[0].time == 2.5f, "bursts go when every particle has");
+
+  //Too much to keep is cut down to size
+  const vec2 many[8] = {};
+  emitter.origins = many;
+  emitter.num_origins = 8;
+  const ParticleBurst big = MakeParticleBurst(1, emitter, 1000, 0.0f);
+  Check(big.count == BURST_MAX_PARTICLES and big.num_origins == BURST_MAX_ORIGINS, "bursts are capped");
+
+  //A game with bursts plays out the same, only the particles are kept differently
+  Game game;
+  Game burst_game;
+  burst_game.SetParticleMode(ParticleMode::bursts);
+
+  GameState simulated = MakeBusyGame(game, 2000, 1500, 50);
+  GameState with_bursts = simulated;
+  for (int i = 0; i < 90; i++)
+  {
+    game.SimulateInPlace(simulated, dt);
+    burst_game.SimulateInPlace(with_bursts, dt);
+  }
+
+  ParticleStore live;
+  for (const ParticleBurst &b : with_bursts.particle_bursts) EvaluateParticleBurst(live, b, with_bursts.time - b.time);
+  live.RemoveExpired();
+
+  cout << "simulated particles: " << simulated.particles.size() << "  bursts: " << with_bursts.particle_bursts.size()
+       << " with " << live.size() << " particles" << endl;
+  Check(with_bursts.particles.empty() and not with_bursts.particle_bursts.empty(), "burst mode keeps bursts");
+  Check(simulated.balls.size() == with_bursts.balls.size() and simulated.blocks.size() == with_bursts.blocks.size(),
+    "burst mode plays the same game");
+  CheckSameRandom(simulated, with_bursts, "burst mode");
+  Check(std::abs(live.size() - simulated.particles.size()) < simulated.particles.size() / 10, "bursts make about as many particles");
+}
+
+
+//A few busy games with the paddle being swept back and forth, different
+//seeds and input for each one
+std::vector<BatchGame> MakeBatch(const Game &game, int num_games, int num_ticks)
+{
+  std::vector<BatchGame> games(num_games);
+
+  for (int g = 0; g < num_games; g++)
+  {
+    games[g].state = MakeBusyGame(game, 1200, 900, 10, 100 + g);
+    games[g].intents.resize(num_ticks);
+
+    for (int t = 0; t < num_ticks; t++)
+    {
+      Intent move{IntentType::player_input, {PlayerInput::mouse_position}, {}};
+      move.position = {600.0f + 500.0f * std::sin(t * 0.02f * (g + 1)), 800.0f};
+      games[g].intents[t].push_back(move);
+
+      if (t % 97 == g)
+      {
+        Intent shoot{IntentType::player_input, {PlayerInput::shoot}, {}};
+        shoot.down = true;
+        games[g].intents[t].push_back(shoot);
+      }
+    }
+  }
+
+  return games;
+}
+
+
+void TestBatch()
+{
+  cout << "\n\n==== Testing ThreadPool and BatchRunner\n"
+       << endl;
+
+  ThreadPool pool(4);
+  Check(pool.GetNumThreads() == 4, "pool has four threads");
+
+  //Every index is visited exactly once, over and over
+  std::vector<std::atomic<int>> visits(1000);
+  for (int round = 0; round < 50; round++)
+  {
+    pool.ParallelFor(visits.size(), [&](int i) { visits[i]++; });
+  }
+  for (auto &v : visits) Check(v == 50, "ParallelFor visits each index once");
+
+  //Lots of short jobs back to back, so workers often wake up after the job
+  //they were woken for is done
+  std::atomic<int> total{0};
+  std::atomic<int> wrong_job{0};
+  for (int round = 0; round < 5000; round++)
+  {
+    const int size = 1 + round % 7;
+    pool.ParallelFor(size, [&](int i) {
+      if (i >= size) wrong_job++;
+      total++;
+    });
+  }
+  int expected_total = 0;
+  for (int round = 0; round < 5000; round++) expected_total += 1 + round % 7;
+  Check(total == expected_total and wrong_job == 0, "back to back ParallelFors each run their own indexes once");
+
+  bool caught = false;
+  try
+  {
+    pool.ParallelFor(100, [](int i) {
+      if (i == 42) throw std::runtime_error("42");
+    });
+  }
+  catch (const std::runtime_error &)
+  {
+    caught = true;
+  }
+  Check(caught, "ParallelFor rethrows");
+
+  //Batches come out the same as running the games one after another, at any
+  //thread count
+  Game game;
+  const int num_games = 6;
+  const int num_ticks = 300;
+  const float dt = 1.0f / 60.0f;
+
+  std::vector<BatchGame> serial = MakeBatch(game, num_games, num_ticks);
+  for (BatchGame &g : serial) RunBatchGame(game, g, num_ticks, dt);
+
+  for (int threads : {1, 3, 8})
+  {
+    BatchRunner runner(game, threads);
+    std::vector<BatchGame> batch = MakeBatch(game, num_games, num_ticks);
+
+    BatchResult result = runner.Run(batch, num_ticks, dt);
+
+    cout << threads << " threads: " << result.total_ticks << " ticks, "
+         << result.ticks_per_second << " ticks/s" << endl;
+
+    Check(result.num_threads == threads, "runner thread count");
+    Check(result.total_ticks == num_games * num_ticks, "every game ran every tick");
+
+    for (int g = 0; g < num_games; g++)
+    {
+      CheckSameGame(serial[g].state, batch[g].state, std::to_string(threads) + " thread batch");
+      Check(batch[g].state.sound_events.empty(), "batch drops sound events");
+    }
+  }
+
+  //A game that quits stops early
+  std::vector<BatchGame> quitting = MakeBatch(game, 1, 10);
+  game.SetState(quitting[0].state, State::pause_menu);
+  quitting[0].intents[3].push_back(Intent{IntentType::quit, {}, {}});
+
+  BatchRunner runner(game, 2);
+  Check(runner.Run(quitting, 10, dt).total_ticks == 4, "batch stops when a game quits");
+}
+
+
+void TestParallelCollisions()
+{
+  cout << "\n\n==== Testing parallel ball collisions\n"
+       << endl;
+
+  Game serial_game;
+  const GameState start = MakeBusyGame(serial_game, 2000, 1500, 400);
+
+  GameState serial = start;
+  int serial_sounds = 0;
+  for (int i = 0; i < 200; i++)
+  {
+    serial_game.SimulateInPlace(serial, 1.0f / 60.0f);
+    serial_sounds += serial.sound_events.size();
+  }
+
+  cout << "balls: " << serial.balls.size() << "  blocks: " << serial.blocks.size()
+       << "  particles: " << serial.particles.size() << endl;
+
+  for (int threads : {1, 2, 3, 8})
+  {
+    ThreadPool pool(threads);
+    Game game;
+    game.SetThreadPool(&pool);
+
+    GameState state = start;
+    int sounds = 0;
+    for (int i = 0; i < 200; i++)
+    {
+      game.SimulateInPlace(state, 1.0f / 60.0f);
+      sounds += state.sound_events.size();
+    }
+
+    const std::string name = std::to_string(threads) + " thread collisions";
+    CheckSameGame(serial, state, name);
+    Check(sounds == serial_sounds, name + " play the same sounds");
+    CheckSameRandom(serial, state, name);
+
+    for (int i = 0; i < serial.particles.size(); i++)
+    {
+      Check(serial.particles.x[i] == state.particles.x[i] and serial.particles.y[i] == state.particles.y[i],
+        name + " make the same particles");
+    }
+
+    bool refused = false;
+    try
+    {
+      BatchRunner runner(game);
+    }
+    catch (const std::runtime_error &)
+    {
+      refused = true;
+    }
+    Check(refused, "BatchRunner refuses a Game with a thread pool");
+  }
+}
+
+
+void TestReplay()
+{
+  cout << "\n\n==== Testing replays\n"
+       << endl;
+
+  Game game;
+  const uint64_t seed = 77;
+
+  GameState start = game.NewGame(800, 600, seed);
+  game.SetState(start, State::new_level);
+  FixedTimestep live(start);
+
+  std::stringstream log;
+  ReplayRecorder recorder(log, game, seed, live, 50);
+
+  //Uneven frames, the paddle swept around and firing, and a window resize
+  const int num_frames = 400;
+  const int check_frame = 275;
+  GameState at_check_frame;
+  Random rng(3);
+
+  for (int f = 0; f < num_frames; f++)
+  {
+    if (f == check_frame) at_check_frame = live.Current();
+
+    ReplayFrame frame;
+    frame.delta_time = RandomFloat(rng, 0.005f, 0.04f);
+    frame.width = (f < 200) ? 800 : 1024;
+    frame.height = (f < 200) ? 600 : 700;
+
+    Intent move{IntentType::player_input, {PlayerInput::mouse_position}, {}};
+    move.position = {RandomFloat(rng, 0.0f, 1024.0f), 500.0f};
+    frame.intents.push_back(move);
+
+    if (f % 40 == 10)
+    {
+      Intent shoot{IntentType::player_input, {PlayerInput::shoot}, {}};
+      shoot.down = true;
+      frame.intents.push_back(shoot);
+    }
+
+    recorder.RecordFrame(frame, live);
+    RunReplayFrame(game, live, frame);
+  }
+
+  cout << "log: " << log.str().size() << " bytes for " << recorder.GetNumFrames() << " frames, "
+       << live.GetNumTicks() << " ticks" << endl;
+  cout << "balls: " << live.Current().balls.size() << "  blocks: " << live.Current().blocks.size()
+       << "  particles: " << live.Current().particles.size() << endl;
+
+  ReplayPlayer player(log);
+  Check(player.GetSeed() == seed, "replay keeps the seed");
+  Check(player.GetNumFrames() == num_frames, "replay has every frame");
+  Check(player.GetFrame() == 0, "replay starts at the first frame");
+
+  //Playing it all back ends up in the same place, both frame by frame and
+  //jumping straight to the end from the last keyframe
+  Check(player.PlayToEnd(game) <= player.GetKeyframeInterval(), "jumps to the last keyframe");
+  CheckSameGame(live.Current(), player.Current(), "replay from a keyframe");
+
+  player.Seek(game, 0);
+  for (int f = 1; f <= num_frames; f++) Check(player.Seek(game, f) <= 1, "plays one frame at a time");
+  CheckSameGame(live.Current(), player.Current(), "replay");
+  CheckSameRandom(live.Current(), player.Current(), "replay");
+  Check(player.GetSimulation().GetNumTicks() == live.GetNumTicks(), "replay runs the same ticks");
+  Check(player.Current().width == 1024, "replay resizes");
+
+  //Seeking back only runs from the keyframe before
+  const int frames_run = player.Seek(game, check_frame);
+  Check(frames_run <= player.GetKeyframeInterval(), "seeking starts from a keyframe");
+  CheckSameGame(at_check_frame, player.Current(), "seek");
+  CheckSameRandom(at_check_frame, player.Current(), "seek");
+
+  //And going on from there is the same as having played through
+  player.PlayToEnd(game);
+  CheckSameGame(live.Current(), player.Current(), "replay after seeking");
+
+  bool rejected = false;
+  try
+  {
+    std::istringstream junk("not a replay at all");
+    ReplayPlayer bad(junk);
+  }
+  catch (const std::runtime_error &)
+  {
+    rejected = true;
+  }
+  Check(rejected, "replay rejects other files");
+
+  //Intents come back field by field
+  const ReplayFrame frame_10 = player.GetReplayFrame(10);
+  Check(frame_10.intents.size() == 2 and frame_10.intents[0].player_input == PlayerInput::mouse_position and
+      frame_10.intents[0].position.y == 500.0f,
+    "replay keeps mouse intents");
+  Check(frame_10.intents[1].player_input == PlayerInput::shoot and frame_10.intents[1].down, "replay keeps button intents");
+
+  //The game's modes go in the header, and a game in other modes can't play it
+  Game swept_game;
+  swept_game.SetBroadphase(Broadphase::aabb_tree);
+  swept_game.SetCollisionMode(CollisionMode::swept);
+  swept_game.SetParticleMode(ParticleMode::bursts);
+
+  FixedTimestep swept_live(start);
+  std::stringstream swept_log;
+  {
+    ReplayRecorder swept_recorder(swept_log, swept_game, seed, swept_live, 50);
+    for (int f = 0; f < 100; f++)
+    {
+      ReplayFrame frame;
+      frame.delta_time = 1.0f / 60.0f;
+      frame.width = 800;
+      frame.height = 600;
+
+      Intent shoot{IntentType::player_input, {PlayerInput::shoot}, {}};
+      shoot.down = (f % 20 == 5);
+      frame.intents.push_back(shoot);
+
+      swept_recorder.RecordFrame(frame, swept_live);
+      RunReplayFrame(swept_game, swept_live, frame);
+    }
+  }
+  const std::string swept_bytes = swept_log.str();
+
+  ReplayPlayer swept_player(swept_log);
+  bool wrong_modes = false;
+  try
+  {
+    swept_player.Seek(game, 1);
+  }
+  catch (const std::runtime_error &)
+  {
+    wrong_modes = true;
+  }
+  Check(wrong_modes, "replay refuses a game in other modes");
+
+  Game set_up;
+  swept_player.SetUpGame(set_up);
+  Check(set_up.GetBroadphase() == Broadphase::aabb_tree and set_up.GetCollisionMode() == CollisionMode::swept and
+      set_up.GetParticleMode() == ParticleMode::bursts,
+    "replay sets the game up as it was recorded");
+  swept_player.PlayToEnd(set_up);
+  CheckSameGame(swept_live.Current(), swept_player.Current(), "replay in recorded modes");
+
+  //The last frame's shoot intent is its last three bytes, its type first
+  std::string bad_intent = swept_bytes;
+  bad_intent[bad_intent.size() - 3] = char(200);
+  rejected = false;
+  try
+  {
+    std::istringstream in(bad_intent);
+    ReplayPlayer bad(in);
+  }
+  catch (const std::runtime_error &)
+  {
+    rejected = true;
+  }
+  Check(rejected, "replay rejects a bad intent type");
+}
+
+
+template<typename T>
+bool SameBytes(const std::vector<T> &a, const std::vector<T> &b)
+{
+  return a.size() == b.size() and (a.empty() or std::memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0);
+}
+
+
+bool SameBlocks(const SlotMap<Block> &a, const SlotMap<Block> &b)
+{
+  return SameBytes(a.items, b.items) and SameBytes(a.table.dense_slots, b.table.dense_slots) and
+    SameBytes(a.table.slots, b.table.slots) and a.table.free_slot == b.table.free_slot;
+}
+
+
+bool SameParticles(const ParticleStore &a, const ParticleStore &b)
+{
+  return SameBytes(a.ttl, b.ttl) and SameBytes(a.radius, b.radius) and SameBytes(a.colour, b.colour) and
+    SameBytes(a.x, b.x) and SameBytes(a.y, b.y) and SameBytes(a.rotation, b.rotation) and
+    SameBytes(a.vx, b.vx) and SameBytes(a.vy, b.vy) and SameBytes(a.rot_vel, b.rot_vel);
+}
+
+
+bool SameCollisions(const CollisionRing &a, const CollisionRing &b)
+{
+  if (a.size() != b.size() or a.GetCapacity() != b.GetCapacity() or a.GetOverflowPolicy() != b.GetOverflowPolicy() or
+    a.GetNumPushed() != b.GetNumPushed() or a.GetNumDropped() != b.GetNumDropped() or a.GetHighWater() != b.GetHighWater())
+  {
+    return false;
+  }
+
+  for (int i = 0; i < a.size(); i++)
+  {
+    if (std::memcmp(&a[i], &b[i], sizeof(Collision)) != 0) return false;
+  }
+  return true;
+}
+
+
+//Every saved field, not just what CheckSameGame looks at
+void CheckSameSnapshot(const GameState &expected, const GameState &state, const std::string &name)
+{
+  const BallStore &a = expected.balls;
+  const BallStore &b = state.balls;
+
+  Check(expected.width == state.width and expected.height == state.height, name + " keeps the size");
+  Check(expected.running == state.running and expected.sound_muted == state.sound_muted and
+      expected.debug_enabled == state.debug_enabled,
+    name + " keeps the flags");
+  Check(SameBytes(a.x, b.x) and SameBytes(a.y, b.y) and SameBytes(a.vx, b.vx) and SameBytes(a.vy, b.vy) and
+      SameBytes(a.radius, b.radius) and SameBytes(a.min_x, b.min_x) and SameBytes(a.max_y, b.max_y) and
+      SameBytes(a.colour, b.colour) and SameBytes(a.alive_mask, b.alive_mask),
+    name + " keeps the balls");
+  Check(SameBytes(a.handles.dense_slots, b.handles.dense_slots) and SameBytes(a.handles.slots, b.handles.slots) and
+      a.handles.free_slot == b.handles.free_slot,
+    name + " keeps the ball handles");
+  Check(SameBytes(expected.lines, state.lines), name + " keeps the lines");
+  Check(SameBlocks(expected.blocks, state.blocks), name + " keeps the blocks");
+  Check(SameBlocks(expected.border_lines, state.border_lines), name + " keeps the borders");
+  Check(expected.state == state.state and std::memcmp(&expected.state_timer, &state.state_timer, sizeof(float)) == 0, name + " keeps the state machine");
+  CheckSameRandom(expected, state, name);
+  Check(std::memcmp(&expected.player.block, &state.player.block, sizeof(Block)) == 0 and
+      expected.player.sticky_ball == state.player.sticky_ball and
+      SameBytes(expected.player.avg_velocity, state.player.avg_velocity),
+    name + " keeps the paddle");
+  Check(SameParticles(expected.particles, state.particles) and SameBytes(expected.particle_bursts, state.particle_bursts) and
+      expected.time == state.time,
+    name + " keeps the particles");
+  Check(SameCollisions(expected.collisions, state.collisions) and SameBytes(expected.sound_events, state.sound_events), name + " keeps the events");
+  Check(expected.menu_items == state.menu_items and expected.selected_menu_item == state.selected_menu_item and
+      expected.activated_menu_item == state.activated_menu_item,
+    name + " keeps the menu");
+}
+
+
+GameState SnapshotRoundTrip(const GameState &state)
+{
+  std::ostringstream out;
+  WriteSnapshot(out, state);
+  const std::string bytes = out.str();
+
+  std::vector<uint64_t> memory(bytes.size() / sizeof(uint64_t) + 1);
+  std::memcpy(memory.data(), bytes.data(), bytes.size());
+
+  return SnapshotView(memory.data(), bytes.size()).ToGameState();
+}
+
+
+void TestSnapshot()
+{
+  cout << "\n\n==== Testing snapshots\n"
+       << endl;
+
+  Game game;
+
+  //Straight out of NewGame, and sitting in a menu
+  GameState fresh = game.NewGame(800, 600, 42);
+  CheckSameSnapshot(fresh, SnapshotRoundTrip(fresh), "NewGame snapshot");
+
+  game.SetState(fresh, State::pause_menu);
+  CheckSameSnapshot(fresh, SnapshotRoundTrip(fresh), "menu snapshot");
+
+  //Mid game, with dead lines in the pool, particles and queued up sounds
+  GameState busy = MakeBusyGame(game, 2000, 1500, 50);
+  for (int i = 0; i < 60; i++) game.SimulateInPlace(busy, 1.0f / 60.0f);
+
+  //Bursts too
+  Game burst_game;
+  burst_game.SetParticleMode(ParticleMode::bursts);
+  GameState bursts = MakeBusyGame(burst_game, 2000, 1500, 50);
+  for (int i = 0; i < 60; i++) burst_game.SimulateInPlace(bursts, 1.0f / 60.0f);
+  CheckSameSnapshot(bursts, SnapshotRoundTrip(bursts), "particle burst snapshot");
+
+  //Through a file, mapped back in
+  const std::string filename = "test_snapshot.pongsnap";
+  SaveSnapshot(filename, busy);
+  GameState loaded = LoadSnapshot(filename);
+  CheckSameSnapshot(busy, loaded, "mapped snapshot");
+
+  {
+    MappedFile file(filename);
+    SnapshotView view(file.GetData(), file.GetSize());
+
+    cout << "snapshot: " << file.GetSize() << " bytes, " << view.GetBlocks().size() << " blocks, "
+         << view.GetParticleColumn(SnapshotSection::particle_x).size() << " particles" << endl;
+
+    //Used where it is, without copying
+    Check(view.GetBlocks().size() == static_cast<int>(busy.blocks.size()), "view has every block");
+    Check(view.GetBlocks()[3].position.x == busy.blocks[3].position.x, "view blocks are in place");
+    Check(view.GetBallColumn(SnapshotSection::ball_vy)[7] == busy.balls.vy[7], "view balls are in place");
+  }
+  std::remove(filename.c_str());
+
+  //And it carries on exactly the same
+  for (int i = 0; i < 120; i++)
+  {
+    game.SimulateInPlace(busy, 1.0f / 60.0f);
+    game.SimulateInPlace(loaded, 1.0f / 60.0f);
+  }
+  CheckSameGame(busy, loaded, "snapshot");
+  CheckSameRandom(busy, loaded, "snapshot");
+
+  //Damaged snapshots are refused
+  std::ostringstream out;
+  WriteSnapshot(out, busy);
+  std::string bytes = out.str();
+  std::vector<uint64_t> memory(bytes.size() / sizeof(uint64_t) + 1);
+
+  auto refused = [&](const std::string &what, size_t size) {
+    std::memcpy(memory.data(), bytes.data(), bytes.size());
+    try
+    {
+      SnapshotView view(memory.data(), size);
+    }
+    catch (const std::runtime_error &)
+    {
+      return;
+    }
+    Check(false, "snapshot refuses " + what);
+  };
+
+  refused("being cut short", bytes.size() - 100);
+  bytes[8]++;
+  refused("another version", bytes.size());
+  bytes[8]--;
+
+  //Sections that fit in the file but don't make a sound GameState
+  SnapshotHeader *header = reinterpret_cast<SnapshotHeader *>(memory.data());
+  auto section = [&](SnapshotSection which) -> SnapshotSectionEntry & { return header->sections[static_cast<int>(which)]; };
+  auto first_block = [&]() { return reinterpret_cast<Block *>(reinterpret_cast<char *>(memory.data()) + section(SnapshotSection::blocks).offset); };
+
+  auto corrupt = [&](const std::string &what, const std::function<void()> &damage) {
+    std::memcpy(memory.data(), bytes.data(), bytes.size());
+    damage();
+    try
+    {
+      SnapshotView view(memory.data(), bytes.size());
+      view.ToGameState();
+    }
+    catch (const std::runtime_error &)
+    {
+      return;
+    }
+    Check(false, "snapshot refuses " + what);
+  };
+
+  corrupt("a short ball column", [&] { section(SnapshotSection::ball_vx).count--; });
+  corrupt("a short ball alive mask", [&] { section(SnapshotSection::ball_alive_mask).count = 0; });
+  corrupt("missing lines", [&] { section(SnapshotSection::lines).count = 0; });
+  corrupt("block lines out of bounds", [&] { first_block()->num_lines = 1 << 30; });
+  corrupt("negative block lines", [&] { first_block()->first_line = -1; });
+  corrupt("an unknown block type", [&] { first_block()->type = static_cast<BlockType>(200); });
+  corrupt("player lines out of bounds", [&] { header->scalars.player_block.first_line = 1 << 30; });
+  corrupt("an unknown game state", [&] { header->scalars.state = 99; });
+
+  bytes[0] = 'X';
+  refused("other files", bytes.size());
+}
+
+
+void CheckLevelRefused(const Game &game, const std::string &level, const std::string &what)
+{
+  try
+  {
+    GameState state;
+    std::istringstream in(level);
+    LoadLevel(game, in, state);
+  }
+  catch (const std::runtime_error &e)
+  {
+    cout << "refused " << what << ": " << e.what() << endl;
+    return;
+  }
+  Check(false, "level refuses " + what);
+}
+
+
+void TestLevels()
+{
+  cout << "\n\n==== Testing levels\n"
+       << endl;
+
+  Game game;
+
+  const std::string text =
+    "# A test level\n"
+    "pong_level 1\n"
+    "\n"
+    "square 50 50 #ff8040\n"
+    "  triangle_left 160.5 50 #20C0FF80   \r\n"
+    "rect_triangle_right 270 -3.25e1 #000000\n"
+    "# the end\n";
+
+  GameState state;
+  std::istringstream in(text);
+  Check(LoadLevel(game, in, state) == 3, "text level has three blocks");
+  Check(state.blocks.size() == 3, "text level blocks are added");
+
+  const Block &b = state.blocks[1];
+  Check(b.type == BlockType::triangle_left, "level block type");
+  Check(b.position.x == 160.5f and b.position.y == 50.0f, "level block position");
+  Check(b.colour.r == 0x20 / 255.0f and b.colour.g == 0xc0 / 255.0f and b.colour.b == 1.0f and b.colour.a == 0x80 / 255.0f, "level block colour");
+  Check(state.blocks[0].colour.a == 1.0f, "colours are opaque without alpha");
+  Check(state.blocks[2].position.y == -32.5f, "level numbers can have exponents");
+
+  //Bounds come from the shape table, the same as working them out
+  for (const Block &block : state.blocks)
+  {
+    CheckBlockLines(state, block);
+
+    Block recomputed = block;
+    recomputed.UpdateBounds(state.lines);
+    Check(std::memcmp(&recomputed.bounds, &block.bounds, sizeof(BoundingBox)) == 0, "level block bounds");
+  }
+
+  //Text and binary both save and load back the same blocks
+  GameState big = MakeBusyGame(game, 4000, 3000, 0);
+  for (Block &block : big.blocks)
+  {
+    //Levels keep colours as bytes
+    block.colour = {std::round(block.colour.r * 255.0f) / 255.0f, std::round(block.colour.g * 255.0f) / 255.0f,
+      std::round(block.colour.b * 255.0f) / 255.0f, 1.0f};
+  }
+
+  for (bool binary : {false, true})
+  {
+    std::stringstream saved;
+    if (binary)
+      SaveLevelBinary(saved, big.blocks);
+    else
+      SaveLevelText(saved, big.blocks);
+
+    GameState loaded;
+    Check(LoadLevel(game, saved, loaded) == static_cast<int>(big.blocks.size()), "saved level has every block");
+
+    const std::string name = binary ? "binary level" : "text level";
+    for (int i = 0; i < big.blocks.size(); i++)
+    {
+      const Block &x = big.blocks[i];
+      const Block &y = loaded.blocks[i];
+      Check(x.type == y.type and x.position.x == y.position.x and x.position.y == y.position.y and
+          x.colour.r == y.colour.r and x.colour.g == y.colour.g and x.colour.b == y.colour.b and x.colour.a == y.colour.a and
+          std::memcmp(&x.bounds, &y.bounds, sizeof(BoundingBox)) == 0,
+        name + " round trip");
+    }
+
+    cout << name << ": " << saved.str().size() << " bytes for " << loaded.blocks.size() << " blocks" << endl;
+  }
+
+  //New games use the level once it is set
+  game.SetLevel(text);
+  GameState level_game = game.NewGame(800, 600, 5);
+  Check(level_game.blocks.size() == 3 and level_game.blocks[1].type == BlockType::triangle_left, "NewGame uses the level");
+  Check(level_game.border_lines.size() == 2, "level game has borders");
+
+  game.ClearLevel();
+  Check(game.NewGame(800, 600, 5).blocks.size() == 15, "NewGame goes back to the random grid");
+
+  CheckLevelRefused(game, "square 1 2 #ffffff\n", "a missing header");
+  CheckLevelRefused(game, "pong_level 2\n", "another version");
+  CheckLevelRefused(game, "pong_level 1\nhexagon 1 2 #ffffff\n", "unknown types");
+  CheckLevelRefused(game, "pong_level 1\npaddle 1 2 #ffffff\n", "paddles");
+  CheckLevelRefused(game, "pong_level 1\nsquare 1 #ffffff\n", "missing numbers");
+  CheckLevelRefused(game, "pong_level 1\nsquare 1 2 #fffff\n", "short colours");
+  CheckLevelRefused(game, "pong_level 1\nsquare 1 2 #ffffff extra\n", "trailing text");
+  CheckLevelRefused(game, std::string("PONGLEVL\x01\0\0\0\x05\0\0\0", 16), "cut short binary levels");
+  CheckLevelRefused(game, std::string("PONGLEVL\x01\0\0\0\xff\xff\xff\x7f", 16), "binary levels counting more blocks than they hold");
+  CheckLevelRefused(game, "pong_level 1\nsquare nan 2 #ffffff\n", "nan positions");
+  CheckLevelRefused(game, "pong_level 1\nsquare 1 inf #ffffff\n", "infinite positions");
+
+  const float infinity = std::numeric_limits<float>::infinity();
+  std::string infinite_record("PONGLEVL\x01\0\0\0\x01\0\0\0", 16);
+  infinite_record.append(reinterpret_cast<const char *>(&infinity), 4);
+  infinite_record.append(std::string("\0\0\0\0\x04\xff\xff\xff\xff", 9));
+  CheckLevelRefused(game, infinite_record, "infinite binary positions");
+
+  bool refused = false;
+  try
+  {
+    game.SetLevel("pong_level 1\nsquare 1 2\n");
+  }
+  catch (const std::runtime_error &)
+  {
+    refused = true;
+  }
+  Check(refused and game.NewGame(800, 600, 5).blocks.size() == 15, "SetLevel refuses broken levels");
+}
+
+
+void TestSlotMap()
+{
+  cout << "\n\n==== Testing slot maps\n"
+       << endl;
+
+  SlotMap<int> map;
+  std::vector<SlotHandle> handles;
+  for (int i = 0; i < 10; i++) handles.push_back(map.Add(i * 10));
+
+  //Removing swaps the last item into the hole and nothing else moves
+  map.Remove(handles[2]);
+  Check(map.size() == 9 and map[2] == 90 and map[3] == 30, "remove swaps the last item in");
+  Check(not map.Get(handles[2]), "removed handles go stale");
+  Check(map.Get(handles[9]) and *map.Get(handles[9]) == 90, "the moved item's handle follows it");
+
+  map.Remove(handles[2]);
+  Check(map.size() == 9, "removing a stale handle does nothing");
+
+  //The slot gets used again, but not by the old handle
+  const SlotHandle reused = map.Add(100);
+  Check(reused.slot == handles[2].slot and reused != handles[2], "freed slots come back with a new generation");
+  Check(not map.Get(handles[2]) and *map.Get(reused) == 100, "the old handle doesn't find the new item");
+
+  //Removing highest first only ever swaps in items that are staying
+  std::vector<SlotHandle> kept;
+  for (int i = map.size() - 1; i >= 0; i--)
+  {
+    if (map[i] % 20 == 0)
+      map.RemoveAt(i);
+    else
+      kept.push_back(map.GetHandle(i));
+  }
+
+  cout << "left after removing multiples of 20:";
+  for (int v : map) cout << " " << v;
+  cout << endl;
+
+  Check(map.size() == 5 and static_cast<int>(kept.size()) == 5, "RemoveAt removes the item");
+  for (const SlotHandle &handle : kept)
+  {
+    Check(map.Get(handle) and *map.Get(handle) % 20 != 0, "handles follow the items swapped around");
+  }
+  Check(map.table.IsConsistent(map.size()), "table is consistent after removals");
+
+  const SlotHandle first = map.GetHandle(0);
+  map.clear();
+  Check(map.empty() and not map.Get(reused) and not map.Get(first), "clear stales every handle");
+  Check(map.Add(7).slot == first.slot, "slots are handed out in dense order after clear");
+
+  SlotTable broken = map.table;
+  broken.free_slot = broken.dense_slots[0];
+  Check(not broken.IsConsistent(map.size()), "a live slot on the free list is caught");
+
+  //A copy shares the version until one of them gains or loses an item
+  SlotMap<int> copy = map;
+  Check(copy.GetVersion() == map.GetVersion(), "copies share a version");
+  copy.Add(8);
+  Check(copy.GetVersion() != map.GetVersion(), "adding changes the version");
+  SlotMap<int> other = map;
+  other.RemoveAt(0);
+  map.clear();
+  Check(other.GetVersion() != map.GetVersion() and map.GetVersion() != copy.GetVersion(), "removing and clearing change the version");
+  Check(SlotMap<int>().GetVersion() != SlotMap<int>().GetVersion(), "new maps don't share a version");
+
+  //Handles taken at the start of a game find their blocks until they break,
+  //whatever else gets removed around them
+  Game game;
+  GameState state = MakeBusyGame(game, 1600, 1200, 200);
+
+  std::vector<SlotHandle> block_handles;
+  std::vector<vec2> block_positions;
+  for (int i = 0; i < state.blocks.size(); i++)
+  {
+    block_handles.push_back(state.blocks.GetHandle(i));
+    block_positions.push_back(state.blocks[i].position);
+  }
+
+  std::vector<BlockHandle> hits;
+  int num_hits = 0;
+
+  for (int tick = 0; tick < 300; tick++)
+  {
+    for (int i = 0; i < state.balls.size(); i++)
+    {
+      vec2 normal{};
+      if (not game.CalculateBallCollision(state, i, normal, hits)) continue;
+
+      for (const BlockHandle &hit : hits)
+      {
+        Check(game.FindBlock(state, hit) != nullptr, "hit handles find their blocks");
+        num_hits++;
+      }
+    }
+
+    game.SimulateInPlace(state, 1.0f / 60.0f);
+  }
+
+  int num_found = 0;
+  for (unsigned i = 0; i < block_handles.size(); i++)
+  {
+    const Block *block = state.blocks.Get(block_handles[i]);
+    if (not block) continue;
+
+    Check(block->position.x == block_positions[i].x and block->position.y == block_positions[i].y, "block handles follow their blocks");
+    num_found++;
+  }
+
+  cout << "hits: " << num_hits << "  blocks left: " << state.blocks.size() << " of " << block_handles.size() << endl;
+  Check(num_found == state.blocks.size() and num_found < static_cast<int>(block_handles.size()), "every block left is found by its handle");
+  Check(state.blocks.table.IsConsistent(state.blocks.size()) and state.balls.handles.IsConsistent(state.balls.size()), "game tables are consistent");
+
+  const SlotHandle border = state.border_lines.GetHandle(0);
+  game.ResizeInPlace(state, 1000, 800);
+  Check(not game.FindBlock(state, {border, BlockSet::border_lines}), "resizing stales the old borders");
+}
+
+
+void TestCollisionRing()
+{
+  cout << "\n\n==== Testing the collision ring\n"
+       << endl;
+
+  EventRing<int> newest(4);
+  for (int i = 0; i < 6; i++) newest.Push(i);
+  Check(newest.size() == 4 and newest[0] == 0 and newest[3] == 3, "drop_newest keeps the first events");
+  Check(newest.GetNumPushed() == 6 and newest.GetNumDropped() == 2 and newest.GetHighWater() == 4, "drop_newest counts what it drops");
+
+  EventRing<int> oldest(4, OverflowPolicy::drop_oldest);
+  for (int i = 0; i < 6; i++) oldest.Push(i);
+  Check(oldest.size() == 4 and oldest[0] == 2 and oldest[3] == 5, "drop_oldest keeps the last events");
+
+  //Wrapped around, so the events come in two runs
+  const EventSpan<int> run0 = oldest.GetRun(0);
+  const EventSpan<int> run1 = oldest.GetRun(1);
+  Check(run0.size() == 2 and run0[0] == 2 and run0[1] == 3 and run1.size() == 2 and run1[0] == 4 and run1[1] == 5, "runs are oldest first");
+
+  oldest.Clear();
+  oldest.Push(9);
+  Check(oldest.size() == 1 and oldest.GetRun(0).size() == 1 and oldest.GetRun(1).size() == 0, "Clear rewinds the ring");
+  Check(oldest.GetNumPushed() == 7 and oldest.GetNumDropped() == 2, "counters carry on past Clear");
+
+  //A storm of collisions only costs what the ring holds
+  Game game;
+  CollisionTelemetry telemetry;
+  game.AddCollisionStage(MakeTelemetryStage(telemetry));
+
+  GameState state = MakeBusyGame(game, 1600, 1200, 1000);
+  state.collisions.SetCapacity(16);
+
+  for (int tick = 0; tick < 120; tick++)
+  {
+    game.SimulateInPlace(state, 1.0f / 60.0f);
+    Check(state.collisions.empty(), "the stages drain the ring every tick");
+  }
+
+  const CollisionRing &ring = state.collisions;
+  cout << "collisions: " << ring.GetNumPushed() << " pushed, " << ring.GetNumDropped() << " dropped, "
+       << "telemetry saw " << telemetry.num_collisions << " in " << telemetry.num_spans << " spans" << endl;
+
+  Check(ring.GetNumDropped() > 0 and ring.GetHighWater() == 16, "a storm overflows a small ring");
+  Check(telemetry.num_collisions == ring.GetNumPushed() - ring.GetNumDropped(), "telemetry sees every kept collision");
+  Check(telemetry.largest_span <= 16, "stages never get more than the ring holds");
+  Check(telemetry.by_block_type[static_cast<int>(BlockType::world_border)] > 0, "telemetry counts by block type");
+
+  //With a pool the stages run side by side, and give the same state
+  GameState serial = MakeBusyGame(game, 1600, 1200, 0);
+  for (int i = 0; i < 600; i++)
+  {
+    const Block &block = serial.border_lines[i % 2];
+    serial.collisions.Push({{float(i), 100.0f}, {1.0f, 2.0f}, {-1.0f, 2.0f}, block.type, {serial.border_lines.GetHandle(i % 2), BlockSet::border_lines}, {}});
+  }
+  GameState parallel = serial;
+
+  ThreadPool pool(4);
+  Game pooled;
+  pooled.SetThreadPool(&pool);
+
+  game.RunCollisionStages(serial);
+  pooled.RunCollisionStages(parallel);
+
+  Check(serial.collisions.empty() and parallel.collisions.empty(), "RunCollisionStages empties the ring");
+  Check(serial.particles.size() == 600 * 20 and SameParticles(serial.particles, parallel.particles), "parallel stages make the same particles");
+  Check(SameBytes(serial.sound_events, parallel.sound_events), "parallel stages make the same sounds");
+  CheckSameRandom(serial, parallel, "parallel stages");
+}
+
+
+void TestProfiler()
+{
+  cout << "\n\n==== Testing the profiler\n"
+       << endl;
+
+#if PROFILER
+  {
+    PROFILE_ZONE("not captured");
+  }
+  Profiler::BeginCapture();
+  Check(Profiler::GetNumEvents() == 0, "zones outside a capture aren't kept");
+
+  {
+    PROFILE_ZONE("outer");
+    PROFILE_FRAME();
+    {
+      PROFILE_ZONE("inner");
+    }
+  }
+
+  //Every pool thread gets a buffer of its own
+  ThreadPool pool(4);
+  pool.ParallelFor(16, [](int) { PROFILE_ZONE("task"); });
+
+  Game game;
+  GameState state = MakeBusyGame(game, 1600, 1200, 100);
+  game.SimulateInPlace(state, 1.0f / 60.0f);
+
+  Profiler::EndCapture();
+
+  {
+    PROFILE_ZONE("after");
+  }
+
+  std::ostringstream trace;
+  Profiler::WriteChromeTrace(trace);
+  const std::string json = trace.str();
+
+  auto count = [&json](const std::string &str) {
+    int n = 0;
+    for (size_t i = json.find(str); i != std::string::npos; i = json.find(str, i + 1)) n++;
+    return n;
+  };
+
+  cout << Profiler::GetNumEvents() << " events, " << json.size() << " bytes of trace" << endl;
+
+  Check(Profiler::GetNumDropped() == 0, "nothing dropped");
+  Check(count("\"outer\"") == 1 and count("\"inner\"") == 1 and count("\"frame\"") == 1, "zones and frames are in the trace");
+  Check(count("\"task\"") == 16, "zones on pool threads are in the trace");
+  Check(count("\"Simulate\"") == 1 and count("\"physics\"") == 1 and count("\"particles\"") == 1, "Simulate is broken down into zones");
+  Check(count("\"not captured\"") == 0 and count("\"after\"") == 0, "only the capture is in the trace");
+  Check(count("\"ph\": \"X\"") + count("\"ph\": \"i\"") == Profiler::GetNumEvents(), "every event is written");
+  Check(json.front() == '{' and json.find("]}") != std::string::npos, "the trace is a JSON object");
+
+  Profiler::BeginCapture();
+  Profiler::EndCapture();
+  Check(Profiler::GetNumEvents() == 0, "a new capture starts empty");
+#else
+  cout << "built without PROFILER" << endl;
+#endif
+}
+
+
+void TestMetrics()
+{
+  cout << "\n\n==== Testing metrics\n"
+       << endl;
+
+  MetricsRegistry registry;
+
+  Counter &counter = registry.GetCounter("hits");
+  Gauge &gauge = registry.GetGauge("level");
+  Histogram &histogram = registry.GetHistogram("ms", {1.0, 10.0, 100.0});
+  Check(&registry.GetCounter("hits") == &counter, "a name finds the same counter again");
+
+  //The slots only get a cache line each if the metric starts on one
+  for (int i = 0; i < 8; i++)
+  {
+    Counter &more = registry.GetCounter("aligned " + std::to_string(i));
+    Check(reinterpret_cast<uintptr_t>(&more) % METRIC_SHARD_SIZE == 0, "counters are aligned to a slot");
+  }
+  Check(reinterpret_cast<uintptr_t>(&histogram) % METRIC_SHARD_SIZE == 0, "histograms are aligned to a slot");
+
+  //Before any other threads are about, which might be allocating
+  const long before = num_allocations;
+  counter.Add(10);
+  gauge.Set(3.5);
+  histogram.Observe(0.5);
+  const long allocations = num_allocations - before;
+  Check(allocations == 0, "updating metrics doesn't allocate");
+
+  //Adds from every pool thread all land
+  ThreadPool pool(4);
+  pool.ParallelFor(64, [&counter](int task) { counter.Add(task); });
+  Check(counter.Get() == 10 + 64 * 63 / 2, "counters add up over threads");
+
+  gauge.Set(7.0);
+  Check(gauge.Get() == 7.0, "gauges keep the last value");
+
+  for (double v : {1.0, 5.0, 50.0, 500.0, 1000.0}) histogram.Observe(v);
+  Check(histogram.GetCounts() == std::vector<uint64_t>({2, 1, 1, 2}), "histogram buckets include their upper bound");
+  Check(histogram.GetCount() == 6 and histogram.GetSum() == 1556.5, "histogram count and sum");
+
+  bool threw = false;
+  try
+  {
+    registry.GetHistogram("ms", {2.0});
+  }
+  catch (std::runtime_error &)
+  {
+    threw = true;
+  }
+  Check(threw, "a histogram can't change its bounds");
+
+  threw = false;
+  try
+  {
+    registry.GetHistogram("too fine", std::vector<double>(METRIC_MAX_BUCKETS, 1.0));
+  }
+  catch (std::runtime_error &)
+  {
+    threw = true;
+  }
+  Check(threw, "a histogram can't have more than METRIC_MAX_BUCKETS buckets");
+
+  std::ostringstream out;
+  WriteMetricsJson(out, registry.Snapshot());
+  const std::string json = out.str();
+  cout << json;
+  Check(json.find("\"hits\": 2026") != std::string::npos and json.find("\"level\": 7") != std::string::npos, "snapshots have every metric");
+  Check(json.find("\"counts\": [2, 1, 1, 2]") != std::string::npos and std::count(json.begin(), json.end(), '\n') == 1, "a snapshot is one line");
+
+  //The game's own, fed by a collision stage
+  Game game;
+  GameMetrics metrics(registry);
+  game.AddCollisionStage(MakeMetricsStage(metrics));
+
+  GameState state = MakeBusyGame(game, 1600, 1200, 200);
+  uint64_t kept = 0;
+  for (int tick = 0; tick < 60; tick++)
+  {
+    const uint64_t pushed = state.collisions.GetNumPushed();
+    const uint64_t dropped = state.collisions.GetNumDropped();
+    game.SimulateInPlace(state, 1.0f / 60.0f);
+    kept += (state.collisions.GetNumPushed() - pushed) - (state.collisions.GetNumDropped() - dropped);
+  }
+  metrics.SetCounts(state);
+
+  Check(metrics.collisions.Get() == kept and kept > 0, "the metrics stage counts every collision");
+  Check(metrics.balls.Get() == state.balls.size() and metrics.particles.Get() == state.particles.size(), "gauges follow the state");
+
+  //An exporter writes a line on its way out at least
+  const std::string filename = "test_metrics.jsonl";
+  std::remove(filename.c_str());
+  {
+    MetricsExporter exporter(registry, filename, 60.0);
+  }
+  std::ifstream file(filename);
+  std::string line;
+  Check(std::getline(file, line) and line.find("\"collisions\": " + std::to_string(kept)) != std::string::npos, "the exporter writes snapshots");
+  file.close();
+  std::remove(filename.c_str());
+}
+
+
+int main()
+{
+  TestMaths();
+
+  TestRandom();
+
+  TestIntegrateBalls();
+
+  TestUpdateParticles();
+
+  TestEmitParticles();
+
+  TestParticleBursts();
+
+  TestBroadphase();
+
+  TestAABBTreeSegments();
+
+  TestLinePool();
+
+  TestInPlaceSimulate();
+
+  TestFixedTimestep();
+
+  TestSweptCollisions();
+
+  TestBatch();
+
+  TestParallelCollisions();
+
+  TestReplay();
+
+  TestSnapshot();
+
+  TestLevels();
+
+  TestSlotMap();
+
+  TestCollisionRing();
+
+  TestProfiler();
+
+  TestMetrics();
 
   return EXIT_SUCCESS;
 }
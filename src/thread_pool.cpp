@@ -0,0 +1,101 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+
+ThreadPool::ThreadPool(int num_threads)
+{
+  if (num_threads <= 0) num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+  for (int i = 1; i < num_threads; i++)
+  {
+    workers.emplace_back([this] { WorkerLoop(); });
+  }
+}
+
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+
+  for (std::thread &worker : workers) worker.join();
+}
+
+
+void ThreadPool::RunJob(const std::function<void(int)> &func, int count)
+{
+  for (int i = next_index++; i < count; i = next_index++)
+  {
+    try
+    {
+      func(i);
+    }
+    catch (...)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (not error) error = std::current_exception();
+    }
+  }
+}
+
+
+void ThreadPool::WorkerLoop()
+{
+  unsigned seen_generation = 0;
+
+  while (true)
+  {
+    const std::function<void(int)> *func = nullptr;
+    int count = 0;
+
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [&] { return stopping or generation != seen_generation; });
+      if (stopping) return;
+
+      seen_generation = generation;
+      func = job;
+      count = job_size;
+    }
+
+    RunJob(*func, count);
+
+    bool last = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      last = --unfinished_workers == 0;
+    }
+    if (last) finished.notify_one();
+  }
+}
+
+
+void ThreadPool::ParallelFor(int count, const std::function<void(int)> &func)
+{
+  if (count <= 0) return;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    job = &func;
+    job_size = count;
+    next_index = 0;
+    unfinished_workers = workers.size();
+    error = nullptr;
+    generation++;
+  }
+  wake.notify_all();
+
+  RunJob(func, count);
+
+  //Workers that woke up late may still be inside RunJob, or not have looked
+  //at the job at all, even though every index has been handed out
+  std::unique_lock<std::mutex> lock(mutex);
+  finished.wait(lock, [&] { return unfinished_workers == 0; });
+  job = nullptr;
+
+  if (error) std::rethrow_exception(error);
+}
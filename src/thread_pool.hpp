@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+//A fixed set of worker threads for splitting loops up. The calling thread
+//joins in as well, so a pool of N threads has N - 1 workers.
+
+class ThreadPool
+{
+private:
+  std::vector<std::thread> workers;
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable finished;
+
+  //The loop being run, shared by everyone working on it
+  const std::function<void(int)> *job = nullptr;
+  int job_size = 0;
+  std::atomic<int> next_index{0};
+
+  //Workers yet to be done with this generation's job. ParallelFor waits for
+  //every one of them, even those with nothing left to do, so a worker can't
+  //wake up late and pick up a job that has gone, or the next one's indexes.
+  int unfinished_workers = 0;
+  unsigned generation = 0;
+  bool stopping = false;
+
+  std::exception_ptr error;
+
+  void WorkerLoop();
+  void RunJob(const std::function<void(int)> &func, int count);
+
+public:
+  //0 threads means one per hardware thread
+  explicit ThreadPool(int num_threads = 0);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  int GetNumThreads() const { return workers.size() + 1; }
+
+  //Calls func(i) for every i from 0 to count - 1 spread over the threads, and
+  //returns once they are all done. Rethrows the first exception thrown. Only
+  //one thread at a time may call this, and not from inside func.
+  void ParallelFor(int count, const std::function<void(int)> &func);
+};
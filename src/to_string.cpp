@@ -2,9 +2,6 @@
 #include "to_string.hpp"
 
 
-std::ostringstream TRACE;
-
-
 std::string ToString(const State &state)
 {
   switch (state)
@@ -30,6 +27,29 @@ std::string ToString(const State &state)
 }
 
 
+std::string ToString(const SoundEffect &effect)
+{
+  switch (effect)
+  {
+    case SoundEffect::bounce:
+      return "bounce";
+    case SoundEffect::bounce_hit:
+      return "bounce_hit";
+    case SoundEffect::paddle_bounce:
+      return "paddle_bounce";
+    case SoundEffect::lost_ball:
+      return "lost_ball";
+    case SoundEffect::error:
+      return "error";
+    case SoundEffect::menu_beep:
+      return "menu_beep";
+    case SoundEffect::menu_activated:
+      return "menu_activated";
+  }
+  return "[ERROR: SoundEffect not found]";
+}
+
+
 
 std::ostream &operator<<(std::ostream &out, vec2 const &v2)
 {
@@ -71,36 +91,3 @@ std::ostream &operator<<(std::ostream &out, mat4 const &mat)
   out << " ]";
   return out;
 }
-
-
-std::string ToString(const GLenum &e)
-{
-    switch(e)
-    {
-
-        case GL_DEBUG_SEVERITY_HIGH: return "SEVERITY_HIGH";
-        case GL_DEBUG_SEVERITY_MEDIUM: return "SEVERITY_MEDIUM";
-        case GL_DEBUG_SEVERITY_LOW: return "SEVERITY_LOW";
-        case GL_DEBUG_SEVERITY_NOTIFICATION: return "NOTIFICATION";
-        case GL_DEBUG_TYPE_ERROR: return "ERROR";
-        case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: return "DEPRECATED_BEHAVIOR";
-        case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR: return "UNDEFINED_BEHAVIOR";
-        case GL_DEBUG_TYPE_PORTABILITY: return "PORTABILITY";
-        case GL_DEBUG_TYPE_PERFORMANCE: return "PERFORMANCE";
-        case GL_DEBUG_TYPE_MARKER: return "MARKER";
-        case GL_DEBUG_TYPE_PUSH_GROUP: return "PUSH_GROUP";
-        case GL_DEBUG_TYPE_POP_GROUP: return "POP_GROUP";
-        case GL_DEBUG_TYPE_OTHER: return "OTHER";
-        case GL_DEBUG_SOURCE_API: return "SOURCE_API";
-        case GL_DEBUG_SOURCE_WINDOW_SYSTEM: return "SOURCE_WINDOW_SYSTEM";
-        case GL_DEBUG_SOURCE_SHADER_COMPILER: return "SHADER_COMPILER";
-        case GL_DEBUG_SOURCE_THIRD_PARTY: return "SOURCE_THIRD_PARTY";
-        case GL_DEBUG_SOURCE_APPLICATION: return "SOURCE_APPLICATION";
-        case GL_DEBUG_SOURCE_OTHER: return "SOURCE_OTHER";
-
-        default: return "[ERROR: Unknown GLenum]";
-    }
-}
-
-
-